@@ -2113,6 +2113,26 @@ bool CFlyServerJSON::pushStatistic(const bool p_is_sync_run)
             l_stat_info["SizeTTHCache"] = CFlylinkDBManager::get_tth_cache_size();
             l_stat_info["SizeNotExistsCache"] = ShareManager::get_cache_size_file_not_exists_set();
             l_stat_info["SizeSearchFileCache"] = ShareManager::get_cache_file_map();
+			{
+				const auto l_pool = StringPool::getStats();
+				l_stat_info["StringPoolCount"] = Json::Value::UInt64(l_pool.m_count);
+				l_stat_info["StringPoolBytes"] = Json::Value::UInt64(l_pool.m_bytes);
+				l_stat_info["StringPoolRefs"] = Json::Value::UInt64(l_pool.m_references);
+			}
+			{
+				CFlyDBWriterStat l_writer;
+				CFlylinkDBManager::getInstance()->get_writer_stat(l_writer);
+				l_stat_info["DBWriterQueue"] = Json::Value::UInt64(l_writer.m_queue_size);
+				l_stat_info["DBWriterMaxQueue"] = Json::Value::UInt64(l_writer.m_max_queue_size);
+				l_stat_info["DBWriterWrites"] = Json::Value::UInt64(l_writer.m_writes);
+				l_stat_info["DBWriterTransactions"] = Json::Value::UInt64(l_writer.m_transactions);
+				l_stat_info["DBWriterCallerBatches"] = Json::Value::UInt64(l_writer.m_caller_batches);
+				l_stat_info["DBWriterMaxTransactionMs"] = Json::Value::UInt64(l_writer.m_max_transaction_ms);
+				if (l_writer.m_transactions)
+				{
+					l_stat_info["DBWriterAvgTransactionMs"] = Json::Value::UInt64(l_writer.m_total_transaction_ms / l_writer.m_transactions);
+				}
+			}
 			l_stat_info["Size"] = ShareManager::getShareSizeString();
 			// TODO -       Clients
 			l_stat_info["Users"] = Util::toString(ClientManager::getTotalUsers());
@@ -25,6 +25,7 @@
 #include "ADLSearch.h"
 #include "QueueManager.h"
 #include "StringTokenizer.h"
+#include "WorkerPool.h"
 
 ADLSearch::ADLSearch() :
 	searchString("<Enter string>"),
@@ -213,76 +214,301 @@ inline void ADLSearch::unprepare()
 	stringSearches.clear();
 }
 
-bool ADLSearch::matchesFile(const string& f, const string& fp, int64_t size) const
+/// A name or a path: lower-cased and scanned by the automata only when a rule needs it
+class ADLSearchMatcher::MatchText
 {
-	// Check status
-	if (!isActive)
-	{
-		return false;
-	}
+	public:
+		MatchText(const ADLSearchMatcher& p_matcher, const string* p_text) : m_matcher(p_matcher), m_text(p_text), m_is_lower(false)
+		{
+		}
+		bool isSet() const
+		{
+			return m_text != nullptr;
+		}
+		void set(const string* p_text)
+		{
+			m_text = p_text;
+		}
+		const string& get() const
+		{
+			return *m_text;
+		}
+		MultiStringSearch::Mask getFound(uint16_t p_group)
+		{
+			if (m_found.empty())
+			{
+				m_found.resize(m_matcher.m_groups.size());
+				m_is_found.resize(m_matcher.m_groups.size());
+			}
+			if (!m_is_found[p_group])
+			{
+				if (!m_is_lower)
+				{
+					::Text::toLower(*m_text, m_lower);
+					m_is_lower = true;
+				}
+				const MultiStringSearch& l_group = m_matcher.m_groups[p_group];
+				m_found[p_group] = l_group.matchLower(m_lower, l_group.getFullMask());
+				m_is_found[p_group] = true;
+			}
+			return m_found[p_group];
+		}
+	private:
+		const ADLSearchMatcher& m_matcher;
+		const string* m_text;
+		string m_lower;
+		bool m_is_lower;
+		vector<MultiStringSearch::Mask> m_found;
+		vector<bool> m_is_found;
+};
+
+void ADLSearchMatcher::compile(const vector<ADLSearch>& p_collection)
+{
+	m_rules.clear();
+	m_groups.clear();
+	m_size_bounds.clear();
+	m_size_rules.clear();
+	m_file_rules.clear();
+	m_dir_rules.clear();
 	
-	// Check size for files
-	if (size >= 0 && (sourceType == OnlyFile || sourceType == FullPath))
-	{
-		if (minFileSize >= 0 && size < minFileSize * GetSizeBase())
+	// Every distinct substring gets a bit of one of the automata
+	const size_t l_max_group_length = 0x8000;
+	boost::unordered_map<string, std::pair<uint16_t, MultiStringSearch::Mask> > l_bits;
+	vector<StringSearch::List> l_groups;
+	size_t l_group_length = 0;
+	for (size_t i = 0; i < p_collection.size(); ++i)
+	{
+		const ADLSearch& l_search = p_collection[i];
+		if (!l_search.isActive || l_search.sourceType < ADLSearch::TypeFirst || l_search.sourceType >= ADLSearch::TypeLast)
+			continue;
+		Rule l_rule;
+		l_rule.m_index = static_cast<uint16_t>(i);
+		l_rule.m_is_full_path = l_search.sourceType == ADLSearch::FullPath;
+		
+		// The search string is tried as a regular expression first, the substrings are used only when it isn't one
+		StringList l_substrings;
+		bool l_is_regex = false;
+		try
 		{
-			// Too small
-			return false;
+			std::regex l_reg(l_search.searchString, std::regex_constants::icase);
+			l_is_regex = true;
 		}
-		if (maxFileSize >= 0 && size > maxFileSize * GetSizeBase())
+		catch (...) {}
+		if (l_is_regex)
 		{
-			// Too large
-			return false;
+			if (l_search.searchString.empty())
+			{
+				l_rule.m_type = MATCH_ANY;
+			}
+			else if (l_search.searchString.find_first_of("^$\\.*+?()[]{}|") == string::npos)
+			{
+				l_substrings.push_back(::Text::toLower(l_search.searchString));
+			}
+			else
+			{
+				l_rule.m_type = MATCH_REGEX;
+				l_rule.m_regex = std::make_shared<std::regex>(l_search.searchString, std::regex_constants::icase);
+			}
 		}
+		else
+		{
+			for (auto j = l_search.stringSearches.cbegin(); j != l_search.stringSearches.cend(); ++j)
+			{
+				l_substrings.push_back(j->getPattern());
+			}
+		}
+		
+		if (!l_substrings.empty())
+		{
+			l_rule.m_type = MATCH_SUBSTRINGS;
+			for (auto j = l_substrings.cbegin(); j != l_substrings.cend(); ++j)
+			{
+				if (j->size() >= l_max_group_length)
+				{
+					// Can't be a part of a file list name anyway
+					l_rule.m_type = MATCH_NEVER;
+					break;
+				}
+				auto l_bit = l_bits.find(*j);
+				if (l_bit == l_bits.end())
+				{
+					if (l_groups.empty() || l_groups.back().size() == MultiStringSearch::MAX_PATTERNS || l_group_length + j->size() >= l_max_group_length)
+					{
+						l_groups.push_back(StringSearch::List());
+						l_group_length = 0;
+					}
+					const auto l_value = std::make_pair(static_cast<uint16_t>(l_groups.size() - 1), MultiStringSearch::Mask(1) << l_groups.back().size());
+					l_groups.back().push_back(StringSearch(*j));
+					l_group_length += j->size();
+					l_bit = l_bits.insert(std::make_pair(*j, l_value)).first;
+				}
+				auto l_need = l_rule.m_need.begin();
+				while (l_need != l_rule.m_need.end() && l_need->first != l_bit->second.first)
+					++l_need;
+				if (l_need == l_rule.m_need.end())
+					l_rule.m_need.push_back(l_bit->second);
+				else
+					l_need->second |= l_bit->second.second;
+			}
+		}
+		if (l_rule.m_type == MATCH_NEVER)
+			continue;
+			
+		const uint16_t l_pos = static_cast<uint16_t>(m_rules.size());
+		if (l_search.sourceType == ADLSearch::OnlyDirectory)
+			m_dir_rules.push_back(l_pos);
+		else
+			m_file_rules.push_back(l_pos);
+		m_rules.push_back(l_rule);
 	}
 	
-	// Do search
-	switch (sourceType)
+	m_groups.resize(l_groups.size());
+	for (size_t i = 0; i < l_groups.size(); ++i)
 	{
+		const bool l_result = m_groups[i].init(l_groups[i]);
+		dcassert(l_result && m_groups[i].size() == l_groups[i].size());
+	}
+	
+	// Size intervals: the set of the file rules is the same for all the sizes of an interval
+	const int64_t l_max = std::numeric_limits<int64_t>::max();
+	m_size_bounds.push_back(0);
+	for (auto i = m_file_rules.cbegin(); i != m_file_rules.cend(); ++i)
+	{
+		const ADLSearch& l_search = p_collection[m_rules[*i].m_index];
+		if (l_search.minFileSize >= 0)
+			m_size_bounds.push_back(l_search.minFileSize * l_search.GetSizeBase());
+		if (l_search.maxFileSize >= 0 && l_search.maxFileSize * l_search.GetSizeBase() < l_max)
+			m_size_bounds.push_back(l_search.maxFileSize * l_search.GetSizeBase() + 1);
+	}
+	std::sort(m_size_bounds.begin(), m_size_bounds.end());
+	m_size_bounds.erase(std::unique(m_size_bounds.begin(), m_size_bounds.end()), m_size_bounds.end());
+	m_size_rules.resize(m_size_bounds.size());
+	for (size_t j = 0; j < m_size_bounds.size(); ++j)
+	{
+		const int64_t l_size = m_size_bounds[j];
+		for (auto i = m_file_rules.cbegin(); i != m_file_rules.cend(); ++i)
+		{
+			const ADLSearch& l_search = p_collection[m_rules[*i].m_index];
+			if (l_search.minFileSize >= 0 && l_size < l_search.minFileSize * l_search.GetSizeBase())
+				continue;
+			if (l_search.maxFileSize >= 0 && l_size > l_search.maxFileSize * l_search.GetSizeBase())
+				continue;
+			m_size_rules[j].push_back(*i);
+		}
+	}
+}
+
+bool ADLSearchMatcher::matchRule(const Rule& p_rule, MatchText& p_text) const
+{
+	switch (p_rule.m_type)
+	{
+		case MATCH_ANY:
+			return true;
+		case MATCH_REGEX:
+			return std::regex_search(p_text.get(), *p_rule.m_regex);
+		case MATCH_SUBSTRINGS:
+			for (auto i = p_rule.m_need.cbegin(); i != p_rule.m_need.cend(); ++i)
+			{
+				if ((p_text.getFound(i->first) & i->second) != i->second)
+					return false;
+			}
+			return true;
 		default:
-		case OnlyDirectory:
 			return false;
-		case OnlyFile:
-			return searchAll(f);
-		case FullPath:
-			return searchAll(fp);
 	}
 }
 
-bool ADLSearch::matchesDirectory(const string& d) const
+void ADLSearchMatcher::matchFile(const string& p_name, const string& p_dir_path, int64_t p_size, Matches& p_matches) const
 {
-	// Check status
-	if (!isActive)
+	p_matches.clear();
+	const vector<uint16_t>* l_candidates = &m_file_rules;
+	if (p_size >= 0)
 	{
-		return false;
+		const auto l_bound = std::upper_bound(m_size_bounds.cbegin(), m_size_bounds.cend(), p_size);
+		l_candidates = &m_size_rules[l_bound - m_size_bounds.cbegin() - 1];
 	}
-	if (sourceType != OnlyDirectory)
+	if (l_candidates->empty())
+		return;
+		
+	MatchText l_name(*this, &p_name);
+	string l_path;
+	MatchText l_full_path(*this, nullptr);
+	for (auto i = l_candidates->cbegin(); i != l_candidates->cend(); ++i)
 	{
-		return false;
+		const Rule& l_rule = m_rules[*i];
+		if (l_rule.m_is_full_path && !l_full_path.isSet())
+		{
+			l_path = p_dir_path + "\\" + p_name;
+			l_full_path.set(&l_path);
+		}
+		if (matchRule(l_rule, l_rule.m_is_full_path ? l_full_path : l_name))
+		{
+			p_matches.push_back(l_rule.m_index);
+		}
 	}
-	
-	// Do search
-	return searchAll(d);
 }
 
-bool ADLSearch::searchAll(const string& s) const
+void ADLSearchMatcher::matchDirectory(const string& p_name, Matches& p_matches) const
 {
-	try
+	p_matches.clear();
+	MatchText l_name(*this, &p_name);
+	for (auto i = m_dir_rules.cbegin(); i != m_dir_rules.cend(); ++i)
 	{
-		std::regex reg(searchString, std::regex_constants::icase);
-		return std::regex_search(s, reg);
+		const Rule& l_rule = m_rules[*i];
+		if (matchRule(l_rule, l_name))
+		{
+			p_matches.push_back(l_rule.m_index);
+		}
 	}
-	catch (...) {}
-	
-	// Match all substrings
-	for (auto i = stringSearches.cbegin(), iend = stringSearches.cend(); i != iend; ++i)
+}
+
+void ADLSearchMatcher::matchDirectory(DirectoryMatches& p_dir) const
+{
+	matchDirectory(p_dir.m_dir->getName(), p_dir.m_dir_matches);
+	Matches l_matches;
+	const auto& l_files = p_dir.m_dir->m_files;
+	for (size_t i = 0; i < l_files.size(); ++i)
 	{
-		if (!i->match(s))
+		matchFile(l_files[i]->getName(), p_dir.m_path, l_files[i]->getSize(), l_matches);
+		if (!l_matches.empty())
 		{
-			return false;
+			p_dir.m_file_matches.push_back(std::make_pair(i, Matches()));
+			p_dir.m_file_matches.back().second.swap(l_matches);
 		}
 	}
-	return !stringSearches.empty();
+}
+
+static void flattenTree(DirectoryListing::Directory* p_dir, const string& p_path, ADLSearchMatcher::TreeMatches& p_result, size_t& p_file_count)
+{
+	p_result.push_back(ADLSearchMatcher::DirectoryMatches(p_dir, p_path));
+	p_file_count += p_dir->m_files.size();
+	for (auto i = p_dir->directories.cbegin(); i != p_dir->directories.cend(); ++i)
+	{
+		flattenTree(*i, p_path + "\\" + (*i)->getName(), p_result, p_file_count);
+	}
+}
+
+void ADLSearchMatcher::matchTree(DirectoryListing::Directory* p_root, const string& p_path, TreeMatches& p_result) const
+{
+	// Pre-order, the same as in ADLSearchManager::matchRecurse
+	p_result.clear();
+	size_t l_file_count = 0;
+	flattenTree(p_root, p_path, p_result, l_file_count);
+	
+	volatile long l_next = 0;
+	const auto l_work = [this, &p_result, &l_next]()
+	{
+		for (;;)
+		{
+			const size_t l_index = static_cast<size_t>(BaseThread::safeInc(l_next) - 1);
+			if (l_index >= p_result.size())
+				break;
+			matchDirectory(p_result[l_index]);
+		}
+	};
+	
+	// The pool threads are worth it for the big lists only
+	WorkerPool::getInstance()->runParallel(l_work, l_file_count / 10000 + 1);
 }
 
 ADLSearchManager::ADLSearchManager() : breakOnFirst(false), sentRaw(false)
@@ -437,14 +663,14 @@ void ADLSearchManager::save() const
 	catch (const SimpleXMLException&) { }
 }
 
-void ADLSearchManager::matchesFile(DestDirList& destDirVector, DirectoryListing::File *currentFile, const string& fullPath)
+void ADLSearchManager::matchesFile(DirectoryListing& aDirList, DestDirList& destDirVector, DirectoryListing::File *currentFile, const ADLSearchMatcher::Matches& aMatches)
 {
 	// Add to any substructure being stored
 	for (auto id = destDirVector.begin(); id != destDirVector.end(); ++id)
 	{
 		if (id->subdir != NULL)
 		{
-			auto copyFile = new DirectoryListing::File(*currentFile, true);
+			auto copyFile = aDirList.copyFile(*currentFile, true);
 			copyFile->setFlags(currentFile->getFlags());
 			dcassert(id->subdir->getAdls());
 			
@@ -459,56 +685,53 @@ void ADLSearchManager::matchesFile(DestDirList& destDirVector, DirectoryListing:
 		return;
 	}
 	
-	string filePath = fullPath + "\\" + currentFile->getName();// TODO Crash
-	// Match searches
-	for (auto is = collection.cbegin(); is != collection.cend(); ++is)
+	// Matched searches, in the order of the collection
+	for (auto im = aMatches.cbegin(); im != aMatches.cend(); ++im)
 	{
+		const auto is = collection.cbegin() + *im;
 		if (destDirVector[is->ddIndex].fileAdded)
 		{
 			continue;
 		}
-		if (is->matchesFile(currentFile->getName(), filePath, currentFile->getSize()))
-		{
-			auto copyFile = new DirectoryListing::File(*currentFile, true);
-			copyFile->setFlags(currentFile->getFlags());
+		auto copyFile = aDirList.copyFile(*currentFile, true);
+		copyFile->setFlags(currentFile->getFlags());
 #ifdef IRAINMAN_INCLUDE_USER_CHECK
-			if (is->isForbidden && !getSentRaw())
-			{
-				AutoArray<char> buf(FULL_MAX_PATH);
-				_snprintf(buf, FULL_MAX_PATH, CSTRING(CHECK_FORBIDDEN), currentFile->getName().c_str());
-				
-				ClientManager::setClientStatus(user, buf.data(), is->raw, false);
-				
-				setSentRaw(true);
-			}
-#endif
+		if (is->isForbidden && !getSentRaw())
+		{
+			AutoArray<char> buf(FULL_MAX_PATH);
+			_snprintf(buf, FULL_MAX_PATH, CSTRING(CHECK_FORBIDDEN), currentFile->getName().c_str());
 			
-			destDirVector[is->ddIndex].dir->m_files.push_back(copyFile);
-			destDirVector[is->ddIndex].fileAdded = true;
+			ClientManager::setClientStatus(user, buf.data(), is->raw, false);
 			
-			if (is->isAutoQueue)
+			setSentRaw(true);
+		}
+#endif
+		
+		destDirVector[is->ddIndex].dir->m_files.push_back(copyFile);
+		destDirVector[is->ddIndex].fileAdded = true;
+		
+		if (is->isAutoQueue)
+		{
+			try
 			{
-				try
-				{
-					QueueManager::getInstance()->add(0,/* [-] IRainman needs for support download to specify extension dir. SETTING(DOWNLOAD_DIRECTORY) + */currentFile->getName(),
-					                                 currentFile->getSize(), currentFile->getTTH(), getUser()/*, Util::emptyString*/);
-				}
-				catch (const Exception& e)
-				{
-					LogManager::message("QueueManager::getInstance()->add Error = " + e.getError());
-				}
+				QueueManager::getInstance()->add(0,/* [-] IRainman needs for support download to specify extension dir. SETTING(DOWNLOAD_DIRECTORY) + */currentFile->getName(),
+				                                 currentFile->getSize(), currentFile->getTTH(), getUser()/*, Util::emptyString*/);
 			}
-			
-			if (breakOnFirst)
+			catch (const Exception& e)
 			{
-				// Found a match, search no more
-				break;
+				LogManager::message("QueueManager::getInstance()->add Error = " + e.getError());
 			}
 		}
+		
+		if (breakOnFirst)
+		{
+			// Found a match, search no more
+			break;
+		}
 	}
 }
 
-void ADLSearchManager::matchesDirectory(DestDirList& destDirVector, DirectoryListing::Directory* currentDir, const string& fullPath) const
+void ADLSearchManager::matchesDirectory(DestDirList& destDirVector, DirectoryListing::Directory* currentDir, const string& fullPath, const ADLSearchMatcher::Matches& aMatches) const
 {
 	// Add to any substructure being stored
 	for (auto id = destDirVector.begin(); id != destDirVector.end(); ++id)
@@ -528,23 +751,21 @@ void ADLSearchManager::matchesDirectory(DestDirList& destDirVector, DirectoryLis
 		return;
 	}
 	
-	// Match searches
-	for (auto is = collection.cbegin(); is != collection.cend(); ++is)
+	// Matched searches, in the order of the collection
+	for (auto im = aMatches.cbegin(); im != aMatches.cend(); ++im)
 	{
+		const auto is = collection.cbegin() + *im;
 		if (destDirVector[is->ddIndex].subdir != NULL)
 		{
 			continue;
 		}
-		if (is->matchesDirectory(currentDir->getName()))
+		destDirVector[is->ddIndex].subdir =
+		    new DirectoryListing::AdlDirectory(fullPath, destDirVector[is->ddIndex].dir, currentDir->getName());
+		destDirVector[is->ddIndex].dir->directories.push_back(destDirVector[is->ddIndex].subdir);
+		if (breakOnFirst)
 		{
-			destDirVector[is->ddIndex].subdir =
-			    new DirectoryListing::AdlDirectory(fullPath, destDirVector[is->ddIndex].dir, currentDir->getName());
-			destDirVector[is->ddIndex].dir->directories.push_back(destDirVector[is->ddIndex].subdir);
-			if (breakOnFirst)
-			{
-				// Found a match, search no more
-				break;
-			}
+			// Found a match, search no more
+			break;
 		}
 	}
 }
@@ -657,23 +878,45 @@ void ADLSearchManager::matchListing(DirectoryListing& aDirList) noexcept
 	prepareDestinationDirectories(destDirs, aDirList.getRoot(), params);
 	setBreakOnFirst(BOOLSETTING(ADLS_BREAK_ON_FIRST));
 	
-	const string path(aDirList.getRoot()->getName());
-	matchRecurse(destDirs, aDirList.getRoot(), path);
+	// [+] The searches are compiled after prepare(): the substrings depend on the user
+	ADLSearchMatcher l_matcher;
+	l_matcher.compile(collection);
+	if (!l_matcher.empty())
+	{
+		const string path(aDirList.getRoot()->getName());
+		ADLSearchMatcher::TreeMatches l_matches;
+		l_matcher.matchTree(aDirList.getRoot(), path, l_matches);
+		size_t l_next = 0;
+		matchRecurse(aDirList, destDirs, l_matches, l_next, aDirList.getRoot(), path);
+	}
 	
 	finalizeDestinationDirectories(destDirs, aDirList.getRoot());
 }
 
-void ADLSearchManager::matchRecurse(DestDirList &aDestList, DirectoryListing::Directory* aDir, const string &aPath)
+void ADLSearchManager::matchRecurse(DirectoryListing& aDirList, DestDirList &aDestList, const ADLSearchMatcher::TreeMatches& aMatches, size_t& aNext, DirectoryListing::Directory* aDir, const string &aPath)
 {
+	// aMatches is in the same pre-order as this walk
+	const ADLSearchMatcher::DirectoryMatches& current = aMatches[aNext++];
+	dcassert(current.m_dir == aDir);
 	for (auto dirIt = aDir->directories.cbegin(); dirIt != aDir->directories.cend(); ++dirIt)
 	{
-		string tmpPath = aPath + "\\" + (*dirIt)->getName();
-		matchesDirectory(aDestList, *dirIt, tmpPath);
-		matchRecurse(aDestList, *dirIt, tmpPath);
+		const ADLSearchMatcher::DirectoryMatches& sub = aMatches[aNext];
+		matchesDirectory(aDestList, *dirIt, sub.m_path, sub.m_dir_matches);
+		matchRecurse(aDirList, aDestList, aMatches, aNext, *dirIt, sub.m_path);
 	}
-	for (auto fileIt = aDir->m_files.cbegin(); fileIt != aDir->m_files.cend(); ++fileIt)
+	static const ADLSearchMatcher::Matches g_no_matches;
+	auto matchIt = current.m_file_matches.cbegin();
+	for (size_t i = 0; i < aDir->m_files.size(); ++i)
 	{
-		matchesFile(aDestList, *fileIt, aPath);
+		if (matchIt != current.m_file_matches.cend() && matchIt->first == i)
+		{
+			matchesFile(aDirList, aDestList, aDir->m_files[i], matchIt->second);
+			++matchIt;
+		}
+		else
+		{
+			matchesFile(aDirList, aDestList, aDir->m_files[i], g_no_matches);
+		}
 	}
 	stepUpDirectory(aDestList);
 }
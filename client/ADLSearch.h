@@ -27,7 +27,9 @@
 
 #include "SettingsManager.h"
 #include "StringSearch.h"
+#include "MultiStringSearch.h"
 #include "DirectoryListing.h"
+#include <regex>
 
 class AdlSearchManager;
 
@@ -90,18 +92,82 @@ class ADLSearch
 		
 	private:
 		friend class ADLSearchManager;
+		friend class ADLSearchMatcher;
 		/// Prepare search
 		void prepare(StringMap& params);
 		void unprepare();
 		
-		/// Search for file match
-		bool matchesFile(const string& f, const string& fp, int64_t size) const;
-		/// Search for directory match
-		bool matchesDirectory(const string& d) const;
-		
 		/// Substring searches
 		StringSearch::List stringSearches;
-		bool searchAll(const string& s) const;
+};
+
+/**
+ * [+] The active searches compiled for one listing.
+ * The substrings of all the searches share a few MultiStringSearch automata (up to 64 substrings each),
+ * so a name is lower-cased and scanned once per automaton instead of once per search and substring.
+ * A search string without regular expression syntax is one substring, a real regular expression is built once here.
+ * The size limits of the file searches are put into an index of size intervals.
+ * Immutable after compile(), matchTree() uses it on all processors.
+ */
+class ADLSearchMatcher
+{
+	public:
+		/// Indexes of the matching searches in ADLSearchManager::collection, in its order
+		typedef vector<uint16_t> Matches;
+		
+		struct DirectoryMatches
+		{
+			DirectoryListing::Directory* m_dir;
+			string m_path;
+			Matches m_dir_matches; // the name of m_dir
+			vector<std::pair<size_t, Matches> > m_file_matches; // index in m_dir->m_files, only the matched files
+			DirectoryMatches(DirectoryListing::Directory* p_dir, const string& p_path) : m_dir(p_dir), m_path(p_path)
+			{
+			}
+		};
+		typedef vector<DirectoryMatches> TreeMatches;
+		
+		void compile(const vector<ADLSearch>& p_collection);
+		bool empty() const
+		{
+			return m_rules.empty();
+		}
+		void matchFile(const string& p_name, const string& p_dir_path, int64_t p_size, Matches& p_matches) const;
+		void matchDirectory(const string& p_name, Matches& p_matches) const;
+		/// All the directories under p_root in pre-order (p_root first), the work is shared by several threads
+		void matchTree(DirectoryListing::Directory* p_root, const string& p_path, TreeMatches& p_result) const;
+		
+	private:
+		enum MatchType
+		{
+			MATCH_NEVER,
+			MATCH_ANY,
+			MATCH_REGEX,
+			MATCH_SUBSTRINGS
+		};
+		struct Rule
+		{
+			uint16_t m_index;
+			MatchType m_type;
+			bool m_is_full_path;
+			std::shared_ptr<std::regex> m_regex;
+			/// All the substrings must be found: automaton and its bits
+			vector<std::pair<uint16_t, MultiStringSearch::Mask> > m_need;
+			Rule() : m_index(0), m_type(MATCH_NEVER), m_is_full_path(false)
+			{
+			}
+		};
+		class MatchText;
+		bool matchRule(const Rule& p_rule, MatchText& p_text) const;
+		void matchDirectory(DirectoryMatches& p_dir) const;
+		
+		vector<Rule> m_rules;
+		vector<MultiStringSearch> m_groups;
+		/// m_size_rules[i] - the file rules for the sizes from m_size_bounds[i] to m_size_bounds[i + 1]
+		vector<int64_t> m_size_bounds;
+		vector<vector<uint16_t> > m_size_rules;
+		vector<uint16_t> m_file_rules; // a file without a size
+		vector<uint16_t> m_dir_rules;
 };
 
 /// Class that holds all active searches
@@ -140,11 +206,11 @@ class ADLSearchManager : public Singleton<ADLSearchManager>
 		
 	private:
 		// @internal
-		void matchRecurse(DestDirList& /*aDestList*/, DirectoryListing::Directory* /*aDir*/, const string& /*aPath*/);
+		void matchRecurse(DirectoryListing& /*aDirList*/, DestDirList& /*aDestList*/, const ADLSearchMatcher::TreeMatches& /*aMatches*/, size_t& /*aNext*/, DirectoryListing::Directory* /*aDir*/, const string& /*aPath*/);
 		// Search for file match
-		void matchesFile(DestDirList& destDirVector, DirectoryListing::File *currentFile, const string& fullPath);
+		void matchesFile(DirectoryListing& aDirList, DestDirList& destDirVector, DirectoryListing::File *currentFile, const ADLSearchMatcher::Matches& aMatches);
 		// Search for directory match
-		void matchesDirectory(DestDirList& destDirVector, DirectoryListing::Directory* currentDir, const string& fullPath) const;
+		void matchesDirectory(DestDirList& destDirVector, DirectoryListing::Directory* currentDir, const string& fullPath, const ADLSearchMatcher::Matches& aMatches) const;
 		// Step up directory
 		void stepUpDirectory(DestDirList& destDirVector) const;
 		
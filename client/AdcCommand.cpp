@@ -21,17 +21,17 @@
 
 #include "ClientManager.h"
 
-AdcCommand::AdcCommand(uint32_t aCmd, char aType /* = TYPE_CLIENT */) : m_cmdInt(aCmd), m_from(0), m_type(aType), m_to(0)
+AdcCommand::AdcCommand(uint32_t aCmd, char aType /* = TYPE_CLIENT */) : m_is_borrowed(false), m_cmdInt(aCmd), m_from(0), m_type(aType), m_to(0)
 {
 	dcassert(m_cmd[3] == 0);
 	m_cmd[3] = 0;
 }
-AdcCommand::AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType) : m_cmdInt(aCmd), m_from(0), m_to(aTarget), m_type(aType)
+AdcCommand::AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType) : m_is_borrowed(false), m_cmdInt(aCmd), m_from(0), m_to(aTarget), m_type(aType)
 {
 	dcassert(m_cmd[3] == 0);
 	m_cmd[3] = 0;
 }
-AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /* = TYPE_CLIENT */) : m_cmdInt(CMD_STA), m_from(0), m_type(aType), m_to(0)
+AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /* = TYPE_CLIENT */) : m_is_borrowed(false), m_cmdInt(CMD_STA), m_from(0), m_type(aType), m_to(0)
 {
 	addParam((sev == SEV_SUCCESS && err == SUCCESS) ? "000" : Util::toString(sev * 100 + err));
 	addParam(desc);
@@ -39,14 +39,35 @@ AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /
 	m_cmd[3] = 0;
 }
 
-AdcCommand::AdcCommand(const string& aLine, bool nmdc /* = false */) : m_cmdInt(0), m_type(TYPE_CLIENT)
+AdcCommand::AdcCommand(const string& aLine, bool nmdc /* = false */, ParseMode p_mode /* = PARSE_COPY */) : m_is_borrowed(false), m_cmdInt(0), m_from(0), m_to(0), m_type(TYPE_CLIENT)
 {
-	parse(aLine, nmdc);
+	parse(aLine, nmdc, p_mode);
 	dcassert(m_cmd[3] == 0);
 	m_cmd[3] = 0;
 }
 
-void AdcCommand::parse(const string& aLine, bool nmdc /* = false */)
+#ifndef _DEBUG
+AdcCommand::AdcCommand(const AdcCommand& rhs) : m_is_borrowed(false), features(rhs.features), m_cmdInt(rhs.m_cmdInt), m_from(rhs.m_from), m_to(rhs.m_to), m_type(rhs.m_type)
+{
+	assignParams(rhs);
+}
+
+AdcCommand& AdcCommand::operator=(const AdcCommand& rhs)
+{
+	if (this != &rhs)
+	{
+		features = rhs.features;
+		m_cmdInt = rhs.m_cmdInt;
+		m_from = rhs.m_from;
+		m_to = rhs.m_to;
+		m_type = rhs.m_type;
+		assignParams(rhs);
+	}
+	return *this;
+}
+#endif
+
+void AdcCommand::parse(const string& aLine, bool nmdc /* = false */, ParseMode p_mode /* = PARSE_COPY */)
 {
 	string::size_type i = 5;
 	//m_CID.init();
@@ -82,10 +103,13 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */)
 		m_from = HUB_SID;
 	}
 	
-	string::size_type len = aLine.length();
+	parameters.clear();
+	m_param_views.clear();
+	m_unescaped.clear();
+	m_is_borrowed = true;
+	
+	const string::size_type len = aLine.length();
 	const char* buf = aLine.c_str();
-	string cur;
-	cur.reserve(128);
 	
 	bool toSet = false;
 	bool featureSet = false;
@@ -93,122 +117,151 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */)
 	
 	while (i < len)
 	{
-		switch (buf[i])
+		// The parameter ends on the first unescaped space, escapes are decoded only when there are any
+		string::size_type j = i;
+		bool l_is_escaped = false;
+		while (j < len && buf[j] != ' ')
 		{
-			case '\\':
-				++i;
-				if (i == len)
+			if (buf[j] == '\\')
+			{
+				if (++j == len)
 					throw ParseException("Escape at eol");
-				if (buf[i] == 's')
-					cur += ' ';
-				else if (buf[i] == 'n')
-					cur += '\n';
-				else if (buf[i] == '\\')
-					cur += '\\';
-				else if (buf[i] == ' ' && nmdc) // $ADCGET escaping, leftover from old specs
-					cur += ' ';
-				else
+				// the escapes are checked in the order of the line, as the char by char parser did
+				if (buf[j] != 's' && buf[j] != 'n' && buf[j] != '\\' && !(buf[j] == ' ' && nmdc))
 					throw ParseException("Unknown escape");
-				break;
-			case ' ':
-				// New parameter...
-			{
-				if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
-				{
-					if (cur.length() != 4)
-					{
-						throw ParseException("Invalid SID length");
-					}
-					m_from = toSID(cur);
-					fromSet = true;
-				}
-				else if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet)
-				{
-					if (cur.length() != 4)
-					{
-						throw ParseException("Invalid SID length");
-					}
-					m_to = toSID(cur);
-					toSet = true;
-				}
-				else if (m_type == TYPE_FEATURE && !featureSet)
-				{
-					if (cur.length() % 5 != 0)
-					{
-						throw ParseException("Invalid feature length");
-					}
-					// Skip...
-					featureSet = true;
-				}
-				else
-				{
-					parameters.push_back(cur);
-					/*
-					if (cur.size() > 2 && cur[0] == 'I' && cur[1] == 'D')
-					{
-					    if (cur.size() == 41)
-					    {
-					        m_CID = CID(cur.substr(2));
-					    }
-					}
-					*/
-				}
-				cur.clear();
+				l_is_escaped = true;
 			}
-			break;
-			default:
-				cur += buf[i];
+			++j;
 		}
-		++i;
+		const boost::string_view l_param(buf + i, j - i);
+		addParsedParam(l_is_escaped ? unescape(l_param, nmdc, len) : l_param, fromSet, toSet, featureSet);
+		i = j + 1;
 	}
-	if (!cur.empty())
+	
+	if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
 	{
-		if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
+		throw ParseException("Missing from_sid");
+	}
+	
+	if (m_type == TYPE_FEATURE && !featureSet)
+	{
+		throw ParseException("Missing feature");
+	}
+	
+	if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet)
+	{
+		throw ParseException("Missing to_sid");
+	}
+	
+	if (p_mode == PARSE_COPY)
+	{
+		materialize();
+	}
+}
+
+void AdcCommand::addParsedParam(const boost::string_view& p_param, bool& p_fromSet, bool& p_toSet, bool& p_featureSet)
+{
+	if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !p_fromSet)
+	{
+		if (p_param.length() != 4)
 		{
-			if (cur.length() != 4)
-			{
-				throw ParseException("Invalid SID length");
-			}
-			m_from = toSID(cur);
-			fromSet = true;
+			throw ParseException("Invalid SID length");
 		}
-		else if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet)
+		m_from = *reinterpret_cast<const uint32_t*>(p_param.data());
+		p_fromSet = true;
+	}
+	else if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !p_toSet)
+	{
+		if (p_param.length() != 4)
 		{
-			if (cur.length() != 4)
-			{
-				throw ParseException("Invalid SID length");
-			}
-			m_to = toSID(cur);
-			toSet = true;
+			throw ParseException("Invalid SID length");
 		}
-		else if (m_type == TYPE_FEATURE && !featureSet)
+		m_to = *reinterpret_cast<const uint32_t*>(p_param.data());
+		p_toSet = true;
+	}
+	else if (m_type == TYPE_FEATURE && !p_featureSet)
+	{
+		if (p_param.length() % 5 != 0)
 		{
-			if (cur.length() % 5 != 0)
-			{
-				throw ParseException("Invalid feature length");
-			}
-			// Skip...
-			featureSet = true;
+			throw ParseException("Invalid feature length");
 		}
-		else
+		// Skip...
+		p_featureSet = true;
+	}
+	else
+	{
+		m_param_views.push_back(p_param);
+	}
+}
+
+boost::string_view AdcCommand::unescape(const boost::string_view& p_param, bool nmdc, size_t p_line_size)
+{
+	// Each escaped parameter shrinks by at least one char, which leaves room for its terminating zero,
+	// so the buffer reserved for the whole line never reallocates under the views already taken.
+	if (m_unescaped.empty())
+	{
+		m_unescaped.reserve(p_line_size);
+	}
+	dcdrun(const auto l_capacity = m_unescaped.capacity());
+	const auto l_start = m_unescaped.size();
+	for (size_t i = 0; i < p_param.size(); ++i)
+	{
+		if (p_param[i] != '\\')
 		{
-			parameters.push_back(cur);
+			m_unescaped += p_param[i];
+			continue;
 		}
+		++i;
+		dcassert(i < p_param.size());
+		if (p_param[i] == 's')
+			m_unescaped += ' ';
+		else if (p_param[i] == 'n')
+			m_unescaped += '\n';
+		else if (p_param[i] == '\\')
+			m_unescaped += '\\';
+		else if (p_param[i] == ' ' && nmdc) // $ADCGET escaping, leftover from old specs
+			m_unescaped += ' ';
+		else
+			throw ParseException("Unknown escape");
 	}
-	
-	if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
+	const auto l_size = m_unescaped.size() - l_start;
+	m_unescaped += '\0';
+	dcassert(m_unescaped.capacity() == l_capacity);
+	return boost::string_view(m_unescaped.data() + l_start, l_size);
+}
+
+void AdcCommand::assignParams(const AdcCommand& rhs)
+{
+	if (rhs.m_is_borrowed)
 	{
-		throw ParseException("Missing from_sid");
+		parameters.clear();
+		parameters.reserve(rhs.m_param_views.size());
+		for (auto i = rhs.m_param_views.cbegin(); i != rhs.m_param_views.cend(); ++i)
+		{
+			parameters.push_back(string(i->data(), i->size()));
+		}
 	}
-	
-	if (m_type == TYPE_FEATURE && !featureSet)
+	else
 	{
-		throw ParseException("Missing feature");
+		parameters = rhs.parameters;
 	}
-	
-	if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet)
+	m_param_views.clear();
+	m_unescaped.clear();
+	m_is_borrowed = false;
+}
+
+void AdcCommand::materialize()
+{
+	if (m_is_borrowed)
 	{
-		throw ParseException("Missing to_sid");
+		parameters.clear();
+		parameters.reserve(m_param_views.size());
+		for (auto i = m_param_views.cbegin(); i != m_param_views.cend(); ++i)
+		{
+			parameters.push_back(string(i->data(), i->size()));
+		}
+		m_param_views.clear();
+		m_is_borrowed = false;
 	}
 }
 
@@ -302,10 +355,21 @@ string AdcCommand::getParamString(bool nmdc) const
 {
 	string tmp;
 	tmp.reserve(65);
-	for (auto i = getParameters().cbegin(); i != getParameters().cend(); ++i)
+	if (m_is_borrowed)
 	{
-		tmp += ' ';
-		tmp += escape(*i, nmdc);
+		for (auto i = m_param_views.cbegin(); i != m_param_views.cend(); ++i)
+		{
+			tmp += ' ';
+			tmp += escape(string(i->data(), i->size()), nmdc);
+		}
+	}
+	else
+	{
+		for (auto i = parameters.cbegin(); i != parameters.cend(); ++i)
+		{
+			tmp += ' ';
+			tmp += escape(*i, nmdc);
+		}
 	}
 	if (nmdc)
 	{
@@ -320,11 +384,24 @@ string AdcCommand::getParamString(bool nmdc) const
 
 bool AdcCommand::getParam(const char* name, size_t start, string& ret) const
 {
-	for (string::size_type i = start; i < getParameters().size(); ++i)
+	boost::string_view l_value;
+	if (getParam(name, start, l_value))
+	{
+		ret.assign(l_value.data(), l_value.size());
+		return true;
+	}
+	return false;
+}
+
+bool AdcCommand::getParam(const char* name, size_t start, boost::string_view& ret) const
+{
+	const auto l_code = toCode(name);
+	for (size_t i = start; i < getParamCount(); ++i)
 	{
-		if (toCode(name) == toCode(getParameters()[i].c_str()))
+		const auto l_param = getParamView(i);
+		if (l_param.size() >= 2 && l_code == toCode(l_param.data()))
 		{
-			ret = getParameters()[i].substr(2);
+			ret = l_param.substr(2);
 			return true;
 		}
 	}
@@ -333,11 +410,13 @@ bool AdcCommand::getParam(const char* name, size_t start, string& ret) const
 
 bool AdcCommand::hasFlag(const char* name, size_t start) const
 {
-	for (string::size_type i = start; i < getParameters().size(); ++i)
+	const auto l_code = toCode(name);
+	for (size_t i = start; i < getParamCount(); ++i)
 	{
-		if (toCode(name) == toCode(getParameters()[i].c_str()) &&
-		        getParameters()[i].size() == 3 &&
-		        getParameters()[i][2] == '1')
+		const auto l_param = getParamView(i);
+		if (l_param.size() == 3 &&
+		        l_code == toCode(l_param.data()) &&
+		        l_param[2] == '1')
 		{
 			return true;
 		}
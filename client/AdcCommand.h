@@ -23,6 +23,8 @@
 #include "SettingsManager.h"
 #include "Exception.h"
 #include "CID.h"
+#include <boost/utility/string_view.hpp>
+#include <boost/container/small_vector.hpp>
 
 STANDARD_EXCEPTION(ParseException);
 
@@ -129,8 +131,19 @@ class AdcCommand
 		explicit AdcCommand(uint32_t aCmd, char aType = TYPE_CLIENT);
 		explicit AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType);
 		explicit AdcCommand(Severity sev, Error err, const string& desc, char aType = TYPE_CLIENT);
-		explicit AdcCommand(const string& aLine, bool nmdc = false);
-		void parse(const string& aLine, bool nmdc = false);
+		enum ParseMode
+		{
+			PARSE_COPY,  // parameters are copied into a StringList
+			PARSE_BORROW // parameters point into the line, which must outlive the command
+		};
+		
+		explicit AdcCommand(const string& aLine, bool nmdc = false, ParseMode p_mode = PARSE_COPY);
+#ifndef _DEBUG
+		// A copy never borrows: the line the views point into belongs to the original
+		AdcCommand(const AdcCommand& rhs);
+		AdcCommand& operator=(const AdcCommand& rhs);
+#endif
+		void parse(const string& aLine, bool nmdc = false, ParseMode p_mode = PARSE_COPY);
 		
 		uint32_t getCommand() const
 		{
@@ -167,11 +180,20 @@ class AdcCommand
 		
 		StringList& getParameters()
 		{
+			materialize();
 			return parameters;
 		}
-		const StringList& getParameters() const
+		size_t getParamCount() const
 		{
-			return parameters;
+			return m_is_borrowed ? m_param_views.size() : parameters.size();
+		}
+		/** Every view is followed by a separator (space or zero), so numeric fields can be read with atoi & co. */
+		boost::string_view getParamView(size_t n) const
+		{
+			dcassert(getParamCount() > n);
+			if (m_is_borrowed)
+				return m_param_views[n];
+			return parameters[n];
 		}
 		
 		string toString(const CID& aCID, bool nmdc = false) const;
@@ -179,22 +201,30 @@ class AdcCommand
 		
 		AdcCommand& addParam(const string& name, const string& value)
 		{
+			materialize();
 			parameters.push_back(name);
 			parameters.back() += value;
 			return *this;
 		}
 		AdcCommand& addParam(const string& str)
 		{
+			materialize();
 			parameters.push_back(str);
 			return *this;
 		}
 		const string getParam(size_t n) const //   -  .
 		{
-			dcassert(getParameters().size() > n);
-			return getParameters().size() > n ? getParameters()[n] : Util::emptyString;
+			dcassert(getParamCount() > n);
+			if (getParamCount() > n)
+			{
+				const auto l_param = getParamView(n);
+				return string(l_param.data(), l_param.size());
+			}
+			return Util::emptyString;
 		}
 		/** Return a named parameter where the name is a two-letter code */
 		bool getParam(const char* name, size_t start, string& ret) const;
+		bool getParam(const char* name, size_t start, boost::string_view& ret) const;
 		bool hasFlag(const char* name, size_t start) const;
 		static uint16_t toCode(const char* x)
 		{
@@ -247,7 +277,17 @@ class AdcCommand
 	private:
 		string getHeaderString(const CID& cid) const;
 		string getHeaderString(uint32_t sid, bool nmdc) const;
+		void addParsedParam(const boost::string_view& p_param, bool& p_fromSet, bool& p_toSet, bool& p_featureSet);
+		boost::string_view unescape(const boost::string_view& p_param, bool nmdc, size_t p_line_size);
+		void materialize();
+		void assignParams(const AdcCommand& rhs);
+		
 		StringList parameters;
+		// PARSE_BORROW: a dispatched INF/SCH holds 10-30 parameters, keep them on the stack
+		typedef boost::container::small_vector<boost::string_view, 32> ParamViewArray;
+		ParamViewArray m_param_views;
+		string m_unescaped; // only the parameters with escapes, reserved once so the views stay valid
+		bool m_is_borrowed;
 		string features;
 		union
 		{
@@ -276,7 +316,7 @@ class CommandHandler
 				{
 					return;
 				}
-				AdcCommand cmd(aLine, nmdc);
+				AdcCommand cmd(aLine, nmdc, AdcCommand::PARSE_BORROW);
 				
 #define CALL_CMD(n) case AdcCommand::CMD_##n: ((T*)this)->handle(AdcCommand::n(), cmd); break;
 				switch (cmd.getCommand())
@@ -233,7 +233,7 @@ void AdcHub::clearUsers()
 
 void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 	{
 		dcassert(0);
 		return;
@@ -292,70 +292,76 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 	PROFILE_THREAD_SCOPED_DESC("getParameters")
 	string l_ip4;
 	string l_ip6;
-	for (auto i = c.getParameters().cbegin(); i != c.getParameters().cend(); ++i)
+	Identity::StringParams l_string_params; // set at once after the loop
+	for (size_t j = 0; j < c.getParamCount(); ++j)
 	{
-		if (i->length() < 2)
+		const boost::string_view l_param = c.getParamView(j);
+		if (l_param.length() < 2)
 		{
 			dcassert(0);
 			continue;
 		}
+		// The view points into the received line and ends at a separator: numbers are read in place,
+		// only the values that are stored get copied.
+		const char* l_value = l_param.data() + 2;
+		const boost::string_view l_text = l_param.substr(2);
 		// [+] brain-ripper
-		switch (*(short*)i->c_str())
+		switch (*(short*)l_param.data())
 		{
 			case TAG('S', 'L'):
 			{
-				id.setSlots(Util::toInt(i->c_str() + 2));
+				id.setSlots(Util::toInt(l_value));
 				break;
 			}
 			case TAG('F', 'S'):
 			{
-				id.setFreeSlots(Util::toInt(i->c_str() + 2));
+				id.setFreeSlots(Util::toInt(l_value));
 				break;
 			}
 			case TAG('S', 'S'):
 			{
-				changeBytesSharedL(id, Util::toInt64(i->c_str() + 2));
+				changeBytesSharedL(id, Util::toInt64(l_value));
 				break;
 			}
 			// [+] IRainman fix.
 			case TAG('S', 'U'):
 			{
-				AdcSupports::setSupports(id, i->substr(2));
+				AdcSupports::setSupports(id, l_text.to_string());
 				break;
 			}
 			case TAG('S', 'F'):
 			{
-				id.setSharedFiles(Util::toInt(i->c_str() + 2));
+				id.setSharedFiles(Util::toInt(l_value));
 				break;
 			}
 			case TAG('I', '4'):
 			{
-				l_ip4 = i->substr(2);
+				l_ip4 = l_text.to_string();
 				break;
 			}
 			case TAG('U', '4'):
 			{
-				id.setUdpPort(Util::toInt(i->substr(2)));
+				id.setUdpPort(Util::toInt(l_value));
 				break;
 			}
 			case TAG('I', '6'):
 			{
-				l_ip6 = i->substr(2);
+				l_ip6 = l_text.to_string();
 				break;
 			}
 			case TAG('U', '6'):
 			{
-				id.setUdpPort(Util::toInt(i->substr(2)));
+				id.setUdpPort(Util::toInt(l_value));
 				break;
 			}
 			case TAG('E', 'M'):
 			{
-				id.setEmail(i->substr(2));
+				id.setEmail(l_text.to_string());
 				break;
 			}
 			case TAG('D', 'E'):
 			{
-				id.setDescription(i->substr(2));
+				id.setDescription(l_text.to_string());
 				break;
 			}
 			case TAG('C', 'O'):
@@ -371,7 +377,7 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 			}
 			case TAG('D', 'S'):
 			{
-				id.setDownloadSpeed(Util::toUInt32(i->c_str() + 2));
+				id.setDownloadSpeed(Util::toUInt32(l_value));
 				break;
 			}
 			case TAG('O', 'P'):
@@ -383,32 +389,32 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 			// [~] IRainman fix.
 			case TAG('C', 'T'):
 			{
-				id.setClientType(Util::toInt(i->c_str() + 2));
+				id.setClientType(Util::toInt(l_value));
 				break;
 			}
 			case TAG('U', 'S'):
 			{
-				id.setLimit(Util::toUInt32(i->c_str() + 2));
+				id.setLimit(Util::toUInt32(l_value));
 				break;
 			}
 			case TAG('H', 'N'):
 			{
-				id.setHubNormal(i->c_str() + 2);
+				id.setHubNormal(l_value);
 				break;
 			}
 			case TAG('H', 'R'):
 			{
-				id.setHubRegister(i->c_str() + 2);
+				id.setHubRegister(l_value);
 				break;
 			}
 			case TAG('H', 'O'):
 			{
-				id.setHubOperator(i->c_str() + 2);
+				id.setHubOperator(l_value);
 				break;
 			}
 			case TAG('N', 'I'):
 			{
-				id.setNick(i->substr(2));
+				id.setNick(l_text.to_string());
 				break;
 			}
 			case TAG('A', 'W'): // [+] IRainman fix: away mode.
@@ -419,21 +425,25 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 #ifdef _DEBUG
 			case TAG('V', 'E'):
 			{
-				id.setStringParam("VE", i->substr(2));
+				id.setStringParam("VE", l_text.to_string());
 				break;
 			}
 			case TAG('A', 'P'):
 			{
-				id.setStringParam("AP", i->substr(2));
+				id.setStringParam("AP", l_text.to_string());
 				break;
 			}
 #endif
 			default:
 			{
-				id.setStringParam(i->c_str(), i->substr(2));
+				l_string_params.push_back(make_pair(*(short*)l_param.data(), l_text));
 			}
 		}
 	}
+	if (!l_string_params.empty())
+	{
+		id.setStringParams(l_string_params);
+	}
 	if (!l_ip4.empty())
 	{
 		id.setIp(l_ip4);
@@ -473,18 +483,19 @@ void AdcHub::handle(AdcCommand::SUP, const AdcCommand& c) noexcept
 		return;
 	bool baseOk = false;
 	bool tigrOk = false;
-	for (auto i = c.getParameters().cbegin(); i != c.getParameters().cend(); ++i)
+	for (size_t i = 0; i < c.getParamCount(); ++i)
 	{
-		if (*i == AdcSupports::BAS0_SUPPORT)
+		const string l_param = c.getParam(i);
+		if (l_param == AdcSupports::BAS0_SUPPORT)
 		{
 			baseOk = true;
 			tigrOk = true;
 		}
-		else if (*i == AdcSupports::BASE_SUPPORT)
+		else if (l_param == AdcSupports::BASE_SUPPORT)
 		{
 			baseOk = true;
 		}
-		else if (*i == AdcSupports::TIGR_SUPPORT)
+		else if (l_param == AdcSupports::TIGR_SUPPORT)
 		{
 			tigrOk = true;
 		}
@@ -512,7 +523,7 @@ void AdcHub::handle(AdcCommand::SID, const AdcCommand& c) noexcept
 		return;
 	}
 	
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 		
 	m_sid = AdcCommand::toSID(c.getParam(0));
@@ -528,7 +539,7 @@ void AdcHub::handle(AdcCommand::MSG, const AdcCommand& c) noexcept
 		return;
 	}
 	
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 	auto l_user = findUser(c.getFrom());
 	if (!l_user)
@@ -571,7 +582,7 @@ void AdcHub::handle(AdcCommand::MSG, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::GPA, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 	m_salt = c.getParam(0);
 	state = STATE_VERIFY;
@@ -648,7 +659,7 @@ void AdcHub::handle(AdcCommand::CTM, const AdcCommand& c) noexcept
 	OnlineUserPtr ou = findUser(c.getFrom()); // [!] IRainman fix.
 	if (isMeCheck(ou))
 		return;
-	if (c.getParameters().size() < 3)
+	if (c.getParamCount() < 3)
 		return;
 		
 	const string& protocol = c.getParam(0);
@@ -695,7 +706,7 @@ void AdcHub::handle(AdcCommand::ZON, const AdcCommand& /*c*/) noexcept
 
 void AdcHub::handle(AdcCommand::RCM, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 2)
+	if (c.getParamCount() < 2)
 	{
 		return;
 	}
@@ -740,7 +751,7 @@ void AdcHub::handle(AdcCommand::RCM, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::CMD, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 1)
+	if (c.getParamCount() < 1)
 		return;
 	const string& l_name = c.getParam(0);
 	bool rem = c.hasFlag("RM", 1);
@@ -813,7 +824,7 @@ void AdcHub::sendUDP(const AdcCommand& cmd) noexcept
 
 void AdcHub::handle(AdcCommand::STA, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 2)
+	if (c.getParamCount() < 2)
 		return;
 		
 	OnlineUserPtr ou;
@@ -928,9 +939,9 @@ void AdcHub::handle(AdcCommand::PSR, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::GET, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 5)
+	if (c.getParamCount() < 5)
 	{
-		if (!c.getParameters().empty())
+		if (c.getParamCount() != 0)
 		{
 			if (c.getParam(0) == "blom")
 			{
@@ -1006,7 +1017,7 @@ void AdcHub::handle(AdcCommand::NAT, const AdcCommand& c) noexcept
 		return;
 		
 	OnlineUserPtr ou = findUser(c.getFrom()); // [!] IRainman fix.
-	if (isMeCheck(ou) || c.getParameters().size() < 3) // [!] IRainman fix.
+	if (isMeCheck(ou) || c.getParamCount() < 3) // [!] IRainman fix.
 		return;
 		
 	const string& protocol = c.getParam(0);
@@ -1047,7 +1058,7 @@ void AdcHub::handle(AdcCommand::RNT, const AdcCommand& c) noexcept
 		return;
 		
 	OnlineUserPtr ou = findUser(c.getFrom()); // [!] IRainman fix.
-	if (isMeCheck(ou) || c.getParameters().size() < 3)// [!] IRainman fix.
+	if (isMeCheck(ou) || c.getParamCount() < 3)// [!] IRainman fix.
 		return;
 		
 	const string& protocol = c.getParam(0);
@@ -1673,7 +1684,7 @@ void AdcHub::info(bool p_force)
 	
 	addParam(c, "SU", su);
 	
-	if (!c.getParameters().empty())
+	if (c.getParamCount() != 0)
 	{
 		send(c);
 	}
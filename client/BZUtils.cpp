@@ -105,11 +105,13 @@ bool UnBZFilter::operator()(const void* in, size_t& insize, void* out, size_t& o
 	insize = insize - zs.avail_in;
 	if (err == BZ_STREAM_END)
 	{
+		// [!] The next stream of a multi-stream .bz2 may follow (ParallelBZipOutputStream), even if nothing was taken by this call
+		const bool l_has_input = zs.avail_in != 0;
 		int l_ret = BZ2_bzDecompressEnd(&zs);
 		dcassert(l_ret == BZ_OK);
 		l_ret = BZ2_bzDecompressInit(&zs, 0, 0);
 		dcassert(l_ret == BZ_OK);
-		if (insize == 0)
+		if (insize == 0 && !l_has_input)
 			return false;
 		else
 			return true;
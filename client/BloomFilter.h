@@ -112,6 +112,156 @@ class BloomFilter
 		std::vector<bool> table;
 };
 
+/**
+ * [+] Blocked Bloom filter: all the bits of one N-gram are in one 64-byte block (one cache line),
+ * so a test of an N-gram costs one cache miss instead of a miss per bit.
+ * The N-gram is hashed as a whole by a 64-bit mix: the high bits select the block,
+ * up to MAX_K groups of 9 low bits select the bits inside the 512 bits of the block.
+ * The number of bits per N-gram follows the size of the table and the number of N-grams given to reset():
+ * more bits per N-gram than ln 2 * m / n fill the table sooner and make the filter worse, not better.
+ */
+template<size_t N, size_t MAX_K = 5>
+class BlockedBloomFilter
+{
+		static_assert(MAX_K * 9 <= 64 - 16, "BlockedBloomFilter: too many bits per N-gram");
+	public:
+		/** p_bits - the least size of the table in bits, rounded up to a power of two blocks. 1 bit per N-gram until reset() */
+		explicit BlockedBloomFilter(size_t p_bits) : m_min_blocks(getBlocks(p_bits, 1)), m_k(1)
+		{
+			allocate(m_min_blocks);
+		}
+		
+		/**
+		 * Clears the table and sizes it for p_items N-grams (repeated ones may be counted as well):
+		 * BITS_PER_ITEM bits each, not less than the size given to the constructor
+		 * and not more than MAX_BLOCKS. The items added later than expected only raise the false positive rate.
+		 */
+		void reset(size_t p_items)
+		{
+			allocate(getBlocks(p_items * BITS_PER_ITEM, m_min_blocks));
+			const double l_bits_per_item = double((m_mask + 1) * BLOCK_BITS) / double(std::max<size_t>(p_items, 1));
+			m_k = std::max<size_t>(1, std::min<size_t>(MAX_K, size_t(l_bits_per_item * 0.693 + 0.5)));
+		}
+		
+		/** The N-grams of a string of p_len bytes, for reset() */
+		static size_t getItemCount(size_t p_len)
+		{
+			return p_len >= N ? p_len - N + 1 : 0;
+		}
+		
+		void add(const string& s)
+		{
+			if (s.length() >= N)
+			{
+				const string::size_type l = s.length() - N;
+				for (string::size_type i = 0; i <= l; ++i)
+				{
+					const uint64_t h = getHash(s.data() + i);
+					uint64_t* l_block = getBlock(h);
+					for (size_t j = 0; j < m_k; ++j)
+					{
+						const unsigned l_bit = unsigned(h >> (j * 9)) & (BLOCK_BITS - 1);
+						l_block[l_bit >> 6] |= uint64_t(1) << (l_bit & 63);
+					}
+				}
+			}
+		}
+		bool match(const StringList& s) const
+		{
+			for (auto i = s.cbegin(); i != s.cend(); ++i)
+			{
+				if (!match(*i))
+					return false;
+			}
+			return true;
+		}
+		bool match(const string& s) const
+		{
+			if (s.length() >= N)
+			{
+				const string::size_type l = s.length() - N;
+				for (string::size_type i = 0; i <= l; ++i)
+				{
+					const uint64_t h = getHash(s.data() + i);
+					const uint64_t* l_block = getBlock(h);
+					uint64_t l_missed = 0;
+					for (size_t j = 0; j < m_k; ++j)
+					{
+						const unsigned l_bit = unsigned(h >> (j * 9)) & (BLOCK_BITS - 1);
+						l_missed |= ~l_block[l_bit >> 6] & (uint64_t(1) << (l_bit & 63));
+					}
+					if (l_missed)
+					{
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+		void clear()
+		{
+			std::fill(m_storage.begin(), m_storage.end(), 0);
+		}
+		
+	private:
+		static const size_t BLOCK_BITS = 512;
+		static const size_t WORDS = BLOCK_BITS / 64;
+		static const size_t MAX_BLOCKS = size_t(1) << 16; // 4 MB
+		// 8 bits of the table per N-gram (up to 16 after the rounding to a power of two blocks): reset() sets K = ln 2 * 8 = 5.5 -> MAX_K = 5 bits set per N-gram,
+		// (1 - e^(-5/8))^5 = 2.2% of false positives per N-gram, 2.3% with the uneven fill of the 512-bit blocks (0.17% at 16 bits)
+		static const size_t BITS_PER_ITEM = 8;
+		
+		static size_t getBlocks(size_t p_bits, size_t p_min_blocks)
+		{
+			size_t l_blocks = p_min_blocks;
+			while (l_blocks * BLOCK_BITS < p_bits && l_blocks < MAX_BLOCKS)
+			{
+				l_blocks <<= 1;
+			}
+			return l_blocks;
+		}
+		void allocate(size_t p_blocks)
+		{
+			// The blocks are aligned to the cache line by hand: std::vector doesn't align to 64
+			std::vector<uint64_t> l_storage((p_blocks + 1) * WORDS);
+			m_storage.swap(l_storage);
+			m_first = ((64 - (reinterpret_cast<uintptr_t>(m_storage.data()) & 63)) & 63) / sizeof(uint64_t);
+			m_mask = p_blocks - 1;
+		}
+		uint64_t* getBlock(uint64_t h)
+		{
+			return m_storage.data() + m_first + (size_t(h >> 48) & m_mask) * WORDS;
+		}
+		const uint64_t* getBlock(uint64_t h) const
+		{
+			return m_storage.data() + m_first + (size_t(h >> 48) & m_mask) * WORDS;
+		}
+		/* murmur3 fmix64 over the N bytes read by 8 */
+		static uint64_t getHash(const char* p)
+		{
+			uint64_t h = N;
+			for (size_t i = 0; i < N; i += 8)
+			{
+				uint64_t l_chunk = 0;
+				memcpy(&l_chunk, p + i, std::min<size_t>(8, N - i));
+				h = (h ^ l_chunk) * 0x9e3779b97f4a7c15ULL;
+				h ^= h >> 32;
+			}
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+			return h;
+		}
+		
+		std::vector<uint64_t> m_storage;
+		size_t m_first;
+		size_t m_mask;
+		const size_t m_min_blocks;
+		size_t m_k;
+};
+
 #endif // !defined(BLOOM_FILTER_H)
 
 /**
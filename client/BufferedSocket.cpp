@@ -22,6 +22,9 @@
 #include "TimerManager.h"
 #include "SettingsManager.h"
 #include "Streams.h"
+#include "MappedFileStream.h"
+#include "SocketReactor.h"
+#include "LineFramer.h"
 #include "CryptoManager.h"
 #include "ZUtils.h"
 #include "ThrottleManager.h"
@@ -34,10 +37,33 @@
 #include "DebugManager.h"
 #include "SSLSocket.h"
 #include "UserConnection.h"
+#include "CompatibilityManager.h"
 #include "../FlyFeatures/flyServer.h"
 
-// Polling is used for tasks...should be fixed...
 static const uint64_t POLL_TIMEOUT = 250;
+// [+] The speed limit is reached: the socket is left out of the poll for this time
+static const uint64_t THROTTLE_RETRY = 100;
+// How often the I/O thread looks for the end of an overlapped TransmitFile if its wait couldn't be registered
+static const uint64_t TRANSMIT_FILE_CHECK = 10;
+// TransmitFile sends of all the sockets in flight
+static volatile long g_transmit_count = 0;
+
+static bool takeTransmitSlot()
+{
+	// Workstation editions of Windows run two TransmitFile sends at a time system-wide and queue the rest,
+	// so a third upload would wait for a slow peer of another one
+	static const long g_max_transmit = CompatibilityManager::getOsType() == VER_NT_WORKSTATION ? 2 : LONG_MAX;
+	if (Thread::safeInc(g_transmit_count) <= g_max_transmit)
+		return true;
+	Thread::safeDec(g_transmit_count);
+	return false;
+}
+
+static VOID CALLBACK onTransmitFileDone(PVOID p_io_thread, BOOLEAN)
+{
+	// WSAPoll doesn't see the end of an overlapped send: the event wakes up the I/O thread of the socket
+	static_cast<SocketReactor::IOThread*>(p_io_thread)->wakeup();
+}
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 boost::atomic<long> BufferedSocket::g_sockets(0);
 #endif
@@ -56,12 +82,29 @@ BufferedSocket::BufferedSocket(char aSeparator, UserConnection* p_connection) :
 	m_is_disconnecting(false),
 	m_myInfoCount(0),
 	m_is_all_my_info_loaded(false),
-	m_is_hide_share(false)
+	m_is_hide_share(false),
+	m_io_thread(nullptr),
+	m_is_busy(false),
+	m_is_shutdown(false),
+	m_turn_events(0),
+	m_read_retry_tick(0),
+	m_write_retry_tick(0),
+	m_sendPos(0),
+	m_sendFile(nullptr),
+	m_chunk(nullptr),
+	m_chunkLen(0),
+	m_chunkPos(0),
+	m_retrySize(0),
+	m_is_mapped_send(false),
+	m_transmitFile(nullptr),
+	m_transmitWait(nullptr),
+	m_is_transmit_pending(false)
 {
-	start(64, "BufferedSocket");
+	memzero(&m_transmitOv, sizeof(m_transmitOv));
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 	++g_sockets;
 #endif
+	SocketReactor::getInstance()->add(this);
 }
 
 BufferedSocket::~BufferedSocket()
@@ -72,6 +115,11 @@ BufferedSocket::~BufferedSocket()
 	--g_sockets;
 #endif
 	dcassert(m_tasks.empty());
+	dcassert(!m_is_transmit_pending);
+	if (m_transmitOv.hEvent)
+	{
+		::CloseHandle(m_transmitOv.hEvent);
+	}
 }
 
 void BufferedSocket::setMode(Modes aMode, size_t aRollback)
@@ -261,7 +309,7 @@ void BufferedSocket::threadConnect(const string& aAddr, uint16_t aPort, uint16_t
 		{
 			if (natRole == NAT_NONE)
 				throw;
-			sleep(SHORT_TIMEOUT);
+			Thread::sleep(SHORT_TIMEOUT);
 		}
 	}
 	while (GET_TICK() < endTime); // [~] IRainman opt
@@ -292,7 +340,7 @@ void BufferedSocket::threadAccept()
 	}
 }
 
-bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separator, const string& p_line,
+bool BufferedSocket::all_search_parser(const boost::string_view& p_line,
                                        CFlySearchArrayTTH& p_tth_search,
                                        CFlySearchArrayFile& p_file_search)
 {
@@ -306,7 +354,7 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	if (ShareManager::g_is_initial == true)
 	{
 #ifdef _DEBUG
-		LogManager::message("[ShareManager::g_is_initial] BufferedSocket::all_search_parser p_line = " + p_line);
+		LogManager::message("[ShareManager::g_is_initial] BufferedSocket::all_search_parser p_line = " + p_line.to_string());
 #endif
 		return true;
 	}
@@ -319,7 +367,7 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 #ifndef _DEBUG
 		const
 #endif
-		string l_line_item = p_line.substr(0, p_pos_next_separator);
+		string l_line_item = p_line.to_string();
 		auto l_marker_tth = l_line_item.find("?0?9?TTH:");
 		// TODO      
 		// "x.x.x.x:yyy T?F?57671680?9?TTH:A3VSWSWKCVC4N6EP2GX47OEMGT5ZL52BOS2LAHA"
@@ -485,25 +533,21 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	{
 		if (p_line.size() >= 45 && p_line[3] == ' ' && (p_line[2] == 'P' || p_line[2] == 'A') && p_line[43] == ' ')
 		{
-			const TTHValue l_tth(p_line.c_str() + 4, 39);
+			const TTHValue l_tth(p_line.data() + 4, 39);
 			if (ShareManager::isUnknownTTH(l_tth) == false)
 			{
-				const auto l_end_cmd = p_line.find('|', 43);
-				if (l_end_cmd != string::npos)
+				string l_search_str = p_line.substr(44).to_string();
+				if (p_line[2] == 'P')
+					l_search_str = "Hub:" + l_search_str;
+				dcassert(l_search_str.size() > 4);
+				if (l_search_str.size() > 4)
 				{
-					string l_search_str = p_line.substr(44, l_end_cmd - 44);
-					if (p_line[2] == 'P')
-						l_search_str = "Hub:" + l_search_str;
-					dcassert(l_search_str.size() > 4);
-					if (l_search_str.size() > 4)
-					{
-						p_tth_search.emplace_back(CFlySearchItemTTH(l_tth, l_search_str));
-					}
+					p_tth_search.emplace_back(CFlySearchItemTTH(l_tth, l_search_str));
 				}
 			}
 			else
 			{
-				string l_line_item = p_line.substr(0, p_pos_next_separator);
+				const string l_line_item = p_line.to_string();
 				COMMAND_DEBUG("[TTHS][FastSkip]" + l_line_item, DebugTask::HUB_IN, getServerAndPort());
 #ifdef _DEBUG
 				//  LogManager::message("BufferedSocket::all_search_parser Skip unknown TTH = " + l_tth.toBase32());
@@ -515,10 +559,10 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	}
 	return false;
 }
-void BufferedSocket::all_myinfo_parser(const string::size_type p_pos_next_separator, const string& p_line, StringList& p_all_myInfo, bool p_is_zon)
+void BufferedSocket::all_myinfo_parser(const boost::string_view& p_line, StringList& p_all_myInfo, bool p_is_zon)
 {
 	const bool l_is_MyINFO = m_is_all_my_info_loaded == false ? p_line.compare(0, 8, "$MyINFO ", 8) == 0 : false;
-	const string l_line_item = l_is_MyINFO ? p_line.substr(8, p_pos_next_separator - 8) : p_line.substr(0, p_pos_next_separator);
+	const string l_line_item = l_is_MyINFO ? p_line.substr(8).to_string() : p_line.to_string();
 	if (m_is_all_my_info_loaded == false)
 	{
 		if (l_is_MyINFO)
@@ -641,6 +685,22 @@ void BufferedSocket::parseSearch(
 	}
 }
 
+void BufferedSocket::onLine(const boost::string_view& p_line, bool p_is_zon,
+                            StringList& p_all_myInfo,
+                            CFlySearchArrayTTH& p_tth_search,
+                            CFlySearchArrayFile& p_file_search)
+{
+	if (ClientManager::isBeforeShutdown())
+	{
+		m_line.clear();
+		throw SocketException(STRING(COMMAND_SHUTDOWN_IN_PROGRESS));
+	}
+	if (all_search_parser(p_line, p_tth_search, p_file_search) == false)
+	{
+		all_myinfo_parser(p_line, p_all_myInfo, p_is_zon);
+	}
+}
+
 void BufferedSocket::threadRead()
 {
 	if (m_state != RUNNING)
@@ -653,13 +713,17 @@ void BufferedSocket::threadRead()
 			// EWOULDBLOCK, no data received...
 			return;
 		}
+		else if (l_left == ThrottleManager::NO_TOKENS)
+		{
+			m_read_retry_tick = GET_TICK() + THROTTLE_RETRY;
+			return;
+		}
 		else if (l_left == 0)
 		{
 			// This socket has been closed...
 			throw SocketException(STRING(CONNECTION_CLOSED));
 		}
 		
-		string::size_type l_pos = 0;
 		// always uncompressed data
 		string l;
 		int l_bufpos = 0;
@@ -679,9 +743,10 @@ void BufferedSocket::threadRead()
 				{
 					const int BUF_SIZE = 1024;
 					// Special to autodetect nmdc connections...
-					string::size_type l_zpos = 0; //  warning C6246: Local declaration of 'pos' hides declaration of the same name in outer scope.
 					std::unique_ptr<char[]> buffer(new char[BUF_SIZE]);
-					l = m_line;
+					// the unfinished command of the previous read goes first
+					l.clear();
+					l.swap(m_line);
 					// decompress all input data and store in l.
 					while (l_left)
 					{
@@ -698,40 +763,22 @@ void BufferedSocket::threadRead()
 							break;
 						}
 					}
-					// process all lines
-#define FLYLINKDC_USE_MYINFO_ARRAY
-#ifdef FLYLINKDC_USE_MYINFO_ARRAY
-#ifdef _DEBUG
-					// LogManager::message("BufferedSocket::threadRead[MODE_ZPIPE] = " + l);
-#endif
-					//
 					if (!ClientManager::isBeforeShutdown())
 					{
 						StringList l_all_myInfo;
 						CFlySearchArrayTTH l_tth_search;
 						CFlySearchArrayFile l_file_search;
-						while ((l_zpos = l.find(m_separator)) != string::npos)
+						auto l_on_line = [&](const boost::string_view & p_line)
 						{
-							if (l_zpos > 0) // check empty (only pipe) command and don't waste cpu with it ;o)
-							{
-								if (all_search_parser(l_zpos, l, l_tth_search, l_file_search) == false)
-								{
-									all_myinfo_parser(l_zpos, l, l_all_myInfo, true);
-								}
-							}
-							l.erase(0, l_zpos + 1 /* separator char */); //[3] https://www.box.net/shared/74efa5b96079301f7194
-						}
+							onLine(p_line, true, l_all_myInfo, l_tth_search, l_file_search);
+							return true;
+						};
+						bool l_is_stopped;
+						const size_t l_parsed = LineFramer::parseLines(l.data(), l.size(), m_separator, l_on_line, l_is_stopped);
 						parseMyINfo(l_all_myInfo);
 						parseSearch(l_tth_search, l_file_search);
-#else
-					// process all lines
-					while ((pos = l.find(m_separator)) != string::npos)
-					{
-						if (pos > 0) // check empty (only pipe) command and don't waste cpu with it ;o)
-							fly_fire1(__FUNCTION__, BufferedSocketListener::Line(), l.substr(0, pos));
-						l.erase(0, pos + 1 /* separator char */); // TODO  
-					}
-#endif
+						// store remainder
+						m_line.assign(l, l_parsed, string::npos);
 					}
 					else
 					{
@@ -741,8 +788,6 @@ void BufferedSocket::threadRead()
 #endif
 						throw SocketException(STRING(COMMAND_SHUTDOWN_IN_PROGRESS));
 					}
-					// store remainder
-					m_line = l;
 					break;
 				}
 				case MODE_LINE:
@@ -764,81 +809,34 @@ void BufferedSocket::threadRead()
 					//   -    
 					//   -   UDP (  ?)
 					//======================================================================
-					l = m_line + string((char*)& m_inbuf[l_bufpos], l_left);
-					//dcassert(isalnum(l[0]) || isalpha(l[0]) || isascii(l[0]));
-#if 0
-					int l_count_separator = 0;
-#endif
-#ifdef _DEBUG
-					//LogManager::message("MODE_LINE . m_line = " + m_line);
-					//LogManager::message("MODE_LINE = " + l);
-#endif
 					if (!ClientManager::isBeforeShutdown())
 					{
 						StringList l_all_myInfo;
 						CFlySearchArrayTTH l_tth_search;
 						CFlySearchArrayFile l_file_search;
-						while ((l_pos = l.find(m_separator)) != string::npos)
+						// [!] The commands are parsed right in the receive buffer,
+						// only the unfinished command at its end is copied into m_line till the next read
+						auto l_on_line = [&](const boost::string_view & p_line)
 						{
-#if 0
-							if (l_count_separator++ && l.length() > 0 && BOOLSETTING(LOG_PROTOCOL))
-							{
-								StringMap params;
-								const string l_log = "MODE_LINE l_count_separator = " + Util::toString(l_count_separator) + " l_left = " + Util::toString(l_left) + " l.length()=" + Util::toString(l.length()) + " l = " + l;
-								LogManager::message(l_log);
-							}
-#endif
-							if (ClientManager::isBeforeShutdown())
-							{
-								m_line.clear();
-								throw SocketException(STRING(COMMAND_SHUTDOWN_IN_PROGRESS));
-							}
-							if (l_pos > 0) // check empty (only pipe) command and don't waste cpu with it ;o)
-							{
-								if (all_search_parser(l_pos, l, l_tth_search, l_file_search) == false)
-								{
-									all_myinfo_parser(l_pos, l, l_all_myInfo, false);
-								}
-							}
-							l.erase(0, l_pos + 1 /* separator char */);
-							// TODO - erase  .
-							if (l.length() < (size_t)l_left)
-							{
-								l_left = l.length();
-							}
-							//dcassert(mode == MODE_LINE);
-							if (m_mode != MODE_LINE)
-							{
-								// dcassert(mode == MODE_LINE);
-								// TOOD ? m_myInfoStop = true;
-								// we changed mode; remainder of l is invalid.
-								l.clear();
-								l_bufpos = l_total - l_left;
-								break;
-							}
-						}
+							onLine(p_line, false, l_all_myInfo, l_tth_search, l_file_search);
+							// we changed mode; the rest of the data is left in inbuf for it
+							return m_mode == MODE_LINE;
+						};
+						const int l_used = int(LineFramer::feed(m_line, reinterpret_cast<const char*>(&m_inbuf[l_bufpos]), l_left, m_separator, l_on_line));
+						l_bufpos += l_used;
+						l_left -= l_used;
 						parseMyINfo(l_all_myInfo);
 						parseSearch(l_tth_search, l_file_search);
 					}
 					else
 					{
 #ifdef _DEBUG
-						const string l_log = "Skip MODE_LINE [normal] - FlylinkDC++ Destroy... l = " + l;
+						const string l_log = "Skip MODE_LINE [normal] - FlylinkDC++ Destroy... m_line = " + m_line;
 						LogManager::message(l_log);
 #endif
-						l.clear();
-						l_bufpos = l_total - l_left;
-						l_left = 0;
-						l_pos = string::npos;
 						m_line.clear();
 						throw SocketException(STRING(COMMAND_SHUTDOWN_IN_PROGRESS));
 					}
-					
-					if (l_pos == string::npos)
-					{
-						l_left = 0;
-					}
-					m_line = l;
 					break;
 				}
 				case MODE_DATA:
@@ -926,16 +924,13 @@ boost::asio::ip::address_v4 BufferedSocket::getIp4() const
 	}
 }
 
-void BufferedSocket::putBufferedSocket(BufferedSocket*& p_sock, bool p_delete /*= false*/)
+void BufferedSocket::putBufferedSocket(BufferedSocket*& p_sock)
 {
 	if (p_sock)
 	{
 		p_sock->m_connection = nullptr;
+		// [!] The I/O thread deletes the socket after SHUTDOWN
 		p_sock->shutdown();
-		if (p_delete)
-		{
-			delete p_sock;
-		}
 		p_sock = nullptr;
 	}
 }
@@ -945,175 +940,219 @@ void BufferedSocket::waitShutdown()
 {
 	while (g_sockets > 0)
 	{
-		sleep(10);
+		Thread::sleep(10);
 	}
 }
 #endif
 
-void BufferedSocket::threadSendFile(InputStream* p_file)
+void BufferedSocket::startSendFile(InputStream* p_file)
 {
-	if (m_state != RUNNING)
-		return;
-		
-	if (socketIsDisconnecting())
-		return;
 	dcassert(p_file != NULL);
-	
-	const size_t l_sockSize = MAX_SOCKET_BUFFER_SIZE; //   size_t(sock->getSocketOptInt(SO_SNDBUF));
-	static size_t g_bufSize = 0;
-	if (g_bufSize == 0)
+	m_sendFile = p_file;
+	m_chunk = nullptr;
+	m_chunkLen = 0;
+	m_chunkPos = 0;
+	m_retrySize = 0;
+	// [+] Plain TCP: the data is sent straight from the file mapping.
+	// SSL reads the buffer in user mode, so it keeps the copying path where the I/O errors of the mapping are caught.
+	m_is_mapped_send = p_file->canReadRef() && !sock->isSecure();
+	// [+] A whole shared file is sent by the kernel (TransmitFile), the data doesn't come to user mode at all.
+	// Compressed and partial (LimitedInputStream) transfers aren't MappedFileStream here and go the mapped way.
+	m_transmitFile = m_is_mapped_send ? dynamic_cast<MappedFileStream*>(p_file) : nullptr;
+	if (m_transmitFile && !m_transmitOv.hEvent)
 	{
-		g_bufSize = std::max(l_sockSize, size_t(MAX_SOCKET_BUFFER_SIZE));
-	}
-	
-	ByteVector l_readBuf; // TODO   -    0- std::unique_ptr<uint8_t[]> buf(new uint8_t[BUFSIZE]);
-	ByteVector l_writeBuf;
-	bool l_is_bad_alloc = false;
-	do
-	{
-		try
+		m_transmitOv.hEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+		if (!m_transmitOv.hEvent)
 		{
-			l_is_bad_alloc = false;
-			l_readBuf.resize(g_bufSize);
-			l_writeBuf.resize(g_bufSize);
+			m_transmitFile = nullptr;
 		}
-		catch (std::bad_alloc&)
+	}
+	dcdebug("Starting threadSend\n");
+}
+
+void BufferedSocket::finishSendFile()
+{
+	m_sendFile = nullptr;
+	m_transmitFile = nullptr;
+	m_chunk = nullptr;
+	m_chunkLen = 0;
+	m_chunkPos = 0;
+	fly_fire(BufferedSocketListener::TransmitDone());
+}
+
+bool BufferedSocket::threadNextFileChunk()
+{
+	m_chunkPos = 0;
+	if (m_is_mapped_send)
+	{
+		m_chunkLen = MAX_SOCKET_BUFFER_SIZE * 4;
+		m_chunk = m_sendFile->readRef(m_chunkLen);
+	}
+	else
+	{
+		if (m_fileBuf.empty())
 		{
-			ShareManager::tryFixBadAlloc();
-			g_bufSize /= 2;
-			l_is_bad_alloc = g_bufSize > 1024;
-			if (l_is_bad_alloc == false)
+			try
 			{
-				throw;
+				m_fileBuf.resize(MAX_SOCKET_BUFFER_SIZE);
+			}
+			catch (std::bad_alloc&)
+			{
+				ShareManager::tryFixBadAlloc();
+				throw SocketException(STRING(BAD_ALLOC));
 			}
 		}
+		m_chunkLen = m_fileBuf.size();
+		m_sendFile->read(&m_fileBuf[0], m_chunkLen);
+		m_chunk = &m_fileBuf[0];
 	}
-	while (l_is_bad_alloc == true);
-	
-	size_t readPos = 0;
-	bool readDone = false;
-	dcdebug("Starting threadSend\n");
-	while (!socketIsDisconnecting())
+	if (m_chunkLen == 0)
+	{
+		return false;
+	}
+	dcassert(m_connection);
+	if (m_connection)
+	{
+		m_connection->fireBytesSent(m_chunkLen, 0);
+	}
+	return true;
+}
+
+void BufferedSocket::endTransmitFile()
+{
+	dcassert(m_is_transmit_pending);
+	if (m_transmitWait)
 	{
-		if (!readDone && l_readBuf.size() > readPos)
+		// The callback has run or is cancelled here, it can't touch the socket after that
+		::UnregisterWaitEx(m_transmitWait, INVALID_HANDLE_VALUE);
+		m_transmitWait = nullptr;
+	}
+	m_is_transmit_pending = false;
+	Thread::safeDec(g_transmit_count);
+}
+
+void BufferedSocket::threadSendFileStep(bool p_is_writable)
+{
+	const size_t l_sockSize = MAX_SOCKET_BUFFER_SIZE;
+	// A turn doesn't send more than this, the reading and the tasks of the socket wait for it
+	size_t l_quota = l_sockSize * 4;
+	while (l_quota > 0)
+	{
+		// A chunk that was started from the mapping is sent to the end first
+		if (m_transmitFile && m_chunkPos == m_chunkLen)
 		{
-			size_t bytesRead = l_readBuf.size() - readPos;
-			size_t actual = p_file->read(&l_readBuf[readPos], bytesRead); // TODO        
-#ifdef _DEBUG
-			if (actual)
+			// TransmitFile is overlapped: the end of the send wakes up the I/O thread, then the next chunk is started
+			if (m_is_transmit_pending)
 			{
-				std::ofstream l_fs;
-				l_fs.open(_T("flylinkdc-buffered-socket.log"), std::ifstream::out | std::ifstream::app);
-				if (l_fs.good())
+				int l_sent;
+				try
 				{
-					const string l_str = std::string((const char*) &l_readBuf[readPos], actual);
-					l_fs << std::endl << std::endl << std::endl << " Body: [" << l_str << "]" << std::endl;
+					l_sent = sock->getTransmitFileResult(m_transmitOv);
 				}
-				else
+				catch (const SocketException&)
 				{
-					//dcassert(0);
+					endTransmitFile(); // the send has ended with an error
+					throw;
 				}
-			}
-#endif
-			
-			if (bytesRead > 0)
-			{
+				if (l_sent < 0)
+					return;
+				endTransmitFile();
+				m_transmitFile->setPos(m_transmitFile->getPos() + l_sent);
 				dcassert(m_connection);
 				if (m_connection)
 				{
-					m_connection->fireBytesSent(bytesRead, 0);
+					m_connection->fireBytesSent(l_sent, l_sent);
 				}
 			}
-			if (actual == 0)
+			const int64_t l_pos = m_transmitFile->getPos();
+			size_t l_len = size_t(std::min(int64_t(l_quota), m_transmitFile->getSize() - l_pos));
+			if (l_len == 0)
 			{
-				readDone = true;
+				finishSendFile();
+				return;
 			}
-			else
+			if (takeTransmitSlot())
 			{
-				readPos += actual;
+				// The chunk is cut down to the tokens of the speed limiter
+				int l_result;
+				try
+				{
+					l_result = ThrottleManager::getInstance()->transmitFile(sock.get(), m_transmitFile->getHandle(), l_pos, l_len, m_transmitOv);
+				}
+				catch (const SocketException&)
+				{
+					Thread::safeDec(g_transmit_count);
+					throw;
+				}
+				if (l_result != 1)
+				{
+					Thread::safeDec(g_transmit_count);
+				}
+				if (l_result == -1)
+				{
+					// TransmitFile isn't available (LSP), the rest is sent from the mapping
+					m_transmitFile = nullptr;
+					continue;
+				}
+				if (l_result == 0)
+				{
+					m_write_retry_tick = GET_TICK() + THROTTLE_RETRY;
+					return;
+				}
+				m_is_transmit_pending = true;
+				if (!::RegisterWaitForSingleObject(&m_transmitWait, m_transmitOv.hEvent, onTransmitFileDone, m_io_thread, INFINITE, WT_EXECUTEONLYONCE))
+				{
+					m_transmitWait = nullptr; // getWaitFlags falls back to polling
+				}
+				return;
 			}
+			// All the TransmitFile slots are busy with other uploads: this chunk goes from the mapping
 		}
-		if (readDone && readPos == 0)
+		
+		if (m_chunkPos == m_chunkLen && !threadNextFileChunk())
 		{
-			fly_fire(BufferedSocketListener::TransmitDone());
+			finishSendFile();
 			return;
 		}
-		l_readBuf.swap(l_writeBuf);
-		l_readBuf.resize(g_bufSize);
-		l_writeBuf.resize(readPos); // TODO - l_writeBuf      .
-		readPos = 0;
-		
-		size_t writePos = 0, writeSize = 0;
-		int written = 0;
-		
-		while (writePos < l_writeBuf.size())
+		size_t l_size;
+		int l_written;
+		if (m_retrySize)
 		{
-			if (socketIsDisconnecting())
-				return;
-				
-			if (written == -1)
-			{
-				// workaround for OpenSSL (crashes when previous write failed and now retrying with different writeSize)
-				written = sock->write(&l_writeBuf[writePos], writeSize);
-			}
-			else
-			{
-				writeSize = std::min(l_sockSize / 2, l_writeBuf.size() - writePos);
-				written = ThrottleManager::getInstance()->write(sock.get(), &l_writeBuf[writePos], writeSize);
+			// workaround for OpenSSL (crashes when previous write failed and now retrying with different writeSize)
+			l_size = m_retrySize;
+			l_written = sock->write(m_chunk + m_chunkPos, int(l_size));
+		}
+		else
+		{
+			l_size = std::min(l_sockSize / 2, m_chunkLen - m_chunkPos);
+			l_written = ThrottleManager::getInstance()->write(sock.get(), m_chunk + m_chunkPos, l_size);
 #ifdef _DEBUG
-				COMMAND_DEBUG("BufferedSocket: write bytes = " + Util::toString(written), DebugTask::CLIENT_OUT, getRemoteIpPort());
+			COMMAND_DEBUG("BufferedSocket: write bytes = " + Util::toString(l_written), DebugTask::CLIENT_OUT, getRemoteIpPort());
 #endif
-			}
-			
-			if (written > 0)
-			{
-				writePos += written;
-				dcassert(m_connection);
-				if (m_connection)
-				{
-					m_connection->fireBytesSent(0, written);
-				}
-			}
-			else if (written == -1)
+		}
+		if (l_written > 0)
+		{
+			m_retrySize = 0;
+			m_chunkPos += l_written;
+			l_quota -= std::min(l_quota, size_t(l_written));
+			dcassert(m_connection);
+			if (m_connection)
 			{
-				if (!readDone && readPos < l_readBuf.size())
-				{
-					size_t bytesRead = min(l_readBuf.size() - readPos, l_readBuf.size() / 2);
-					size_t actual = p_file->read(&l_readBuf[readPos], bytesRead);
-					if (bytesRead > 0)
-					{
-						dcassert(m_connection);
-						if (m_connection)
-						{
-							m_connection->fireBytesSent(bytesRead, 0);
-						}
-					}
-					if (actual == 0)
-					{
-						readDone = true;
-					}
-					else
-					{
-						readPos += actual;
-					}
-				}
-				else
-				{
-					while (!socketIsDisconnecting())
-					{
-						const int w = sock->wait(POLL_TIMEOUT, Socket::WAIT_WRITE | Socket::WAIT_READ);
-						if (w & Socket::WAIT_READ)
-						{
-							threadRead();
-						}
-						if (w & Socket::WAIT_WRITE)
-						{
-							break;
-						}
-					}
-				}
+				m_connection->fireBytesSent(0, l_written);
 			}
 		}
+		else if (l_written == -1)
+		{
+			// EWOULDBLOCK, the rest goes on WAIT_WRITE
+			m_retrySize = l_size;
+			return;
+		}
+		else
+		{
+			// no tokens of the speed limiter
+			m_write_retry_tick = GET_TICK() + THROTTLE_RETRY;
+			return;
+		}
 	}
 }
 
@@ -1157,89 +1196,101 @@ void BufferedSocket::write(const char* aBuf, size_t aLen)
 	m_writeBuf.insert(m_writeBuf.end(), aBuf, aBuf + aLen); // [1] std::bad_alloc nomem https://www.box.net/shared/nmobw6wofukhcdr7lx4h
 }
 
-void BufferedSocket::threadSendData()
+void BufferedSocket::startSendData()
 {
-	if (m_state != RUNNING)
-		return;
-	ByteVector l_sendBuf;
-	{
-		CFlyFastLock(cs);
-		if (m_writeBuf.empty())
-		{
-			dcassert(!m_writeBuf.empty());
-			return;
-		}
-		m_writeBuf.swap(l_sendBuf);
-	}
-	
-	size_t left = l_sendBuf.size();
-	size_t done = 0;
-	while (left > 0)
+	CFlyFastLock(cs);
+	dcassert(!m_writeBuf.empty());
+	m_writeBuf.swap(m_sendBuf);
+	m_sendPos = 0;
+}
+
+void BufferedSocket::threadSendDataStep()
+{
+	if (ClientManager::isBeforeShutdown())
 	{
-		if (ClientManager::isBeforeShutdown())
-		{
 #ifdef _DEBUG
-			LogManager::message("[ClientManager::isBeforeShutdown()]Skip BufferedSocket::threadSendData Data = " + string((const char*)&l_sendBuf[0], l_sendBuf.size()));
+		LogManager::message("[ClientManager::isBeforeShutdown()]Skip BufferedSocket::threadSendData Data = " + string((const char*)&m_sendBuf[0], m_sendBuf.size()));
 #endif
-		}
-		if (socketIsDisconnecting())
+	}
+	while (m_sendPos < m_sendBuf.size())
+	{
+		// TODO - find ("||")
+		const int n = sock->write(&m_sendBuf[m_sendPos], int(m_sendBuf.size() - m_sendPos)); // adguard - https://www.box.net/shared/9201edaa1fa1b83a8d3c
+		if (n <= 0)
 		{
+			// EWOULDBLOCK, the rest goes on WAIT_WRITE
 			return;
 		}
-		
-		const int w = sock->wait(POLL_TIMEOUT, Socket::WAIT_READ | Socket::WAIT_WRITE);
-		
-		if (w & Socket::WAIT_READ)
-		{
-			threadRead();
-		}
-		
-		if (w & Socket::WAIT_WRITE)
-		{
-			// TODO - find ("||")
-			const int n = sock->write(&l_sendBuf[done], left); // adguard - https://www.box.net/shared/9201edaa1fa1b83a8d3c
-			if (n > 0)
-			{
-				left -= n;
-				done += n;
-			}
-		}
+		m_sendPos += n;
+	}
+	m_sendBuf.clear();
+	m_sendPos = 0;
+}
+
+void BufferedSocket::threadSendStep(bool p_is_writable)
+{
+	if (socketIsDisconnecting())
+	{
+		clearSend();
+	}
+	else if (!m_sendBuf.empty())
+	{
+		threadSendDataStep();
+	}
+	else if (m_sendFile)
+	{
+		threadSendFileStep(p_is_writable);
 	}
 }
 
+void BufferedSocket::clearSend()
+{
+	if (m_is_transmit_pending)
+	{
+		// The kernel writes to m_transmitOv until the cancelled send ends
+		sock->cancelTransmitFile(m_transmitOv);
+		endTransmitFile();
+	}
+	m_sendBuf.clear();
+	m_sendPos = 0;
+	m_sendFile = nullptr;
+	m_transmitFile = nullptr;
+	m_chunk = nullptr;
+	m_chunkLen = 0;
+	m_chunkPos = 0;
+	m_retrySize = 0;
+}
+
 bool BufferedSocket::checkEvents()
 {
-	while (m_state == RUNNING ? m_socket_semaphore.wait(0) : m_socket_semaphore.wait())
+	// A send in progress keeps the following tasks in the queue
+	while (!hasSend())
 	{
 		pair<Tasks, std::unique_ptr<TaskData>> p;
 		{
 			CFlyFastLock(cs);
-			if (!m_tasks.empty())
+			if (m_tasks.empty())
 			{
-				swap(p, m_tasks.front());
-				m_tasks.pop_front();
-			}
-			else
-			{
-				dcassert(!m_tasks.empty());
-				return false;
+				return true;
 			}
+			swap(p, m_tasks.front());
+			m_tasks.pop_front();
 		}
 		if (m_state == RUNNING)
 		{
 			if (p.first == UPDATED)
 			{
 				fly_fire(BufferedSocketListener::Updated());
-				continue;
 			}
 			else if (p.first == SEND_DATA)
 			{
-				threadSendData();
+				startSendData();
+				threadSendStep(false);
 			}
 			else if (p.first == SEND_FILE)
 			{
-				threadSendFile(static_cast<SendFileInfo*>(p.second.get())->m_stream);
-				break;
+				startSendFile(static_cast<SendFileInfo*>(p.second.get())->m_stream);
+				threadSendStep(false);
 			}
 			else if (p.first == DISCONNECT)
 			{
@@ -1256,14 +1307,10 @@ bool BufferedSocket::checkEvents()
 		}
 		else if (m_state == STARTING)
 		{
-			if (p.first == CONNECT)
-			{
-				ConnectInfo* ci = static_cast<ConnectInfo*>(p.second.get());
-				threadConnect(ci->addr, ci->port, ci->localPort, ci->natRole, ci->proxy);
-			}
-			else if (p.first == ACCEPTED)
+			if (p.first == CONNECT || p.first == ACCEPTED)
 			{
-				threadAccept();
+				// [+] The blocking connection setup, the turn runs on a work thread of SocketReactor
+				threadSetup(p);
 			}
 			else if (p.first == SHUTDOWN)
 			{
@@ -1289,49 +1336,158 @@ bool BufferedSocket::checkEvents()
 	return true;
 }
 
-void BufferedSocket::checkSocket()
+void BufferedSocket::threadSetup(const pair<Tasks, std::unique_ptr<TaskData> >& p_task)
 {
-	if (hasSocket())
+	try
 	{
-		int waitFor = sock->wait(POLL_TIMEOUT, Socket::WAIT_READ);
-		if (waitFor & Socket::WAIT_READ)
+		if (p_task.first == CONNECT)
+		{
+			const ConnectInfo* ci = static_cast<ConnectInfo*>(p_task.second.get());
+			threadConnect(ci->addr, ci->port, ci->localPort, ci->natRole, ci->proxy);
+		}
+		else
 		{
-			threadRead();
+			dcassert(p_task.first == ACCEPTED);
+			threadAccept();
 		}
 	}
+	catch (const Exception& e)
+	{
+#ifdef _DEBUG
+		LogManager::message("BufferedSocket::threadSetup(), error = " + e.getError());
+#endif
+		fail(e.getError());
+	}
 }
 
 /**
- * Main task dispatcher for the buffered socket abstraction.
- * @todo Fix the polling...
+ * Called by a work thread of SocketReactor for the turn handed over by the I/O thread.
+ * The listeners may block here (disk, database, hub commands): only this socket waits for them.
  */
-int BufferedSocket::run()
+void BufferedSocket::threadTurn()
 {
-	dcdebug("BufferedSocket::run() start %p\n", (void*)this);
-	while (true)
+	dcassert(m_is_busy);
+	if (!process(m_turn_events))
 	{
-		try
+		m_is_shutdown = true;
+	}
+	// The I/O thread may delete the socket as soon as it gets it back
+	SocketReactor::IOThread* l_io_thread = m_io_thread;
+	m_is_busy = false;
+	l_io_thread->wakeup();
+}
+
+/**
+ * Cheap check of the I/O thread: is there anything for a turn of the socket.
+ */
+bool BufferedSocket::hasWork(int p_events, uint64_t p_tick)
+{
+	if (p_events != Socket::WAIT_NONE)
+	{
+		return true;
+	}
+	if (m_state == RUNNING && hasSocket())
+	{
+		if (socketIsDisconnecting())
+		{
+			if (hasSend())
+				return true;
+		}
+		else if (m_is_transmit_pending)
+		{
+			if (HasOverlappedIoCompleted(&m_transmitOv))
+				return true;
+		}
+		else if (m_read_retry_tick <= p_tick && sock->isReadPending())
+		{
+			return true;
+		}
+	}
+	if (hasSend())
+	{
+		return false; // the tasks wait for the send in progress
+	}
+	CFlyFastLock(cs);
+	return !m_tasks.empty();
+}
+
+int BufferedSocket::getWaitFlags(uint64_t p_tick, uint64_t& p_timeout)
+{
+	if (m_is_busy || m_is_shutdown || m_state != RUNNING || !hasSocket() || sock->m_sock == INVALID_SOCKET)
+	{
+		return Socket::WAIT_NONE;
+	}
+	int l_wait_for = Socket::WAIT_NONE;
+	if (m_read_retry_tick <= p_tick)
+	{
+		l_wait_for |= Socket::WAIT_READ;
+		if (sock->isReadPending())
+		{
+			p_timeout = 0; // SSL has the data already, process() reads it
+		}
+	}
+	else
+	{
+		p_timeout = std::min(p_timeout, m_read_retry_tick - p_tick);
+	}
+	if (m_is_transmit_pending)
+	{
+		// The end of the overlapped TransmitFile isn't seen by WSAPoll, onTransmitFileDone wakes the thread up
+		if (!m_transmitWait)
+		{
+			p_timeout = std::min(p_timeout, TRANSMIT_FILE_CHECK);
+		}
+	}
+	else if (hasSend())
+	{
+		if (m_write_retry_tick <= p_tick)
+		{
+			l_wait_for |= Socket::WAIT_WRITE;
+		}
+		else
+		{
+			p_timeout = std::min(p_timeout, m_write_retry_tick - p_tick);
+		}
+	}
+	return l_wait_for;
+}
+
+/**
+ * One turn of the socket on a work thread: the ready reading and sending, then the new tasks.
+ * @return false - SHUTDOWN, the socket is deleted by the I/O thread.
+ */
+bool BufferedSocket::process(int p_events)
+{
+	try
+	{
+		if (m_state == RUNNING && hasSocket())
 		{
-			if (!checkEvents())
+			if (socketIsDisconnecting())
 			{
-				break;
+				clearSend();
 			}
-			if (m_state == RUNNING)
+			else
 			{
-				checkSocket();
+				if ((p_events & Socket::WAIT_READ) || (m_read_retry_tick <= GET_TICK() && sock->isReadPending()))
+				{
+					threadRead();
+				}
+				if (((p_events & Socket::WAIT_WRITE) && hasSend()) || m_is_transmit_pending)
+				{
+					threadSendStep(true);
+				}
 			}
 		}
-		catch (const Exception& e)
-		{
+		return checkEvents();
+	}
+	catch (const Exception& e)
+	{
 #ifdef _DEBUG
-			LogManager::message("BufferedSocket::run(), error = " + e.getError());
+		LogManager::message("BufferedSocket::process(), error = " + e.getError());
 #endif
-			fail(e.getError());
-		}
+		fail(e.getError());
 	}
-	dcdebug("BufferedSocket::run() end %p\n", (void*)this);
-	delete this;
-	return 0;
+	return true;
 }
 
 void BufferedSocket::fail(const string& aError)
@@ -1340,6 +1496,7 @@ void BufferedSocket::fail(const string& aError)
 	{
 		sock->disconnect();
 	}
+	clearSend();
 	
 	if (m_state == RUNNING)
 	{
@@ -1413,7 +1570,7 @@ void BufferedSocket::addTaskL(Tasks p_task, TaskData* p_data)
 #endif
 	
 	m_tasks.push_back(std::make_pair(p_task, std::unique_ptr<TaskData>(p_data)));
-	m_socket_semaphore.signal();
+	m_io_thread->wakeup();
 }
 
 /**
@@ -24,16 +24,18 @@
 
 #include <boost/atomic.hpp>
 #include <boost/asio/ip/address_v4.hpp>
+#include <boost/utility/string_view.hpp>
 
 #include "BufferedSocketListener.h"
-#include "Semaphore.h"
 #include "Socket.h"
+#include "SocketReactor.h"
 #include "CFlySearchItemTTH.h"
 
 class UnZFilter;
 class InputStream;
+class MappedFileStream;
 class UserConnection;
-class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
+class BufferedSocket : public Speaker<BufferedSocketListener>
 {
 	public:
 		enum Modes
@@ -61,7 +63,7 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 			return l_sock;
 		}
 		
-		static void putBufferedSocket(BufferedSocket*& p_sock, bool p_delete = false);
+		static void putBufferedSocket(BufferedSocket*& p_sock);
 		
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 		static void waitShutdown();
@@ -206,10 +208,15 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 			return getIp() + ':' + Util::toString(getPort());
 		}
 		
-		void all_myinfo_parser(const string::size_type p_pos_next_separator, const string& p_line, StringList& p_all_myInfo, bool p_is_zon);
-		bool all_search_parser(const string::size_type p_pos_next_separator, const string& p_line,
+		void all_myinfo_parser(const boost::string_view& p_line, StringList& p_all_myInfo, bool p_is_zon);
+		bool all_search_parser(const boost::string_view& p_line,
 		                       CFlySearchArrayTTH& p_tth_search,
 		                       CFlySearchArrayFile& p_file_search);
+		/** Passes one command framed by LineFramer to the parsers. */
+		void onLine(const boost::string_view& p_line, bool p_is_zon,
+		            StringList& p_all_myInfo,
+		            CFlySearchArrayTTH& p_tth_search,
+		            CFlySearchArrayFile& p_file_search);
 		char m_separator;
 		unsigned m_count_search_ddos;
 		UserConnection* m_connection;
@@ -260,7 +267,6 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 		
 		FastCriticalSection cs; // [!] IRainman opt: use spinlock here!
 		
-		Semaphore m_socket_semaphore;
 		deque<pair<Tasks, std::unique_ptr<TaskData> > > m_tasks;
 		ByteVector m_inbuf;
 		size_t m_myInfoCount; //  MyInfo
@@ -280,20 +286,62 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 		
 		volatile bool m_is_disconnecting; // [!] IRainman fix: this variable is volatile.
 		
-		int run();
+		// [+] SocketReactor: the socket is served by an I/O thread of the pool instead of its own thread
+		friend class SocketReactor;
+		SocketReactor::IOThread* m_io_thread;
+		volatile bool m_is_busy; // a work thread runs the turn of the socket, the I/O thread leaves it alone
+		volatile bool m_is_shutdown; // the last turn has ended with SHUTDOWN, the I/O thread deletes the socket
+		int m_turn_events;
+		uint64_t m_read_retry_tick; // the speed limit is reached, the socket isn't polled until this tick
+		uint64_t m_write_retry_tick;
+		
+		// The send in progress, it is continued on WAIT_WRITE
+		ByteVector m_sendBuf;
+		size_t m_sendPos;
+		InputStream* m_sendFile;
+		ByteVector m_fileBuf;
+		const uint8_t* m_chunk; // the part of m_sendFile being sent: m_fileBuf or the file mapping
+		size_t m_chunkLen;
+		size_t m_chunkPos;
+		size_t m_retrySize; // OpenSSL wants the failed write repeated with the same size
+		bool m_is_mapped_send;
+		MappedFileStream* m_transmitFile;
+		OVERLAPPED m_transmitOv; // the event is created with the first TransmitFile of the socket
+		HANDLE m_transmitWait; // wait of the thread pool for m_transmitOv.hEvent, it wakes up m_io_thread
+		bool m_is_transmit_pending;
+		void endTransmitFile();
+		
+		bool hasSend() const
+		{
+			return !m_sendBuf.empty() || m_sendFile != nullptr;
+		}
+		socket_t getPollSocket() const
+		{
+			return sock->m_sock;
+		}
+		int getWaitFlags(uint64_t p_tick, uint64_t& p_timeout);
+		bool hasWork(int p_events, uint64_t p_tick);
+		bool process(int p_events);
+		void threadTurn();
+		void threadSetup(const pair<Tasks, std::unique_ptr<TaskData> >& p_task);
 		
 		void threadConnect(const string& aAddr, uint16_t aPort, uint16_t localPort, NatRoles natRole, bool proxy);
 		void threadAccept();
 		void threadRead();
-		void threadSendFile(InputStream* is);
-		void threadSendData();
+		void startSendFile(InputStream* p_file);
+		void finishSendFile();
+		bool threadNextFileChunk();
+		void threadSendFileStep(bool p_is_writable);
+		void startSendData();
+		void threadSendDataStep();
+		void threadSendStep(bool p_is_writable);
+		void clearSend();
 		
 		void fail(const string& aError);
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 		static boost::atomic<long> g_sockets;
 #endif
 		bool checkEvents();
-		void checkSocket();
 		
 		void setSocket(std::unique_ptr<Socket> && s);
 		void setOptions()
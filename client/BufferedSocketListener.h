@@ -26,6 +26,10 @@
 #include "typedefs.h"
 #include "CFlySearchItemTTH.h"
 
+/**
+ * The events of a running socket come from its SocketReactor I/O thread, which serves many other sockets:
+ * the handlers must not block.
+ */
 class BufferedSocketListener
 {
 	public:
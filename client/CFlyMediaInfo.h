@@ -28,7 +28,6 @@ struct CFlyServerCache
 };
 #endif
 
-#ifdef _DEBUG
 class CFlyMediainfoRAW
 {
 	public:
@@ -59,8 +58,6 @@ struct CFlyMediainfoRAWHasher
 	}
 };
 
-#endif
-
 class CFlyMediaInfo
 #ifdef _DEBUG
 //: public boost::noncopyable
@@ -188,9 +185,7 @@ class CFlyMediaInfo
 		}
 };
 
-#ifdef _DEBUG
 typedef std::unordered_map<CFlyMediainfoRAW, std::shared_ptr<CFlyMediaInfo>, CFlyMediainfoRAWHasher> CFlyCacheMediaInfo;
-#endif
 
 struct CFlyHashCacheItem
 {
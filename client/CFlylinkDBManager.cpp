@@ -892,6 +892,7 @@ CFlylinkDBManager::CFlylinkDBManager()
 		}
 		*/
 		load_all_hub_into_cacheL();
+		load_ip_location_indexL(e_IPIndexAll);
 		//safeAlter("ALTER TABLE fly_last_ip_nick_hub add column message_count integer");
 		
 		/*      {
@@ -904,6 +905,7 @@ CFlylinkDBManager::CFlylinkDBManager()
 	{
 		errorDB("SQLite - CFlylinkDBManager: " + e.getError());
 	}
+	m_deferred_writer.start_writer(this);
 }
 //========================================================================================================
 void CFlylinkDBManager::load_all_hub_into_cacheL()
@@ -1262,24 +1264,26 @@ void CFlylinkDBManager::push_event_statistic(const std::string& p_event_type, co
                                              const string& p_tth
                                             )
 {
-	CFlyLock(m_cs);
-	try
+	m_deferred_writer.push([=]()
 	{
-		m_insert_event_stat.init(m_flySQLiteDB,
-		                         "insert into stat_db.fly_event(type,event_key,event_value,ip,port,hub,tth,event_time) values(?,?,?,?,?,?,?,strftime('%d.%m.%Y %H:%M:%S','now','localtime'))");
-		m_insert_event_stat->bind(1, p_event_type, SQLITE_STATIC);
-		m_insert_event_stat->bind(2, p_event_key, SQLITE_STATIC);
-		m_insert_event_stat->bind(3, p_event_value, SQLITE_STATIC);
-		m_insert_event_stat->bind(4, p_ip, SQLITE_STATIC);
-		m_insert_event_stat->bind(5, p_port, SQLITE_STATIC);
-		m_insert_event_stat->bind(6, p_hub, SQLITE_STATIC);
-		m_insert_event_stat->bind(7, p_tth, SQLITE_STATIC);
-		m_insert_event_stat->executenonquery();
-	}
-	catch (const database_error& e)
-	{
-		errorDB("SQLite - push_event_statistic: " + e.getError());
-	}
+		try
+		{
+			m_insert_event_stat.init(m_flySQLiteDB,
+			                         "insert into stat_db.fly_event(type,event_key,event_value,ip,port,hub,tth,event_time) values(?,?,?,?,?,?,?,strftime('%d.%m.%Y %H:%M:%S','now','localtime'))");
+			m_insert_event_stat->bind(1, p_event_type, SQLITE_STATIC);
+			m_insert_event_stat->bind(2, p_event_key, SQLITE_STATIC);
+			m_insert_event_stat->bind(3, p_event_value, SQLITE_STATIC);
+			m_insert_event_stat->bind(4, p_ip, SQLITE_STATIC);
+			m_insert_event_stat->bind(5, p_port, SQLITE_STATIC);
+			m_insert_event_stat->bind(6, p_hub, SQLITE_STATIC);
+			m_insert_event_stat->bind(7, p_tth, SQLITE_STATIC);
+			m_insert_event_stat->executenonquery();
+		}
+		catch (const database_error& e)
+		{
+			errorDB("SQLite - push_event_statistic: " + e.getError());
+		}
+	});
 }
 
 
@@ -1289,35 +1293,37 @@ void CFlylinkDBManager::push_dc_command_statistic(const std::string& p_hub, cons
 	dcassert(!p_hub.empty() && !p_command.empty());
 	if (!p_hub.empty() && !p_command.empty())
 	{
-		CFlyLock(m_cs);
-		try
+		m_deferred_writer.push([=]()
 		{
-			__int64 l_counter = 0;
+			try
 			{
-				m_select_statistic_dc_command.init(m_flySQLiteDB,
-				                                   "select counter from stat_db.fly_dc_command_log where hub = ? and command = ?");
-				m_select_statistic_dc_command->bind(1, p_hub, SQLITE_STATIC);
-				m_select_statistic_dc_command->bind(2, p_command, SQLITE_STATIC);
-				sqlite3_reader l_q = m_select_statistic_dc_command.get()->executereader();
-				while (l_q.read())
+				__int64 l_counter = 0;
 				{
-					l_counter = l_q.getint64(0);
+					m_select_statistic_dc_command.init(m_flySQLiteDB,
+					                                   "select counter from stat_db.fly_dc_command_log where hub = ? and command = ?");
+					m_select_statistic_dc_command->bind(1, p_hub, SQLITE_STATIC);
+					m_select_statistic_dc_command->bind(2, p_command, SQLITE_STATIC);
+					sqlite3_reader l_q = m_select_statistic_dc_command.get()->executereader();
+					while (l_q.read())
+					{
+						l_counter = l_q.getint64(0);
+					}
 				}
+				m_insert_statistic_dc_command.init(m_flySQLiteDB,
+				                                   "insert or replace into stat_db.fly_dc_command_log(hub, command, server, port, sender_nick, counter, last_time) values(?,?,?,?,?,?,strftime('%d.%m.%Y %H:%M:%S','now','localtime'))");
+				m_insert_statistic_dc_command->bind(1, p_hub, SQLITE_STATIC);
+				m_insert_statistic_dc_command->bind(2, p_command, SQLITE_STATIC);
+				m_insert_statistic_dc_command->bind(3, p_server, SQLITE_STATIC);
+				m_insert_statistic_dc_command->bind(4, p_port, SQLITE_STATIC);
+				m_insert_statistic_dc_command->bind(5, p_sender_nick, SQLITE_STATIC);
+				m_insert_statistic_dc_command->bind(6, l_counter + 1);
+				m_insert_statistic_dc_command->executenonquery();
 			}
-			m_insert_statistic_dc_command.init(m_flySQLiteDB,
-			                                   "insert or replace into stat_db.fly_dc_command_log(hub, command, server, port, sender_nick, counter, last_time) values(?,?,?,?,?,?,strftime('%d.%m.%Y %H:%M:%S','now','localtime'))");
-			m_insert_statistic_dc_command->bind(1, p_hub, SQLITE_STATIC);
-			m_insert_statistic_dc_command->bind(2, p_command, SQLITE_STATIC);
-			m_insert_statistic_dc_command->bind(3, p_server, SQLITE_STATIC);
-			m_insert_statistic_dc_command->bind(4, p_port, SQLITE_STATIC);
-			m_insert_statistic_dc_command->bind(5, p_sender_nick, SQLITE_STATIC);
-			m_insert_statistic_dc_command->bind(6, l_counter + 1);
-			m_insert_statistic_dc_command->executenonquery();
-		}
-		catch (const database_error& e)
-		{
-			errorDB("SQLite - push_dc_command_statistic: " + e.getError());
-		}
+			catch (const database_error& e)
+			{
+				errorDB("SQLite - push_dc_command_statistic: " + e.getError());
+			}
+		});
 	}
 	else
 	{
@@ -1502,188 +1508,141 @@ void CFlylinkDBManager::save_location(const CFlyLocationIPArray& p_geo_ip)
 			++m_count_fly_location_ip_record;
 		}
 		l_trans.commit();
-		{
-			CFlyFastLock(m_cache_location_cs);
-			m_location_cache_array.clear();
-			m_ip_info_cache.clear();
-		}
+		load_ip_location_indexL(e_IPIndexLocation);
 	}
 	catch (const database_error& e)
 	{
 		errorDB("SQLite - save_location: " + e.getError());
 	}
 }
-#ifdef FLYLINKDC_USE_GEO_IP
-//========================================================================================================
-__int64 CFlylinkDBManager::get_dic_country_id(const string& p_country)
-{
-	CFlyLock(m_cs);
-	return get_dic_idL(p_country, e_DIC_COUNTRY, true);
-}
 //========================================================================================================
-bool CFlylinkDBManager::find_cache_country(uint32_t p_ip, uint16_t& p_index)
+void CFlyIPRangeIndex::build(vector<Range>& p_ranges)
 {
-	CFlyFastLock(m_cache_location_cs);
-	dcassert(p_ip);
-	p_index = 0;
-	const auto l_result = m_ip_info_cache.find(p_ip);
-	if (m_ip_info_cache.find(p_ip) != m_ip_info_cache.end())
+	std::sort(p_ranges.begin(), p_ranges.end(), [](const Range & a, const Range & b)
 	{
-		const auto& l_record = l_result->second;
-		p_index = l_record.m_country_cache_index;
-		return true;
+		return a.m_start_ip < b.m_start_ip;
+	});
+	m_start_ip.resize(p_ranges.size());
+	m_stop_ip.resize(p_ranges.size());
+	m_value.resize(p_ranges.size());
+	for (size_t i = 0; i < p_ranges.size(); ++i)
+	{
+		m_start_ip[i] = p_ranges[i].m_start_ip;
+		m_stop_ip[i] = p_ranges[i].m_stop_ip;
+		m_value[i] = p_ranges[i].m_value;
 	}
-	dcassert(m_country_cache.size() <= 0xFFFF);
-	for (auto i =  m_country_cache.begin(); i !=  m_country_cache.end(); ++i)
+	m_prefix.resize(0x10000 + 1);
+	size_t l_pos = 0;
+	for (size_t i = 0; i <= 0x10000; ++i)
 	{
-		++p_index;
-		if (p_ip >= i->m_start_ip && p_ip < i->m_stop_ip)
+		const uint64_t l_prefix_start = uint64_t(i) << 16;
+		while (l_pos < m_start_ip.size() && m_start_ip[l_pos] < l_prefix_start)
 		{
-			return true;
+			++l_pos;
 		}
+		m_prefix[i] = uint32_t(l_pos);
 	}
-	p_index = 0;
-	return false;
 }
 //========================================================================================================
-bool CFlylinkDBManager::find_cache_location(uint32_t p_ip, uint32_t& p_location_index, uint16_t& p_flag_location_index)
+void CFlylinkDBManager::load_ip_rangesL(const char* p_sql, vector<CFlyLocationDesc>& p_cache, CFlyLocationDescIndex& p_cache_index, CFlyIPRangeIndex& p_index)
 {
-	CFlyFastLock(m_cache_location_cs);
-	p_location_index = 0;
-	p_flag_location_index = 0;
-	const auto l_result = m_ip_info_cache.find(p_ip);
-	if (m_ip_info_cache.find(p_ip) != m_ip_info_cache.end())
+	vector<CFlyIPRangeIndex::Range> l_ranges;
+	std::unique_ptr<sqlite3_command> l_sql(new sqlite3_command(m_flySQLiteDB, p_sql));
+	sqlite3_reader l_q = l_sql->executereader();
+	while (l_q.read())
 	{
-		const auto& l_record = l_result->second;
-		p_location_index = l_record.m_location_cache_index;
-		p_flag_location_index = l_record.m_flag_location_index;
-		return true;
+		const uint32_t l_start_ip = l_q.getint(0);
+		const uint32_t l_stop_ip = l_q.getint(1);
+		auto l_key = std::make_pair(l_q.getstring(2), uint16_t(l_q.getint(3)));
+		// The same description gets the same index, the old indexes stay valid after a reload
+		auto l_desc = p_cache_index.find(l_key);
+		if (l_desc == p_cache_index.end())
+		{
+			CFlyLocationDesc l_location;
+			l_location.m_start_ip = l_start_ip;
+			l_location.m_stop_ip = l_stop_ip;
+			l_location.m_location = l_key.first;
+			l_location.m_description = Text::toT(l_key.first);
+			l_location.m_flag_index = l_key.second;
+			{
+				CFlyFastLock(m_cache_location_cs);
+				p_cache.push_back(l_location);
+			}
+			l_desc = p_cache_index.insert(std::make_pair(std::move(l_key), uint32_t(p_cache.size()))).first;
+		}
+		l_ranges.push_back(CFlyIPRangeIndex::Range(l_start_ip, l_stop_ip, l_desc->second));
 	}
-	for (auto i = m_location_cache_array.cbegin(); i != m_location_cache_array.cend(); ++i, ++p_location_index)
+	p_index.build(l_ranges);
+}
+//========================================================================================================
+void CFlylinkDBManager::load_ip_location_indexL(int p_tables)
+{
+	try
 	{
-		if (p_ip >= i->m_start_ip && p_ip < i->m_stop_ip)
+		const auto l_old_index = get_ip_location_index();
+		auto l_index = l_old_index ? std::make_shared<CFlyIPLocationIndex>(*l_old_index) : std::make_shared<CFlyIPLocationIndex>();
+		if (p_tables & e_IPIndexCountry)
 		{
-			++p_location_index;
-			p_flag_location_index = i->m_flag_index;
-			return true;
+			load_ip_rangesL("select start_ip,stop_ip,country,flag_index from location_db.fly_country_ip",
+			                m_country_cache, m_country_cache_index, l_index->m_country);
+			dcassert(m_country_cache.size() <= 0x7FFF);
+		}
+		if (p_tables & e_IPIndexLocation)
+		{
+			load_ip_rangesL("select start_ip,stop_ip,location,flag_index from location_db.fly_location_ip",
+			                m_location_cache_array, m_location_cache_index, l_index->m_location);
 		}
+		if (p_tables & e_IPIndexP2PGuard)
+		{
+			load_ip_rangesL("select start_ip,stop_ip,note,0 from location_db.fly_p2pguard_ip",
+			                m_p2p_guard_cache, m_p2p_guard_cache_index, l_index->m_p2p_guard);
+		}
+		std::atomic_store(&m_ip_location_index, std::shared_ptr<const CFlyIPLocationIndex>(l_index));
+	}
+	catch (const database_error& e)
+	{
+		errorDB("SQLite - load_ip_location_indexL: " + e.getError());
 	}
-	return false;
+}
+#ifdef FLYLINKDC_USE_GEO_IP
+//========================================================================================================
+__int64 CFlylinkDBManager::get_dic_country_id(const string& p_country)
+{
+	CFlyLock(m_cs);
+	return get_dic_idL(p_country, e_DIC_COUNTRY, true);
 }
 //========================================================================================================
 void CFlylinkDBManager::get_country_and_location(uint32_t p_ip, uint16_t& p_country_index, uint32_t& p_location_index, bool p_is_use_only_cache)
 {
 	dcassert(p_ip);
-	uint16_t l_flag_location_index = 0; // TODO ?
-	const bool l_is_find_country   = Util::isPrivateIp(p_ip) || find_cache_country(p_ip, p_country_index);
-	const bool l_is_find_location = find_cache_location(p_ip, p_location_index, l_flag_location_index);
-	if (p_is_use_only_cache == false)
+	// [!] The tables are in memory, p_is_use_only_cache doesn't matter any more
+	const auto l_index = get_ip_location_index();
+	if (!Util::isPrivateIp(p_ip))
 	{
-		if (l_is_find_country == false || l_is_find_location == false)
-		{
-			load_country_locations_p2p_guard_from_db(p_ip, p_location_index, p_country_index);
-		}
+		p_country_index = l_index ? uint16_t(l_index->m_country.find(p_ip)) : 0;
 	}
+	p_location_index = l_index ? l_index->m_location.find(p_ip) : 0;
 }
 //========================================================================================================
-string CFlylinkDBManager::load_country_locations_p2p_guard_from_db(uint32_t p_ip, uint32_t& p_location_cache_index, uint16_t& p_country_cache_index)
+void CFlylinkDBManager::get_country_and_location(const vector<uint32_t>& p_ips, vector<std::pair<uint16_t, uint32_t> >& p_indexes)
 {
-	dcassert(p_ip);
-	CFlyLock(m_cs); //    -
-	string l_p2p_guard_text;
-	try
+	const auto l_index = get_ip_location_index();
+	p_indexes.resize(p_ips.size());
+	for (size_t i = 0; i < p_ips.size(); ++i)
 	{
-		// http://www.sql.ru/forum/783621/faq-nahozhdenie-zapisey-gde-zadannoe-znachenie-nahoditsya-mezhdu-znacheniyami-poley
-		// http://habrahabr.ru/post/138067/
-		
-		// TODO - optimisation if(!Util::isPrivateIp(p_ip))
-		// TODO -     
-		//    p2p    
-		m_select_country_and_location.init(m_flySQLiteDB,
-		                                   "select country,flag_index,start_ip,stop_ip,0 from "
-		                                   "(select country,flag_index,start_ip,stop_ip from location_db.fly_country_ip where start_ip <=? order by start_ip desc limit 1) "
-		                                   "where stop_ip >=?"
-		                                   "\nunion all\n"
-		                                   "select location,flag_index,start_ip,stop_ip,1 from "
-		                                   "(select location,flag_index,start_ip,stop_ip from location_db.fly_location_ip where start_ip <=? order by start_ip desc limit 1) "
-		                                   "where stop_ip >=?"
-		                                   "\nunion all\n"
-		                                   "select note,0,start_ip,stop_ip,2 from "
-		                                   "(select note,start_ip,stop_ip from location_db.fly_p2pguard_ip where start_ip <=? order by start_ip desc limit 1) "
-		                                   "where stop_ip >=?");
-		m_select_country_and_location->bind(1, p_ip);
-		m_select_country_and_location->bind(2, p_ip);
-		m_select_country_and_location->bind(3, p_ip);
-		m_select_country_and_location->bind(4, p_ip);
-		m_select_country_and_location->bind(5, p_ip);
-		m_select_country_and_location->bind(6, p_ip);
-		sqlite3_reader l_q = m_select_country_and_location->executereader();
-		CFlyLocationDesc l_location;
-		p_location_cache_index = 0;
-		p_country_cache_index = 0;
-		l_location.m_flag_index = 0;
-		unsigned l_count_country = 0;
-		CFlyCacheIPInfo* l_ip_cahe_item = nullptr;
+		const uint32_t l_ip = p_ips[i];
+		auto& l_result = p_indexes[i];
+		l_result.first = 0;
+		l_result.second = 0;
+		if (l_index && l_ip && l_ip != INADDR_NONE)
 		{
-			CFlyFastLock(m_cache_location_cs);
-			l_ip_cahe_item = &m_ip_info_cache[p_ip];
-		}
-		while (l_q.read())
-		{
-			const unsigned l_id = l_q.getint(4);
-			dcassert(l_id < 3)
-			const string l_description = l_q.getstring(0);
-			l_location.m_description = Text::toT(l_description);
-			l_location.m_flag_index = l_q.getint(1);
-			l_location.m_start_ip = l_q.getint(2);
-			l_location.m_stop_ip = l_q.getint(3);
-			switch (l_q.getint(4))
+			if (!Util::isPrivateIp(l_ip))
 			{
-				case 0:
-				{
-					l_count_country++;
-					{
-						CFlyFastLock(m_cache_location_cs);
-						m_country_cache.push_back(l_location);
-						p_country_cache_index = uint16_t(m_country_cache.size());
-						l_ip_cahe_item->m_country_cache_index = p_country_cache_index;
-						l_ip_cahe_item->m_flag_location_index = l_location.m_flag_index;
-					}
-					break;
-				}
-				case 1:
-				{
-					CFlyFastLock(m_cache_location_cs);
-					m_location_cache_array.push_back(l_location);
-					p_location_cache_index = m_location_cache_array.size();
-					l_ip_cahe_item->m_location_cache_index = p_location_cache_index;
-					l_ip_cahe_item->m_flag_location_index = l_location.m_flag_index;
-					break;
-				}
-				case 2:
-				{
-					{
-						CFlyFastLock(m_cache_location_cs);
-						l_ip_cahe_item->m_description_p2p_guard = l_description;
-					}
-					if (!l_p2p_guard_text.empty())
-					{
-						l_p2p_guard_text += " + ";
-					}
-					l_p2p_guard_text += l_description;
-					continue;
-				}
-				default:
-					dcassert(0);
+				l_result.first = uint16_t(l_index->m_country.find(l_ip));
 			}
+			l_result.second = l_index->m_location.find(l_ip);
 		}
-		dcassert(l_count_country <= 1); //    GeoIPCountryWhois.csv   !
-	}
-	catch (const database_error& e)
-	{
-		errorDB("SQLite - load_country_locations_p2p_guard_from_db: " + e.getError());
 	}
-	return l_p2p_guard_text;
 }
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 //========================================================================================================
@@ -1710,21 +1669,20 @@ string CFlylinkDBManager::is_p2p_guard(const uint32_t& p_ip)
 	string l_p2p_guard_text;
 	if (p_ip && p_ip != INADDR_NONE)
 	{
+		const auto l_index = get_ip_location_index();
+		const uint32_t l_p2p_guard_index = l_index ? l_index->m_p2p_guard.find(p_ip) : 0;
+		if (l_p2p_guard_index)
 		{
 			CFlyFastLock(m_cache_location_cs);
-			const auto l_p2p = m_ip_info_cache.find(p_ip);
-			if (l_p2p != m_ip_info_cache.end())
-				return l_p2p->second.m_description_p2p_guard;
+			l_p2p_guard_text = m_p2p_guard_cache[l_p2p_guard_index - 1].m_location;
 		}
-		uint16_t l_country_index;
-		uint32_t l_location_index;
-		l_p2p_guard_text = load_country_locations_p2p_guard_from_db(p_ip, l_location_index, l_country_index);
 	}
 	return l_p2p_guard_text;
 }
 //========================================================================================================
 void CFlylinkDBManager::remove_manual_p2p_guard(const string& p_ip)
 {
+	CFlyLock(m_cs);
 	try
 	{
 		m_delete_manual_p2p_guard.init(m_flySQLiteDB,
@@ -1736,6 +1694,7 @@ void CFlylinkDBManager::remove_manual_p2p_guard(const string& p_ip)
 		
 			m_delete_manual_p2p_guard->bind(1, l_ip_boost.to_ulong());
 			m_delete_manual_p2p_guard->executenonquery();
+			load_ip_location_indexL(e_IPIndexP2PGuard);
 		}
 	}
 	catch (const database_error& e)
@@ -1769,10 +1728,6 @@ void CFlylinkDBManager::save_p2p_guard(const CFlyP2PGuardArray& p_p2p_guard_ip,
 	CFlyLock(m_cs);
 	try
 	{
-		{
-			CFlyFastLock(m_cache_location_cs);
-			m_ip_info_cache.clear();
-		}
 		CFlyBusy l_disable_log(g_DisableSQLtrace);
 		sqlite3_transaction l_trans(m_flySQLiteDB);
 		if (p_manual_marker.empty())
@@ -1792,6 +1747,7 @@ void CFlylinkDBManager::save_p2p_guard(const CFlyP2PGuardArray& p_p2p_guard_ip,
 			m_insert_p2p_guard->executenonquery();
 		}
 		l_trans.commit();
+		load_ip_location_indexL(e_IPIndexP2PGuard);
 	}
 	catch (const database_error& e)
 	{
@@ -1819,6 +1775,7 @@ void CFlylinkDBManager::save_geoip(const CFlyLocationIPArray& p_geo_ip)
 			m_insert_geoip->executenonquery();
 		}
 		l_trans.commit();
+		load_ip_location_indexL(e_IPIndexCountry);
 	}
 	catch (const database_error& e)
 	{
@@ -2500,13 +2457,19 @@ void CFlylinkDBManager::save_transfer_history(bool p_is_torrent, eTypeTransfer p
 			g_tiger_tree_cache.erase(p_item->getTTH());
 		}
 	}
-	CFlyLock(m_cs);
+	m_deferred_writer.push([this, p_is_torrent, p_type, p_item, l_name, l_path]()
+	{
+		save_transfer_historyL(p_is_torrent, p_type, p_item, l_name, l_path);
+	});
+}
+//========================================================================================================
+void CFlylinkDBManager::save_transfer_historyL(bool p_is_torrent, eTypeTransfer p_type, const FinishedItemPtr& p_item, const string& p_name, const string& p_path)
+{
 	try
 	{
 		if (!p_is_torrent)
 		{
-			sqlite3_transaction l_trans(m_flySQLiteDB);
-			inc_hitL(l_path, l_name);
+			inc_hitL(p_path, p_name);
 			m_insert_transfer.init(m_flySQLiteDB,
 			                       "insert into transfer_db.fly_transfer_file (type,day,stamp,path,nick,hub,size,speed,ip,tth,actual) "
 			                       "values(?,strftime('%s','now','localtime')/60/60/24,strftime('%s','now','localtime'),?,?,?,?,?,?,?,?)");
@@ -2523,7 +2486,6 @@ void CFlylinkDBManager::save_transfer_history(bool p_is_torrent, eTypeTransfer p
 				m_insert_transfer->bind(8);
 			m_insert_transfer->bind(9, p_item->getActual());
 			m_insert_transfer->executenonquery();
-			l_trans.commit();
 		}
 		else
 		{
@@ -2547,7 +2509,7 @@ void CFlylinkDBManager::save_transfer_history(bool p_is_torrent, eTypeTransfer p
 	}
 	catch (const database_error& e)
 	{
-		errorDB("SQLite - save_transfer_history: " + e.getError());
+		errorDB("SQLite - save_transfer_historyL: " + e.getError());
 	}
 }
 //========================================================================================================
@@ -3589,9 +3551,7 @@ void CFlylinkDBManager::update_last_ip_and_message_count(uint32_t p_hub_id, cons
                                                          const bool p_is_message_count_dirty
                                                         )
 {
-#ifndef FLYLINKDC_USE_LASTIP_CACHE
-	CFlyLock(m_cs);
-#endif
+#ifdef FLYLINKDC_USE_LASTIP_CACHE
 	try
 	{
 		update_last_ip_deferredL(p_hub_id, p_nick, p_message_count, p_last_ip, p_is_sql_not_found,
@@ -3602,13 +3562,166 @@ void CFlylinkDBManager::update_last_ip_and_message_count(uint32_t p_hub_id, cons
 	{
 		errorDB("SQLite - update_last_ip_and_message_count: " + e.getError());
 	}
+#else
+	// Called from the hub threads: the row is written by the deferred writer.
+	const bool l_is_sql_not_found = p_is_sql_not_found;
+	m_deferred_writer.push([=]()
+	{
+		try
+		{
+			bool l_is_not_found = l_is_sql_not_found;
+			update_last_ip_deferredL(p_hub_id, p_nick, p_message_count, p_last_ip, l_is_not_found,
+			                         p_is_last_ip_dirty,
+			                         p_is_message_count_dirty);
+		}
+		catch (const database_error& e)
+		{
+			errorDB("SQLite - update_last_ip_and_message_count: " + e.getError());
+		}
+	});
+	p_is_sql_not_found = false;
+#endif
 }
 //========================================================================================================
 void CFlylinkDBManager::flush()
 {
+	while (m_deferred_writer.write_batch())
+	{
+	}
 	flush_all_last_ip_and_message_count();
 }
 //========================================================================================================
+void CFlylinkDBManager::CFlyDeferredWriter::start_writer(CFlylinkDBManager* p_db)
+{
+	m_db = p_db;
+	m_is_stop = false;
+	start(64, "CFlyDeferredWriter");
+}
+//========================================================================================================
+void CFlylinkDBManager::CFlyDeferredWriter::shutdown()
+{
+	if (!m_is_stop)
+	{
+		m_is_stop = true;
+		m_semaphore.signal();
+		join();
+	}
+}
+//========================================================================================================
+void CFlylinkDBManager::CFlyDeferredWriter::push(CFlyDeferredWrite&& p_write)
+{
+	size_t l_size;
+	{
+		CFlyFastLock(m_cs);
+		m_queue.push_back(std::move(p_write));
+		l_size = m_queue.size();
+		if (l_size > m_stat.m_max_queue_size)
+		{
+			m_stat.m_max_queue_size = l_size;
+		}
+	}
+	if (m_is_stop) // Not started yet or already stopped - write it now.
+	{
+		write_batch();
+	}
+	else if (l_size == 1 || l_size == BATCH_SIZE)
+	{
+		m_semaphore.signal();
+	}
+	else if (l_size >= MAX_QUEUE_SIZE) // The thread is behind (the base is locked by a long operation) - help it.
+	{
+		{
+			CFlyFastLock(m_cs);
+			++m_stat.m_caller_batches;
+		}
+		write_batch();
+	}
+}
+//========================================================================================================
+size_t CFlylinkDBManager::CFlyDeferredWriter::write_batch()
+{
+	dcassert(m_db);
+	// The base is locked before the queue: batches written by the thread and by flush() keep their order.
+	CFlyLock(m_db->m_cs);
+	std::vector<CFlyDeferredWrite> l_batch;
+	{
+		CFlyFastLock(m_cs);
+		const size_t l_count = std::min<size_t>(m_queue.size(), BATCH_SIZE);
+		l_batch.reserve(l_count);
+		for (size_t i = 0; i < l_count; ++i)
+		{
+			l_batch.push_back(std::move(m_queue.front()));
+			m_queue.pop_front();
+		}
+	}
+	if (l_batch.empty())
+	{
+		return 0;
+	}
+	const uint64_t l_tick = GET_TICK();
+	try
+	{
+		sqlite3_transaction l_trans(m_db->m_flySQLiteDB, l_batch.size() > 1);
+		for (auto i = l_batch.cbegin(); i != l_batch.cend(); ++i)
+		{
+			(*i)();
+		}
+		l_trans.commit();
+	}
+	catch (const database_error& e)
+	{
+		errorDB("SQLite - CFlyDeferredWriter::write_batch: " + e.getError());
+	}
+	const uint64_t l_time = GET_TICK() - l_tick;
+	CFlyFastLock(m_cs);
+	m_stat.m_writes += l_batch.size();
+	++m_stat.m_transactions;
+	m_stat.m_last_transaction_ms = l_time;
+	m_stat.m_total_transaction_ms += l_time;
+	if (l_time > m_stat.m_max_transaction_ms)
+	{
+		m_stat.m_max_transaction_ms = l_time;
+	}
+	return l_batch.size();
+}
+//========================================================================================================
+int CFlylinkDBManager::CFlyDeferredWriter::run()
+{
+	bool l_is_wait = true;
+	while (true)
+	{
+		if (l_is_wait)
+		{
+			m_semaphore.wait();
+		}
+		if (m_is_stop)
+			break;
+		// Let the batch grow until it is full or the first write waited long enough.
+		const uint64_t l_start = GET_TICK();
+		while (!m_is_stop && get_queue_size() < BATCH_SIZE)
+		{
+			const uint64_t l_elapsed = GET_TICK() - l_start;
+			if (l_elapsed >= BATCH_TIME_MS)
+				break;
+			m_semaphore.wait(uint32_t(BATCH_TIME_MS - l_elapsed));
+		}
+		write_batch();
+		// push() signals only on an empty queue, the rest is picked up without waiting
+		l_is_wait = get_queue_size() == 0;
+	}
+	while (write_batch())
+	{
+	}
+	return 0;
+}
+//========================================================================================================
+void CFlylinkDBManager::CFlyDeferredWriter::get_stat(CFlyDBWriterStat& p_stat) const
+{
+	CFlyFastLock(m_cs);
+	p_stat = m_stat;
+	p_stat.m_queue_size = m_queue.size();
+}
+//========================================================================================================
 void CFlylinkDBManager::flush_all_last_ip_and_message_count()
 {
 #ifdef FLYLINKDC_USE_LASTIP_CACHE
@@ -4510,6 +4623,12 @@ bool CFlylinkDBManager::get_tree(const TTHValue& p_root, TigerTree& p_tt, __int6
 				p_tt = l_cache_tt->second;
 				return true;
 			}
+			const auto l_pending_tt = m_pending_trees.find(p_root);
+			if (l_pending_tt != m_pending_trees.end())
+			{
+				p_tt = l_pending_tt->second;
+				return true;
+			}
 		}
 		CFlyLock(m_cs); // TODO -     -    
 		m_get_tree.init(m_flySQLiteDB, "select tiger_tree,file_size,block_size from fly_hash_block where tth=?");
@@ -4781,8 +4900,29 @@ __int64 CFlylinkDBManager::merge_fileL(const string& p_Path, const string& p_fil
 //========================================================================================================
 void CFlylinkDBManager::add_tree(const TigerTree& p_tt)
 {
-	CFlyLock(m_cs);
-	add_treeL(p_tt);
+	const TTHValue l_root = p_tt.getRoot();
+	{
+		// get_tree() finds the tree here until the writer stores it
+		CFlyFastLock(g_tth_cache_cs);
+		if (!m_pending_trees.insert(std::make_pair(l_root, p_tt)).second)
+			return; // already queued
+	}
+	// The entry is not changed until this write erases it, so the closure keeps only the root
+	m_deferred_writer.push([this, l_root]()
+	{
+		const TigerTree* l_tt;
+		{
+			CFlyFastLock(g_tth_cache_cs);
+			const auto l_pending_tt = m_pending_trees.find(l_root);
+			dcassert(l_pending_tt != m_pending_trees.end());
+			if (l_pending_tt == m_pending_trees.end())
+				return;
+			l_tt = &l_pending_tt->second;
+		}
+		add_treeL(*l_tt);
+		CFlyFastLock(g_tth_cache_cs);
+		m_pending_trees.erase(l_root); // under m_cs: a reader that missed it waits for the commit
+	});
 }
 //========================================================================================================
 void CFlylinkDBManager::add_tree_internal_bind_and_executeL(sqlite3_command* p_sql, const TigerTree& p_tt)
@@ -4923,6 +5063,7 @@ CFlylinkDBManager::~CFlylinkDBManager()
 		dcassert(g_tiger_tree_cache.empty());
 	}
 	dcassert(m_cache_hash_files.empty());
+	m_deferred_writer.shutdown();
 	flush();
 #ifdef _DEBUG
 	{
@@ -4937,13 +5078,10 @@ CFlylinkDBManager::~CFlylinkDBManager()
 		}
 #endif //FLYLINKDC_USE_LASTIP_CACHE
 	}
-#ifdef FLYLINKDC_USE_GEO_IP
 	{
 		dcdebug("CFlylinkDBManager::m_country_cache size = %d\n", m_country_cache.size());
-	}
-#endif
-	{
 		dcdebug("CFlylinkDBManager::m_location_cache_array size = %d\n", m_location_cache_array.size());
+		dcdebug("CFlylinkDBManager::m_p2p_guard_cache size = %d\n", m_p2p_guard_cache.size());
 	}
 #endif // _DEBUG
 }
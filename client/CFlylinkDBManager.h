@@ -12,6 +12,7 @@
 #include "QueueItem.h"
 #include "Singleton.h"
 #include "CFlyThread.h"
+#include "Semaphore.h"
 #include "sqlite/sqlite3x.hpp"
 #include "CFlyMediaInfo.h"
 #include "LogManager.h"
@@ -182,6 +183,52 @@ struct CFlyLocationDesc : public CFlyLocationIP
 typedef std::vector<CFlyLocationIP> CFlyLocationIPArray;
 typedef std::vector<CFlyP2PGuardIP> CFlyP2PGuardArray;
 
+// [+] Immutable index of the ranges of one location_db table.
+// find() returns the value of the last range that starts not after the address if the address is inside it
+// (the same as "where start_ip <=? order by start_ip desc limit 1" + "where stop_ip >=?").
+// m_prefix[i] - the first range with start_ip >= (i << 16), so the binary search runs inside one /16.
+class CFlyIPRangeIndex
+{
+	public:
+		struct Range : public CFlyIPRange
+		{
+			uint32_t m_value;
+			Range(uint32_t p_start_ip, uint32_t p_stop_ip, uint32_t p_value) : CFlyIPRange(p_start_ip, p_stop_ip), m_value(p_value)
+			{
+			}
+		};
+		void build(vector<Range>& p_ranges);
+		uint32_t find(uint32_t p_ip) const
+		{
+			if (m_start_ip.empty())
+				return 0;
+			const auto l_begin = m_start_ip.cbegin() + m_prefix[p_ip >> 16];
+			const auto l_end = m_start_ip.cbegin() + m_prefix[(p_ip >> 16) + 1];
+			const size_t l_pos = std::upper_bound(l_begin, l_end, p_ip) - m_start_ip.cbegin();
+			if (l_pos == 0 || m_stop_ip[l_pos - 1] < p_ip)
+				return 0;
+			return m_value[l_pos - 1];
+		}
+		size_t size() const
+		{
+			return m_start_ip.size();
+		}
+	private:
+		vector<uint32_t> m_start_ip;
+		vector<uint32_t> m_stop_ip;
+		vector<uint32_t> m_value;
+		vector<uint32_t> m_prefix;
+};
+
+// [+] fly_country_ip, fly_location_ip and fly_p2pguard_ip in memory.
+// The values are 1-based indexes in CFlylinkDBManager::m_country_cache, m_location_cache_array and m_p2p_guard_cache.
+struct CFlyIPLocationIndex
+{
+	CFlyIPRangeIndex m_country;
+	CFlyIPRangeIndex m_location;
+	CFlyIPRangeIndex m_p2p_guard;
+};
+
 struct CFlyTransferHistogram
 {
 	std::string m_date;
@@ -308,6 +355,21 @@ struct CFlyDirItem : public CFlyBaseDirItem
 	}
 };
 typedef std::vector<CFlyDirItem> CFlyDirItemArray;
+struct CFlyDBWriterStat
+{
+	size_t m_queue_size;
+	size_t m_max_queue_size;
+	uint64_t m_writes;
+	uint64_t m_transactions;
+	uint64_t m_caller_batches; // the queue was full and the caller wrote a batch itself
+	uint64_t m_last_transaction_ms;
+	uint64_t m_max_transaction_ms;
+	uint64_t m_total_transaction_ms;
+	CFlyDBWriterStat() : m_queue_size(0), m_max_queue_size(0), m_writes(0), m_transactions(0), m_caller_batches(0),
+		m_last_transaction_ms(0), m_max_transaction_ms(0), m_total_transaction_ms(0)
+	{
+	}
+};
 typedef std::unordered_map<string, CFlyRegistryValue> CFlyRegistryMap;
 typedef boost::unordered_map<string, CFlyPathItem> CFlyPathCache;
 class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
@@ -400,6 +462,9 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		void load_transfer_historgam(bool p_is_torrent, eTypeTransfer p_type, CFlyTransferHistogramArray& p_array);
 		bool is_download_tth(const TTHValue& p_tth);
 		void save_transfer_history(bool p_is_torrent, eTypeTransfer p_type, const FinishedItemPtr& p_item);
+	private:
+		void save_transfer_historyL(bool p_is_torrent, eTypeTransfer p_type, const FinishedItemPtr& p_item, const string& p_name, const string& p_path);
+	public:
 		void delete_transfer_history(const vector<__int64>& p_id_array);
 		void delete_transfer_history_torrent(const vector<__int64>& p_id_array);
 		
@@ -494,6 +559,8 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 #endif
 #ifdef FLYLINKDC_USE_GEO_IP
 		void get_country_and_location(uint32_t p_ip, uint16_t& p_country_index, uint32_t& p_location_index, bool p_is_use_only_cache);
+		/// The country and location indexes of all the addresses at once (a user list of a hub)
+		void get_country_and_location(const vector<uint32_t>& p_ips, vector<std::pair<uint16_t, uint32_t> >& p_indexes);
 		uint16_t get_country_index_from_cache(int16_t p_index)
 		{
 			dcassert(p_index > 0);
@@ -520,10 +587,21 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 			return m_location_cache_array[p_index - 1];
 		}
 	private:
+		enum
+		{
+			e_IPIndexCountry = 1,
+			e_IPIndexLocation = 2,
+			e_IPIndexP2PGuard = 4,
+			e_IPIndexAll = e_IPIndexCountry | e_IPIndexLocation | e_IPIndexP2PGuard
+		};
+		typedef boost::unordered_map<std::pair<string, uint16_t>, uint32_t> CFlyLocationDescIndex;
+		void load_ip_location_indexL(int p_tables);
+		void load_ip_rangesL(const char* p_sql, vector<CFlyLocationDesc>& p_cache, CFlyLocationDescIndex& p_cache_index, CFlyIPRangeIndex& p_index);
+		std::shared_ptr<const CFlyIPLocationIndex> get_ip_location_index() const
+		{
+			return std::atomic_load(&m_ip_location_index);
+		}
 #ifdef FLYLINKDC_USE_GEO_IP
-		string load_country_locations_p2p_guard_from_db(uint32_t p_ip, uint32_t& p_location_cache_index, uint16_t& p_country_cache_index);
-		bool find_cache_country(uint32_t p_ip, uint16_t& p_index);
-		bool find_cache_location(uint32_t p_ip, uint32_t& p_location_index, uint16_t& p_flag_index);
 		__int64 get_dic_country_id(const string& p_country);
 		void clear_dic_cache_country();
 #endif
@@ -574,6 +652,41 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		void clean_fly_hash_blockL();
 		
 		mutable CriticalSection m_cs;
+		
+		// Writes nobody waits for (downloaded trees, transfer history, last ip, statistics) are queued
+		// and written by one thread, many of them in one transaction. A full queue is written by the caller.
+		typedef std::function<void()> CFlyDeferredWrite;
+		class CFlyDeferredWriter : public Thread
+		{
+			public:
+				enum
+				{
+					BATCH_SIZE = 512,    // writes per transaction
+					BATCH_TIME_MS = 250, // how long the first queued write may wait for the others
+					MAX_QUEUE_SIZE = 8192
+				};
+				CFlyDeferredWriter() : m_db(nullptr), m_is_stop(true)
+				{
+				}
+				void start_writer(CFlylinkDBManager* p_db);
+				void shutdown();
+				void push(CFlyDeferredWrite&& p_write);
+				size_t write_batch();
+				void get_stat(CFlyDBWriterStat& p_stat) const;
+			private:
+				int run() override;
+				size_t get_queue_size() const
+				{
+					CFlyFastLock(m_cs);
+					return m_queue.size();
+				}
+				CFlylinkDBManager* m_db;
+				mutable FastCriticalSection m_cs;
+				Semaphore m_semaphore;
+				std::deque<CFlyDeferredWrite> m_queue;
+				CFlyDBWriterStat m_stat;
+				volatile bool m_is_stop;
+		} m_deferred_writer;
 		// http://leveldb.googlecode.com/svn/trunk/doc/index.html Concurrency
 		//  A database may only be opened by one process at a time. The leveldb implementation acquires
 		// a lock from the operating system to prevent misuse. Within a single process, the same leveldb::DB
@@ -712,19 +825,14 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		CFlySQLCommand m_update_registry;
 		CFlySQLCommand m_delete_registry;
 		
+		// [!] The descriptions are only appended (the indexes are kept by the users), m_cache_location_cs guards the appending.
+		// The ranges are looked up in m_ip_location_index without any lock, it is replaced as a whole after the tables change.
 		FastCriticalSection m_cache_location_cs;
 		vector<CFlyLocationDesc> m_location_cache_array;
-		struct CFlyCacheIPInfo
-		{
-			string m_description_p2p_guard;
-			uint32_t m_location_cache_index;
-			uint16_t m_country_cache_index;
-			uint16_t m_flag_location_index;
-			CFlyCacheIPInfo() : m_location_cache_index(0), m_country_cache_index(0), m_flag_location_index(0)
-			{
-			}
-		};
-		boost::unordered_map<uint32_t, CFlyCacheIPInfo> m_ip_info_cache;
+		CFlyLocationDescIndex m_location_cache_index;
+		vector<CFlyLocationDesc> m_p2p_guard_cache;
+		CFlyLocationDescIndex m_p2p_guard_cache_index;
+		std::shared_ptr<const CFlyIPLocationIndex> m_ip_location_index;
 		
 		int m_count_fly_location_ip_record;
 		bool is_fly_location_ip_valid() const
@@ -742,12 +850,11 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		boost::unordered_set<string> m_lost_location_cache;
 #endif
 #ifdef FLYLINKDC_USE_GEO_IP
-		CFlySQLCommand m_select_country_and_location;
-		// TODO CFlySQLCommand m_select_only_location;
 		CFlySQLCommand m_insert_geoip;
 		CFlySQLCommand m_delete_geoip;
-		vector<CFlyLocationDesc> m_country_cache;
 #endif
+		vector<CFlyLocationDesc> m_country_cache;
+		CFlyLocationDescIndex m_country_cache_index;
 #ifdef _DEBUG
 		boost::unordered_map<uint32_t, unsigned> m_count_ip_sql_query_guard;
 #endif
@@ -831,6 +938,7 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		static int32_t g_count_queue_files;
 		
 		static boost::unordered_map<TTHValue, TigerTree> g_tiger_tree_cache;
+		boost::unordered_map<TTHValue, TigerTree> m_pending_trees; // queued for add_treeL, under g_tth_cache_cs; an entry stays unchanged until its write erases it
 		static FastCriticalSection g_tth_cache_cs;
 		static void clearTTHCache();
 		static unsigned g_tth_cache_limit;
@@ -839,6 +947,10 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		static bool is_delete_torrent(const libtorrent::sha1_hash& p_sha1);
 		
 		static void tryFixBadAlloc();
+		void get_writer_stat(CFlyDBWriterStat& p_stat) const
+		{
+			m_deferred_writer.get_stat(p_stat);
+		}
 		static unsigned get_tth_cache_size()
 		{
 			//CFlyFastLock(g_tth_cache_cs);
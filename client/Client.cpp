@@ -642,6 +642,14 @@ void Client::updatedMyINFO(const OnlineUserPtr& aUser)
 	}
 }
 
+void Client::updatedMyINFO(const OnlineUserList& p_list)
+{
+	if (!p_list.empty() && !ClientManager::isBeforeShutdown())
+	{
+		fly_fire2(ClientListener::UsersUpdatedMyINFO(), this, p_list);
+	}
+}
+
 string Client::getLocalIp() const
 {
 	// [!] IRainman fix:
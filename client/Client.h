@@ -91,7 +91,7 @@ class ClientBase
 };
 
 /** Yes, this should probably be called a Hub */
-class Client : public ClientBase, public Speaker<ClientListener>, public BufferedSocketListener, protected TimerManagerListener
+class Client : public ClientBase, public SnapshotSpeaker<ClientListener>, public BufferedSocketListener, protected TimerManagerListener
 {
 	protected:
 		std::unique_ptr<webrtc::RWLockWrapper> m_cs;
@@ -244,6 +244,7 @@ class Client : public ClientBase, public Speaker<ClientListener>, public Buffere
 		string getLocalIp() const;
 		
 		void updatedMyINFO(const OnlineUserPtr& aUser);
+		void updatedMyINFO(const OnlineUserList& p_list);
 		
 		/*
 		std::deque<OnlineUserPtr> m_update_online_user_deque;
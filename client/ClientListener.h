@@ -46,6 +46,7 @@ class ClientListener
 #ifdef FLYLINKDC_USE_CHECK_CHANGE_MYINFO
 		typedef X<25> UserShareUpdated;
 #endif
+		typedef X<26> UsersUpdatedMyINFO; // [+] UserUpdatedMyINFO for a batch of $MyINFO at once
 		
 		enum StatusFlags
 		{
@@ -61,6 +62,7 @@ class ClientListener
 		virtual void on(UserShareUpdated, const OnlineUserPtr&) noexcept {}
 #endif
 		virtual void on(UsersUpdated, const Client*, const OnlineUserList&) noexcept { }
+		virtual void on(UsersUpdatedMyINFO, const Client*, const OnlineUserList&) noexcept { }
 		virtual void on(UserRemoved, const Client*, const OnlineUserPtr&) noexcept { }
 		virtual void on(Redirect, const Client*, const string&) noexcept { }
 		virtual void on(ClientFailed, const Client*, const string&) noexcept { }
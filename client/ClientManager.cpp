@@ -623,6 +623,41 @@ UserPtr ClientManager::getUser(const string& p_Nick, const string& p_HubURL, uin
 	return l_result_insert.first->second;
 }
 
+void ClientManager::getUsers(const StringList& p_nicks, const vector<CID>& p_cids
+#ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
+                             , uint32_t p_HubID
+#endif
+                             , vector<UserPtr>& p_users)
+{
+	dcassert(p_nicks.size() == p_cids.size());
+	p_users.clear();
+	p_users.reserve(p_nicks.size());
+	CFlyWriteLock(*g_csUsers);
+	for (size_t i = 0; i < p_nicks.size(); ++i)
+	{
+		const string& l_nick = p_nicks[i];
+		dcassert(!l_nick.empty());
+		auto l_result_insert = g_users.insert(make_pair(p_cids[i], UserPtr()));
+		if (l_result_insert.second)
+		{
+			l_result_insert.first->second = std::make_shared<User>(p_cids[i], l_nick, p_HubID);
+		}
+		else
+		{
+			const auto &l_user = l_result_insert.first->second;
+			l_user->setLastNick(l_nick);
+#ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
+			if (!l_user->getHubID())
+			{
+				l_user->setHubID(p_HubID);
+			}
+#endif
+		}
+		l_result_insert.first->second->setFlag(User::NMDC);
+		p_users.push_back(l_result_insert.first->second);
+	}
+}
+
 UserPtr ClientManager::createUser(const CID& p_cid, const string& p_nick, uint32_t p_hub_id)
 {
 	dcassert(!ClientManager::isBeforeShutdown());
@@ -698,6 +733,34 @@ void ClientManager::putOnline(const OnlineUserPtr& ou, bool p_is_fire_online) no
 	}
 }
 
+void ClientManager::putOnline(const OnlineUserList& p_list, bool p_is_fire_online) noexcept
+{
+	if (!isBeforeShutdown())
+	{
+		{
+			CFlyWriteLock(*g_csOnlineUsers);
+			for (auto i = p_list.cbegin(); i != p_list.cend(); ++i)
+			{
+				dcassert((*i)->getIdentity().getSID() != AdcCommand::HUB_SID);
+				dcassert(!(*i)->getUser()->getCID().isZero());
+				g_onlineUsers.insert(make_pair((*i)->getUser()->getCID(), *i));
+			}
+		}
+		for (auto i = p_list.cbegin(); i != p_list.cend() && !ClientManager::isBeforeShutdown(); ++i)
+		{
+			const auto& user = (*i)->getUser();
+			if (!user->isOnline())
+			{
+				user->setFlag(User::ONLINE);
+				if (p_is_fire_online)
+				{
+					fly_fire1(ClientManagerListener::UserConnected(), user);
+				}
+			}
+		}
+	}
+}
+
 void ClientManager::putOffline(const OnlineUserPtr& ou, bool p_is_disconnect) noexcept
 {
 	if (!isBeforeShutdown())
@@ -1335,6 +1398,14 @@ void ClientManager::on(UserUpdatedMyINFO, const OnlineUserPtr& p_ou) noexcept
 	addAsyncOnlineUserUpdated(p_ou);
 }
 
+void ClientManager::on(UsersUpdatedMyINFO, const Client*, const OnlineUserList& p_list) noexcept
+{
+	for (auto i = p_list.cbegin(); i != p_list.cend(); ++i)
+	{
+		addAsyncOnlineUserUpdated(*i);
+	}
+}
+
 void ClientManager::on(UsersUpdated, const Client* client, const OnlineUserList& l) noexcept
 {
 	dcassert(!isBeforeShutdown());
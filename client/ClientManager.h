@@ -82,6 +82,12 @@ class ClientManager : public Speaker<ClientManagerListener>,
 #endif
 		                      );
 		static UserPtr createUser(const CID& cid, const string& p_nick, uint32_t p_hub_id);
+		/** [+] getUser for a batch of nicks of one hub: p_cids (makeCid) are computed by the caller without the lock, g_users is locked once */
+		static void getUsers(const StringList& p_nicks, const vector<CID>& p_cids
+#ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
+		                     , uint32_t p_HubID
+#endif
+		                     , vector<UserPtr>& p_users);
 		
 		static string findHub(const string& ipPort);
 		static string findHubEncoding(const string& aUrl);
@@ -171,6 +177,7 @@ class ClientManager : public Speaker<ClientManagerListener>,
 		static CID makeCid(const string& nick, const string& hubUrl);
 		
 		void putOnline(const OnlineUserPtr& ou, bool p_is_fire_online) noexcept; // [!] IRainman fix.
+		void putOnline(const OnlineUserList& p_list, bool p_is_fire_online) noexcept;
 		void putOffline(const OnlineUserPtr& ou, bool p_is_disconnect = false) noexcept; // [!] IRainman fix.
 		
 		static bool isMe(const CID& p_cid)
@@ -321,6 +328,7 @@ class ClientManager : public Speaker<ClientManagerListener>,
 		void on(Connected, const Client* c) noexcept override;
 		void on(UserUpdatedMyINFO, const OnlineUserPtr& user) noexcept override;
 		void on(UsersUpdated, const Client* c, const OnlineUserList&) noexcept override;
+		void on(UsersUpdatedMyINFO, const Client* c, const OnlineUserList&) noexcept override;
 		void on(ClientFailed, const Client*, const string&) noexcept override;
 		void on(HubUpdated, const Client* c) noexcept override;
 		void on(HubUserCommand, const Client*, int, int, const string&, const string&) noexcept override;
@@ -1228,12 +1228,13 @@ void ConnectionManager::on(AdcCommand::SUP, UserConnection* aSource, const AdcCo
 	
 	bool baseOk = false;
 	
-	for (auto i = cmd.getParameters().cbegin(); i != cmd.getParameters().cend(); ++i)
+	for (size_t i = 0; i < cmd.getParamCount(); ++i)
 	{
-		if (i->compare(0, 2, "AD", 2) == 0)
+		const string l_param = cmd.getParam(i);
+		if (l_param.compare(0, 2, "AD", 2) == 0)
 		{
 			bool tigrOk = false;
-			string feat = i->substr(2);
+			string feat = l_param.substr(2);
 			if (feat == UserConnection::FEATURE_ADC_BASE || feat == UserConnection::FEATURE_ADC_BAS0)
 			{
 				baseOk = true;
@@ -31,6 +31,9 @@
 #include "UserManager.h"
 #include "WebServerManager.h"
 #include "ThrottleManager.h"
+#include "SocketReactor.h"
+#include "WorkerPool.h"
+#include "StringPool.h"
 #include "GPGPUManager.h"
 
 #include "CFlylinkDBManager.h"
@@ -80,6 +83,8 @@ void startup(PROGRESSCALLBACKPROC pProgressCallbackProc, void* pProgressParam, G
 			break;
 	}
 	while (i < 6);
+	SocketReactor::newInstance(); // [+] I/O threads of all BufferedSocket
+	WorkerPool::newInstance(); // [+] Threads of the parallel CPU work
 #ifdef FLYLINKDC_USE_SYSLOG
 	syslog_loghost("syslog.fly-server.ru");
 	openlog("flylinkdc", 0, LOG_USER | LOG_INFO);
@@ -128,9 +133,7 @@ void startup(PROGRESSCALLBACKPROC pProgressCallbackProc, void* pProgressParam, G
 	
 	LOAD_STEP("Custom Locations", Util::loadCustomlocations());
 	
-#ifdef FLYLINKDC_USE_GPU_TTH
-	LOAD_STEP("TTH on GPU", GPGPUTTHManager::newInstance());
-#endif
+	LOAD_STEP("TTH on GPU", GPGPUTTHManager::newInstance()); // [!] The CPU backend too, needs WorkerPool
 	HashManager::newInstance();
 #ifdef FLYLINKDC_USE_VLD
 	VLDDisable(); // TODO VLD    -      OpenSSL
@@ -178,9 +181,7 @@ void startup(PROGRESSCALLBACKPROC pProgressCallbackProc, void* pProgressParam, G
 	
 	LOAD_STEP_L(SHARED_FILES, ShareManager::getInstance()->refresh_share(true, false));
 	
-#ifdef IRAINMAN_USE_STRING_POOL
 	StringPool::newInstance(); // [+] IRainman opt.
-#endif
 	
 #undef LOAD_STEP
 #undef LOAD_STEP_L
@@ -290,10 +291,9 @@ void shutdown(GUIINITPROC pGuiInitProc, void *pGuiParam)
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 		BufferedSocket::waitShutdown();
 #endif
+		SocketReactor::deleteInstance();
 		
-#ifdef IRAINMAN_USE_STRING_POOL
 		StringPool::deleteInstance(); // [+] IRainman opt.
-#endif
 		ConnectivityManager::deleteInstance();
 		WebServerManager::deleteInstance();
 		if (pGuiInitProc)
@@ -321,12 +321,11 @@ void shutdown(GUIINITPROC pGuiInitProc, void *pGuiParam)
 		FavoriteManager::deleteInstance();
 		ClientManager::deleteInstance();
 		HashManager::deleteInstance();
-#ifdef FLYLINKDC_USE_GPU_TTH
 		GPGPUTTHManager::deleteInstance();
-#endif // FLYLINKDC_USE_GPU_TTH
 		
 		CFlylinkDBManager::deleteInstance();
 		CFlylinkDBManager::shutdown_engine();
+		WorkerPool::deleteInstance();
 		TimerManager::deleteInstance();
 		SettingsManager::deleteInstance();
 		ToolbarManager::shutdown();
@@ -24,6 +24,7 @@
 #include "SimpleXML.h"
 #include "FilteredFile.h"
 #include "BZUtils.h"
+#include "ParallelBZipStream.h"
 #include "CryptoManager.h"
 #include "SimpleXMLReader.h"
 #include "User.h"
@@ -44,6 +45,36 @@ DirectoryListing::~DirectoryListing()
 	delete root;
 }
 
+DirectoryListing::File* DirectoryListing::createFile(Directory* p_dir, const string& p_name, int64_t p_size, const TTHValue& p_tth, uint32_t p_hit, uint32_t p_ts, const CFlyMediaInfo* p_media)
+{
+	return m_arena.create<File>(p_dir, internName(p_name), p_size, p_tth, p_hit, p_ts, p_media);
+}
+
+DirectoryListing::File* DirectoryListing::copyFile(const File& p_file, bool p_adls)
+{
+	return m_arena.create<File>(p_file, p_adls);
+}
+
+const string* DirectoryListing::internName(const string& p_name)
+{
+	return &*m_names.insert(p_name).first;
+}
+
+const CFlyMediaInfo* DirectoryListing::internMedia(const string& p_WH, const string& p_br, const string& p_audio, const string& p_video)
+{
+	CFlyMediainfoRAW l_key;
+	l_key.m_WH = p_WH;
+	l_key.m_br = p_br;
+	l_key.m_audio = p_audio;
+	l_key.m_video = p_video;
+	auto& l_media = m_media_cache[l_key];
+	if (!l_media)
+	{
+		l_media = std::make_shared<CFlyMediaInfo>(p_WH, atoi(p_br.c_str()), p_audio, p_video);
+	}
+	return l_media.get();
+}
+
 UserPtr DirectoryListing::getUserFromFilename(const string& fileName)
 {
 	// General file list name format: [username].[CID].[xml|xml.bz2]
@@ -108,7 +139,8 @@ void DirectoryListing::loadFile(const string& p_file, bool p_own_list)
 		        || stricmp(ext, ".dclst") == 0 // [+] SSA dclst support
 		   )
 		{
-			FilteredInputStream<UnBZFilter, false> f(&ff);
+			// [!] Unpacked on other threads while the XML is parsed here
+			ParallelBZipInputStream f(&ff);
 			loadXML(f, false, p_own_list);
 		}
 		else if (stricmp(ext, ".xml") == 0)
@@ -134,6 +166,7 @@ class ListLoader : public SimpleXMLReader::CallBack
 		
 		void startTag(const string& name, StringPairList& attribs, bool simple);
 		void endTag(const string& name, const string& data);
+		bool startTagRef(const SimpleXMLReader::StringRef& name, const SimpleXMLReader::StringRefPairList& attribs, bool simple) override;
 		
 		const string& getBase() const
 		{
@@ -147,6 +180,9 @@ class ListLoader : public SimpleXMLReader::CallBack
 #ifdef _DEBUG
 		static CFlyCacheMediaInfo g_cache_mediainfo;
 #endif
+		void checkAbort() const;
+		bool updateFile(const string& p_name, int64_t p_size, const TTHValue& p_tth);
+		void addFile(const string& p_name, int64_t p_size, const TTHValue& p_tth, int p_hit, uint32_t p_ts, const CFlyMediaInfo* p_media);
 		DirectoryListing* m_list;
 		DirectoryListing::Directory* m_cur;
 		UserPtr m_user;
@@ -238,6 +274,133 @@ const string g_SMAudio = "MA";
 
 const string g_SShared = "Shared";
 
+void ListLoader::checkAbort() const
+{
+	if (ClientManager::isBeforeShutdown())
+	{
+		throw AbortException("ListLoader::startTag - ClientManager::isBeforeShutdown()");
+	}
+	if (m_list->getAbort())
+	{
+		throw AbortException("ListLoader::startTag - " + STRING(ABORT_EM));
+	}
+}
+
+bool ListLoader::updateFile(const string& p_name, int64_t p_size, const TTHValue& p_tth)
+{
+	// just update the current file if it is already there.
+	for (auto i = m_cur->m_files.cbegin(); i != m_cur->m_files.cend(); ++i)
+	{
+		auto& file = **i;
+		/// @todo comparisons should be case-insensitive but it takes too long - add a cache
+		if (file.getName() == p_name || file.getTTH() == p_tth)
+		{
+			file.setName(m_list->internName(p_name));
+			file.setSize(p_size);
+			file.setTTH(p_tth);
+			return true;
+		}
+	}
+	return false;
+}
+
+static int64_t toInt64(const SimpleXMLReader::StringRef& p_value)
+{
+	auto i = p_value.cbegin();
+	const bool l_negative = i != p_value.cend() && *i == '-';
+	if (l_negative)
+		++i;
+	int64_t l_result = 0;
+	for (; i != p_value.cend() && *i >= '0' && *i <= '9'; ++i)
+	{
+		l_result = l_result * 10 + (*i - '0');
+	}
+	return l_negative ? -l_result : l_result;
+}
+
+void ListLoader::addFile(const string& p_name, int64_t p_size, const TTHValue& p_tth, int p_hit, uint32_t p_ts, const CFlyMediaInfo* p_media)
+{
+#ifdef FLYLINKDC_USE_DIRLIST_FILE_EXT_STAT
+	auto& l_item = DirectoryListing::g_ext_stat[Util::getFileExtWithoutDot(Text::toLower(p_name))];
+	l_item.m_count++;
+	if (p_size > l_item.m_max_size)
+		l_item.m_max_size = p_size;
+	if (p_size < l_item.m_min_size)
+		l_item.m_min_size = p_size;
+		
+#endif
+	auto f = m_list->createFile(m_cur, p_name, p_size, p_tth, p_hit, p_ts, p_media);
+	m_cur->m_virus_detect.add(p_name, p_size);
+	m_cur->m_files.push_back(f);
+	if (p_size)
+	{
+		if (m_is_own_list)//[+] FlylinkDC++
+		{
+			f->setFlag(DirectoryListing::FLAG_SHARED_OWN);  // TODO -  FLAG_SHARED_OWN
+		}
+		else
+		{
+			if (ShareManager::isTTHShared(f->getTTH()))
+			{
+				f->setFlag(DirectoryListing::FLAG_SHARED);
+			}
+			else
+			{
+				if (QueueManager::is_queue_tth(f->getTTH()))
+				{
+					f->setFlag(DirectoryListing::FLAG_QUEUE);
+				}
+				// TODO if(l_size >= 100 * 1024 *1024)
+				{
+					if (!CFlyServerConfig::isParasitFile(f->getName())) // TODO -   
+					{
+						f->setFlag(DirectoryListing::FLAG_NOT_SHARED);
+						const auto l_status_file = CFlylinkDBManager::getInstance()->get_status_file(f->getTTH()); // TODO -    ?
+						if (l_status_file & CFlylinkDBManager::PREVIOUSLY_DOWNLOADED)
+							f->setFlag(DirectoryListing::FLAG_DOWNLOAD);
+						if (l_status_file & CFlylinkDBManager::VIRUS_FILE_KNOWN)
+							f->setFlag(DirectoryListing::FLAG_VIRUS_FILE);
+						if (l_status_file & CFlylinkDBManager::PREVIOUSLY_BEEN_IN_SHARE)
+							f->setFlag(DirectoryListing::FLAG_OLD_TTH);
+					}
+				}
+			}
+		}//[+] FlylinkDC++
+	}
+}
+
+bool ListLoader::startTagRef(const SimpleXMLReader::StringRef& name, const SimpleXMLReader::StringRefPairList& attribs, bool simple)
+{
+	// Only the standard DC++ <File Name Size TTH/>, the extended tags go through startTag
+	if (!m_is_in_listing || attribs.size() != 3 || name != g_SFile)
+	{
+		return false;
+	}
+	checkAbort();
+	
+	const SimpleXMLReader::StringRef l_name = getAttribRef(attribs, g_SName, 0);
+	const SimpleXMLReader::StringRef l_s = getAttribRef(attribs, g_SSize, 1);
+	if (l_name.empty() || l_s.empty())
+	{
+		dcassert(0);
+		return true;
+	}
+	const SimpleXMLReader::StringRef l_h = getAttribRef(attribs, g_STTH, 2);
+	if (l_h.empty() || (m_is_own_list == false && l_h.starts_with("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA")))
+	{
+		return true;
+	}
+	const TTHValue l_tth = l_h.size() == 39 ? TTHValue(l_h.data(), 39) : TTHValue(l_h.to_string());
+	const int64_t l_size = toInt64(l_s);
+	const string l_file_name(l_name.data(), l_name.size());
+	if (m_is_updating && updateFile(l_file_name, l_size, l_tth))
+	{
+		return true;
+	}
+	addFile(l_file_name, l_size, l_tth, 0, 0, nullptr);
+	return true;
+}
+
 void ListLoader::startTag(const string& name, StringPairList& attribs, bool simple)
 {
 #ifdef _DEBUG
@@ -248,14 +411,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 		// dcdebug("ListLoader::startTag g_max_attribs_size = %d , attribs.capacity() = %d\n", g_max_attribs_size, attribs.capacity());
 	}
 #endif
-	if (ClientManager::isBeforeShutdown())
-	{
-		throw AbortException("ListLoader::startTag - ClientManager::isBeforeShutdown()");
-	}
-	if (m_list->getAbort())
-	{
-		throw AbortException("ListLoader::startTag - " + STRING(ABORT_EM));
-	}
+	checkAbort();
 	
 	if (m_is_in_listing)
 	{
@@ -288,36 +444,15 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 			const TTHValue l_tth(l_h); /// @todo verify validity?
 			dcassert(l_tth != TTHValue());
 			
-			if (m_is_updating)
+			if (m_is_updating && updateFile(l_name, l_size, l_tth))
 			{
-				// just update the current file if it is already there.
-				for (auto i = m_cur->m_files.cbegin(); i != m_cur->m_files.cend(); ++i)
-				{
-					auto& file = **i;
-					/// @todo comparisons should be case-insensitive but it takes too long - add a cache
-					if (file.getName() == l_name || file.getTTH() == l_tth)
-					{
-						file.setName(l_name);
-						file.setSize(l_size);
-						file.setTTH(l_tth);
-						return;
-					}
-				}
+				return;
 			}
 			// [+] FlylinkDC
-			std::shared_ptr<CFlyMediaInfo> l_mediaXY;
+			const CFlyMediaInfo* l_mediaXY = nullptr;
 			uint32_t l_i_ts = 0;
 			int l_i_hit     = 0;
 			string l_hit;
-#ifdef FLYLINKDC_USE_DIRLIST_FILE_EXT_STAT
-			auto& l_item = DirectoryListing::g_ext_stat[Util::getFileExtWithoutDot(Text::toLower(l_name))];
-			l_item.m_count++;
-			if (l_size > l_item.m_max_size)
-				l_item.m_max_size = l_size;
-			if (l_size < l_item.m_min_size)
-				l_item.m_min_size = l_size;
-				
-#endif
 			if (attribs.size() >= 4) // 3 -  DC++, 4 - GreyLinkDC++
 			{
 				if (attribs.size() == 4 ||
@@ -360,11 +495,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 						if (!l_audio.empty() || !l_video.empty())
 						{
 							const string& l_br = getAttrib(attribs, g_SBR, 4);
-							l_mediaXY = std::make_shared<CFlyMediaInfo>(getAttrib(attribs, g_SWH, 3),
-							                                            atoi(l_br.c_str()),
-							                                            l_audio,
-							                                            l_video
-							                                           );
+							l_mediaXY = m_list->internMedia(getAttrib(attribs, g_SWH, 3), l_br, l_audio, l_video);
 						}
 					}
 					
@@ -407,44 +538,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				}
 				l_i_hit = l_hit.empty() ? 0 : atoi(l_hit.c_str());
 			}
-			auto f = new DirectoryListing::File(m_cur, l_name, l_size, l_tth, l_i_hit, l_i_ts, l_mediaXY);
-			m_cur->m_virus_detect.add(l_name, l_size);
-			m_cur->m_files.push_back(f);
-			if (l_size)
-			{
-				if (m_is_own_list)//[+] FlylinkDC++
-				{
-					f->setFlag(DirectoryListing::FLAG_SHARED_OWN);  // TODO -  FLAG_SHARED_OWN
-				}
-				else
-				{
-					if (ShareManager::isTTHShared(f->getTTH()))
-					{
-						f->setFlag(DirectoryListing::FLAG_SHARED);
-					}
-					else
-					{
-						if (QueueManager::is_queue_tth(f->getTTH()))
-						{
-							f->setFlag(DirectoryListing::FLAG_QUEUE);
-						}
-						// TODO if(l_size >= 100 * 1024 *1024)
-						{
-							if (!CFlyServerConfig::isParasitFile(f->getName())) // TODO -   
-							{
-								f->setFlag(DirectoryListing::FLAG_NOT_SHARED);
-								const auto l_status_file = CFlylinkDBManager::getInstance()->get_status_file(f->getTTH()); // TODO -    ?
-								if (l_status_file & CFlylinkDBManager::PREVIOUSLY_DOWNLOADED)
-									f->setFlag(DirectoryListing::FLAG_DOWNLOAD);
-								if (l_status_file & CFlylinkDBManager::VIRUS_FILE_KNOWN)
-									f->setFlag(DirectoryListing::FLAG_VIRUS_FILE);
-								if (l_status_file & CFlylinkDBManager::PREVIOUSLY_BEEN_IN_SHARE)
-									f->setFlag(DirectoryListing::FLAG_OLD_TTH);
-							}
-						}
-					}
-				}//[+] FlylinkDC++
-			}
+			addFile(l_name, l_size, l_tth, l_i_hit, l_i_ts, l_mediaXY);
 		}
 		else if (name == g_SDirectory)
 		{
@@ -688,7 +782,7 @@ struct HashContained
 		explicit HashContained(const DirectoryListing::Directory::TTHSet& l) : tl(l) { }
 		bool operator()(const DirectoryListing::File::Ptr i) const
 		{
-			return tl.count((i->getTTH())) && (DeleteFunction()(i), true);
+			return tl.count((i->getTTH())) != 0; // the file stays in the arena of the listing
 		}
 	private:
 		void operator=(HashContained&); // [!] IRainman fix.
@@ -730,7 +824,7 @@ DirectoryListing::Directory::~Directory()
 		CFlyServerJSON::addAntivirusCounter(l_file_list);
 	}
 	for_each(directories.begin(), directories.end(), DeleteFunction());
-	for_each(m_files.begin(), m_files.end(), DeleteFunction());
+	// m_files are freed with the arena of DirectoryListing
 }
 
 bool DirectoryListing::CFlyVirusDetector::is_virus_dir() const
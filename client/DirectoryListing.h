@@ -26,6 +26,7 @@
 #include "QueueItem.h"
 #include "CFlyMediaInfo.h"
 #include "UserInfoBase.h"
+#include "MemoryArena.h"
 
 class ListLoader;
 class DirectoryListingFrame;
@@ -66,25 +67,35 @@ class DirectoryListing : public UserInfoBase
 				};
 				typedef vector<Ptr> List;
 				
-				File(Directory* p_Dir, const string& p_Name, int64_t p_Size, const TTHValue& p_TTH, uint32_t p_Hit, uint32_t p_ts, std::shared_ptr<CFlyMediaInfo>& p_media) noexcept :
-					name(p_Name), size(p_Size), parent(p_Dir), tthRoot(p_TTH), hit(p_Hit), ts(p_ts), m_media(p_media), adls(false)
+				// [!] Files live in the arena of DirectoryListing (see createFile) and are never deleted one by one,
+				// the name and the media info are interned by the listing.
+				File(Directory* p_Dir, const string* p_Name, int64_t p_Size, const TTHValue& p_TTH, uint32_t p_Hit, uint32_t p_ts, const CFlyMediaInfo* p_media) noexcept :
+					m_name(p_Name), size(p_Size), parent(p_Dir), tthRoot(p_TTH), hit(p_Hit), ts(p_ts), m_media(p_media), adls(false)
 				{
 				}
-				File(const File& rhs, bool _adls = false) : name(rhs.name), size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot),
+				File(const File& rhs, bool _adls = false) : m_name(rhs.m_name), size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot),
 					hit(rhs.hit), ts(rhs.ts), adls(_adls), m_media(rhs.m_media)
 				{
 				}
-				~File()
+				
+				const string& getName() const
 				{
+					return *m_name;
 				}
-				
-				GETSET(string, name, Name);
+				/** p_Name from DirectoryListing::internName */
+				void setName(const string* p_Name)
+				{
+					m_name = p_Name;
+				}
+			private:
+				const string* m_name;
+			public:
 				GETSET(int64_t, size, Size);
 				GETSET(Directory*, parent, Parent);
 				GETSET(TTHValue, tthRoot, TTH);
 				GETSET(uint64_t, hit, Hit);
 				GETSET(int64_t, ts, TS);
-				std::shared_ptr<CFlyMediaInfo> m_media;
+				const CFlyMediaInfo* m_media;
 				GETSET(bool, adls, Adls);
 		};
 		class CFlyVirusDetector
@@ -229,6 +240,11 @@ class DirectoryListing : public UserInfoBase
 		}
 		
 		void checkDupes(); // !fulDC!
+		
+		File* createFile(Directory* p_dir, const string& p_name, int64_t p_size, const TTHValue& p_tth, uint32_t p_hit, uint32_t p_ts, const CFlyMediaInfo* p_media);
+		File* copyFile(const File& p_file, bool p_adls);
+		const string* internName(const string& p_name);
+		const CFlyMediaInfo* internMedia(const string& p_WH, const string& p_br, const string& p_audio, const string& p_video);
 		static UserPtr getUserFromFilename(const string& fileName);
 		
 		const UserPtr& getUser() const
@@ -250,6 +266,11 @@ class DirectoryListing : public UserInfoBase
 		string m_file;
 		Directory* find(const string& aName, Directory* current);
 		
+		// [+] Storage of all the files of the listing, freed after root
+		MemoryArena m_arena;
+		boost::unordered_set<string> m_names;
+		CFlyCacheMediaInfo m_media_cache;
+		
 };
 
 inline bool operator==(const DirectoryListing::Directory::Ptr a, const string& b)
@@ -835,13 +835,13 @@ void DownloadManager::on(UserConnectionListener::FileNotAvailable, UserConnectio
 void DownloadManager::on(AdcCommand::STA, UserConnection* aSource, const AdcCommand& cmd) noexcept
 {
 	dcassert(!ClientManager::isBeforeShutdown());
-	if (cmd.getParameters().size() < 2)
+	if (cmd.getParamCount() < 2)
 	{
 		aSource->disconnect();
 		return;
 	}
 	
-	const string& err = cmd.getParameters()[0];
+	const string err = cmd.getParam(0);
 	if (err.length() != 3)
 	{
 		aSource->disconnect();
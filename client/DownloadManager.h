@@ -49,7 +49,7 @@ class session;
 //typedef boost::unordered_map<UserPtr, UserConnection*, User::Hash> IdlersMap;
 typedef std::vector<UserConnection*> UserConnectionList;
 
-class DownloadManager : public Speaker<DownloadManagerListener>,
+class DownloadManager : public SnapshotSpeaker<DownloadManagerListener>,
 	private UserConnectionListener, private TimerManagerListener,
 	public Singleton<DownloadManager>
 {
@@ -18,10 +18,12 @@
 
 #include "stdinc.h"
 
-#ifdef FLYLINKDC_USE_GPU_TTH
-
 #include "GPGPUManager.h"
 #include "SettingsManager.h"
+#include "MerkleTree.h"
+#include "WorkerPool.h"
+
+#ifdef FLYLINKDC_USE_GPU_TTH
 
 GPGPUOpenCL::GPGPUOpenCL()
 	: pfm_name("OpenCL"),
@@ -336,12 +338,121 @@ size_t GPGPUOpenCL::get_1d_max_wg_wi(int dev_num)
 	
 	return res;
 }
+#endif // FLYLINKDC_USE_GPU_TTH
+
+const string GPGPUCPU::PLATFORM_NAME("CPU");
+
+// A part hashed by one thread has at least so many leaves, smaller subtrees are hashed by the caller alone
+static const uint64_t CPU_MIN_PART_LEAVES = 256ULL;
+
+GPGPUCPU::GPGPUCPU()
+	: dev_name("CPU - " + Util::toString(WorkerPool::getInstance()->getThreadsCount() + 1) + " threads"),
+	  cur_dev_num(-1),
+	  sts(GPGPU_S_DEVICE_NOT_SELECTED)
+{
+}
+
+void GPGPUCPU::select_device(int num)
+{
+	dcassert(num == 0);
+	cur_dev_num = 0;
+	sts = GPGPU_OK;
+}
+
+uint64_t GPGPUCPU::get_min_ttr_size()
+{
+	return 2 * CPU_MIN_PART_LEAVES * MerkleTree<TigerHash>::BASE_BLOCK_SIZE;
+}
+
+bool GPGPUCPU::krn_ttr(uint8_t *data, uint64_t bc, uint64_t last_bs, uint64_t res[3])
+{
+	typedef MerkleTree<TigerHash> Tree;
+	static const uint64_t l_leaf_size = Tree::BASE_BLOCK_SIZE;
+	
+	dcassert(bc && (bc & (bc - 1)) == 0);
+	
+	if (cur_dev_num < 0) return false;
+	
+	// The subtree of bc (a power of 2) leaves is split into equal parts, a power of 2 leaves each,
+	// so the part roots are the nodes of one level of the subtree. A few parts per thread even out the load.
+	const uint64_t l_max_parts = 4 * (WorkerPool::getInstance()->getThreadsCount() + 1);
+	uint64_t l_part_count = 1;
+	while (l_part_count < l_max_parts && bc / (l_part_count * 2) >= CPU_MIN_PART_LEAVES)
+	{
+		l_part_count *= 2;
+	}
+	const uint64_t l_part_leaves = bc / l_part_count;
+	
+	vector<Tree::MerkleValue> l_roots(static_cast<size_t>(l_part_count));
+	volatile long l_next_part = 0;
+	volatile bool l_is_failed = false;
+	const auto l_hash_parts = [&]()
+	{
+		while (true)
+		{
+			const long l_part = Thread::safeInc(l_next_part) - 1;
+			if (l_part >= long(l_part_count))
+				break;
+			const uint64_t l_size = l_part + 1 == long(l_part_count) ? (l_part_leaves - 1) * l_leaf_size + last_bs : l_part_leaves * l_leaf_size;
+			try
+			{
+				Tree l_tree(int64_t(l_part_leaves * l_leaf_size));
+				l_tree.update(data + l_part * l_part_leaves * l_leaf_size, size_t(l_size));
+				l_tree.finalize();
+				l_roots[l_part] = l_tree.getRoot();
+			}
+			catch (std::bad_alloc&)
+			{
+				l_is_failed = true;
+			}
+		}
+	};
+	if (l_part_count > 1)
+	{
+		WorkerPool::getInstance()->runParallel(l_hash_parts, size_t(l_part_count));
+	}
+	else
+	{
+		l_hash_parts();
+	}
+	if (l_is_failed)
+	{
+		throw std::bad_alloc();
+	}
+	
+	// The part roots are blocks of the same size in a row, reduceBlocks joins them just like the serial tree does
+	Tree l_tree(int64_t(bc * l_leaf_size));
+	for (auto i = l_roots.cbegin(); i != l_roots.cend(); ++i)
+	{
+		l_tree.addBlock(*i, int64_t(l_part_leaves * l_leaf_size));
+	}
+	dcassert(l_tree.getLeaves().size() == 1);
+	memcpy(res, l_tree.getLeaves()[0].data, TigerHash::BYTES);
+	
+#ifdef _DEBUG
+	// [+] The root must be the one of the serial tree
+	{
+		Tree l_serial(int64_t(bc * l_leaf_size));
+		l_serial.update(data, size_t((bc - 1) * l_leaf_size + last_bs));
+		l_serial.finalize();
+		dcassert(memcmp(res, l_serial.getRoot().data, TigerHash::BYTES) == 0);
+	}
+#endif
+	return true;
+}
 
 GPGPUManager::GPGPUManager()
 	: i_cur_pfm(-1)
 {
+#ifdef FLYLINKDC_USE_GPU_TTH
 	platforms.push_back(new GPGPUOpenCL);
 	i_cur_pfm = 0;
+#endif
+	platforms.push_back(new GPGPUCPU);
+	if (i_cur_pfm < 0)
+	{
+		i_cur_pfm = int(platforms.size()) - 1;
+	}
 }
 
 GPGPUManager::~GPGPUManager()
@@ -371,6 +482,10 @@ GPGPUTTHManager::GPGPUTTHManager()
 			}
 		}
 	}
-}
-
-#endif // FLYLINKDC_USE_GPU_TTH
\ No newline at end of file
+	// [+] No GPU selected - the big buffers are hashed by the CPU backend, it has the only device
+	if (get()->get_cur_dev() < 0)
+	{
+		select(get_platform_count() - 1);
+		get()->select_device(0);
+	}
+}
\ No newline at end of file
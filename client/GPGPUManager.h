@@ -22,13 +22,15 @@
 #ifndef DCPLUSPLUS_DCPP_GPGPUMANAGER_H
 #define DCPLUSPLUS_DCPP_GPGPUMANAGER_H
 
-#ifdef FLYLINKDC_USE_GPU_TTH
-#include <CL/opencl.h>
 #include <vector>
 
 #include "Singleton.h"
 #include "CFlyThread.h"
 
+#ifdef FLYLINKDC_USE_GPU_TTH
+#include <CL/opencl.h>
+#endif
+
 class GPGPUTTHManager;
 
 class GPGPUPlatform
@@ -46,6 +48,7 @@ class GPGPUPlatform
 		static const Status GPGPU_E_DEVICE_INFO = (1UL << 27);
 		
 		GPGPUPlatform() { }
+		virtual ~GPGPUPlatform() { }
 		
 		virtual void select_device(int num) = 0;
 		virtual int get_cur_dev() = 0;
@@ -59,6 +62,11 @@ class GPGPUPlatform
 		{
 			return false;
 		}
+		/* [+] Smaller buffers are cheaper to hash by MerkleTree::update on the calling thread */
+		virtual uint64_t get_min_ttr_size()
+		{
+			return 0;
+		}
 };
 
 class GPGPUManager
@@ -89,6 +97,11 @@ class GPGPUManager
 			return platforms[i_cur_pfm];
 		}
 		
+		int get_platform_count() const
+		{
+			return (int)platforms.size();
+		}
+		
 	private:
 		vector<GPGPUPlatform *> platforms;
 		int i_cur_pfm;
@@ -102,6 +115,7 @@ class GPGPUTTHManager : public GPGPUManager, public Singleton<GPGPUTTHManager>
 		GPGPUTTHManager();
 };
 
+#ifdef FLYLINKDC_USE_GPU_TTH
 class GPGPUOpenCL : public GPGPUPlatform
 {
 	public:
@@ -175,6 +189,57 @@ class GPGPUOpenCL : public GPGPUPlatform
 		
 		void release_cl();
 };
-
 #endif // FLYLINKDC_USE_GPU_TTH
+
+/*
+ * [+] CPU backend: no GPU at all, but the subtree of krn_ttr is split
+ * between the threads of WorkerPool. One "device" - all the cores.
+ * Used when there is no OpenCL GPU (or it is not enabled in the settings).
+ */
+class GPGPUCPU : public GPGPUPlatform
+{
+	public:
+		GPGPUCPU();
+		
+		static const string PLATFORM_NAME;
+		
+		void select_device(int num);
+		
+		int get_cur_dev()
+		{
+			return cur_dev_num;
+		}
+		
+		const string& get_dev_name(int num)
+		{
+			dcassert(num == 0);
+			return dev_name;
+		}
+		
+		int get_dev_cnt()
+		{
+			return 1;
+		}
+		
+		const string& get_platform_name()
+		{
+			return PLATFORM_NAME;
+		}
+		
+		Status get_status()
+		{
+			return sts;
+		}
+		
+		/* Several hashing threads may call it at once, each call has its own parts */
+		bool krn_ttr(uint8_t *data, uint64_t bc, uint64_t last_bs, uint64_t res[3]);
+		
+		uint64_t get_min_ttr_size();
+		
+	private:
+		string dev_name;
+		volatile int cur_dev_num;
+		volatile Status sts;
+};
+
 #endif // !defined(GPGPUMANAGER_H)
\ No newline at end of file
@@ -43,23 +43,41 @@ uint64_t HashBloom::get_m(size_t n, size_t k)
 	return ((m + 63ULL) / 64ULL) * 64ULL;
 }
 
+namespace
+{
+// The TTH with 8 zero bytes after it: pos() reads 64-bit words past the last byte
+struct PaddedTTH
+{
+	uint8_t data[TTHValue::BYTES + 8];
+	explicit PaddedTTH(const TTHValue& tth)
+	{
+		memcpy(data, tth.data, TTHValue::BYTES);
+		memset(data + TTHValue::BYTES, 0, 8);
+	}
+};
+}
+
 void HashBloom::add(const TTHValue& tth)
 {
+	const PaddedTTH l_tth(tth);
 	for (size_t i = 0; i < k; ++i)
 	{
-		bloom[pos(tth, i)] = true;
+		const size_t l_pos = pos(l_tth.data, i);
+		bloom[l_pos / 8] |= uint8_t(1 << (l_pos % 8));
 	}
 }
 
 bool HashBloom::match(const TTHValue& tth) const
 {
-	if (bloom.empty())
+	if (m == 0)
 	{
 		return false;
 	}
+	const PaddedTTH l_tth(tth);
 	for (size_t i = 0; i < k; ++i)
 	{
-		if (!bloom[pos(tth, i)])
+		const size_t l_pos = pos(l_tth.data, i);
+		if (!(bloom[l_pos / 8] & (1 << (l_pos % 8))))
 		{
 			return false;
 		}
@@ -69,45 +87,50 @@ bool HashBloom::match(const TTHValue& tth) const
 
 void HashBloom::push_back(bool v)
 {
-	bloom.push_back(v);
+	if (m % 8 == 0)
+	{
+		bloom.push_back(0);
+	}
+	if (v)
+	{
+		bloom[m / 8] |= uint8_t(1 << (m % 8));
+	}
+	++m;
 }
 
-void HashBloom::reset(size_t k_, size_t m, size_t h_)
+void HashBloom::reset(size_t k_, size_t m_, size_t h_)
 {
-	bloom.resize(m);
+	bloom.assign((m_ + 7) / 8, 0);
+	m = m_;
 	k = k_;
 	h = h_;
 }
 
-size_t HashBloom::pos(const TTHValue& tth, size_t n) const
+size_t HashBloom::pos(const uint8_t* tth, size_t n) const
 {
 	if ((n + 1)*h > TTHValue::BITS)
 	{
 		return 0;
 	}
 	
-	uint64_t x = 0;
-	
-	size_t start = n * h;
-	for (size_t i = 0; i < h; ++i)
+	// Bits start..start+h-1 of the TTH, the lowest bit of a byte first (little-endian words on x86/x64)
+	const size_t start = n * h;
+	const size_t shift = start % 8;
+	uint64_t x;
+	memcpy(&x, tth + start / 8, sizeof(x));
+	x >>= shift;
+	if (shift != 0 && h > 64 - shift)
 	{
-		size_t bit = start + i;
-		size_t byte = bit / 8;
-		size_t pos = bit % 8;
-		
-		if (tth.data[byte] & (1 << pos))
-		{
-			x |= (1i64 << i);
-		}
+		x |= uint64_t(tth[start / 8 + 8]) << (64 - shift);
 	}
-	return x % bloom.size();
+	if (h < 64)
+	{
+		x &= (uint64_t(1) << h) - 1;
+	}
+	return size_t(x % m);
 }
 
 void HashBloom::copy_to(ByteVector& v) const
 {
-	v.resize(bloom.size() / 8);
-	for (size_t i = 0; i < bloom.size(); ++i)
-	{
-		v[i / 8] |= bloom[i] << (i % 8);
-	}
+	v.assign(bloom.begin(), bloom.begin() + size_t(m / 8));
 }
@@ -34,11 +34,15 @@
  * files in share since each file is identified by one TTH value. We try that for each even dividend
  * of the key size (2, 3, 4, 6, 8, 12) and if m fits within the bits we're able to address (2^(keysize/k)),
  * we can use that value when requesting the bloom filter.
+ *
+ * [!] The layout of the bits is fixed by ADC (the hub tests the same positions), so the filter can't be blocked by cache lines.
+ * The bits are kept packed in the ADC byte order instead of std::vector<bool>, the positions are read from the TTH
+ * by whole 64-bit words and the filter is copied out as is.
  */
 class HashBloom
 {
 	public:
-		HashBloom() : k(0), h(0) { }
+		HashBloom() : m(0), k(0), h(0) { }
 		
 		/** Return a suitable value for k based on n */
 		static size_t get_k(size_t n, size_t h);
@@ -53,9 +57,10 @@ class HashBloom
 		void copy_to(ByteVector& v) const;
 	private:
 	
-		size_t pos(const TTHValue& tth, size_t n) const;
+		size_t pos(const uint8_t* tth, size_t n) const;
 		
-		std::vector<bool> bloom;
+		ByteVector bloom; // bit i is (bloom[i / 8] >> (i % 8)) & 1
+		uint64_t m;
 		size_t k;
 		size_t h;
 };
@@ -25,7 +25,9 @@
 #include "ClientManager.h"
 #include "CompatibilityManager.h" // [+] IRainman
 #include "ShareManager.h"
+#include "MappedFileStream.h"
 #include "../FlyFeatures/flyServer.h"
+#include <winioctl.h>
 
 #ifdef IRAINMAN_NTFS_STREAM_TTH
 //[+] Greylink
@@ -288,16 +290,18 @@ void HashManager::addFile(__int64 p_path_id, const string& p_file_name, int64_t
 
 void HashManager::Hasher::hashFile(__int64 p_path_id, const string& fileName, int64_t size)
 {
+	const unsigned l_device = getDevice(fileName);
 	CFlyFastLock(cs);
 	CFlyHashTaskItem l_task_item;
 	l_task_item.m_file_size = size;
 	l_task_item.m_path_id   = p_path_id;
 	
-	if (w.insert(make_pair(fileName, l_task_item)). second)
+	if (w.insert(make_pair(make_pair(l_device, fileName), l_task_item)). second)
 	{
 		m_CurrentBytesLeft += size;// [+]IRainman
+		++m_device_queued[l_device];
 		if (m_paused > 0)
-			m_paused++;
+			m_deferred_files++;
 		else
 			m_hash_semaphore.signal();
 			
@@ -322,10 +326,15 @@ bool HashManager::Hasher::pause()
 void HashManager::Hasher::resume()
 {
 	CFlyFastLock(cs);
-	while (--m_paused > 0)
+	m_paused = 0;
+	for (; m_deferred_files > 0; --m_deferred_files)
 	{
 		m_hash_semaphore.signal();
 	}
+	for (; m_paused_workers > 0; --m_paused_workers)
+	{
+		m_pause_semaphore.signal();
+	}
 }
 
 bool HashManager::Hasher::isPaused() const
@@ -343,14 +352,16 @@ void HashManager::Hasher::stopHashing(const string& baseDir)
 		// in the hashing dialog then the hesher is cleaning.
 		w.clear();
 		m_CurrentBytesLeft = 0;
+		std::fill(m_device_queued.begin(), m_device_queued.end(), 0);
 	}
 	else
 	{
 		for (auto i = w.cbegin(); i != w.cend();)
 		{
-			if (strnicmp(baseDir, i->first, baseDir.length()) == 0) // TODO  ID ?
+			if (strnicmp(baseDir, i->first.second, baseDir.length()) == 0) // TODO  ID ?
 			{
 				m_CurrentBytesLeft -= i->second.m_file_size;
+				--m_device_queued[i->first.first];
 				w.erase(i++);
 			}
 			else
@@ -361,12 +372,27 @@ void HashManager::Hasher::stopHashing(const string& baseDir)
 	}
 	// [+] brain-ripper
 	// cleanup state
-	m_running = false;
-	dwMaxFiles = 0;
-	iMaxBytes = 0;
-	m_fname.erase();
-	m_currentSize = 0;
-	m_path_id = 0;
+	bool l_is_running = false;
+	for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
+	{
+		Worker& l_worker = **i;
+		if (baseDir.empty() || strnicmp(baseDir, l_worker.m_fname, baseDir.length()) == 0)
+		{
+			// The worker drops the file at the next block
+			l_worker.m_is_running = false;
+			l_worker.m_fname.erase();
+			l_worker.m_currentSize = 0;
+			l_worker.m_path_id = 0;
+		}
+		l_is_running |= l_worker.m_is_running;
+	}
+	if (!l_is_running && w.empty())
+	{
+		m_running = false;
+		dwMaxFiles = 0;
+		iMaxBytes = 0;
+		m_cached_bytes = 0;
+	}
 }
 
 void HashManager::Hasher::instantPause()
@@ -374,21 +400,176 @@ void HashManager::Hasher::instantPause()
 	bool wait = false;
 	{
 		CFlyFastLock(cs);
-		if (m_paused > 0)
+		if (m_paused > 0 && !m_stop)
 		{
-			m_paused++;
+			m_paused_workers++;
 			wait = true;
 		}
 	}
 	if (wait)
 	{
-		m_hash_semaphore.wait();
+		m_pause_semaphore.wait();
+	}
+}
+
+void HashManager::Hasher::setPriority(Priority p)
+{
+	setThreadPriority(p);
+	CFlyFastLock(cs);
+	for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
+	{
+		if (*i != &m_main_worker)
+		{
+			(*i)->setThreadPriority(p);
+		}
+	}
+}
+
+/** Mount point of the volume holding the folder (drive root, UNC share root), lower-cased */
+static string getHashVolume(const string& p_path)
+{
+	const tstring l_path = Text::toT(p_path);
+	TCHAR l_volume_path[MAX_PATH];
+	if (!::GetVolumePathName(l_path.c_str(), l_volume_path, MAX_PATH))
+	{
+		return Text::toLower(p_path.substr(0, 3));
+	}
+	return Text::toLower(Text::fromT(l_volume_path));
+}
+
+/**
+ * Physical disk of the volume: "disk:N" if the volume lies on one disk, the volume path otherwise
+ * (network shares, spanned volumes, no access to the volume).
+ */
+static string getHashDevice(const string& p_volume)
+{
+	const tstring l_volume_path = Text::toT(p_volume);
+	TCHAR l_volume_name[MAX_PATH];
+	if (::GetVolumeNameForVolumeMountPoint(l_volume_path.c_str(), l_volume_name, MAX_PATH))
+	{
+		// "\\?\Volume{GUID}\" without the trailing backslash opens the volume itself
+		tstring l_volume = l_volume_name;
+		if (!l_volume.empty() && l_volume.back() == _T('\\'))
+			l_volume.pop_back();
+		const HANDLE h = ::CreateFile(l_volume.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (h != INVALID_HANDLE_VALUE)
+		{
+			VOLUME_DISK_EXTENTS l_extents = { 0 };
+			DWORD l_bytes = 0;
+			const BOOL l_result = ::DeviceIoControl(h, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS, nullptr, 0, &l_extents, sizeof(l_extents), &l_bytes, nullptr);
+			::CloseHandle(h);
+			if (l_result && l_extents.NumberOfDiskExtents == 1)
+			{
+				return "disk:" + Util::toString(l_extents.Extents[0].DiskNumber);
+			}
+		}
+	}
+	return p_volume;
+}
+
+unsigned HashManager::Hasher::getDevice(const string& p_file_name)
+{
+	const string l_dir = Util::getFilePath(p_file_name);
+	{
+		CFlyFastLock(cs);
+		if (l_dir == m_last_device_dir)
+			return m_last_device;
+	}
+	// The disk extents are asked once per volume, not for every new folder
+	const string l_volume = getHashVolume(l_dir);
+	{
+		CFlyFastLock(cs);
+		const auto i = m_volume_devices.find(l_volume);
+		if (i != m_volume_devices.end())
+		{
+			m_last_device_dir = l_dir;
+			m_last_device = i->second;
+			return m_last_device;
+		}
+	}
+	// Outside the spin lock: the workers take the next files from the device table meanwhile
+	const string l_device = getHashDevice(l_volume);
+	CFlyFastLock(cs);
+	// Another thread could add the same volume or device while the lock was released
+	const auto i = std::find(m_devices.cbegin(), m_devices.cend(), l_device);
+	m_last_device = unsigned(i - m_devices.cbegin());
+	if (i == m_devices.cend())
+	{
+		m_devices.push_back(l_device);
+		m_device_queued.push_back(0);
+		m_device_active.push_back(0);
+	}
+	m_volume_devices[l_volume] = m_last_device;
+	m_last_device_dir = l_dir;
+	return m_last_device;
+}
+
+bool HashManager::Hasher::takeNextFileL(Worker& p_worker)
+{
+	for (unsigned d = 0; d < m_devices.size(); ++d)
+	{
+		if (m_device_queued[d] && m_device_active[d] < m_max_device_workers)
+		{
+			const auto i = w.lower_bound(make_pair(d, string()));
+			dcassert(i != w.end() && i->first.first == d);
+			p_worker.m_fname = i->first.second;
+			p_worker.m_currentSize = i->second.m_file_size;
+			p_worker.m_path_id = i->second.m_path_id;
+			p_worker.m_device = d;
+			p_worker.m_is_running = true;
+			m_CurrentBytesLeft -= p_worker.m_currentSize;// [+]IRainman
+			--m_device_queued[d];
+			++m_device_active[d];
+			++m_active_workers;
+			w.erase(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+void HashManager::Hasher::releaseFileL(Worker& p_worker)
+{
+	dcassert(m_active_workers && m_device_active[p_worker.m_device]);
+	--m_device_active[p_worker.m_device];
+	--m_active_workers;
+	p_worker.m_fname.clear();
+	p_worker.m_currentSize = 0;
+	p_worker.m_path_id = 0;
+	p_worker.m_is_running = false;
+	// The device is free again - let the other workers look at the files they skipped
+	for (; m_deferred_tokens > 0; --m_deferred_tokens)
+	{
+		m_hash_semaphore.signal();
+	}
+	if (w.empty() && m_active_workers == 0)
+	{
+		m_running = false;
+		iMaxBytes = 0;
+		dwMaxFiles = 0;
+		m_CurrentBytesLeft = 0;//[+]IRainman
+		m_cached_bytes = 0;
 	}
 }
 
+bool HashManager::Hasher::reservePageCache(int64_t p_size)
+{
+	const int64_t l_limit = int64_t(SETTING(HASH_PAGE_CACHE_LIMIT)) * 1024 * 1024;
+	CFlyFastLock(cs);
+	if (p_size <= 0 || m_cached_bytes + p_size > l_limit)
+		return false;
+	m_cached_bytes += p_size;
+	return true;
+}
+
+static void updateTreeAccessor(void* p_tree, const uint8_t* p_data, size_t p_len)
+{
+	static_cast<TigerTree*>(p_tree)->update(p_data, p_len);
+}
+
 static size_t g_HashBufferSize = 16 * 1024 * 1024;
 
-bool HashManager::Hasher::fastHash(const string& fname, uint8_t* buf, unsigned p_buf_size, TigerTree& tth, int64_t& p_size, bool p_is_link)
+bool HashManager::Hasher::fastHash(Worker& p_worker, const string& fname, TigerTree& tth, int64_t& p_size, bool p_is_link)
 {
 	int64_t l_size = p_size;
 	HANDLE h = INVALID_HANDLE_VALUE;
@@ -458,8 +639,8 @@ bool HashManager::Hasher::fastHash(const string& fname, uint8_t* buf, unsigned p
 	}
 	DWORD hn = 0;
 	DWORD rn = 0;
-	uint8_t* hbuf = buf + g_HashBufferSize;
-	uint8_t* rbuf = buf;
+	uint8_t* hbuf = p_worker.m_buf + g_HashBufferSize;
+	uint8_t* rbuf = p_worker.m_buf;
 	
 	OVERLAPPED over = { 0 };
 	BOOL res = TRUE;
@@ -476,17 +657,17 @@ bool HashManager::Hasher::fastHash(const string& fname, uint8_t* buf, unsigned p
 	uint64_t lastRead = GET_TICK();
 	if (!::ReadFile(h, hbuf, g_HashBufferSize, &hn, &over))
 	{
-		m_last_error =   GetLastError();
-		if (m_last_error == ERROR_HANDLE_EOF)
+		p_worker.m_last_error =   GetLastError();
+		if (p_worker.m_last_error == ERROR_HANDLE_EOF)
 		{
 			hn = 0;
 		}
-		else if (m_last_error == ERROR_IO_PENDING)
+		else if (p_worker.m_last_error == ERROR_IO_PENDING)
 		{
 			if (!GetOverlappedResult(h, &over, &hn, TRUE))
 			{
-				m_last_error_overlapped =   GetLastError();
-				if (m_last_error_overlapped == ERROR_HANDLE_EOF)
+				p_worker.m_last_error_overlapped =   GetLastError();
+				if (p_worker.m_last_error_overlapped == ERROR_HANDLE_EOF)
 				{
 					hn = 0;
 				}
@@ -508,7 +689,7 @@ bool HashManager::Hasher::fastHash(const string& fname, uint8_t* buf, unsigned p
 	// [+] brain-ripper
 	// exit loop if "running" equals false.
 	// "running" sets to false in stopHashing function
-	while (!m_stop && m_running && l_size >= 0)
+	while (!m_stop && p_worker.m_is_running && l_size >= 0)
 	{
 		if (l_size > 0)
 		{
@@ -540,7 +721,7 @@ bool HashManager::Hasher::fastHash(const string& fname, uint8_t* buf, unsigned p
 		
 		{
 			CFlyFastLock(cs);
-			m_currentSize = max(m_currentSize - hn, _LL(0));
+			p_worker.m_currentSize = max(p_worker.m_currentSize - hn, _LL(0));
 		}
 		
 		if (l_size == 0)
@@ -592,9 +773,96 @@ int HashManager::Hasher::run()
 {
 	setThreadPriority(Thread::IDLE);
 	
-	uint8_t* l_buf = nullptr;
-	unsigned l_buf_size = 0;
-	bool l_is_virtualBuf = true;
+	// [+] Worker pool: HASH_THREADS files at once, at most HASH_THREADS_PER_DEVICE of them from one disk
+	unsigned l_count = SETTING(HASH_THREADS);
+	if (l_count == 0)
+	{
+		l_count = unsigned(std::min(CompatibilityManager::getProcessorsCount(), size_t(4)));
+	}
+	m_max_device_workers = std::max(SETTING(HASH_THREADS_PER_DEVICE), 1);
+	{
+		CFlyFastLock(cs);
+		for (unsigned i = 1; i < l_count; ++i)
+		{
+			m_workers.push_back(new Worker(*this));
+		}
+	}
+	for (size_t i = 1; i < l_count; ++i)
+	{
+		m_workers[i]->start(0, "HashManager worker");
+		m_workers[i]->setThreadPriority(Thread::IDLE);
+	}
+	const int l_result = processFiles(m_main_worker);
+	for (size_t i = 1; i < l_count; ++i)
+	{
+		m_workers[i]->join();
+	}
+	{
+		CFlyFastLock(cs);
+		for (size_t i = 1; i < m_workers.size(); ++i)
+		{
+			delete m_workers[i];
+		}
+		m_workers.resize(1);
+	}
+	return l_result;
+}
+
+bool HashManager::Hasher::Worker::allocBuffer()
+{
+#ifdef _WIN32
+	if (m_buf == NULL)
+	{
+		m_is_virtualBuf = true;
+		m_buf_size = g_HashBufferSize * 2;
+		m_buf = (uint8_t*)VirtualAlloc(NULL, m_buf_size, MEM_COMMIT, PAGE_READWRITE);  //   *2!
+		// - %%%    fastHash
+	}
+#endif
+	if (m_buf == NULL)
+	{
+		m_is_virtualBuf = false;
+		bool l_is_bad_alloc;
+		do
+		{
+			try
+			{
+				dcassert(g_HashBufferSize);
+				l_is_bad_alloc = false;
+				m_buf = new uint8_t[g_HashBufferSize];
+			}
+			catch (std::bad_alloc&)
+			{
+				ShareManager::tryFixBadAlloc();
+				m_buf = nullptr;
+				g_HashBufferSize /= 2;
+				l_is_bad_alloc = g_HashBufferSize > 128;
+				if (l_is_bad_alloc == false)
+				{
+					throw;
+				}
+			}
+		}
+		while (l_is_bad_alloc == true);
+		m_buf_size = g_HashBufferSize;
+	}
+	return m_buf != nullptr;
+}
+
+void HashManager::Hasher::Worker::freeBuffer()
+{
+	if (m_buf != nullptr)
+	{
+		if (m_is_virtualBuf)
+			VirtualFree(m_buf, 0, MEM_RELEASE);
+		else
+			delete [] m_buf;
+		m_buf = nullptr;
+	}
+}
+
+int HashManager::Hasher::processFiles(Worker& p_worker)
+{
 	bool l_is_last = false;
 	for (;;)
 	{
@@ -608,15 +876,12 @@ int HashManager::Hasher::run()
 			LogManager::message(STRING(HASH_REBUILT));
 			continue;
 		}
+		string l_fname;
 		{
 			CFlyFastLock(cs);
-			if (!w.empty())
+			if (takeNextFileL(p_worker))
 			{
-				m_fname = w.begin()->first;
-				m_currentSize = w.begin()->second.m_file_size;
-				m_path_id = w.begin()->second.m_path_id;
-				m_CurrentBytesLeft -= m_currentSize;// [+]IRainman
-				w.erase(w.begin());
+				l_fname = p_worker.m_fname;
 				l_is_last = w.empty();
 				if (!m_running)
 				{
@@ -624,22 +889,25 @@ int HashManager::Hasher::run()
 					m_running = true;
 				}
 			}
+			else if (!w.empty())
+			{
+				// All the queued files are on the busy devices - releaseFileL wakes us up again
+				++m_deferred_tokens;
+				continue;
+			}
 			else
 			{
-				m_currentSize = 0;
 				l_is_last = true;
-				m_fname.clear();
-				m_running = false;
-				iMaxBytes = 0;
-				dwMaxFiles = 0;
-				m_CurrentBytesLeft = 0;// [+]IRainman
+				if (m_active_workers == 0)
+				{
+					m_running = false;
+					iMaxBytes = 0;
+					dwMaxFiles = 0;
+					m_CurrentBytesLeft = 0;// [+]IRainman
+					m_cached_bytes = 0;
+				}
 			}
 		}
-		string l_fname;
-		{
-			CFlyFastLock(cs);
-			l_fname = m_fname;
-		}
 		if (!l_fname.empty())
 		{
 			int64_t l_size = 0;
@@ -647,42 +915,7 @@ int HashManager::Hasher::run()
 			bool l_is_link = false;
 			File::isExist(l_fname, l_size, l_outFiletime, l_is_link); // TODO -   isLink
 			int64_t l_sizeLeft = l_size;
-#ifdef _WIN32
-			if (l_buf == NULL)
-			{
-				l_is_virtualBuf = true;
-				l_buf_size = g_HashBufferSize * 2;
-				l_buf = (uint8_t*)VirtualAlloc(NULL, l_buf_size, MEM_COMMIT, PAGE_READWRITE);  //   *2!
-				// - %%%    fastHash
-			}
-#endif
-			if (l_buf == NULL)
-			{
-				l_is_virtualBuf = false;
-				bool l_is_bad_alloc;
-				do
-				{
-					try
-					{
-						dcassert(g_HashBufferSize);
-						l_is_bad_alloc = false;
-						l_buf = new uint8_t[g_HashBufferSize];
-					}
-					catch (std::bad_alloc&)
-					{
-						ShareManager::tryFixBadAlloc();
-						l_buf = nullptr;
-						g_HashBufferSize /= 2;
-						l_is_bad_alloc = g_HashBufferSize > 128;
-						if (l_is_bad_alloc == false)
-						{
-							throw;
-						}
-					}
-				}
-				while (l_is_bad_alloc == true);
-				l_buf_size = g_HashBufferSize;
-			}
+			p_worker.allocBuffer();
 			try
 			{
 				if (l_size == 0) //  && l_is_link -     aux.h
@@ -713,18 +946,26 @@ int HashManager::Hasher::run()
 				if (!l_is_ntfs)
 				{
 #endif
-					if (l_is_virtualBuf == false || !BOOLSETTING(FAST_HASH) || !fastHash(l_fname, l_buf, l_buf_size, fastTTH, l_size, l_is_link))
+					// [+] Files that fit into the page cache limit of the hashing run are read through the mapping:
+					// they are likely cached already (just downloaded or shared) and the data is not copied.
+					// The rest goes through the unbuffered fastHash and leaves the page cache to the uploads.
+					const bool l_is_mapped = reservePageCache(l_size);
+					if (l_is_mapped || p_worker.m_is_virtualBuf == false || !BOOLSETTING(FAST_HASH) || !fastHash(p_worker, l_fname, fastTTH, l_size, l_is_link))
 					{
 #else
 				if (!BOOLSETTING(FAST_HASH) || !fastHash(fname, 0, fastTTH, l_size))
 				{
 #endif
 						// [+] brain-ripper
-						if (m_running)
+						if (p_worker.m_is_running)
 						{
 							tth = &slowTTH;
 							uint64_t lastRead = GET_TICK();
-							File l_slow_file_reader(l_fname, File::READ, File::OPEN);
+							std::unique_ptr<InputStream> l_slow_file_reader;
+							if (l_is_mapped)
+								l_slow_file_reader.reset(new MappedFileStream(l_fname));
+							else
+								l_slow_file_reader.reset(new File(l_fname, File::READ, File::OPEN));
 							do
 							{
 								size_t bufSize = g_HashBufferSize;
@@ -743,20 +984,35 @@ int HashManager::Hasher::run()
 								{
 									lastRead = GET_TICK();
 								}
-								n = l_slow_file_reader.read(l_buf, bufSize);
+								if (l_is_mapped)
+								{
+									n = bufSize;
+									const uint8_t* l_data = l_slow_file_reader->readRef(n);
+									if (n > 0 && !MappedFileStream::safeAccess(updateTreeAccessor, tth, l_data, n))
+									{
+										throw FileException(Util::translateError(ERROR_READ_FAULT));
+									}
+								}
+								else
+								{
+									n = l_slow_file_reader->read(p_worker.m_buf, bufSize);
+									if (n > 0)
+									{
+										tth->update(p_worker.m_buf, n);
+									}
+								}
 								if (n > 0)
 								{
-									tth->update(l_buf, n);
 									{
 										CFlyFastLock(cs);
-										m_currentSize = max(static_cast<uint64_t>(m_currentSize - n), static_cast<uint64_t>(0)); // TODO - max  0  ?
+										p_worker.m_currentSize = max(static_cast<uint64_t>(p_worker.m_currentSize - n), static_cast<uint64_t>(0)); // TODO - max  0  ?
 									}
 									l_sizeLeft -= n;
 									
 									instantPause();
 								}
 							}
-							while (!m_stop && m_running && n > 0);
+							while (!m_stop && p_worker.m_is_running && n > 0);
 						}
 						else
 							tth = nullptr;
@@ -773,28 +1029,28 @@ int HashManager::Hasher::run()
 				{
 					speed = l_size * _LL(1000) / (end - start);
 				}
-				if (m_running)
+				if (p_worker.m_is_running)
 				{
-					if (m_path_id == 0)
+					if (p_worker.m_path_id == 0)
 					{
 						//dcassert(m_path_id);
 						const auto l_path = Text::toLower(Util::getFilePath(l_fname));
 						dcassert(!l_path.empty());
 						bool l_is_no_mediainfo;
-						m_path_id = CFlylinkDBManager::getInstance()->get_path_id(l_path, true, false, l_is_no_mediainfo, false);
-						dcassert(m_path_id);
+						p_worker.m_path_id = CFlylinkDBManager::getInstance()->get_path_id(l_path, true, false, l_is_no_mediainfo, false);
+						dcassert(p_worker.m_path_id);
 					}
 #ifdef IRAINMAN_NTFS_STREAM_TTH
 					if (l_is_ntfs)
 					{
-						HashManager::getInstance()->hashDone(m_path_id, l_fname, timestamp, *tth, speed, l_is_ntfs, l_size);
+						HashManager::getInstance()->hashDone(p_worker.m_path_id, l_fname, timestamp, *tth, speed, l_is_ntfs, l_size);
 					}
 					else
 #endif
 						if (tth)
 						{
 							tth->finalize();
-							HashManager::getInstance()->hashDone(m_path_id, l_fname, timestamp, *tth, speed, l_is_ntfs, l_size);
+							HashManager::getInstance()->hashDone(p_worker.m_path_id, l_fname, timestamp, *tth, speed, l_is_ntfs, l_size);
 						}
 				}
 			}
@@ -803,28 +1059,15 @@ int HashManager::Hasher::run()
 				LogManager::message(STRING(ERROR_HASHING) + ' ' + l_fname + ": " + e.getError());
 			}
 		}
+		if (!l_fname.empty())
 		{
 			CFlyFastLock(cs);
-			m_fname.clear();
-			m_currentSize = 0;
-			m_path_id = 0;
-			
-			if (w.empty())
-			{
-				m_running = false;
-				iMaxBytes = 0;
-				dwMaxFiles = 0;
-				m_CurrentBytesLeft = 0;//[+]IRainman
-			}
+			releaseFileL(p_worker);
 		}
 		
-		if (l_buf != NULL && (l_is_last || m_stop))
+		if (l_is_last || m_stop)
 		{
-			if (l_is_virtualBuf)
-				VirtualFree(l_buf, 0, MEM_RELEASE);
-			else
-				delete [] l_buf;
-			l_buf = nullptr;
+			p_worker.freeBuffer();
 		}
 	}
 	return 0;
@@ -89,7 +89,7 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 		}
 		void setThreadPriority(Thread::Priority p)
 		{
-			hasher.setThreadPriority(p);
+			hasher.setPriority(p);
 		}
 		
 		void addTree(const string& aFileName, int64_t aTimeStamp, const TigerTree& tt, int64_t p_Size)
@@ -250,10 +250,14 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 		class Hasher : public Thread
 		{
 			public:
-				Hasher() : m_stop(false), m_running(false), m_paused(0), m_rebuild(false), m_currentSize(0), m_path_id(0),
+				Hasher() : m_stop(false), m_running(false), m_paused(0), m_rebuild(false),
 					m_CurrentBytesLeft(0), //[+]IRainman
-					m_ForceMaxHashSpeed(0), dwMaxFiles(0), iMaxBytes(0), uiStartTime(0), m_last_error(0), m_last_error_overlapped(0) { }
-					
+					m_ForceMaxHashSpeed(0), dwMaxFiles(0), iMaxBytes(0), uiStartTime(0),
+					m_deferred_files(0), m_deferred_tokens(0), m_paused_workers(0), m_active_workers(0), m_max_device_workers(1), m_last_device(0), m_cached_bytes(0), m_main_worker(*this)
+				{
+					m_workers.push_back(&m_main_worker);
+				}
+				
 				void hashFile(__int64 p_path_id, const string& fileName, int64_t size);
 				
 				/// @return whether hashing was already paused
@@ -263,27 +267,36 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 				
 				void stopHashing(const string& baseDir);
 				int run();
-				bool fastHash(const string& fname, uint8_t* buf, unsigned p_buf_size, TigerTree& tth, int64_t& size, bool p_is_link);
+				void setPriority(Priority p);
 				// [+] brain-ripper
 				void getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft)
 				{
 					CFlyFastLock(cs);
-					curFile = m_fname;
+					curFile.clear();
+					for (auto i = m_workers.cbegin(); i != m_workers.cend() && curFile.empty(); ++i)
+					{
+						curFile = (*i)->m_fname;
+					}
 					getBytesAndFileLeft(bytesLeft, filesLeft);
 				}
 				
 				void signal()
 				{
-					if (m_paused)
-					{
-						m_hash_semaphore.signal(); // TODO      ?
-					}
 					m_hash_semaphore.signal();
 				}
 				void shutdown()
 				{
 					m_stop = true;
-					signal();
+					CFlyFastLock(cs);
+					// Wake up every worker: idle ones wait for a file, paused ones - for resume()
+					for (size_t i = 0; i < m_workers.size(); ++i)
+					{
+						m_hash_semaphore.signal();
+					}
+					for (; m_paused_workers > 0; --m_paused_workers)
+					{
+						m_pause_semaphore.signal();
+					}
 				}
 				void scheduleRebuild()
 				{
@@ -299,11 +312,12 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 			private:
 				void getBytesAndFileLeft(int64_t& bytesLeft, size_t& filesLeft) const
 				{
-					filesLeft = w.size();
-					if (m_running)
-						filesLeft++;
-						
-					bytesLeft = m_currentSize + m_CurrentBytesLeft; // [!]IRainman
+					filesLeft = w.size() + m_active_workers;
+					bytesLeft = m_CurrentBytesLeft; // [!]IRainman
+					for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
+					{
+						bytesLeft += (*i)->m_currentSize;
+					}
 				}
 			public:
 				void EnableForceMinHashSpeed(int iMinHashSpeed)
@@ -369,34 +383,93 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 				// end of Temporarily change hash speed functional
 				
 			private:
+				/**
+				 * [+] One hashing thread: the file it is working on and its own read buffers.
+				 * The Hasher thread itself is the first worker, SETTING(HASH_THREADS) - 1 more are started by run().
+				 */
+				class Worker : public Thread
+				{
+					public:
+						explicit Worker(Hasher& p_hasher) : m_hasher(p_hasher), m_currentSize(0), m_path_id(0), m_device(0), m_is_running(false),
+							m_buf(nullptr), m_buf_size(0), m_is_virtualBuf(true), m_last_error(0), m_last_error_overlapped(0)
+						{
+						}
+						~Worker()
+						{
+							freeBuffer();
+						}
+						bool allocBuffer();
+						void freeBuffer();
+						
+						Hasher& m_hasher;
+						int64_t m_currentSize;
+						__int64 m_path_id;
+						unsigned m_device;
+						volatile bool m_is_running; // false - the file was removed by stopHashing
+						string m_fname;
+						uint8_t* m_buf;
+						unsigned m_buf_size;
+						bool m_is_virtualBuf;
+						DWORD m_last_error;
+						DWORD m_last_error_overlapped;
+					private:
+						int run()
+						{
+							return m_hasher.processFiles(*this);
+						}
+				};
+				
+				int processFiles(Worker& p_worker);
+				bool fastHash(Worker& p_worker, const string& fname, TigerTree& tth, int64_t& size, bool p_is_link);
+				/** Takes the next file for the worker from a device that has a free slot */
+				bool takeNextFileL(Worker& p_worker);
+				void releaseFileL(Worker& p_worker);
+				unsigned getDevice(const string& p_file_name);
+				/** [+] Takes p_size bytes of SETTING(HASH_PAGE_CACHE_LIMIT) for the mapped reading, false - over the limit */
+				bool reservePageCache(int64_t p_size);
+				
 				// Case-sensitive (faster), it is rather unlikely that case changes, and if it does it's harmless.
 				// map because it's sorted (to avoid random hash order that would create quite strange shares while hashing)
+				// [!] The files are grouped by the device, so a worker finds a file from a free device with one lookup.
 				struct CFlyHashTaskItem
 				{
 					int64_t m_file_size;
 					int64_t m_path_id;
 				};
 				void instantPause();
-				typedef std::map<string, CFlyHashTaskItem> WorkMap;
+				typedef std::map<std::pair<unsigned, string>, CFlyHashTaskItem> WorkMap;
 				
 				WorkMap w;
 				mutable FastCriticalSection cs; // [!] IRainman opt: use only spinlock here!
 				Semaphore m_hash_semaphore;
+				Semaphore m_pause_semaphore;
 				
 				volatile bool m_stop; // [!] IRainman fix: this variable is volatile.
 				volatile bool m_running; // [!] IRainman fix: this variable is volatile.
 				int64_t m_paused; //[!] PPA -> int
 				volatile bool m_rebuild; // [!] IRainman fix: this variable is volatile.
-				int64_t m_currentSize;
-				__int64 m_path_id;
 				int m_ForceMaxHashSpeed;
 				size_t dwMaxFiles;
 				int64_t iMaxBytes;
 				uint64_t uiStartTime;
 				int64_t m_CurrentBytesLeft;
-				string m_fname;
-				DWORD m_last_error;
-				DWORD m_last_error_overlapped;
+				
+				// [+] Worker pool
+				unsigned m_deferred_files;   // files added while the hasher was paused
+				unsigned m_deferred_tokens;  // files left in the queue because their devices were busy
+				unsigned m_paused_workers;
+				unsigned m_active_workers;
+				unsigned m_max_device_workers;
+				// Device table: only grows, changed and read under cs
+				StringList m_devices;
+				boost::unordered_map<string, unsigned> m_volume_devices;
+				std::vector<unsigned> m_device_queued;
+				std::vector<unsigned> m_device_active;
+				string m_last_device_dir;
+				unsigned m_last_device;
+				int64_t m_cached_bytes; // read through the page cache in this hashing run
+				Worker m_main_worker;
+				std::vector<Worker*> m_workers;
 		};
 		
 		friend class Hasher;
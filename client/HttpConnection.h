@@ -74,7 +74,7 @@ class HttpConnection : BufferedSocketListener, public Speaker<HttpConnectionList
 			m_http_socket(nullptr) { }
 		~HttpConnection() noexcept
 		{
-			socket_cleanup(true);
+			socket_cleanup();
 		}
 #ifdef RIP_USE_CORAL
 		enum CoralizeStates {CST_DEFAULT, CST_CONNECTED, CST_NOCORALIZE};
@@ -84,13 +84,13 @@ class HttpConnection : BufferedSocketListener, public Speaker<HttpConnectionList
 		}
 #endif
 	private:
-		void socket_cleanup(bool p_delete)
+		void socket_cleanup()
 		{
 			if (m_http_socket)
 			{
 				m_http_socket->removeListeners();
 				m_http_socket->disconnect();
-				BufferedSocket::putBufferedSocket(m_http_socket, p_delete);
+				BufferedSocket::putBufferedSocket(m_http_socket);
 			}
 		}
 		
@@ -55,13 +55,14 @@ void IpGrant::load()
 			l_IPGrant_log.step("IPGrant.ini restored from internal resources");
 		}
 		l_IPGrant_log.step("parse IPGrant.ini");
+		IPList l_ipList;
+		if (!l_data.empty())
+		{
+			l_ipList.addData(l_data, l_IPGrant_log);
+		}
 		{
 			CFlyFastLock(g_cs);
-			g_ipList.clear();
-			if (!l_data.empty())
-			{
-				g_ipList.addData(l_data, l_IPGrant_log);
-			}
+			g_ipList.swap(l_ipList);
 		}
 		l_IPGrant_log.step("parse IPGrant.ini done");
 	}
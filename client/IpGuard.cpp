@@ -102,11 +102,12 @@ void IpGuard::load()
 		}
 		
 		l_IPGuard_log.step("parse IPGuard.ini");
-		g_ipGuardList.clear();
+		IPList l_ipGuardList;
 		if (!l_sIPGuard.empty())
 		{
-			g_ipGuardList.addData(l_sIPGuard, l_IPGuard_log);
+			l_ipGuardList.addData(l_sIPGuard, l_IPGuard_log);
 		}
+		g_ipGuardList.swap(l_ipGuardList);
 		l_IPGuard_log.step("parse IPGuard.ini done");
 	}
 	else
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_LINE_FRAMER_H
+#define DCPLUSPLUS_DCPP_LINE_FRAMER_H
+
+#include <string>
+#include <cstring>
+#include <boost/utility/string_view.hpp>
+
+/**
+ * [+] Cuts the hub commands right in the receive buffer of BufferedSocket (MODE_LINE and the inflated MODE_ZPIPE data).
+ * A command is given out as a string_view without its separator, the empty commands are skipped.
+ * Only the unfinished command at the end of a read is copied, the next read completes it.
+ */
+class LineFramer
+{
+	public:
+		/**
+		 * Gives every complete command of [p_data, p_data + p_len) to p_on_line(const boost::string_view&).
+		 * p_on_line returns false to stop right after the command (the mode of the socket was changed).
+		 * @return the bytes up to the end of the last command given out
+		 */
+		template<typename OnLine>
+		static size_t parseLines(const char* p_data, size_t p_len, char p_separator, OnLine& p_on_line, bool& p_is_stopped)
+		{
+			p_is_stopped = false;
+			const char* l_begin = p_data;
+			const char* const l_end = p_data + p_len;
+			while (l_begin != l_end)
+			{
+				const char* l_separator = static_cast<const char*>(memchr(l_begin, p_separator, l_end - l_begin));
+				if (l_separator == nullptr)
+				{
+					break;
+				}
+				const bool l_is_empty = l_separator == l_begin; // only the separator, don't waste cpu with it
+				const char* const l_line = l_begin;
+				l_begin = l_separator + 1;
+				if (!l_is_empty && !p_on_line(boost::string_view(l_line, l_separator - l_line)))
+				{
+					p_is_stopped = true;
+					break;
+				}
+			}
+			return l_begin - p_data;
+		}
+		
+		/**
+		 * One read: p_line holds the unfinished command of the previous read, it is completed and given out first,
+		 * then the commands of the read itself, the unfinished one at its end goes to p_line.
+		 * @return the bytes used, less than p_len only if p_on_line has stopped the framing
+		 */
+		template<typename OnLine>
+		static size_t feed(std::string& p_line, const char* p_data, size_t p_len, char p_separator, OnLine& p_on_line)
+		{
+			size_t l_used = 0;
+			bool l_is_stopped = false;
+			if (!p_line.empty())
+			{
+				const char* l_separator = static_cast<const char*>(memchr(p_data, p_separator, p_len));
+				l_used = l_separator ? l_separator - p_data + 1 : p_len;
+				p_line.append(p_data, l_used);
+				if (!l_separator)
+				{
+					return l_used;
+				}
+				std::string l_line;
+				l_line.swap(p_line);
+				parseLines(l_line.data(), l_line.size(), p_separator, p_on_line, l_is_stopped);
+				if (l_is_stopped)
+				{
+					return l_used;
+				}
+			}
+			l_used += parseLines(p_data + l_used, p_len - l_used, p_separator, p_on_line, l_is_stopped);
+			if (!l_is_stopped)
+			{
+				p_line.assign(p_data + l_used, p_len - l_used);
+				l_used = p_len;
+			}
+			return l_used;
+		}
+};
+
+#endif // DCPLUSPLUS_DCPP_LINE_FRAMER_H
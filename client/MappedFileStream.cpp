@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "MappedFileStream.h"
+#include "File.h"
+
+// PrefetchVirtualMemory is available since Windows 8
+struct FlyMemoryRangeEntry
+{
+	PVOID VirtualAddress;
+	SIZE_T NumberOfBytes;
+};
+typedef BOOL (WINAPI* PrefetchVirtualMemoryFunc)(HANDLE, ULONG_PTR, FlyMemoryRangeEntry*, ULONG);
+
+static PrefetchVirtualMemoryFunc getPrefetchVirtualMemory()
+{
+	static const PrefetchVirtualMemoryFunc g_func = (PrefetchVirtualMemoryFunc)GetProcAddress(GetModuleHandle(_T("kernel32.dll")), "PrefetchVirtualMemory");
+	return g_func;
+}
+
+static int inPageErrorFilter(DWORD p_code)
+{
+	return p_code == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH;
+}
+
+bool MappedFileStream::safeAccess(Accessor p_accessor, void* p_context, const uint8_t* p_data, size_t p_len)
+{
+	__try
+	{
+		p_accessor(p_context, p_data, p_len);
+		return true;
+	}
+	__except (inPageErrorFilter(GetExceptionCode()))
+	{
+		return false;
+	}
+}
+
+static void copyAccessor(void* p_context, const uint8_t* p_data, size_t p_len)
+{
+	memcpy(p_context, p_data, p_len);
+}
+
+MappedFileStream::MappedFileStream(const string& p_file_name) : m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr), m_view(nullptr),
+	m_view_pos(0), m_view_size(0), m_pos(0), m_size(0)
+{
+	m_file = ::CreateFile(File::formatPath(Text::toT(p_file_name)).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		throw FileException(Util::translateError());
+	}
+	LARGE_INTEGER l_size;
+	if (!::GetFileSizeEx(m_file, &l_size))
+	{
+		const string l_error = Util::translateError();
+		::CloseHandle(m_file);
+		throw FileException(l_error);
+	}
+	m_size = l_size.QuadPart;
+	if (m_size > 0) // An empty file can't be mapped
+	{
+		m_mapping = ::CreateFileMapping(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping == nullptr)
+		{
+			const string l_error = Util::translateError();
+			::CloseHandle(m_file);
+			throw FileException(l_error);
+		}
+	}
+}
+
+MappedFileStream::~MappedFileStream()
+{
+	unmapView();
+	if (m_mapping)
+	{
+		::CloseHandle(m_mapping);
+	}
+	::CloseHandle(m_file);
+}
+
+void MappedFileStream::unmapView()
+{
+	if (m_view)
+	{
+		::UnmapViewOfFile(m_view);
+		m_view = nullptr;
+		m_view_size = 0;
+	}
+}
+
+void MappedFileStream::mapView()
+{
+	unmapView();
+	// VIEW_SIZE is a multiple of the allocation granularity (64K)
+	m_view_pos = m_pos - m_pos % VIEW_SIZE;
+	m_view_size = size_t(min(int64_t(VIEW_SIZE), m_size - m_view_pos));
+	m_view = static_cast<const uint8_t*>(::MapViewOfFile(m_mapping, FILE_MAP_READ, DWORD(m_view_pos >> 32), DWORD(m_view_pos & 0xFFFFFFFF), m_view_size));
+	if (m_view == nullptr)
+	{
+		m_view_size = 0;
+		throw FileException(Util::translateError());
+	}
+	// Read-ahead: the pages of the view are read in the background while the first ones are used
+	if (const auto l_prefetch = getPrefetchVirtualMemory())
+	{
+		FlyMemoryRangeEntry l_range = { const_cast<uint8_t*>(m_view), m_view_size };
+		l_prefetch(GetCurrentProcess(), 1, &l_range, 0);
+	}
+}
+
+const uint8_t* MappedFileStream::readRef(size_t& p_len)
+{
+	if (m_pos >= m_size)
+	{
+		p_len = 0;
+		return m_view;
+	}
+	if (m_view == nullptr || m_pos < m_view_pos || m_pos >= m_view_pos + int64_t(m_view_size))
+	{
+		mapView();
+	}
+	const size_t l_offset = size_t(m_pos - m_view_pos);
+	p_len = min(p_len, m_view_size - l_offset);
+	m_pos += p_len;
+	return m_view + l_offset;
+}
+
+size_t MappedFileStream::read(void* p_buf, size_t& p_len)
+{
+	uint8_t* l_buf = static_cast<uint8_t*>(p_buf);
+	size_t l_done = 0;
+	while (l_done < p_len)
+	{
+		size_t l_len = p_len - l_done;
+		const uint8_t* l_data = readRef(l_len);
+		if (l_len == 0)
+			break;
+		if (!safeAccess(copyAccessor, l_buf + l_done, l_data, l_len))
+		{
+			throw FileException(Util::translateError(ERROR_READ_FAULT));
+		}
+		l_done += l_len;
+	}
+	p_len = l_done;
+	return l_done;
+}
+
+void MappedFileStream::setPos(int64_t p_pos)
+{
+	m_pos = min(max(p_pos, int64_t(0)), m_size);
+}
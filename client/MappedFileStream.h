@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_MAPPED_FILE_STREAM_H
+#define DCPLUSPLUS_DCPP_MAPPED_FILE_STREAM_H
+
+#include "Streams.h"
+
+/**
+ * Read-only file stream over a file mapping: the file is mapped by views of VIEW_SIZE bytes
+ * and every new view is prefetched in the background (PrefetchVirtualMemory, Windows 8+),
+ * the handle is opened with FILE_FLAG_SEQUENTIAL_SCAN for the cache manager read-ahead.
+ * readRef gives the data straight from the page cache without copying.
+ * I/O errors of the mapped pages (network, removable media) are reported by read() as FileException,
+ * the users of readRef must guard their access themselves (see safeAccess).
+ */
+class MappedFileStream : public InputStream
+{
+	public:
+		/** @throw FileException */
+		explicit MappedFileStream(const string& p_file_name);
+		~MappedFileStream();
+		
+		size_t read(void* p_buf, size_t& p_len) override;
+		void setPos(int64_t p_pos) override;
+		bool canReadRef() const override
+		{
+			return true;
+		}
+		const uint8_t* readRef(size_t& p_len) override;
+		
+		int64_t getSize() const
+		{
+			return m_size;
+		}
+		int64_t getPos() const
+		{
+			return m_pos;
+		}
+		HANDLE getHandle() const
+		{
+			return m_file;
+		}
+		
+		typedef void (*Accessor)(void* p_context, const uint8_t* p_data, size_t p_len);
+		/** Calls p_accessor(p_context, p_data, p_len) and turns an in-page error of the mapping into false */
+		static bool safeAccess(Accessor p_accessor, void* p_context, const uint8_t* p_data, size_t p_len);
+		
+		static const size_t VIEW_SIZE = 8 * 1024 * 1024;
+	private:
+		void mapView();
+		void unmapView();
+		
+		HANDLE m_file;
+		HANDLE m_mapping;
+		const uint8_t* m_view;
+		int64_t m_view_pos;
+		size_t m_view_size;
+		int64_t m_pos;
+		int64_t m_size;
+};
+
+#endif // DCPLUSPLUS_DCPP_MAPPED_FILE_STREAM_H
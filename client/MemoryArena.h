@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_MEMORY_ARENA_H
+#define DCPLUSPLUS_DCPP_MEMORY_ARENA_H
+
+#include <vector>
+#include <new>
+
+/**
+ * [+] Bump allocator: objects are placed one after another in big chunks,
+ * the chunks are freed all at once in the destructor.
+ * The destructors of the objects are never called - only objects that own no other memory may be created here.
+ * Not thread safe.
+ */
+class MemoryArena
+#ifdef _DEBUG
+	: private boost::noncopyable
+#endif
+{
+	public:
+		explicit MemoryArena(size_t p_chunk_size = 256 * 1024) : m_chunk_size(p_chunk_size), m_pos(nullptr), m_end(nullptr), m_allocated(0)
+		{
+		}
+		~MemoryArena()
+		{
+			for (auto i = m_chunks.cbegin(); i != m_chunks.cend(); ++i)
+			{
+				free(*i);
+			}
+		}
+		
+		void* allocate(size_t p_size, size_t p_align)
+		{
+			char* l_pos = alignUp(m_pos, p_align);
+			if (m_pos == nullptr || p_size > size_t(m_end - l_pos))
+			{
+				addChunk(p_size + p_align);
+				l_pos = alignUp(m_pos, p_align);
+			}
+			m_pos = l_pos + p_size;
+			m_allocated += p_size;
+			return l_pos;
+		}
+		template<typename T, typename... ArgT>
+		T* create(ArgT && ... args)
+		{
+			return new(allocate(sizeof(T), alignof(T))) T(std::forward<ArgT>(args)...);
+		}
+		
+		size_t getAllocated() const
+		{
+			return m_allocated;
+		}
+	
+	private:
+		static char* alignUp(char* p_pos, size_t p_align)
+		{
+			return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p_pos) + p_align - 1) & ~uintptr_t(p_align - 1));
+		}
+		void addChunk(size_t p_min_size)
+		{
+			const size_t l_size = std::max(m_chunk_size, p_min_size);
+			char* l_chunk = static_cast<char*>(malloc(l_size));
+			if (l_chunk == nullptr)
+			{
+				throw std::bad_alloc();
+			}
+			m_chunks.push_back(l_chunk);
+			m_pos = l_chunk;
+			m_end = l_chunk + l_size;
+		}
+		
+		const size_t m_chunk_size;
+		std::vector<char*> m_chunks;
+		char* m_pos;
+		char* m_end;
+		size_t m_allocated;
+};
+
+#endif // DCPLUSPLUS_DCPP_MEMORY_ARENA_H
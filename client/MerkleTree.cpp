@@ -18,8 +18,6 @@
 
 #include "stdinc.h"
 
-#ifdef FLYLINKDC_USE_GPU_TTH
-
 #include "MerkleTree.h"
 #include "SettingsManager.h"
 
@@ -33,63 +31,57 @@ void MerkleTreeGPU<Hasher>::update(const void* data, size_t len)
 	uint64_t lvlfc;
 	uint64_t hbc;
 	
-	bool b_res = true;
-	
-	bool b_use_cpu = !BOOLSETTING(USE_GPU_IN_TTH_COMPUTING) ||
-	                 GPGPUTTHManager::getInstance()->get()->get_status() != GPGPUPlatform::GPGPU_OK;
-	                 
+	// [!] The small buffers (file lists, downloaded chunks) are hashed right here,
+	// the platform gets the big ones: the OpenCL GPU when it is enabled, otherwise the CPU backend.
+	GPGPUPlatform* l_pfm = GPGPUTTHManager::isValidInstance() ? GPGPUTTHManager::getInstance()->get() : nullptr;
+	const bool b_use_cpu = l_pfm == nullptr ||
+	                       l_pfm->get_status() != GPGPUPlatform::GPGPU_OK ||
+	                       len < l_pfm->get_min_ttr_size() ||
+	                       (!BOOLSETTING(USE_GPU_IN_TTH_COMPUTING) && l_pfm->get_platform_name() != GPGPUCPU::PLATFORM_NAME);
+	                       
 	if (b_use_cpu)
 	{
-		MerkleTree::update(data, len);
+		Base::update(data, len);
 		return;
 	}
 	
 	// Skip empty data sets if we already added at least one of them...
-	if (len == 0 && !(leaves.empty() && blocks.empty()))
+	if (len == 0 && !(this->leaves.empty() && this->blocks.empty()))
 		return;
 		
 	buf = (uint8_t *)data;
-	bc = (len ? (len - 1 + BASE_BLOCK_SIZE) / BASE_BLOCK_SIZE : 1);
+	bc = (len ? (len - 1 + Base::BASE_BLOCK_SIZE) / Base::BASE_BLOCK_SIZE : 1);
 	
-	last_bs = (len ? (BASE_BLOCK_SIZE - 1 + len % BASE_BLOCK_SIZE) % BASE_BLOCK_SIZE + 1 : 0);
+	last_bs = (len ? (Base::BASE_BLOCK_SIZE - 1 + len % Base::BASE_BLOCK_SIZE) % Base::BASE_BLOCK_SIZE + 1 : 0);
 	
 	rbc = bc;
 	
 	do
 	{
-		if (blocks.empty())
+		if (this->blocks.empty())
 		{
-			lvbsz = blockSize;
+			lvbsz = this->blockSize;
 			
 			hbc = rbc;
 		}
 		else
 		{
-			auto lb = blocks.back();
+			auto lb = this->blocks.back();
 			lvbsz = lb.second;
 			
-			lvlfc = calcFullLeafCnt(lvbsz);
+			lvlfc = this->calcFullLeafCnt(lvbsz);
 			hbc = (rbc < lvlfc ? rbc : lvlfc);
 		}
 		
-		b_res = hash_blocks(buf, hbc, lvbsz, last_bs);
-		
-		// If error, dispatch update on CPU
-		if (!b_res)
-		{
-			MerkleTree::update(data, len);
-			return;
-		}
+		hash_blocks(l_pfm, buf, hbc, lvbsz, last_bs);
 		
 		rbc -= hbc;
-		buf += hbc * BASE_BLOCK_SIZE;
+		buf += hbc * Base::BASE_BLOCK_SIZE;
 	}
 	while (rbc);
 	
-	fileSize += (int64_t)len;
+	this->fileSize += (int64_t)len;
 }
 
 template void MerkleTreeGPU<TigerHash>::update(const void*, size_t);
 
-#endif // FLYLINKDC_USE_GPU_TTH
-
@@ -142,25 +142,47 @@ class MerkleTree
 				
 			do
 			{
+				// [+] Full leaves are independent - hash a batch of them at once (multi-buffer SIMD in TigerHash)
+				const size_t l_full_leaves = min((len - i) / BASE_BLOCK_SIZE, size_t(LEAF_BATCH));
+				if (l_full_leaves > 1)
+				{
+					uint8_t l_result[LEAF_BATCH * Hasher::BYTES];
+					Hasher::hashLeaves(buf + i, BASE_BLOCK_SIZE, l_full_leaves, l_result);
+					for (size_t j = 0; j < l_full_leaves; ++j)
+					{
+						addBaseBlock(MerkleValue(l_result + j * Hasher::BYTES));
+					}
+					i += l_full_leaves * BASE_BLOCK_SIZE;
+					continue;
+				}
 				size_t n = min(size_t(BASE_BLOCK_SIZE), len - i);
 				Hasher h;
 				h.update(&zero, 1);
 				h.update(buf + i, n); // n=1024 [4] https://www.box.net/shared/248a073eee69128a3c7b
-				if ((int64_t)BASE_BLOCK_SIZE < blockSize)
-				{
-					blocks.push_back(MerkleBlock(MerkleValue(h.finalize()), BASE_BLOCK_SIZE));
-					reduceBlocks();
-				}
-				else
-				{
-					leaves.push_back(MerkleValue(h.finalize()));
-				}
+				addBaseBlock(MerkleValue(h.finalize()));
 				i += n;
 			}
 			while (i < len);
 			fileSize += len;
 		}
 		
+		/**
+		 * [+] Adds the root of the next p_size bytes of the data: p_size is BASE_BLOCK_SIZE times a power of 2,
+		 * the data hashed so far is a multiple of it. The blocks of the same size are joined by reduceBlocks.
+		 */
+		void addBlock(const MerkleValue& p_value, int64_t p_size)
+		{
+			if (p_size < blockSize)
+			{
+				blocks.push_back(MerkleBlock(p_value, p_size));
+				reduceBlocks();
+			}
+			else
+			{
+				leaves.push_back(p_value);
+			}
+		}
+		
 		uint8_t* finalize()
 		{
 			// No updates yet, make sure we have at least one leaf for 0-length files...
@@ -292,6 +314,14 @@ class MerkleTree
 	private:
 		MerkleValue root;
 		
+		/** Leaves hashed by one Hasher::hashLeaves call in update */
+		static const size_t LEAF_BATCH = 4 * Hasher::LEAF_LANES;
+		
+		void addBaseBlock(const MerkleValue& p_value)
+		{
+			addBlock(p_value, BASE_BLOCK_SIZE);
+		}
+
 		MerkleValue getHash(int64_t start, int64_t length)
 		{
 			dcassert(start + length <= fileSize);
@@ -405,7 +435,6 @@ class MerkleTree
 			// [~] IRainman opt.
 		}
 };
-#ifdef FLYLINKDC_USE_GPU_TTH
 
 template < class Hasher, const size_t baseBlockSize = 1024 >
 class MerkleTreeGPU : public MerkleTree<Hasher, baseBlockSize> { };
@@ -417,56 +446,57 @@ class MerkleTreeGPU : public MerkleTree<Hasher, baseBlockSize> { };
 template <class Hasher>
 class MerkleTreeGPU<Hasher> : public MerkleTree<Hasher>
 {
+		typedef MerkleTree<Hasher> Base;
 	public:
-		MerkleTreeGPU() : MerkleTree() {}
-		MerkleTreeGPU(int64_t aBlockSize) : MerkleTree(aBlockSize) { }
+		typedef typename Base::MerkleValue MerkleValue;
+		
+		MerkleTreeGPU() : Base() {}
+		MerkleTreeGPU(int64_t aBlockSize) : Base(aBlockSize) { }
 		MerkleTreeGPU(int64_t p_FileSize, int64_t p_BlockSize, uint8_t* p_Data, size_t p_DataSize)
-			: MerkleTree(p_FileSize, p_BlockSize, p_Data, p_DataSize) { }
+			: Base(p_FileSize, p_BlockSize, p_Data, p_DataSize) { }
 		MerkleTreeGPU(int64_t aFileSize, int64_t aBlockSize, const MerkleValue& aRoot)
-			: MerkleTree(aFileSize, aBlockSize, aRoot) { }
+			: Base(aFileSize, aBlockSize, aRoot) { }
 			
 		void update(const void* data, size_t len);
 		
 	private:
-		bool hash_blocks(uint8_t *buf, uint64_t bc, uint64_t lvbsz, uint64_t last_bs)
+		// [!] A loop, not the recursion: a 16 MB buffer is up to 16384 blocks
+		void hash_blocks(GPGPUPlatform* p_pfm, uint8_t *buf, uint64_t bc, uint64_t lvbsz, uint64_t last_bs)
 		{
-			uint64_t lvlfc;
 			uint8_t res[Hasher::BYTES];
 			
-			bool b_res = true;
-			
-			if (!bc) return b_res;
-			
-			lvlfc = calcFullLeafCnt(lvbsz);
-			
-			if (bc < lvlfc)
-			{
-				return hash_blocks(buf, bc, lvbsz >> 1, last_bs);
-			}
-			
-			b_res = GPGPUTTHManager::getInstance()->get()->krn_ttr(buf, lvlfc, (bc == lvlfc ? last_bs : BASE_BLOCK_SIZE), (uint64_t *)res);
-			
-			// Data doesn't been processed on GPU
-			if (!b_res) return b_res;
-			
-			if (lvbsz < (uint64_t)blockSize)
+			while (bc)
 			{
-				blocks.push_back(MerkleBlock(MerkleValue(res), lvbsz));
-				reduceBlocks();
-			}
-			else
-			{
-				leaves.push_back(MerkleValue(res));
+				const uint64_t lvlfc = this->calcFullLeafCnt(lvbsz);
+				
+				if (bc < lvlfc)
+				{
+					lvbsz >>= 1;
+					continue;
+				}
+				
+				const uint64_t l_last_bs = (bc == lvlfc ? last_bs : Base::BASE_BLOCK_SIZE);
+				
+				// [!] Data doesn't been processed on GPU - the root of this block is computed here,
+				// the blocks already added stay (the whole buffer can't be hashed again).
+				if (!p_pfm->krn_ttr(buf, lvlfc, l_last_bs, (uint64_t *)res))
+				{
+					Base l_block_tree(static_cast<int64_t>(lvbsz));
+					l_block_tree.update(buf, size_t((lvlfc - 1) * Base::BASE_BLOCK_SIZE + l_last_bs));
+					l_block_tree.finalize();
+					memcpy(res, l_block_tree.getRoot().data, Hasher::BYTES);
+				}
+				
+				this->addBlock(MerkleValue(res), int64_t(lvbsz));
+				
+				buf += lvlfc * Base::BASE_BLOCK_SIZE;
+				bc -= lvlfc;
 			}
-			
-			return hash_blocks(buf + lvlfc * BASE_BLOCK_SIZE, bc - lvlfc, lvbsz, last_bs);
 		}
 };
 
+// [!] The tree roots of the big buffers go to GPGPUTTHManager: OpenCL or the CPU backend (all the cores)
 typedef MerkleTreeGPU<TigerHash> TigerTree;
-#else
-typedef MerkleTree<TigerHash> TigerTree;
-#endif // FLYLINKDC_USE_GPU_TTH
 
 typedef TigerTree::MerkleValue TTHValue;
 
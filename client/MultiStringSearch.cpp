@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "MultiStringSearch.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLYLINKDC_USE_SSE2_PREFILTER
+#endif
+
+bool MultiStringSearch::init(const StringSearch::List& p_patterns)
+{
+	m_patterns.clear();
+	m_delta.clear();
+	m_output.clear();
+	m_full_mask = 0;
+	m_min_length = 0;
+	m_first_count = 0;
+	memset(m_class, 0, sizeof(m_class));
+	memset(m_is_first, 0, sizeof(m_is_first));
+
+	size_t l_total_length = 0;
+	for (auto i = p_patterns.cbegin(); i != p_patterns.cend(); ++i)
+	{
+		const string& l_pattern = i->getPattern();
+		if (l_pattern.empty() || std::find(m_patterns.begin(), m_patterns.end(), l_pattern) != m_patterns.end())
+			continue;
+		if (m_patterns.size() == MAX_PATTERNS)
+		{
+			m_patterns.clear();
+			return false;
+		}
+		m_patterns.push_back(l_pattern);
+		l_total_length += l_pattern.size();
+	}
+	if (l_total_length >= 0xFFFF)
+	{
+		m_patterns.clear();
+		return false;
+	}
+	if (m_patterns.empty())
+	{
+		m_class_count = 1;
+		return true;
+	}
+
+	// Compress the alphabet: every byte present in the patterns gets its own class
+	m_class_count = 1;
+	m_min_length = string::npos;
+	for (auto i = m_patterns.cbegin(); i != m_patterns.cend(); ++i)
+	{
+		m_min_length = std::min(m_min_length, i->size());
+		for (auto c = i->cbegin(); c != i->cend(); ++c)
+		{
+			const uint8_t l_byte = static_cast<uint8_t>(*c);
+			if (m_class[l_byte] == 0)
+				m_class[l_byte] = m_class_count++;
+		}
+		const uint8_t l_first = static_cast<uint8_t>((*i)[0]);
+		if (!m_is_first[l_first])
+		{
+			m_is_first[l_first] = true;
+			if (m_first_count < _countof(m_first))
+				m_first[m_first_count] = l_first;
+			++m_first_count;
+		}
+	}
+
+	// Trie (goto function), 0 in m_delta means "no edge" for every state except the root
+	m_delta.assign(m_class_count, 0);
+	m_output.assign(1, 0);
+	for (size_t i = 0; i < m_patterns.size(); ++i)
+	{
+		uint16_t l_state = 0;
+		const string& l_pattern = m_patterns[i];
+		for (auto c = l_pattern.cbegin(); c != l_pattern.cend(); ++c)
+		{
+			uint16_t& l_next = m_delta[l_state * m_class_count + m_class[static_cast<uint8_t>(*c)]];
+			if (l_next == 0)
+			{
+				l_next = static_cast<uint16_t>(m_output.size());
+				m_delta.resize(m_delta.size() + m_class_count, 0);
+				m_output.push_back(0);
+			}
+			l_state = m_delta[l_state * m_class_count + m_class[static_cast<uint8_t>(*c)]];
+		}
+		m_output[l_state] |= Mask(1) << i;
+		m_full_mask |= Mask(1) << i;
+	}
+
+	// Failure links (BFS), turning the trie into a complete DFA
+	std::vector<uint16_t> l_fail(m_output.size(), 0);
+	std::vector<uint16_t> l_queue;
+	l_queue.reserve(m_output.size());
+	for (uint16_t c = 0; c < m_class_count; ++c)
+	{
+		const uint16_t l_next = m_delta[c];
+		if (l_next)
+			l_queue.push_back(l_next);
+	}
+	for (size_t q = 0; q < l_queue.size(); ++q)
+	{
+		const uint16_t l_state = l_queue[q];
+		m_output[l_state] |= m_output[l_fail[l_state]];
+		for (uint16_t c = 0; c < m_class_count; ++c)
+		{
+			uint16_t& l_next = m_delta[l_state * m_class_count + c];
+			const uint16_t l_fail_next = m_delta[l_fail[l_state] * m_class_count + c];
+			if (l_next)
+			{
+				l_fail[l_next] = l_fail_next;
+				l_queue.push_back(l_next);
+			}
+			else
+			{
+				l_next = l_fail_next;
+			}
+		}
+	}
+	return true;
+}
+
+const uint8_t* MultiStringSearch::skipToFirst(const uint8_t* p_pos, const uint8_t* p_end) const noexcept
+{
+#ifdef FLYLINKDC_USE_SSE2_PREFILTER
+	if (m_first_count <= _countof(m_first))
+	{
+		const __m128i l_c0 = _mm_set1_epi8(static_cast<char>(m_first[0]));
+		const __m128i l_c1 = _mm_set1_epi8(static_cast<char>(m_first[m_first_count > 1 ? 1 : 0]));
+		const __m128i l_c2 = _mm_set1_epi8(static_cast<char>(m_first[m_first_count > 2 ? 2 : 0]));
+		const __m128i l_c3 = _mm_set1_epi8(static_cast<char>(m_first[m_first_count > 3 ? 3 : 0]));
+		while (p_end - p_pos >= 16)
+		{
+			const __m128i l_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_pos));
+			const __m128i l_eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(l_block, l_c0), _mm_cmpeq_epi8(l_block, l_c1)),
+			                                  _mm_or_si128(_mm_cmpeq_epi8(l_block, l_c2), _mm_cmpeq_epi8(l_block, l_c3)));
+			const unsigned l_bits = static_cast<unsigned>(_mm_movemask_epi8(l_eq));
+			if (l_bits)
+			{
+				unsigned long l_index;
+				_BitScanForward(&l_index, l_bits);
+				return p_pos + l_index;
+			}
+			p_pos += 16;
+		}
+	}
+#endif
+	while (p_pos < p_end && !m_is_first[*p_pos])
+		++p_pos;
+	return p_pos;
+}
+
+MultiStringSearch::Mask MultiStringSearch::matchLower(const uint8_t* p_text, size_t p_len, Mask p_need) const noexcept
+{
+	p_need &= m_full_mask;
+	if (p_need == 0 || p_len < m_min_length)
+		return 0;
+	Mask l_found = 0;
+	uint16_t l_state = 0;
+	const uint8_t* l_pos = p_text;
+	const uint8_t* const l_end = p_text + p_len;
+	while (l_pos < l_end)
+	{
+		if (l_state == 0)
+		{
+			l_pos = skipToFirst(l_pos, l_end);
+			if (l_pos == l_end)
+				break;
+		}
+		l_state = m_delta[l_state * m_class_count + m_class[*l_pos++]];
+		l_found |= m_output[l_state];
+		if ((l_found & p_need) == p_need)
+			break;
+	}
+	return l_found & p_need;
+}
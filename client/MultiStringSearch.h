@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_MULTI_STRING_SEARCH_H
+#define DCPLUSPLUS_DCPP_MULTI_STRING_SEARCH_H
+
+#include "StringSearch.h"
+
+/**
+ * Aho-Corasick automaton that matches all the terms of one query against a
+ * lower-cased text in a single pass. Every term owns one bit of a Mask, so the
+ * caller can track the terms that are still unsatisfied (e.g. terms already found
+ * in a parent directory name) without copying any StringSearch::List.
+ * While the automaton sits in its root state the text is skipped with an SSE2
+ * scan for the first bytes of the terms.
+ */
+class MultiStringSearch
+{
+	public:
+		typedef uint64_t Mask;
+		static const size_t MAX_PATTERNS = 64;
+
+		MultiStringSearch() : m_full_mask(0), m_class_count(1), m_min_length(0), m_first_count(0)
+		{
+			memset(m_class, 0, sizeof(m_class));
+			memset(m_first, 0, sizeof(m_first));
+			memset(m_is_first, 0, sizeof(m_is_first));
+		}
+		explicit MultiStringSearch(const StringSearch::List& p_patterns) : MultiStringSearch()
+		{
+			init(p_patterns);
+		}
+		/** Build the automaton. Equal patterns share one bit; returns false if there are more than MAX_PATTERNS distinct ones
+		    (or the patterns are too long for 16-bit states). */
+		bool init(const StringSearch::List& p_patterns);
+
+		bool empty() const
+		{
+			return m_full_mask == 0;
+		}
+		/** Mask with a bit set for every (distinct) pattern */
+		Mask getFullMask() const
+		{
+			return m_full_mask;
+		}
+		size_t size() const
+		{
+			return m_patterns.size();
+		}
+		const string& getPattern(size_t p_index) const
+		{
+			return m_patterns[p_index];
+		}
+		/**
+		 * Match a lower-cased text against the patterns selected by p_need.
+		 * @return subset of p_need found in the text; the scan stops as soon as all of p_need is found.
+		 */
+		Mask matchLower(const string& p_text, Mask p_need) const noexcept
+		{
+			dcassert(Text::toLower(p_text) == p_text);
+			return matchLower(reinterpret_cast<const uint8_t*>(p_text.data()), p_text.size(), p_need);
+		}
+		Mask matchLower(const uint8_t* p_text, size_t p_len, Mask p_need) const noexcept;
+		/** All patterns from p_need are found in the text */
+		bool matchAllLower(const string& p_text, Mask p_need) const noexcept
+		{
+			return matchLower(p_text, p_need) == p_need;
+		}
+		bool matchAllLower(const uint8_t* p_text, size_t p_len, Mask p_need) const noexcept
+		{
+			return matchLower(p_text, p_len, p_need) == p_need;
+		}
+	private:
+		const uint8_t* skipToFirst(const uint8_t* p_pos, const uint8_t* p_end) const noexcept;
+
+		StringList m_patterns;
+		/** DFA: m_delta[state * m_class_count + byte class] */
+		std::vector<uint16_t> m_delta;
+		/** Patterns ending in the state (including ones reached by failure links) */
+		std::vector<Mask> m_output;
+		Mask m_full_mask;
+		/** Byte -> class; class 0 collects the bytes absent in all patterns, so there can be 257 classes */
+		uint16_t m_class[256];
+		uint16_t m_class_count;
+		size_t m_min_length;
+		/** First bytes of the patterns - used by the SIMD prefilter when there are at most 4 distinct ones */
+		uint8_t m_first[4];
+		uint16_t m_first_count;
+		bool m_is_first[256];
+};
+
+#endif // DCPLUSPLUS_DCPP_MULTI_STRING_SEARCH_H
@@ -22,6 +22,8 @@
 #pragma once
 
 #include <boost/unordered/unordered_map.hpp>
+#include <boost/container/small_vector.hpp>
+#include <boost/utility/string_view.hpp>
 #include "StringPool.h"
 #include "User.h"
 #include "UserInfoBase.h"
@@ -120,7 +122,7 @@ class Identity
 			CT_USE_IP6 = 0x80
 		};
 		
-		Identity()
+		Identity() : m_string_fields(nullptr)
 		{
 			memzero(&m_bits_info, sizeof(m_bits_info));
 			m_is_p2p_guard_calc = false;
@@ -131,7 +133,7 @@ class Identity
 			m_virus_type = 0;
 #endif
 		}
-		Identity(const UserPtr& ptr, uint32_t aSID) : user(ptr)
+		Identity(const UserPtr& ptr, uint32_t aSID) : user(ptr), m_string_fields(nullptr)
 		{
 			memzero(&m_bits_info, sizeof(m_bits_info));
 			m_is_p2p_guard_calc = false;
@@ -162,7 +164,7 @@ class Identity
 		};
 		
 #ifndef IRAINMAN_IDENTITY_IS_NON_COPYABLE
-		Identity(const Identity& rhs)
+		Identity(const Identity& rhs) : m_string_fields(nullptr)
 		{
 			*this = rhs; // Use operator= since we have to lock before reading...
 		}
@@ -170,7 +172,7 @@ class Identity
 		{
 			FastUniqueLock l(g_cs);
 			user = rhs.user;
-			m_stringInfo = rhs.m_stringInfo;
+			setStringFields(rhs);
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 			m_virus_type = rhs.m_virus_type;
 #endif
@@ -811,6 +813,10 @@ class Identity
 				return Util::emptyString;
 		}
 		void setStringParam(const char* p_name, const string& p_val);
+		/** The string fields of one INF: the tag and the value, an empty value removes the field */
+		typedef boost::container::small_vector<std::pair<short, boost::string_view>, 8> StringParams;
+		/** setStringParam of all the fields at once: one lock and at most one new array for the whole INF */
+		void setStringParams(const StringParams& p_params);
 		bool isAppNameExists() const
 		{
 			if (getDicAP() > 0)
@@ -846,10 +852,46 @@ class Identity
 		}
 		bool setExtJSON(const string& p_ExtJSON);
 		
-		typedef boost::unordered_map<short, string> InfMap;
-		
+		// [!] The string fields sorted by the tag, the values are in StringPool (the array holds a reference to each one).
+		// Read and changed under m_si_fcs, a changed value is replaced in place, a new array is allocated
+		// only when a field is added or removed.
+		struct StringFields
+		{
+			struct Field
+			{
+				short m_tag;
+				StringPool::StringPoolItemPtr m_value;
+			};
+			size_t m_count;
+			Field m_fields[1];
+			
+			Field* begin()
+			{
+				return m_fields;
+			}
+			Field* end()
+			{
+				return m_fields + m_count;
+			}
+			const Field* begin() const
+			{
+				return m_fields;
+			}
+			const Field* end() const
+			{
+				return m_fields + m_count;
+			}
+			static StringFields* create(size_t p_count);
+			static void destroy(StringFields* p_fields);
+		};
+		StringFields* m_string_fields;
 		mutable FastCriticalSection m_si_fcs;
-		InfMap m_stringInfo;
+		/** false - the value isn't kept in the string fields (AP/VE go to the dictionary, an empty EM/DE that was empty already) */
+		bool prepareStringParam(short p_tag, const boost::string_view& p_val);
+		void setStringParamsL(const StringParams& p_params);
+#ifndef IRAINMAN_IDENTITY_IS_NON_COPYABLE
+		void setStringFields(const Identity& rhs);
+#endif
 		
 		typedef vector<string> StringDictionaryReductionPointers;
 		typedef boost::unordered_map<string, uint16_t> StringDictionaryIndex;
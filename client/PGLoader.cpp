@@ -120,10 +120,10 @@ void PGLoader::load(const string& p_data /*= Util::emptyString*/)
 		l_data = p_data;
 	}
 	
-	CFlyFastLock(g_cs);
 	l_IPTrust_log.step("parse IPTrust.ini");
-	g_ipTrustListAllow.clear();
-	g_ipTrustListBlock.clear();
+	// [!] The lists are loaded aside and swapped in, check() isn't blocked by the parsing
+	IPList l_allow;
+	IPList l_block;
 	
 	if (!l_data.empty())
 	{
@@ -135,17 +135,24 @@ void PGLoader::load(const string& p_data /*= Util::emptyString*/)
 			if (lineend == string::npos)
 			{
 				string l_line = l_data.substr(linestart);
-				addLine(l_line, l_IPTrust_log);
+				addLine(l_line, l_allow, l_block, l_IPTrust_log);
 				break;
 			}
 			else
 			{
 				string l_line = l_data.substr(linestart, lineend - linestart - 1);
-				addLine(l_line, l_IPTrust_log);
+				addLine(l_line, l_allow, l_block, l_IPTrust_log);
 				linestart = lineend + 1;
 			}
 		}
 	}
+	l_allow.build();
+	l_block.build();
+	{
+		CFlyFastLock(g_cs);
+		g_ipTrustListAllow.swap(l_allow);
+		g_ipTrustListBlock.swap(l_block);
+	}
 	l_IPTrust_log.step("parse IPTrust.ini done");
 }
 
@@ -184,7 +191,7 @@ bool PGLoader::check(uint32_t p_ip4)
 	}
 }
 
-void PGLoader::addLine(string& p_Line, CFlyLog& p_log)
+void PGLoader::addLine(string& p_Line, IPList& p_allow, IPList& p_block, CFlyLog& p_log)
 {
 	boost::replace_all(p_Line, " ", "");
 	if (p_Line.empty())
@@ -196,11 +203,11 @@ void PGLoader::addLine(string& p_Line, CFlyLog& p_log)
 	if (p_Line[0] == '-')
 	{
 		p_Line.erase(0, 1);
-		g_ipTrustListBlock.addLine(p_Line, p_log);
+		p_block.addLine(p_Line, p_log);
 	}
 	else
 	{
-		g_ipTrustListAllow.addLine(p_Line, p_log);
+		p_allow.addLine(p_Line, p_log);
 	}
 }
 
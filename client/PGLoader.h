@@ -21,13 +21,13 @@ class PGLoader
 		{
 		}
 		static bool check(uint32_t p_ip4);
-		static void addLine(string& p_Line, CFlyLog& p_log);
 		static void load(const string& p_data = Util::emptyString);
 		static string getConfigFileName()
 		{
 			return Util::getConfigPath() + "IPTrust.ini";
 		}
 	private:
+		static void addLine(string& p_Line, IPList& p_allow, IPList& p_block, CFlyLog& p_log);
 		static FastCriticalSection g_cs;
 		static IPList  g_ipTrustListAllow;
 		static IPList  g_ipTrustListBlock;
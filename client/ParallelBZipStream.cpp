@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ParallelBZipStream.h"
+#include "BZUtils.h"
+#include "ResourceManager.h"
+
+ParallelBZipOutputStream::ParallelBZipOutputStream(OutputStream* p_out) : m_out(p_out), m_is_flushed(false)
+{
+	m_window = WorkerPool::getInstance()->getThreadsCount() * 2;
+}
+
+ParallelBZipOutputStream::~ParallelBZipOutputStream()
+{
+	// The jobs of the blocks not written yet refer to them
+	m_jobs.wait();
+}
+
+size_t ParallelBZipOutputStream::write(const void* p_buf, size_t p_len)
+{
+	if (m_is_flushed)
+		throw Exception("No filtered writes after flush");
+	
+	size_t l_written = 0;
+	const char* l_buf = static_cast<const char*>(p_buf);
+	while (p_len > 0)
+	{
+		if (m_current.empty())
+		{
+			m_current.reserve(BLOCK_SIZE);
+		}
+		const size_t l_len = std::min(p_len, BLOCK_SIZE - m_current.size());
+		m_current.append(l_buf, l_len);
+		l_buf += l_len;
+		p_len -= l_len;
+		if (m_current.size() == BLOCK_SIZE)
+		{
+			if (m_blocks.size() >= m_window)
+			{
+				l_written += writeFirstBlock();
+			}
+			submitBlock();
+		}
+	}
+	return l_written;
+}
+
+size_t ParallelBZipOutputStream::flushBuffers(bool p_force)
+{
+	if (m_is_flushed)
+		return 0;
+	m_is_flushed = true;
+	
+	// An empty list is still a valid .bz2 of one empty stream
+	if (!m_current.empty() || m_blocks.empty())
+	{
+		submitBlock();
+	}
+	size_t l_written = 0;
+	while (!m_blocks.empty())
+	{
+		l_written += writeFirstBlock();
+	}
+	return l_written + m_out->flushBuffers(p_force);
+}
+
+void ParallelBZipOutputStream::submitBlock()
+{
+	const auto l_block = std::make_shared<Block>();
+	l_block->m_data.swap(m_current);
+	m_blocks.push_back(l_block);
+	// The block packed by writeFirstBlock may be gone before its job is run
+	m_jobs.post([this, l_block]()
+	{
+		runBlock(*l_block);
+	});
+}
+
+size_t ParallelBZipOutputStream::writeFirstBlock()
+{
+	dcassert(!m_blocks.empty());
+	Block& l_block = *m_blocks.front();
+	if (!BaseThread::safeExchange(l_block.m_is_taken, 1))
+	{
+		// The pool is busy with other work: the oldest block isn't waited for
+		packBlock(l_block);
+	}
+	else
+	{
+		// m_done is signaled for every block in any order, so the first one is checked again after each signal
+		while (!l_block.m_is_done)
+		{
+			m_done.wait();
+		}
+	}
+	if (!l_block.m_error.empty())
+	{
+		throw Exception(l_block.m_error);
+	}
+	const size_t l_written = l_block.m_packed.empty() ? 0 : m_out->write(l_block.m_packed.data(), l_block.m_packed.size());
+	m_blocks.pop_front();
+	return l_written;
+}
+
+void ParallelBZipOutputStream::pack(const void* p_data, size_t p_len, string& p_out)
+{
+	BZFilter l_filter;
+	const size_t l_buf_size = 64 * 1024;
+	std::unique_ptr<char[]> l_buf(new char[l_buf_size]);
+	p_out.reserve(p_out.size() + p_len / 4);
+	const char* l_in = static_cast<const char*>(p_data);
+	while (p_len > 0)
+	{
+		size_t l_in_len = p_len;
+		size_t l_out_len = l_buf_size;
+		l_filter(l_in, l_in_len, l_buf.get(), l_out_len);
+		l_in += l_in_len;
+		p_len -= l_in_len;
+		p_out.append(l_buf.get(), l_out_len);
+	}
+	for (;;)
+	{
+		size_t l_zero = 0;
+		size_t l_out_len = l_buf_size;
+		const bool l_more = l_filter(nullptr, l_zero, l_buf.get(), l_out_len);
+		p_out.append(l_buf.get(), l_out_len);
+		if (!l_more)
+			break;
+	}
+}
+
+void ParallelBZipOutputStream::packBlock(Block& p_block)
+{
+	try
+	{
+		pack(p_block.m_data.data(), p_block.m_data.size(), p_block.m_packed);
+	}
+	catch (const Exception& e)
+	{
+		p_block.m_error = e.getError();
+	}
+	catch (const std::bad_alloc&)
+	{
+		p_block.m_error = STRING(BAD_ALLOC);
+	}
+	string().swap(p_block.m_data);
+}
+
+void ParallelBZipOutputStream::runBlock(Block& p_block)
+{
+	if (BaseThread::safeExchange(p_block.m_is_taken, 1))
+		return;
+	packBlock(p_block);
+	BaseThread::safeExchange(p_block.m_is_done, 1);
+	m_done.signal();
+}
+
+ParallelBZipInputStream::ParallelBZipInputStream(InputStream* p_in) : m_in(p_in), m_is_eof(false), m_current_pos(0), m_is_stop(false)
+{
+	m_window = WorkerPool::getInstance()->getThreadsCount() * 2;
+}
+
+ParallelBZipInputStream::~ParallelBZipInputStream()
+{
+	{
+		CFlyFastLock(m_cs);
+		m_is_stop = true;
+	}
+	for (auto i = m_tasks.cbegin(); i != m_tasks.cend(); ++i)
+	{
+		(*i)->m_space.signal();
+		(*i)->m_input.signal();
+	}
+	m_jobs.wait();
+}
+
+bool ParallelBZipInputStream::isInputNeeded()
+{
+	if (m_is_eof)
+		return false;
+	if (m_tasks.empty())
+		return true;
+	if (m_tasks.size() > m_window)
+		return false;
+	CFlyFastLock(m_cs);
+	return m_tasks.back()->m_in.size() < MAX_PARTS;
+}
+
+void ParallelBZipInputStream::readPacked()
+{
+	const size_t l_old = m_packed.size();
+	m_packed.resize(l_old + CHUNK_SIZE);
+	size_t l_len = CHUNK_SIZE;
+	const size_t l_read = m_in->read(&m_packed[l_old], l_len);
+	m_packed.resize(l_old + l_read);
+	m_is_eof = l_read == 0;
+	
+	// Every stream starts byte-aligned with "BZh1".."BZh9" and the magic of the first block.
+	// A false match inside the packed data can only break the unpacking of its part, that is an error anyway.
+	// m_packed starts with the beginning of the file or with the tail kept by the previous read.
+	size_t l_start = 0;
+	for (size_t i = m_tasks.empty() ? 1 : 0; i + 10 <= m_packed.size(); ++i)
+	{
+		i = m_packed.find("BZh", i);
+		if (i == string::npos || i + 10 > m_packed.size())
+			break;
+		if (m_packed[i + 3] >= '1' && m_packed[i + 3] <= '9' && memcmp(&m_packed[i + 4], "1AY&SY", 6) == 0)
+		{
+			addInput(l_start, i, true);
+			l_start = i;
+		}
+	}
+	// The start of the next stream may be cut by the end of the read
+	const size_t l_end = m_is_eof ? m_packed.size() : std::max(l_start, m_packed.size() - std::min<size_t>(m_packed.size(), 9));
+	addInput(l_start, l_end, m_is_eof);
+	m_packed.erase(0, l_end);
+}
+
+void ParallelBZipInputStream::addInput(size_t p_begin, size_t p_end, bool p_is_last)
+{
+	if (m_tasks.empty() || m_tasks.back()->m_is_in_done)
+	{
+		if (p_begin == p_end)
+			return;
+		m_tasks.push_back(std::unique_ptr<Task>(new Task));
+		Task* const l_task = m_tasks.back().get();
+		m_jobs.post([this, l_task]()
+		{
+			runTask(*l_task);
+		});
+	}
+	Task& l_task = *m_tasks.back();
+	{
+		CFlyFastLock(m_cs);
+		if (p_end > p_begin)
+		{
+			l_task.m_in.push_back(m_packed.substr(p_begin, p_end - p_begin));
+		}
+		l_task.m_is_in_done = p_is_last;
+	}
+	l_task.m_input.signal();
+}
+
+bool ParallelBZipInputStream::takeInput(Task& p_task, string& p_part)
+{
+	for (;;)
+	{
+		{
+			CFlyFastLock(m_cs);
+			if (m_is_stop)
+				return false;
+			if (!p_task.m_in.empty())
+			{
+				p_part.swap(p_task.m_in.front());
+				p_task.m_in.pop_front();
+				break;
+			}
+			if (p_task.m_is_in_done)
+				return false;
+		}
+		p_task.m_input.wait();
+	}
+	m_data.signal(); // the reader may read on
+	return true;
+}
+
+void ParallelBZipInputStream::runTask(Task& p_task)
+{
+	try
+	{
+		unpack(p_task);
+	}
+	catch (const Exception& e)
+	{
+		p_task.m_error = e.getError();
+	}
+	catch (const std::bad_alloc&)
+	{
+		p_task.m_error = STRING(BAD_ALLOC);
+	}
+	{
+		CFlyFastLock(m_cs);
+		p_task.m_is_done = true;
+	}
+	m_data.signal();
+}
+
+void ParallelBZipInputStream::unpack(Task& p_task)
+{
+	bz_stream zs;
+	memzero(&zs, sizeof(zs));
+	if (BZ2_bzDecompressInit(&zs, 0, 0) != BZ_OK)
+		throw Exception(STRING(DECOMPRESSION_ERROR));
+	std::unique_ptr<bz_stream, decltype(&BZ2_bzDecompressEnd)> l_end(&zs, &BZ2_bzDecompressEnd);
+	string l_part; // zs.next_in points into it
+	bool l_is_in_end = false;
+	bool l_is_end = false;
+	while (!l_is_end && !m_is_stop)
+	{
+		string l_chunk;
+		l_chunk.resize(CHUNK_SIZE);
+		zs.next_out = &l_chunk[0];
+		zs.avail_out = CHUNK_SIZE;
+		while (zs.avail_out != 0)
+		{
+			if (zs.avail_in == 0 && !l_is_in_end)
+			{
+				l_is_in_end = !takeInput(p_task, l_part);
+				if (!l_is_in_end)
+				{
+					zs.next_in = &l_part[0];
+					zs.avail_in = static_cast<unsigned>(l_part.size());
+				}
+			}
+			const int l_err = BZ2_bzDecompress(&zs);
+			if (l_err == BZ_STREAM_END)
+			{
+				if (zs.avail_in == 0)
+				{
+					l_is_in_end = l_is_in_end || !takeInput(p_task, l_part);
+					if (l_is_in_end)
+					{
+						l_is_end = true;
+						break;
+					}
+					zs.next_in = &l_part[0];
+					zs.avail_in = static_cast<unsigned>(l_part.size());
+				}
+				// One more stream in the same part
+				char* const l_next_in = zs.next_in;
+				const unsigned l_avail_in = zs.avail_in;
+				BZ2_bzDecompressEnd(&zs);
+				if (BZ2_bzDecompressInit(&zs, 0, 0) != BZ_OK)
+					throw Exception(STRING(DECOMPRESSION_ERROR));
+				zs.next_in = l_next_in;
+				zs.avail_in = l_avail_in;
+				continue;
+			}
+			// No more packed data, but the stream isn't finished
+			if (l_err != BZ_OK || (l_is_in_end && zs.avail_in == 0 && zs.avail_out != 0))
+				throw Exception(STRING(DECOMPRESSION_ERROR));
+		}
+		l_chunk.resize(CHUNK_SIZE - zs.avail_out);
+		if (!l_chunk.empty())
+		{
+			push(p_task, l_chunk);
+		}
+	}
+}
+
+void ParallelBZipInputStream::push(Task& p_task, string& p_chunk)
+{
+	for (;;)
+	{
+		{
+			CFlyFastLock(m_cs);
+			if (p_task.m_chunks.size() < MAX_CHUNKS || m_is_stop)
+			{
+				p_task.m_chunks.push_back(string());
+				p_task.m_chunks.back().swap(p_chunk);
+				break;
+			}
+		}
+		p_task.m_space.wait();
+	}
+	m_data.signal();
+}
+
+bool ParallelBZipInputStream::nextChunk()
+{
+	for (;;)
+	{
+		while (isInputNeeded())
+		{
+			readPacked();
+		}
+		if (m_tasks.empty())
+			return false;
+		Task& l_task = *m_tasks.front();
+		bool l_is_chunk = false;
+		bool l_is_done = false;
+		{
+			CFlyFastLock(m_cs);
+			if (!l_task.m_chunks.empty())
+			{
+				m_current.swap(l_task.m_chunks.front());
+				l_task.m_chunks.pop_front();
+				l_is_chunk = true;
+			}
+			else
+			{
+				l_is_done = l_task.m_is_done;
+			}
+		}
+		if (l_is_chunk)
+		{
+			m_current_pos = 0;
+			l_task.m_space.signal();
+			return true;
+		}
+		if (l_is_done)
+		{
+			if (!l_task.m_error.empty())
+			{
+				throw Exception(l_task.m_error);
+			}
+			m_tasks.pop_front(); // the window moves
+			continue;
+		}
+		m_data.wait();
+	}
+}
+
+size_t ParallelBZipInputStream::read(void* p_buf, size_t& p_len)
+{
+	char* l_out = static_cast<char*>(p_buf);
+	size_t l_done = 0;
+	while (l_done < p_len)
+	{
+		if (m_current_pos == m_current.size() && !nextChunk())
+			break;
+		const size_t l_len = std::min(p_len - l_done, m_current.size() - m_current_pos);
+		memcpy(l_out + l_done, m_current.data() + m_current_pos, l_len);
+		m_current_pos += l_len;
+		l_done += l_len;
+	}
+	p_len = l_done;
+	return l_done;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_PARALLEL_BZIP_STREAM_H
+#define DCPLUSPLUS_DCPP_PARALLEL_BZIP_STREAM_H
+
+#include "Streams.h"
+#include "WorkerPool.h"
+
+/**
+ * [+] bzip2 compression on the threads of WorkerPool.
+ * The data is cut into blocks of BLOCK_SIZE, every block is packed as an independent bzip2 stream
+ * and the streams are written to the output in the order of the data: the result is a valid multi-stream .bz2
+ * (UnBZFilter starts a new stream after the end of the previous one).
+ * BLOCK_SIZE is the block of bzip2 -9, so the splitting costs almost nothing in the compression ratio.
+ * At most 2 blocks per pool thread are in memory at a time, write() waits for the oldest one when the window is full.
+ * The oldest block is packed by write() itself when no pool thread has taken it yet.
+ */
+class ParallelBZipOutputStream : public OutputStream
+{
+	public:
+		/** p_out isn't owned */
+		explicit ParallelBZipOutputStream(OutputStream* p_out);
+		~ParallelBZipOutputStream();
+		
+		using OutputStream::write;
+		/** @throw Exception Compression or output error */
+		size_t write(const void* p_buf, size_t p_len) override;
+		/** Packs the rest of the data, writes all the streams and flushes the output. No writes after that. */
+		size_t flushBuffers(bool p_force) override;
+		
+		/** Packs the data as one bzip2 stream on the calling thread and appends it to p_out @throw Exception */
+		static void pack(const void* p_data, size_t p_len, string& p_out);
+		
+		static const size_t BLOCK_SIZE = 900 * 1000;
+	
+	private:
+		struct Block
+		{
+			string m_data;
+			string m_packed;
+			string m_error;
+			volatile long m_is_taken; // by a pool thread or by writeFirstBlock
+			volatile long m_is_done;
+			Block() : m_is_taken(0), m_is_done(0)
+			{
+			}
+		};
+		
+		void submitBlock();
+		size_t writeFirstBlock();
+		void runBlock(Block& p_block);
+		static void packBlock(Block& p_block);
+		
+		OutputStream* m_out;
+		size_t m_window;
+		std::deque<std::shared_ptr<Block> > m_blocks; // in the order of the data, written from the front, shared with the jobs
+		Semaphore m_done; // a block is packed
+		WorkerPool::Group m_jobs;
+		string m_current;
+		bool m_is_flushed;
+};
+
+/**
+ * [+] bzip2 decompression on the threads of WorkerPool, the reader gets the data while the rest is still being unpacked.
+ * The packed data is read piece by piece as the reader goes and cut into the streams of a multi-stream .bz2
+ * (ParallelBZipOutputStream), the streams are unpacked in parallel, at most 2 per pool thread ahead of the reader.
+ * A single-stream file is unpacked by one job that gets the packed data in pieces and gives out a short queue of chunks,
+ * so reading, decompression and parsing overlap and the file is never held in memory as a whole.
+ */
+class ParallelBZipInputStream : public InputStream
+{
+	public:
+		/** p_in isn't owned, it is read by read() up to its end */
+		explicit ParallelBZipInputStream(InputStream* p_in);
+		~ParallelBZipInputStream();
+		
+		/** @throw Exception Decompression or input error */
+		size_t read(void* p_buf, size_t& p_len) override;
+		
+		static const size_t CHUNK_SIZE = 256 * 1024; // of the unpacked data and of a read of the packed one
+		static const size_t MAX_CHUNKS = 4; // unpacked and not read yet, per stream
+		static const size_t MAX_PARTS = 2; // read and not unpacked yet, of the last stream
+		
+	private:
+		struct Task
+		{
+			std::deque<string> m_in; // the packed parts not taken by the job yet
+			bool m_is_in_done; // no more parts, set by the reader only
+			std::deque<string> m_chunks;
+			string m_error;
+			bool m_is_done;
+			Semaphore m_space; // a chunk was taken by the reader
+			Semaphore m_input; // a part was added
+			Task() : m_is_in_done(false), m_is_done(false)
+			{
+			}
+		};
+		
+		bool isInputNeeded();
+		void readPacked();
+		void addInput(size_t p_begin, size_t p_end, bool p_is_last);
+		bool takeInput(Task& p_task, string& p_part);
+		void runTask(Task& p_task);
+		void unpack(Task& p_task);
+		void push(Task& p_task, string& p_chunk);
+		bool nextChunk();
+		
+		InputStream* m_in;
+		string m_packed; // read and not given to a stream yet
+		bool m_is_eof;
+		std::deque<std::unique_ptr<Task> > m_tasks; // in the order of the data, read from the front, the last one gets the input
+		size_t m_window;
+		FastCriticalSection m_cs; // Task::m_in, m_is_in_done, m_chunks, m_is_done
+		Semaphore m_data; // a chunk is unpacked, a part is taken or a task is done
+		WorkerPool::Group m_jobs;
+		string m_current;
+		size_t m_current_pos;
+		volatile bool m_is_stop;
+};
+
+#endif // DCPLUSPLUS_DCPP_PARALLEL_BZIP_STREAM_H
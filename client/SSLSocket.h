@@ -74,6 +74,10 @@ class SSLSocket : public Socket
 		{
 			return true;
 		}
+		virtual bool isReadPending() override
+		{
+			return ssl && SSL_pending(ssl) > 0;
+		}
 		virtual bool isTrusted() override;
 		//virtual bool isKeyprintMatch() const noexcept override;
 		virtual string getEncryptionInfo() const noexcept override;
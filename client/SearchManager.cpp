@@ -379,7 +379,7 @@ int SearchManager::UdpQueue::run()
 			else if (x.compare(1, 4, "RES ", 4) == 0 && x[x.length() - 1] == 0x0a)
 			{
 				AdcCommand c(x.substr(0, x.length() - 1));
-				if (c.getParameters().empty())
+				if (c.getParamCount() == 0)
 					continue;
 				const string cid = c.getParam(0);
 				if (cid.size() != 39)
@@ -402,7 +402,7 @@ int SearchManager::UdpQueue::run()
 			else if (x.compare(1, 4, "PSR ", 4) == 0 && x[x.length() - 1] == 0x0a)
 			{
 				AdcCommand c(x.substr(0, x.length() - 1));
-				if (c.getParameters().empty())
+				if (c.getParamCount() == 0)
 					continue;
 				const string cid = c.getParam(0);
 				if (cid.size() != 39)
@@ -515,9 +515,9 @@ void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const boos
 	string tth;
 	uint32_t l_token = -1; // 0 == auto
 	
-	for (auto i = cmd.getParameters().cbegin(); i != cmd.getParameters().cend(); ++i)
+	for (size_t i = 0; i < cmd.getParamCount(); ++i)
 	{
-		const string& str = *i;
+		const string str = cmd.getParam(i);
 		if (str.compare(0, 2, "FN", 2) == 0)
 		{
 			file = Util::toNmdcFile(str.substr(2));
@@ -569,9 +569,9 @@ void SearchManager::onPSR(const AdcCommand& p_cmd, UserPtr from, const boost::as
 	string nick;
 	PartsInfo partialInfo;
 	
-	for (auto i = p_cmd.getParameters().cbegin(); i != p_cmd.getParameters().cend(); ++i)
+	for (size_t i = 0; i < p_cmd.getParamCount(); ++i)
 	{
-		const string& str = *i;
+		const string str = p_cmd.getParam(i);
 		if (str.compare(0, 2, "U4", 2) == 0)
 		{
 			udpPort = static_cast<uint16_t>(Util::toInt(str.substr(2)));
@@ -690,7 +690,7 @@ ClientManagerListener::SearchReply SearchManager::respond(const AdcCommand& adc,
 	}
 	
 	SearchResultList l_search_results;
-	ShareManager::getInstance()->search_max_result(l_search_results, adc.getParameters(), isUdpActive ? 10 : 5, reguest); // [!] IRainman
+	ShareManager::getInstance()->search_max_result(l_search_results, adc, isUdpActive ? 10 : 5, reguest); // [!] IRainman
 	
 	string l_token;
 	
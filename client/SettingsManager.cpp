@@ -438,6 +438,11 @@ static const char* g_settingTags[] =
 	"ReportToUserIfOutdatedOsDetected20130523",
 	"UseGPUInTTHComputing",
 	"TTHGPUDevNum",
+	"UseShareSearchIndex",
+	"HashThreads",
+	"HashThreadsPerDevice",
+	"HashPageCacheLimit",
+	"SocketIOThreads",
 	//"UsersTop", "UsersBottom", "UsersLeft", "UsersRight",
 	"FavUsersSplitterPos",
 	"SENTRY",
@@ -1265,6 +1270,10 @@ void SettingsManager::setDefaults()
 	setDefault(REPORT_TO_USER_IF_OUTDATED_OS_DETECTED, TRUE);
 #endif
 	setDefault(TTH_GPU_DEV_NUM, -1);
+	setDefault(HASH_THREADS, 0); // 0 - by the number of processors
+	setDefault(HASH_THREADS_PER_DEVICE, 1);
+	setDefault(HASH_PAGE_CACHE_LIMIT, 256); // MB of the page cache a hashing run may fill, 0 - hash without it
+	setDefault(SOCKET_IO_THREADS, 0); // 0 - by the number of processors
 	setSearchTypeDefaults();
 	// TODO -        .
 	Util::shrink_to_fit(&strDefaults[STR_FIRST], &strDefaults[STR_LAST]); // [+] IRainman opt.
@@ -459,6 +459,11 @@ class SettingsManager : public Singleton<SettingsManager>, public Speaker<Settin
 		                  REPORT_TO_USER_IF_OUTDATED_OS_DETECTED,
 		                  USE_GPU_IN_TTH_COMPUTING,
 		                  TTH_GPU_DEV_NUM,
+		                  USE_SHARE_SEARCH_INDEX,
+		                  HASH_THREADS,
+		                  HASH_THREADS_PER_DEVICE,
+		                  HASH_PAGE_CACHE_LIMIT,
+		                  SOCKET_IO_THREADS,
 		                  //  USERS_TOP, USERS_BOTTOM, USERS_LEFT, USERS_RIGHT,
 		                  FAV_USERS_SPLITTER_POS,
 		                  INT_LAST,
@@ -29,6 +29,7 @@
 #include "File.h"
 #include "FilteredFile.h"
 #include "BZUtils.h"
+#include "ParallelBZipStream.h"
 #include "Wildcards.h"
 #include "Transfer.h"
 #include "Download.h"
@@ -64,8 +65,12 @@ std::unique_ptr<webrtc::RWLockWrapper> ShareManager::g_csShareCache = std::uniqu
 
 CriticalSection ShareManager::g_csTTHIndex;
 
-FastCriticalSection ShareManager::g_csPartialCache;
-std::unordered_map<string, std::pair<string, unsigned> > ShareManager::g_partial_list_cache;
+FastCriticalSection ShareManager::g_csXmlCache;
+std::unordered_map<string, std::shared_ptr<const ShareManager::XmlFragment> > ShareManager::g_xml_fragments;
+std::unordered_map<string, ShareManager::PartialList> ShareManager::g_partial_list_cache;
+std::unordered_map<string, uint64_t> ShareManager::g_xml_root_versions;
+uint64_t ShareManager::g_xml_version = 0;
+uint64_t ShareManager::g_xml_all_version = 0;
 
 FastCriticalSection ShareManager::g_csTTHPathCache;
 std::unordered_map<TTHValue, std::pair<string, unsigned> > ShareManager::g_tth_path_cache;
@@ -82,7 +87,16 @@ bool ShareManager::g_isNeedsUpdateShareSize;
 int64_t ShareManager::g_CurrentShareSize = -1;
 bool ShareManager::g_is_initial = true;
 ShareManager::DirList ShareManager::g_list_directories;
-BloomFilter<5> ShareManager::g_bloom(1 << 20);
+BlockedBloomFilter<5> ShareManager::g_bloom(1 << 20);
+ShareSearchIndex ShareManager::g_search_index;
+std::vector<ShareManager::SearchIndexItem> ShareManager::g_search_index_items;
+ShareSnapshot::Ptr ShareManager::g_snapshot = std::make_shared<const ShareSnapshot>();
+std::shared_ptr<TTHLookupTable> ShareManager::g_tth_table;
+std::atomic<bool> ShareManager::g_is_snapshot_dirty(false);
+ShareSnapshot::FileChangeList ShareManager::g_snapshot_changes;
+uint64_t ShareManager::g_snapshot_dirty_tick = 0;
+FastCriticalSection ShareManager::g_csSnapshotChanges;
+CriticalSection ShareManager::g_csSnapshot;
 unsigned ShareManager::g_cache_limit = 1000;
 FastCriticalSection ShareManager::g_csBot;
 std::unordered_map<string, unsigned> ShareManager::g_BotDetectMap;
@@ -166,6 +180,8 @@ void ShareManager::shutdown()
 ShareManager::Directory::Directory(const string& aName, const ShareManager::Directory::Ptr& aParent) :
 	CFlyLowerName(aName),
 	m_size(0),
+	m_index_id(ShareSearchIndex::INVALID_ID),
+	m_snapshot_id(ShareSnapshot::INVALID_ID),
 	m_parent(aParent.get()),
 	m_fileTypes_bitmap(1 << Search::TYPE_DIRECTORY)
 {
@@ -286,6 +302,8 @@ bool ShareManager::isTTHShared(const TTHValue& tth)
 {
 	if (!ClientManager::isBeforeShutdown())
 	{
+		if (!isMaybeSharedTTH(tth))
+			return false;
 		CFlyLock(g_csTTHIndex);
 		return g_tthIndex.find(tth) != g_tthIndex.end();
 	}
@@ -348,7 +366,7 @@ string ShareManager::toVirtual(const TTHValue& tth)
 	{
 		return Transfer::g_user_list_name_bz;
 	}
-	else if (tth == xmlRoot)
+	else if (tth == getXmlRoot())
 	{
 		return Transfer::g_user_list_name;
 	}
@@ -406,7 +424,7 @@ TTHValue ShareManager::getTTH(const string& virtualFile) const
 	}
 	else if (virtualFile == Transfer::g_user_list_name)
 	{
-		return xmlRoot;
+		return getXmlRoot();
 	}
 	TTHValue l_tth;
 	findFileAndRealPath(virtualFile, l_tth, true);
@@ -448,7 +466,7 @@ void ShareManager::getFileInfo(AdcCommand& cmd, const string& aFile)
 		
 		cmd.addParam("FN", aFile);
 		cmd.addParam("SI", Util::toString(xmlListLen));
-		cmd.addParam("TR", xmlRoot.toBase32());
+		cmd.addParam("TR", getXmlRoot().toBase32());
 		return;
 	}
 	else if (aFile == Transfer::g_user_list_name_bz)
@@ -465,6 +483,18 @@ void ShareManager::getFileInfo(AdcCommand& cmd, const string& aFile)
 		throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, aFile);
 		
 	const TTHValue val(aFile.c_str() + 4); //[+]FlylinkDC++
+	if (!g_is_snapshot_dirty)
+	{
+		const auto l_snapshot = getSnapshot(false);
+		const ShareSnapshot::FileId l_file = l_snapshot->findFile(val);
+		if (l_file != ShareSnapshot::INVALID_ID)
+		{
+			cmd.addParam("FN", l_snapshot->getADCPath(l_snapshot->getFileDir(l_file)) + l_snapshot->getFileName(l_file));
+			cmd.addParam("SI", Util::toString(l_snapshot->getFileSize(l_file)));
+			cmd.addParam("TR", l_snapshot->getFileTTH(l_file).toBase32());
+			return;
+		}
+	}
 #ifdef FLYLINKDC_USE_RW_LOCK_SHARE
 	CFlyReadLock(*g_csShare);
 #else
@@ -550,6 +580,28 @@ string ShareManager::findFileAndRealPath(const string& virtualFile, TTHValue& p_
 			return i->second.first;
 		}
 	}
+	if (!g_is_snapshot_dirty)
+	{
+		// [+] Lock-free lookup, the tree is only needed for the files hashed after the last snapshot
+		const auto l_snapshot = getSnapshot(false);
+		const ShareSnapshot::FileId l_file = l_is_tth ? l_snapshot->findFile(TTHValue(virtualFile.substr(4))) : l_snapshot->findVirtualFile(virtualFile);
+		if (l_file != ShareSnapshot::INVALID_ID)
+		{
+			checkShutdown(virtualFile);
+			if (p_is_fetch_tth)
+			{
+				p_tth = l_snapshot->getFileTTH(l_file);
+			}
+			const string l_path = getRealPath(*l_snapshot, l_file);
+			if (l_is_tth)
+			{
+				CFlyFastLock(g_csTTHPathCache);
+				auto& i = g_tth_path_cache[l_snapshot->getFileTTH(l_file)];
+				i.first = l_path;
+			}
+			return l_path;
+		}
+	}
 #ifdef FLYLINKDC_USE_RW_LOCK_SHARE
 	CFlyReadLock(*g_csShare);
 #else
@@ -832,6 +884,8 @@ bool ShareManager::loadCache() noexcept
 					{
 						updateIndicesDirL(**i);
 					}
+					rebuildSearchIndexL();
+					rebuildSnapshotL();
 				}
 			}
 			internalClearCache(true);
@@ -1022,6 +1076,9 @@ void ShareManager::addDirectory(const string& realPath, const string& virtualNam
 					CFlyLock(g_csTTHIndex);
 					updateIndicesDirL(*get_mergeL(dp));
 				}
+				rebuildSearchIndexL();
+				rebuildSnapshotL();
+				invalidateXmlCache(Text::toLower(vName));
 			}
 		}
 		setDirty();
@@ -1126,6 +1183,8 @@ void ShareManager::removeDirectory(const string& realPath)
 		}
 		const string l_Name = i->second.m_synonym; //   . fix http://www.flickr.com/photos/96019675@N02/9515345001/
 		{
+			// The index points into the directories removed here
+			clearSearchIndexL();
 			for (auto j = g_list_directories.cbegin(); j != g_list_directories.cend();)
 			{
 				if (stricmp((*j)->getName(), l_Name) == 0)
@@ -1155,7 +1214,9 @@ void ShareManager::removeDirectory(const string& realPath)
 				}
 			}
 		}
-		rebuildIndicesL(true);
+		rebuildIndicesL(false);
+		clear_tth_path_cache();
+		invalidateXmlCache(Text::toLower(l_Name));
 	}
 	internalCalcShareSize();
 	setDirty();
@@ -1585,6 +1646,21 @@ bool ShareManager::updateIndicesDirL(Directory& dir)
 	return false;
 }
 
+size_t ShareManager::getBloomItemsL(const Directory& p_dir)
+{
+	// The N-grams added by updateIndicesDirL, the repeated ones too
+	size_t l_items = g_bloom.getItemCount(p_dir.getLowName().size());
+	for (auto i = p_dir.m_share_files.cbegin(); i != p_dir.m_share_files.cend(); ++i)
+	{
+		l_items += g_bloom.getItemCount(i->getLowName().size());
+	}
+	for (auto i = p_dir.m_share_directories.cbegin(); i != p_dir.m_share_directories.cend(); ++i)
+	{
+		l_items += getBloomItemsL(*i->second);
+	}
+	return l_items;
+}
+
 void ShareManager::rebuildIndicesL(bool p_is_clear_cache)
 {
 	if (!ClientManager::isBeforeShutdown())
@@ -1594,12 +1670,17 @@ void ShareManager::rebuildIndicesL(bool p_is_clear_cache)
 			g_tthIndex.clear();
 		}
 		{
+			size_t l_items = 0;
+			for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
+			{
+				l_items += getBloomItemsL(**i);
+			}
 			CFlyWriteLock(*g_csBloom);
-			g_bloom.clear();
+			g_bloom.reset(l_items);
 		}
 		if (p_is_clear_cache)
 		{
-			clear_partial_cache("");
+			invalidateXmlCache("");
 			clear_tth_path_cache();
 		}
 		{
@@ -1609,7 +1690,10 @@ void ShareManager::rebuildIndicesL(bool p_is_clear_cache)
 				if (updateIndicesDirL(**i) == false)
 					break;
 			}
+			rebuildTTHTable();
 		}
+		rebuildSearchIndexL();
+		rebuildSnapshotL();
 		g_isNeedsUpdateShareSize = true;
 	}
 }
@@ -1625,6 +1709,7 @@ bool ShareManager::updateIndicesFileL(Directory& dir, const Directory::ShareFile
 			{
 				dir.m_size += f.getSize();
 				g_tthIndex.insert(make_pair(f.getTTH(), i));
+				addTTHTableL(f.getTTH());
 				g_isNeedsUpdateShareSize = true;
 			}
 			else
@@ -1640,6 +1725,191 @@ bool ShareManager::updateIndicesFileL(Directory& dir, const Directory::ShareFile
 	return false;
 }
 
+void ShareManager::clearSearchIndexL()
+{
+	g_search_index.clear();
+	g_search_index_items.clear();
+}
+
+void ShareManager::rebuildSearchIndexL()
+{
+	clearSearchIndexL();
+	if (BOOLSETTING(USE_SHARE_SEARCH_INDEX) && !ClientManager::isBeforeShutdown())
+	{
+		CFlyLog l_log("[Share search index]");
+		for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
+		{
+			addSearchIndexDirL(**i);
+		}
+		g_search_index.finalize();
+		l_log.step("Entries: " + Util::toString(g_search_index.size()) + " Memory: " + Util::formatBytes(int64_t(g_search_index.getMemoryUsage())));
+	}
+	else
+	{
+		std::vector<SearchIndexItem>().swap(g_search_index_items);
+	}
+}
+
+void ShareManager::addSearchIndexDirL(Directory& p_dir)
+{
+	// Same order as Directory::search walks the tree: the directory, its files, then the subdirectories
+	p_dir.m_index_id = g_search_index.addDirectory(p_dir.getLowName());
+	g_search_index_items.push_back(SearchIndexItem(&p_dir, nullptr));
+	for (auto i = p_dir.m_share_files.cbegin(); i != p_dir.m_share_files.cend(); ++i)
+	{
+		g_search_index.addFile(i->getLowName());
+		g_search_index_items.push_back(SearchIndexItem(&p_dir, &(*i)));
+	}
+	for (auto i = p_dir.m_share_directories.cbegin(); i != p_dir.m_share_directories.cend(); ++i)
+	{
+		addSearchIndexDirL(*i->second);
+	}
+	g_search_index.closeDirectory(p_dir.m_index_id);
+}
+
+void ShareManager::addSearchIndexFileL(const Directory& p_dir, const Directory::ShareFile& p_file)
+{
+	if (!g_search_index.isReady())
+		return;
+	if (p_dir.m_index_id < g_search_index.size())
+	{
+		g_search_index.addPendingFile(p_file.getLowName(), p_dir.m_index_id);
+		g_search_index_items.push_back(SearchIndexItem(&p_dir, &p_file));
+	}
+	else
+	{
+		// The directory appeared after the index was built - fall back to the tree walk until the next rebuild
+		clearSearchIndexL();
+	}
+}
+
+void ShareManager::rebuildSnapshotL()
+{
+	if (ClientManager::isBeforeShutdown())
+		return;
+	CFlyLock(g_csSnapshot);
+	auto l_snapshot = std::make_shared<ShareSnapshot>();
+	// Breadth-first: the subdirectories of every directory get consecutive ids
+	std::vector<std::pair<Directory*, ShareSnapshot::DirId> > l_queue;
+	for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
+	{
+		Directory& l_dir = **i;
+		const auto l_id = l_snapshot->addDirectory(l_dir.getName(), l_dir.getLowName(), ShareSnapshot::INVALID_ID, l_dir.getDirSizeFast(), l_dir.getTypes());
+		l_dir.m_snapshot_id = l_id;
+		StringList l_real_paths;
+		for (auto j = g_shares.cbegin(); j != g_shares.cend(); ++j)
+		{
+			if (stricmp(j->second.m_synonym, l_dir.getName()) == 0)
+			{
+				l_real_paths.push_back(j->first);
+			}
+		}
+		l_snapshot->setRootRealPaths(l_id, l_real_paths);
+		l_queue.push_back(std::make_pair(&l_dir, l_id));
+	}
+	for (size_t q = 0; q < l_queue.size(); ++q)
+	{
+		const Directory& l_dir = *l_queue[q].first;
+		const auto l_id = l_queue[q].second;
+		l_queue[q].first->m_snapshot_id = l_id;
+		l_snapshot->beginFiles(l_id);
+		for (auto i = l_dir.m_share_files.cbegin(); i != l_dir.m_share_files.cend(); ++i)
+		{
+			// The hit count of ShareFile is set only when a refresh builds the tree, and that rebuilds the snapshot too
+			l_snapshot->addFile(l_id, i->getName(), i->getLowName(), i->getSize(), i->getTTH(), i->getTS(), i->getHit(), uint8_t(i->getFType()), i->m_media_ptr);
+		}
+		l_snapshot->beginSubdirectories(l_id);
+		for (auto i = l_dir.m_share_directories.cbegin(); i != l_dir.m_share_directories.cend(); ++i)
+		{
+			Directory& l_sub = *i->second;
+			l_queue.push_back(std::make_pair(&l_sub, l_snapshot->addDirectory(l_sub.getName(), l_sub.getLowName(), l_id, l_sub.getDirSizeFast(), l_sub.getTypes())));
+		}
+	}
+	l_snapshot->finalize();
+	dcdebug("ShareManager::rebuildSnapshotL: dirs = %u files = %u memory = %u\n",
+	        unsigned(l_snapshot->getDirCount()), unsigned(l_snapshot->getFileCount()), unsigned(l_snapshot->getMemoryUsage()));
+	// The tree can't change while the share lock is held (addSnapshotChangeL needs the write lock),
+	// so the pending changes are covered by this snapshot - and their directory ids are the old ones
+	{
+		CFlyFastLock(g_csSnapshotChanges);
+		g_snapshot_changes.clear();
+		g_is_snapshot_dirty = false;
+	}
+	std::atomic_store(&g_snapshot, ShareSnapshot::Ptr(l_snapshot));
+}
+
+void ShareManager::addSnapshotChangeL(const Directory& p_dir, const Directory::ShareFile& p_file)
+{
+	if (p_dir.m_snapshot_id == ShareSnapshot::INVALID_ID) // Not in the snapshot yet
+	{
+		rebuildSnapshotL();
+		return;
+	}
+	ShareSnapshot::FileChange l_change;
+	l_change.m_dir = p_dir.m_snapshot_id;
+	l_change.m_dir_size = p_dir.getDirSizeFast();
+	l_change.m_name = p_file.getName();
+	l_change.m_low_name = p_file.getLowName();
+	l_change.m_size = p_file.getSize();
+	l_change.m_tth = p_file.getTTH();
+	l_change.m_ts = p_file.getTS();
+	l_change.m_hit = p_file.getHit();
+	l_change.m_type = uint8_t(p_file.getFType());
+	l_change.m_media = p_file.m_media_ptr;
+	CFlyFastLock(g_csSnapshotChanges);
+	g_snapshot_changes.push_back(std::move(l_change));
+	if (!g_is_snapshot_dirty)
+	{
+		g_snapshot_dirty_tick = GET_TICK();
+		g_is_snapshot_dirty = true;
+	}
+}
+
+void ShareManager::applySnapshotChanges()
+{
+	// The directories of the snapshot are the same until rebuildSnapshotL, which waits for this copy
+	CFlyLock(g_csSnapshot);
+	ShareSnapshot::FileChangeList l_changes;
+	{
+		CFlyFastLock(g_csSnapshotChanges);
+		l_changes.swap(g_snapshot_changes);
+		g_is_snapshot_dirty = false;
+	}
+	if (l_changes.empty() || ClientManager::isBeforeShutdown())
+		return;
+	const auto l_base = std::atomic_load(&g_snapshot);
+	auto l_snapshot = std::make_shared<ShareSnapshot>();
+	l_snapshot->applyChanges(*l_base, l_changes);
+	dcdebug("ShareManager::applySnapshotChanges: changes = %u files = %u\n", unsigned(l_changes.size()), unsigned(l_snapshot->getFileCount()));
+	std::atomic_store(&g_snapshot, ShareSnapshot::Ptr(l_snapshot));
+}
+
+ShareSnapshot::Ptr ShareManager::getSnapshot(bool p_is_actual)
+{
+	if (p_is_actual && g_is_snapshot_dirty)
+	{
+		applySnapshotChanges();
+	}
+	return std::atomic_load(&g_snapshot);
+}
+
+string ShareManager::getRealPath(const ShareSnapshot& p_snapshot, ShareSnapshot::FileId p_file)
+{
+	// Same as findRealRootL, the real folders of the root were copied into the snapshot
+	const string l_path = p_snapshot.getRelativeRealPath(p_file);
+	const auto& l_real_paths = p_snapshot.getRootRealPaths(p_snapshot.getRoot(p_snapshot.getFileDir(p_file)));
+	for (auto i = l_real_paths.cbegin(); i != l_real_paths.cend(); ++i)
+	{
+		const string l_name = *i + l_path;
+		dcdebug("Matching %s\n", l_name.c_str());
+		if (FileFindIter(l_name) != FileFindIter::end)
+		{
+			return l_name;
+		}
+	}
+	throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, l_path);
+}
+
 void ShareManager::refresh_share(bool p_dirs /* = false */, bool aUpdate /* = true */) noexcept
 {
 	if (m_is_refreshing.test_and_set())
@@ -1782,6 +2052,7 @@ int ShareManager::run()
 #endif
 			
 			{
+				clearSearchIndexL();
 				g_list_directories.clear();
 				for (auto i = newDirs.cbegin(); i != newDirs.cend(); ++i)
 				{
@@ -1789,6 +2060,7 @@ int ShareManager::run()
 				}
 			}
 			rebuildIndicesL(false);
+			invalidateXmlCache("");
 		}
 		internalCalcShareSize();
 		m_is_refreshDirs = false;
@@ -1832,45 +2104,55 @@ void ShareManager::generateXmlList()
 		
 		try
 		{
-			string tmp2;
-			string indent;
-			
 			string newXmlName = Util::getConfigPath() + "files" + Util::toString(m_listN) + ".xml.bz2";
+			TTHValue l_xml_root;
 			{
 				File f(newXmlName, File::WRITE, File::TRUNCATE | File::CREATE);
 				l_creation_log.step("open file done");
 				// We don't care about the leaves...
 				CalcOutputStream<TTFilter, false> bzTree(&f);
-				FilteredOutputStream<BZFilter, false> bzipper(&bzTree);
-				CountOutputStream<false> count(&bzipper);
-				CalcOutputStream<TTFilter, false> newXmlFile(&count);
-				l_creation_log.step("init packer done");
-				newXmlFile.write(SimpleXML::utf8Header);
-				newXmlFile.write("<FileListing Version=\"1\" CID=\"" + ClientManager::getMyCID().toBase32() + "\" Base=\"/\" Generator=\"DC++ " DCVERSIONSTRING "\">\r\n"); // [!] IRainman fix.
+				// [!] The list is a multi-stream .bz2: the header, the packed XML of every root and the footer.
+				// Only the roots changed since the last list are serialized and packed again (see invalidateXmlCache).
+				const string l_header = SimpleXML::utf8Header + "<FileListing Version=\"1\" CID=\"" + ClientManager::getMyCID().toBase32() + "\" Base=\"/\" Generator=\"DC++ " DCVERSIONSTRING "\">\r\n"; // [!] IRainman fix.
+				const string l_footer = "</FileListing>";
+				string l_bz2;
+				ParallelBZipOutputStream::pack(l_header.data(), l_header.size(), l_bz2);
+				bzTree.write(l_bz2);
+				// The uncompressed list is hashed as it goes to the packer, for the TTH of files.xml
+				TTFilter l_xml_tree;
+				l_xml_tree(l_header.data(), l_header.size());
+				int64_t l_xml_size = l_header.size() + l_footer.size();
 				{
-#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
-					CFlyReadLock(*g_csShare);
-#else
-					CFlyLock(g_csShare);
-#endif
-					
-					for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
+					uint64_t l_version;
 					{
-						(*i)->toXmlL(newXmlFile, indent, tmp2, true); // https://www.box.net/shared/e9d04cfcc59d4a4aaba7
+						CFlyFastLock(g_csXmlCache);
+						l_version = g_xml_version;
+					}
+					// The share is not locked while the list is packed
+					const auto l_snapshot = getSnapshot(true);
+					string l_xml;
+					for (ShareSnapshot::DirId i = 0; i < l_snapshot->getRootCount(); ++i)
+					{
+						const auto l_fragment = getXmlFragment(*l_snapshot, i, l_version, l_xml);
+						bzTree.write(l_fragment->m_bz2);
+						l_xml_tree(l_xml.data(), l_xml.size());
+						l_xml_size += l_fragment->m_xml_size;
 					}
 				}
 				l_creation_log.step("write dir. done");
-				newXmlFile.write("</FileListing>");
-				newXmlFile.flushBuffers(true);
+				l_bz2.clear();
+				ParallelBZipOutputStream::pack(l_footer.data(), l_footer.size(), l_bz2);
+				bzTree.write(l_bz2);
+				bzTree.flushBuffers(true);
+				l_xml_tree(l_footer.data(), l_footer.size());
 				l_creation_log.step("close file");
 				
-				xmlListLen = count.getCount();
+				xmlListLen = l_xml_size;
 				
-				newXmlFile.getFilter().getTree().finalize();
 				bzTree.getFilter().getTree().finalize();
-				
-				xmlRoot = newXmlFile.getFilter().getTree().getRoot();
 				bzXmlRoot = bzTree.getFilter().getTree().getRoot();
+				l_xml_tree.getTree().finalize();
+				l_xml_root = l_xml_tree.getTree().getRoot();
 			}
 			
 			const string l_XmlListFileName = getDefaultBZXmlFile();
@@ -1893,7 +2175,11 @@ void ShareManager::generateXmlList()
 				// Ignore, this is for caching only...
 			}
 			bzXmlRef = unique_ptr<File>(new File(newXmlName, File::READ, File::OPEN));
-			setBZXmlFile(newXmlName);
+			{
+				CFlyFastLock(m_csXmlRoot);
+				setBZXmlFile(newXmlName);
+				xmlRoot = l_xml_root;
+			}
 			bzXmlListLen = File::getSize(newXmlName);
 		}
 		catch (const Exception&)
@@ -1949,92 +2235,63 @@ MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool rec
 		return new MemoryInputStream(xml);
 	}
 #endif
-	if (recurse == false)
+	// The root of the directory: the cached list is removed with the XML of the root (see invalidateXmlCache)
+	const string l_root = Text::toLower(dir.substr(1, dir.find('/', 1) - 1));
+	uint64_t l_version;
 	{
-		CFlyFastLock(g_csPartialCache);
-		auto i = g_partial_list_cache.find(dir);
-		if (i != g_partial_list_cache.end())
+		CFlyFastLock(g_csXmlCache);
+		if (recurse == false)
 		{
-			i->second.second++;
+			auto i = g_partial_list_cache.find(dir);
+			if (i != g_partial_list_cache.end())
+			{
+				i->second.m_hits++;
 #ifdef FLYLINKDC_BETA
-			// LogManager::message("Use partial file list cache: " + dir + " count = " + Util::toString(i->second.second));
+				// LogManager::message("Use partial file list cache: " + dir + " count = " + Util::toString(i->second.m_hits));
 #endif // FLYLINKDC_BETA
-			return new MemoryInputStream(i->second.first);
+				return new MemoryInputStream(i->second.m_xml);
+			}
 		}
+		l_version = getXmlVersionL(l_root);
 	}
 	StringOutputStream sos(xml);
 	
-#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
-	CFlyReadLock(*g_csShare);
-#else
-	CFlyLock(g_csShare);
-#endif
-	
+	const auto l_snapshot = getSnapshot(true);
 	
 	string indent = "\t";
 	
 	if (dir == "/")
 	{
-		for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
+		for (ShareSnapshot::DirId i = 0; i < l_snapshot->getRootCount(); ++i)
 		{
 			tmp.clear();
-			(*i)->toXmlL(sos, indent, tmp, recurse);
+			l_snapshot->toXml(sos, i, indent, tmp, recurse);
 		}
 	}
 	else
 	{
-		string::size_type i = 1, j = 1;
-		
-		Directory::Ptr root;
-		
-		bool first = true;
-		
-		while ((i = dir.find('/', j)) != string::npos)
-		{
-			if (i == j)
-			{
-				j++;
-				continue;
-			}
-			
-			if (first)
-			{
-				first = false;
-				const auto it = getByVirtualL(dir.substr(j, i - j));
-				
-				if (it == g_list_directories.end())
-					return nullptr;
-					
-				root = *it;
-			}
-			else
-			{
-				const auto  it2 = root->m_share_directories.find(dir.substr(j, i - j));
-				if (it2 == root->m_share_directories.end())
-				{
-					return nullptr;
-				}
-				
-				root = it2->second;
-			}
-			j = i + 1;
-		}
-		if (!root)
+		const ShareSnapshot::DirId root = l_snapshot->findDirectory(dir);
+		if (root == ShareSnapshot::INVALID_ID)
 			return nullptr;
 			
-		for (auto it2 = root->m_share_directories.cbegin(); it2 != root->m_share_directories.cend(); ++it2)
+		for (ShareSnapshot::DirId i = l_snapshot->getFirstSubdirectory(root); i != l_snapshot->getEndSubdirectory(root); ++i)
 		{
-			it2->second->toXmlL(sos, indent, tmp, recurse);
+			l_snapshot->toXml(sos, i, indent, tmp, recurse);
 		}
-		root->filesToXmlL(sos, indent, tmp);
+		l_snapshot->filesToXml(sos, root, indent, tmp);
 	}
 	
 	xml += "</FileListing>";
 	if (recurse == false)
 	{
-		CFlyFastLock(g_csPartialCache);
-		auto& i = g_partial_list_cache[dir];
-		i.first = xml;
+		CFlyFastLock(g_csXmlCache);
+		if (getXmlVersionL(l_root) <= l_version)
+		{
+			auto& i = g_partial_list_cache[dir];
+			i.m_root = l_root;
+			i.m_xml = xml;
+			i.m_hits = 0;
+		}
 	}
 	
 #ifdef _DEBUG
@@ -2052,108 +2309,6 @@ MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool rec
 	return new MemoryInputStream(xml);
 }
 
-#define LITERAL(n) n, sizeof(n)-1
-void ShareManager::Directory::toXmlL(OutputStream& xmlFile, string& p_indent, string& tmp2, bool fullList) const
-{
-	if (!p_indent.empty())
-		xmlFile.write(p_indent);
-	xmlFile.write(LITERAL("<Directory Name=\""));
-	xmlFile.write(SimpleXML::escapeAtrib(getName(), tmp2)); // TODO    escape    utf-8 stricmp(encoding, Text::g_utf8)
-	
-	if (fullList)
-	{
-		xmlFile.write(LITERAL("\">\r\n"));
-		
-		p_indent += '\t';
-		for (auto i = m_share_directories.cbegin(); i != m_share_directories.cend(); ++i)
-		{
-			i->second->toXmlL(xmlFile, p_indent, tmp2, fullList);
-		}
-		
-		filesToXmlL(xmlFile, p_indent, tmp2); // [?] https://www.box.net/shared/39f69aa184eea69d2087
-		
-		// dcassert(p_indent.length() > 1);
-		if (p_indent.length() > 1)
-		{
-			p_indent.erase(p_indent.length() - 1);
-		}
-		if (!p_indent.empty())
-		{
-			xmlFile.write(p_indent);
-		}
-		xmlFile.write(LITERAL("</Directory>\r\n"));
-	}
-	else
-	{
-		if (m_share_directories.empty() && m_share_files.empty())
-		{
-			xmlFile.write(LITERAL("\" />\r\n"));
-		}
-		else
-		{
-			xmlFile.write(LITERAL("\" Incomplete=\"1\" />\r\n"));
-		}
-	}
-}
-
-void ShareManager::Directory::filesToXmlL(OutputStream& xmlFile, string& indent, string& tmp2) const
-{
-	for (auto i = m_share_files.cbegin(); i != m_share_files.cend(); ++i)
-	{
-		const auto& f = *i;
-		if (!indent.empty())
-			xmlFile.write(indent);
-#ifdef _DEBUG
-		dcdebug("filesToXmlL = %s\r\n", f.getName().c_str());
-#endif
-		xmlFile.write(LITERAL("<File Name=\""));
-		xmlFile.write(SimpleXML::escapeAtrib(f.getName(), tmp2)); // TODO -   escape    utf-8 stricmp(encoding, Text::g_utf8)
-		xmlFile.write(LITERAL("\" Size=\""));
-		xmlFile.write(Util::toString(f.getSize()));
-		xmlFile.write(LITERAL("\" TTH=\""));
-		tmp2.clear();
-		xmlFile.write(f.getTTH().toBase32(tmp2));
-		if (f.getHit() && BOOLSETTING(ENABLE_HIT_FILE_LIST))
-		{
-			xmlFile.write(LITERAL("\" HIT=\""));
-			xmlFile.write(Util::toString(f.getHit()));
-		}
-		xmlFile.write(LITERAL("\" TS=\""));
-		xmlFile.write(Util::toString(f.getTS()));
-		if (f.m_media_ptr)
-		{
-			if (f.m_media_ptr->m_bitrate)
-			{
-				xmlFile.write(LITERAL("\" BR=\""));
-				xmlFile.write(Util::toString(f.m_media_ptr->m_bitrate));
-			}
-			if (f.m_media_ptr->m_mediaX && f.m_media_ptr->m_mediaY)
-			{
-				xmlFile.write(LITERAL("\" WH=\""));
-				xmlFile.write(f.m_media_ptr->getXY());
-			}
-			
-			if (!f.m_media_ptr->m_audio.empty())
-			{
-				xmlFile.write(LITERAL("\" MA=\""));
-				if (f.m_media_ptr->m_is_need_escape)
-					xmlFile.write(SimpleXML::escapeForce(f.m_media_ptr->m_audio, tmp2));
-				else
-					xmlFile.write(f.m_media_ptr->m_audio);
-			}
-			if (!f.m_media_ptr->m_video.empty())
-			{
-				xmlFile.write(LITERAL("\" MV=\""));
-				if (f.m_media_ptr->m_is_need_escape)
-					xmlFile.write(SimpleXML::escapeForce(f.m_media_ptr->m_video, tmp2));
-				else
-					xmlFile.write(f.m_media_ptr->m_video);
-			}
-		}
-		xmlFile.write(LITERAL("\"/>\r\n"));
-	}
-}
-
 // These ones we can look up as ints (4 bytes...)...
 
 static const char* typeAudio[] = { ".mp3", ".mp2", ".mid", ".wav", ".ogg", ".wma", ".669", ".aac", ".aif", ".amf", ".ams", ".ape", ".dbm", ".dsm", ".far", ".mdl", ".med", ".mod", ".mol", ".mp1", ".mpa", ".mpc", ".mpp", ".mtm", ".nst", ".okt", ".psm", ".ptm", ".rmi", ".s3m", ".stm", ".ult", ".umx", ".wow",
@@ -2428,113 +2583,137 @@ Search::TypeModes ShareManager::getFType(const string& aFileName, bool p_include
 	return Search::TYPE_ANY;
 }
 
+// The filters of an NMDC search, shared by the tree walk and the search index
+static bool isDirectoryResult(const SearchParamBase& p_search_param)
+{
+	const bool sizeOk = (p_search_param.m_size_mode != Search::SIZE_ATLEAST) || (p_search_param.m_size == 0);
+	return ((p_search_param.m_file_type == Search::TYPE_ANY) && sizeOk) || (p_search_param.m_file_type == Search::TYPE_DIRECTORY);
+}
+
+static bool isFileSizeOk(const SearchParamBase& p_search_param, int64_t p_size)
+{
+	if (p_search_param.m_size_mode == Search::SIZE_ATLEAST && p_search_param.m_size > p_size)
+		return false;
+	if (p_search_param.m_size_mode == Search::SIZE_ATMOST && p_search_param.m_size < p_size)
+		return false;
+	return true;
+}
+
 /**
  * Alright, the main point here is that when searching, a search string is most often found in
- * the filename, not directory name, so we want to make that case faster. Also, we want to
- * avoid changing StringLists unless we absolutely have to --> this should only be done if a string
- * has been matched in the directory name. This new stringlist should also be used in all descendants,
- * but not the parents...
+ * the filename, not directory name, so we want to make that case faster. All the terms are
+ * matched in one pass of MultiStringSearch, and the terms found in the directory name are
+ * simply cleared from p_need - this mask is used in all descendants, but not the parents...
  */
-void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::List& aStrings, const SearchParamBase& p_search_param) const noexcept
+void ShareManager::searchSnapshot(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_dir, SearchResultList& aResults, const MultiStringSearch& p_search,
+                                  MultiStringSearch::Mask p_need, const SearchParamBase& p_search_param) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
 	// Skip everything if there's nothing to find here (doh! =)
-	if (!hasType(p_search_param.m_file_type))
+	if (!p_snapshot.hasType(p_dir, p_search_param.m_file_type))
 		return;
 		
-	StringSearch::List* cur = &aStrings;
-	unique_ptr<StringSearch::List> newStr;
+	// Find any matches in the directory name (the terms are counted once per query in search)
+	size_t l_len;
+	const uint8_t* l_low_name = p_snapshot.getDirLowName(p_dir, l_len);
+	p_need &= ~p_search.matchLower(l_low_name, l_len, p_need); // http://flylinkdc.blogspot.com/2010/08/1.html
 	
-	// Find any matches in the directory name
-#ifdef FLYLINKDC_USE_COLLECT_STAT
-	int l_count_find = 0;
-#endif
-	for (auto k = aStrings.cbegin(); k != aStrings.cend(); ++k)
+	if (p_need == 0 && isDirectoryResult(p_search_param))
 	{
-#ifdef FLYLINKDC_USE_COLLECT_STAT
-		{
-			string l_tth;
-			const auto l_tth_pos = (*k).getPattern().find("TTH:");
-			if (l_tth_pos != string::npos)
-				l_tth = (*k).getPattern().c_str() + l_tth_pos + 7;
-			CFlylinkDBManager::getInstance()->push_event_statistic("ShareManager::Directory::search",
-			"find-" + Util::toString(++l_count_find),
-			(*k).getPattern(),
-			"",
-			"",
-			p_search_param.m_client->getHubUrlAndIP(),
-			l_tth);
-		}
-#endif
-		if (k->matchLower(getLowName())) // http://flylinkdc.blogspot.com/2010/08/1.html
+// We satisfied all the search words! Add the directory...(NMDC searches don't support directory size)
+		const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, 0, p_snapshot.getFullName(p_dir), TTHValue(), -1 /*token*/);
+		aResults.push_back(l_sr);
+		ShareManager::incHits();
+	}
+	
+	if (p_search_param.m_file_type != Search::TYPE_DIRECTORY)
+	{
+		for (ShareSnapshot::FileId i = p_snapshot.getFirstFile(p_dir); i != p_snapshot.getEndFile(p_dir); ++i)
 		{
-			if (!newStr.get())
+			const int64_t l_size = p_snapshot.getFileSize(i);
+			if (!isFileSizeOk(p_search_param, l_size))
+				continue;
+			l_low_name = p_snapshot.getFileLowName(i, l_len);
+			if (!p_search.matchAllLower(l_low_name, l_len, p_need))
 			{
-				newStr = std::make_unique<StringSearch::List>(aStrings);
+				continue;
+			}
+			
+			// Check file type...
+			const string l_name = p_snapshot.getFileName(i);
+			if (checkType(l_name, p_search_param.m_file_type))
+			{
+				const SearchResultCore l_sr(SearchResult::TYPE_FILE, l_size, p_snapshot.getFullName(p_dir) + l_name, p_snapshot.getFileTTH(i), -1  /*token*/);
+				aResults.push_back(l_sr);
+				ShareManager::incHits();
+				if (aResults.size() >= p_search_param.m_max_results)
+				{
+					break;
+				}
 			}
-			newStr->erase(remove(newStr->begin(), newStr->end(), *k), newStr->end());
 		}
 	}
-	
-	if (newStr.get() != 0)
+	for (ShareSnapshot::DirId l = p_snapshot.getFirstSubdirectory(p_dir); l != p_snapshot.getEndSubdirectory(p_dir) && aResults.size() < p_search_param.m_max_results; ++l)
+	{
+		searchSnapshot(p_snapshot, l, aResults, p_search, p_need, p_search_param); //TODO - Hot point
+	}
+}
+
+// Same walk, the terms are matched one by one and the ones found in the directory name are erased from a copy of the list
+void ShareManager::searchSnapshot(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_dir, SearchResultList& aResults, const StringSearch::List& p_search,
+                                  const SearchParamBase& p_search_param) noexcept
+{
+	if (ClientManager::isBeforeShutdown())
+		return;
+	if (!p_snapshot.hasType(p_dir, p_search_param.m_file_type))
+		return;
+		
+	size_t l_len;
+	const uint8_t* l_low_name = p_snapshot.getDirLowName(p_dir, l_len);
+	const string l_dir_low_name(reinterpret_cast<const char*>(l_low_name), l_len);
+	unique_ptr<StringSearch::List> l_new_search;
+	for (auto k = p_search.cbegin(); k != p_search.cend(); ++k)
 	{
-		cur = newStr.get();
+		if (k->matchLower(l_dir_low_name))
+		{
+			if (!l_new_search)
+			{
+				l_new_search = std::make_unique<StringSearch::List>(p_search);
+			}
+			l_new_search->erase(remove(l_new_search->begin(), l_new_search->end(), *k), l_new_search->end());
+		}
 	}
+	const StringSearch::List& l_search = l_new_search ? *l_new_search : p_search;
 	
-#ifdef _DEBUG
-//	char l_buf[1000] = {0};
-//	sprintf(l_buf, "Name = %s, limit = %lld m_sizeMode = %d\r\n", getFullName().c_str(), aSize,  aSizeMode);
-//	LogManager::message(l_buf);
-#endif
-	const bool sizeOk = (p_search_param.m_size_mode != Search::SIZE_ATLEAST) || (p_search_param.m_size == 0);
-	if ((cur->empty()) &&
-	        (((p_search_param.m_file_type == Search::TYPE_ANY) && sizeOk) || (p_search_param.m_file_type == Search::TYPE_DIRECTORY)))
+	if (l_search.empty() && isDirectoryResult(p_search_param))
 	{
-// We satisfied all the search words! Add the directory...(NMDC searches don't support directory size)
-		const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, 0, getFullName(), TTHValue(), -1 /*token*/);
+		const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, 0, p_snapshot.getFullName(p_dir), TTHValue(), -1 /*token*/);
 		aResults.push_back(l_sr);
 		ShareManager::incHits();
 	}
 	
 	if (p_search_param.m_file_type != Search::TYPE_DIRECTORY)
 	{
-		for (auto i = m_share_files.cbegin(); i != m_share_files.cend(); ++i)
+		string l_file_low_name;
+		for (ShareSnapshot::FileId i = p_snapshot.getFirstFile(p_dir); i != p_snapshot.getEndFile(p_dir); ++i)
 		{
-		
-#ifdef _DEBUG
-//		char l_buf[1000] = {0};
-//		sprintf(l_buf, "Name = %s, i->getSize() = %lld aSize =  %lld m_sizeMode = %d\r\n", getFullName().c_str(), i->getSize(), aSize,  aSizeMode);
-//		LogManager::message(l_buf);
-#endif
-			if (p_search_param.m_size_mode == Search::SIZE_ATLEAST && p_search_param.m_size > i->getSize())
-			{
-#ifdef _DEBUG
-//			LogManager::message("[] aSizeMode == Search::SIZE_ATLEAST && aSize > i->getSize()");
-#endif
+			const int64_t l_size = p_snapshot.getFileSize(i);
+			if (!isFileSizeOk(p_search_param, l_size))
 				continue;
-			}
-			else if (p_search_param.m_size_mode == Search::SIZE_ATMOST && p_search_param.m_size < i->getSize())
-			{
-#ifdef _DEBUG
-//			LogManager::message("[] aSizeMode == Search::SIZE_ATMOST && aSize < i->getSize()");
-#endif
-				continue;
-			}
-			auto j = cur->begin();
-			for (; j != cur->end() && j->matchLower(i->getLowName()); ++j)
+			l_low_name = p_snapshot.getFileLowName(i, l_len);
+			l_file_low_name.assign(reinterpret_cast<const char*>(l_low_name), l_len);
+			auto j = l_search.cbegin();
+			for (; j != l_search.cend() && j->matchLower(l_file_low_name); ++j)
 			{
 			}
-			
-			if (j != cur->end())
-			{
+			if (j != l_search.cend())
 				continue;
-			}
-			
-			// Check file type...
-			if (checkType(i->getName(), p_search_param.m_file_type))
+				
+			const string l_name = p_snapshot.getFileName(i);
+			if (checkType(l_name, p_search_param.m_file_type))
 			{
-				const SearchResultCore l_sr(SearchResult::TYPE_FILE, i->getSize(), getFullName() + i->getName(), i->getTTH(), -1  /*token*/);
+				const SearchResultCore l_sr(SearchResult::TYPE_FILE, l_size, p_snapshot.getFullName(p_dir) + l_name, p_snapshot.getFileTTH(i), -1  /*token*/);
 				aResults.push_back(l_sr);
 				ShareManager::incHits();
 				if (aResults.size() >= p_search_param.m_max_results)
@@ -2544,13 +2723,15 @@ void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::L
 			}
 		}
 	}
-	for (auto l = m_share_directories.cbegin(); l != m_share_directories.cend() && aResults.size() < p_search_param.m_max_results; ++l)
+	for (ShareSnapshot::DirId l = p_snapshot.getFirstSubdirectory(p_dir); l != p_snapshot.getEndSubdirectory(p_dir) && aResults.size() < p_search_param.m_max_results; ++l)
 	{
-		l->second->search(aResults, *cur, p_search_param); //TODO - Hot point
+		searchSnapshot(p_snapshot, l, aResults, l_search, p_search_param);
 	}
 }
 bool ShareManager::search_tth(const TTHValue& p_tth, SearchResultList& aResults, bool p_is_check_parent)
 {
+	if (!isMaybeSharedTTH(p_tth))
+		return false;
 	CFlyLock(g_csTTHIndex);
 	const auto& i = g_tthIndex.find(p_tth);
 	if (i == g_tthIndex.end())
@@ -2572,9 +2753,30 @@ bool ShareManager::search_tth(const TTHValue& p_tth, SearchResultList& aResults,
 bool ShareManager::searchTTHArray(CFlySearchArrayTTH& p_all_search_array, const Client* p_client)
 {
 	bool l_result = true;
+	// [+] Under a search flood almost all the TTHs are unknown: they are dropped by the prefilter
+	// in one pass over the array and the index isn't locked at all
+	std::unique_ptr<bool[]> l_is_maybe;
+	if (const auto l_table = std::atomic_load(&g_tth_table))
+	{
+		std::vector<const TTHValue*> l_tth;
+		l_tth.reserve(p_all_search_array.size());
+		for (auto j = p_all_search_array.cbegin(); j != p_all_search_array.cend(); ++j)
+		{
+			l_tth.push_back(&j->m_tth);
+		}
+		l_is_maybe.reset(new bool[l_tth.size()]);
+		l_table->mayContain(l_tth.data(), l_tth.size(), l_is_maybe.get());
+		if (std::find(l_is_maybe.get(), l_is_maybe.get() + l_tth.size(), true) == l_is_maybe.get() + l_tth.size())
+			return true;
+	}
 	CFlyLock(g_csTTHIndex);
-	for (auto j = p_all_search_array.begin(); j != p_all_search_array.end(); ++j)
+	size_t l_index = 0;
+	for (auto j = p_all_search_array.begin(); j != p_all_search_array.end(); ++j, ++l_index)
 	{
+		if (l_is_maybe && !l_is_maybe[l_index])
+		{
+			continue;
+		}
 		const auto& i = g_tthIndex.find(j->m_tth);
 		if (i == g_tthIndex.end())
 		{
@@ -2606,10 +2808,45 @@ bool ShareManager::searchTTHArray(CFlySearchArrayTTH& p_all_search_array, const
 
 bool ShareManager::isUnknownTTH(const TTHValue& p_tth)
 {
+	if (!isMaybeSharedTTH(p_tth))
+		return true;
 	CFlyLock(g_csTTHIndex);
 	return g_tthIndex.find(p_tth) == g_tthIndex.end();
 }
 
+bool ShareManager::isMaybeSharedTTH(const TTHValue& p_tth)
+{
+	const auto l_table = std::atomic_load(&g_tth_table);
+	return !l_table || l_table->mayContain(p_tth);
+}
+
+void ShareManager::rebuildTTHTable()
+{
+	if (ClientManager::isBeforeShutdown())
+		return;
+	CFlyLock(g_csTTHIndex);
+	// Room for a half more: the files hashed later go into this table, not into a new one
+	auto l_table = std::make_shared<TTHLookupTable>(g_tthIndex.size() + g_tthIndex.size() / 2 + 1024);
+	for (auto i = g_tthIndex.cbegin(); i != g_tthIndex.cend(); ++i)
+	{
+		l_table->add(i->first);
+	}
+	// Published under g_csTTHIndex: addTTHTableL of a newer TTH can't be lost with an older table
+	std::atomic_store(&g_tth_table, l_table);
+}
+
+void ShareManager::addTTHTableL(const TTHValue& p_tth)
+{
+	if (const auto l_table = std::atomic_load(&g_tth_table))
+	{
+		if (!l_table->addShared(p_tth))
+		{
+			// Full: the index is asked directly until the timer builds a larger table
+			std::atomic_store(&g_tth_table, std::shared_ptr<TTHLookupTable>());
+		}
+	}
+}
+
 bool ShareManager::isUnknownFile(const string& p_search)
 {
 	CFlyReadLock(*g_csShareNotExists);
@@ -2637,6 +2874,101 @@ void ShareManager::addCacheFile(const string& p_search, const SearchResultList&
 	CFlyWriteLock(*g_csShareCache);
 	g_file_cache_map.insert(make_pair(p_search, p_search_result));
 }
+bool ShareManager::searchIndexL(SearchResultList& aResults, const MultiStringSearch& p_search, const SearchParamBase& p_search_param) const
+{
+	ShareSearchIndex::Result l_result;
+	if (!g_search_index.find(p_search, MultiStringSearch(), l_result))
+		return false;
+		
+	// Same filters as searchSnapshot, applied to the entries that satisfied all the search words
+	auto l_add = [&](ShareSearchIndex::EntryId p_id) -> bool
+	{
+		const SearchIndexItem& l_item = g_search_index_items[p_id];
+		if (!l_item.m_dir->hasType(p_search_param.m_file_type))
+			return true;
+		if (l_item.m_file == nullptr)
+		{
+			if (isDirectoryResult(p_search_param))
+			{
+				aResults.push_back(SearchResultCore(SearchResult::TYPE_DIRECTORY, 0, l_item.m_dir->getFullName(), TTHValue(), -1 /*token*/));
+				ShareManager::incHits();
+				return aResults.size() < p_search_param.m_max_results;
+			}
+			return true;
+		}
+		const Directory::ShareFile& l_file = *l_item.m_file;
+		if (p_search_param.m_file_type == Search::TYPE_DIRECTORY || !isFileSizeOk(p_search_param, l_file.getSize()))
+			return true;
+		if (checkType(l_file.getName(), p_search_param.m_file_type))
+		{
+			aResults.push_back(SearchResultCore(SearchResult::TYPE_FILE, l_file.getSize(), l_item.m_dir->getFullName() + l_file.getName(), l_file.getTTH(), -1  /*token*/));
+			ShareManager::incHits();
+			return aResults.size() < p_search_param.m_max_results;
+		}
+		return true;
+	};
+	for (auto i = l_result.m_ranges.cbegin(); i != l_result.m_ranges.cend(); ++i)
+	{
+		for (auto j = i->m_begin; j != i->m_end; ++j)
+		{
+			if (!l_add(j))
+				return true;
+		}
+	}
+	for (auto i = l_result.m_pending.cbegin(); i != l_result.m_pending.cend(); ++i)
+	{
+		if (!l_add(*i))
+			return true;
+	}
+	return true;
+}
+bool ShareManager::searchIndexL(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults) const
+{
+	ShareSearchIndex::Result l_result;
+	if (!g_search_index.find(aStrings.m_include, aStrings.m_exclude, l_result))
+		return false;
+		
+	auto l_add = [&](ShareSearchIndex::EntryId p_id) -> bool
+	{
+		const SearchIndexItem& l_item = g_search_index_items[p_id];
+		if (l_item.m_file == nullptr)
+		{
+			if (aStrings.isDirectoryResult())
+			{
+				aResults.push_back(SearchResultCore(SearchResult::TYPE_DIRECTORY, l_item.m_dir->getDirSizeFast(), l_item.m_dir->getFullName(), TTHValue(), -1  /*token*/));
+				ShareManager::incHits();
+				return aResults.size() < maxResults;
+			}
+			return true;
+		}
+		const Directory::ShareFile& l_file = *l_item.m_file;
+		if (aStrings.m_isDirectory || !aStrings.isFileSizeOk(l_file.getSize()))
+			return true;
+		if (aStrings.isExcludedLower(l_file.getLowName()))
+			return true;
+		if (aStrings.hasExt(l_file.getName()))
+		{
+			aResults.push_back(SearchResultCore(SearchResult::TYPE_FILE, l_file.getSize(), l_item.m_dir->getFullName() + l_file.getName(), l_file.getTTH(), -1  /*token*/));
+			ShareManager::incHits();
+			return aResults.size() < maxResults;
+		}
+		return true;
+	};
+	for (auto i = l_result.m_ranges.cbegin(); i != l_result.m_ranges.cend() && !ClientManager::isBeforeShutdown(); ++i)
+	{
+		for (auto j = i->m_begin; j != i->m_end; ++j)
+		{
+			if (!l_add(j))
+				return true;
+		}
+	}
+	for (auto i = l_result.m_pending.cbegin(); i != l_result.m_pending.cend(); ++i)
+	{
+		if (!l_add(*i))
+			return true;
+	}
+	return true;
+}
 void ShareManager::search(SearchResultList& aResults, const SearchParam& p_search_param) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
@@ -2726,14 +3058,35 @@ void ShareManager::search(SearchResultList& aResults, const SearchParam& p_searc
 	}
 	if (!ssl.empty())
 	{
+		const MultiStringSearch l_search(ssl);
+		if (l_search.empty())
+		{
+			dcdebug("ShareManager::search: too many search terms (%u), matching them one by one\n", unsigned(ssl.size()));
+			const auto l_snapshot = getSnapshot(false);
+			for (ShareSnapshot::DirId j = 0; j < l_snapshot->getRootCount() && aResults.size() < p_search_param.m_max_results; ++j)
+			{
+				searchSnapshot(*l_snapshot, j, aResults, ssl, p_search_param);
+			}
+		}
+		else
+		{
+			bool l_is_index;
+			{
 #ifdef FLYLINKDC_USE_RW_LOCK_SHARE
-		CFlyReadLock(*g_csShare);
+				CFlyReadLock(*g_csShare);
 #else
-		CFlyLock(g_csShare);
+				CFlyLock(g_csShare);
 #endif
-		for (auto j = g_list_directories.cbegin(); j != g_list_directories.cend() && aResults.size() < p_search_param.m_max_results; ++j)
-		{
-			(*j)->search(aResults, ssl, p_search_param);
+				l_is_index = searchIndexL(aResults, l_search, p_search_param);
+			}
+			if (!l_is_index)
+			{
+				const auto l_snapshot = getSnapshot(false);
+				for (ShareSnapshot::DirId j = 0; j < l_snapshot->getRootCount() && aResults.size() < p_search_param.m_max_results; ++j)
+				{
+					searchSnapshot(*l_snapshot, j, aResults, l_search, l_search.getFullMask(), p_search_param);
+				}
+			}
 		}
 	}
 	//    -          - .
@@ -2752,70 +3105,67 @@ inline static uint16_t toCode(char a, char b)
 	return (uint16_t)a | ((uint16_t)b) << 8;
 }
 
-ShareManager::AdcSearch::AdcSearch(const StringList& params) : m_includePtr(&m_includeX), m_gt(0),
-	m_lt(std::numeric_limits<int64_t>::max()), m_hasRoot(false), m_isDirectory(false)
+ShareManager::AdcSearch::AdcSearch(const AdcCommand& p_cmd) : m_gt(0),
+	m_lt(std::numeric_limits<int64_t>::max()), m_hasRoot(false), m_isDirectory(false), m_isValid(false)
 {
-	for (auto i = params.cbegin(); i != params.cend(); ++i)
+	for (size_t i = 0; i < p_cmd.getParamCount(); ++i)
 	{
-		const string& p = *i;
+		const boost::string_view p = p_cmd.getParamView(i);
 		if (p.length() <= 2)
 			continue;
 			
+		// p.data() + 2 is followed by a separator, numbers are read without a copy
 		const uint16_t cmd = toCode(p[0], p[1]);
 		if (toCode('T', 'R') == cmd)
 		{
 			m_hasRoot = true;
-			m_root = TTHValue(p.substr(2));
-			return;
+			m_root = TTHValue(p.substr(2).to_string());
+			break;
 		}
 		else if (toCode('A', 'N') == cmd)
 		{
-			m_includeX.push_back(StringSearch(p.substr(2)));
+			m_includeX.push_back(StringSearch(p.substr(2).to_string()));
 		}
 		else if (toCode('N', 'O') == cmd)
 		{
-			m_exclude.push_back(StringSearch(p.substr(2)));
+			m_excludeX.push_back(StringSearch(p.substr(2).to_string()));
 		}
 		else if (toCode('E', 'X') == cmd)
 		{
-			m_exts.push_back(p.substr(2));
+			m_exts.push_back(p.substr(2).to_string());
 		}
 		else if (toCode('G', 'R') == cmd)
 		{
-			const auto l_exts = AdcHub::parseSearchExts(Util::toInt(p.substr(2)));
+			const auto l_exts = AdcHub::parseSearchExts(Util::toInt(p.data() + 2));
 			m_exts.insert(m_exts.begin(), l_exts.begin(), l_exts.end());
 		}
 		else if (toCode('R', 'X') == cmd)
 		{
-			m_noExts.push_back(p.substr(2));
+			m_noExts.push_back(p.substr(2).to_string());
 		}
 		else if (toCode('G', 'E') == cmd)
 		{
-			m_gt = Util::toInt64(p.substr(2));
+			m_gt = Util::toInt64(p.data() + 2);
 		}
 		else if (toCode('L', 'E') == cmd)
 		{
-			m_lt = Util::toInt64(p.substr(2));
+			m_lt = Util::toInt64(p.data() + 2);
 		}
 		else if (toCode('E', 'Q') == cmd)
 		{
-			m_lt = m_gt = Util::toInt64(p.substr(2));
+			m_lt = m_gt = Util::toInt64(p.data() + 2);
 		}
 		else if (toCode('T', 'Y') == cmd)
 		{
 			m_isDirectory = (p[2] == '2');
 		}
 	}
-}
-
-bool ShareManager::AdcSearch::isExcluded(const string& str)
-{
-	for (auto i = m_exclude.cbegin(); i != m_exclude.cend(); ++i)
+	m_isValid = m_include.init(m_includeX) && m_exclude.init(m_excludeX);
+	if (!m_isValid)
 	{
-		if (i->match(str))
-			return true;
+		m_include.init(StringSearch::List());
+		m_exclude.init(StringSearch::List());
 	}
-	return false;
 }
 
 bool ShareManager::AdcSearch::hasExt(const string& name)
@@ -2835,71 +3185,122 @@ bool ShareManager::AdcSearch::hasExt(const string& name)
 	return false;
 }
 
-void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults) const noexcept
+void ShareManager::searchSnapshot(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_dir, SearchResultList& aResults, AdcSearch& aStrings,
+                                  MultiStringSearch::Mask p_need, StringList::size_type maxResults) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
 		
-	const StringSearch::List* cur = aStrings.m_includePtr;
-	StringSearch::List* old = aStrings.m_includePtr;
+	// Find any matches in the directory name
+	size_t l_len;
+	const uint8_t* l_low_name = p_snapshot.getDirLowName(p_dir, l_len);
+	if (p_need && aStrings.m_exclude.matchLower(l_low_name, l_len, aStrings.m_exclude.getFullMask()) == 0) // http://flylinkdc.blogspot.com/2010/08/1.html
+	{
+		p_need &= ~aStrings.m_include.matchLower(l_low_name, l_len, p_need);
+	}
 	
-	unique_ptr<StringSearch::List> newStr;
+	if (p_need == 0 && aStrings.isDirectoryResult())
+	{
+// We satisfied all the search words! Add the directory...
+		const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, p_snapshot.getDirSize(p_dir), p_snapshot.getFullName(p_dir), TTHValue(), -1  /*token*/);
+		aResults.push_back(l_sr);
+		ShareManager::incHits();
+	}
 	
-	// Find any matches in the directory name
-	for (auto k = cur->cbegin(); k != cur->cend(); ++k)
+	if (!aStrings.m_isDirectory)
 	{
-		if (k->matchLower(getLowName()) && !aStrings.isExcluded(getName())) // http://flylinkdc.blogspot.com/2010/08/1.html
+		for (ShareSnapshot::FileId i = p_snapshot.getFirstFile(p_dir); i != p_snapshot.getEndFile(p_dir) && !ClientManager::isBeforeShutdown(); ++i)
 		{
-			if (!newStr.get())
+			const int64_t l_size = p_snapshot.getFileSize(i);
+			if (!aStrings.isFileSizeOk(l_size))
+				continue;
+			
+			l_low_name = p_snapshot.getFileLowName(i, l_len);
+			if (aStrings.m_exclude.matchLower(l_low_name, l_len, aStrings.m_exclude.getFullMask()) != 0)
+				continue;
+				
+			if (!aStrings.m_include.matchAllLower(l_low_name, l_len, p_need)) // http://flylinkdc.blogspot.com/2010/08/1.html
+				continue;
+				
+			// Check file type...
+			const string l_name = p_snapshot.getFileName(i);
+			if (aStrings.hasExt(l_name))
 			{
-				newStr = std::make_unique<StringSearch::List>(*cur);
+				const SearchResultCore l_sr(SearchResult::TYPE_FILE, l_size, p_snapshot.getFullName(p_dir) + l_name, p_snapshot.getFileTTH(i), -1  /*token*/);
+				aResults.push_back(l_sr);
+				ShareManager::incHits();
+				if (aResults.size() >= maxResults)
+				{
+					return;
+				}
 			}
-			newStr->erase(remove(newStr->begin(), newStr->end(), *k), newStr->end());
 		}
 	}
 	
-	if (newStr.get() != 0)
+	for (ShareSnapshot::DirId l = p_snapshot.getFirstSubdirectory(p_dir); l != p_snapshot.getEndSubdirectory(p_dir) && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++l)
 	{
-		cur = newStr.get();
+		searchSnapshot(p_snapshot, l, aResults, aStrings, p_need, maxResults);
 	}
+}
+
+void ShareManager::searchSnapshot(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_dir, SearchResultList& aResults, AdcSearch& aStrings,
+                                  const StringSearch::List& p_include, StringList::size_type maxResults) noexcept
+{
+	if (ClientManager::isBeforeShutdown())
+		return;
+		
+	size_t l_len;
+	const uint8_t* l_low_name = p_snapshot.getDirLowName(p_dir, l_len);
+	const string l_dir_low_name(reinterpret_cast<const char*>(l_low_name), l_len);
+	unique_ptr<StringSearch::List> l_new_include;
+	if (!p_include.empty() && !aStrings.isExcludedLower(l_dir_low_name))
+	{
+		for (auto k = p_include.cbegin(); k != p_include.cend(); ++k)
+		{
+			if (k->matchLower(l_dir_low_name))
+			{
+				if (!l_new_include)
+				{
+					l_new_include = std::make_unique<StringSearch::List>(p_include);
+				}
+				l_new_include->erase(remove(l_new_include->begin(), l_new_include->end(), *k), l_new_include->end());
+			}
+		}
+	}
+	const StringSearch::List& l_include = l_new_include ? *l_new_include : p_include;
 	
-	const bool sizeOk = (aStrings.m_gt == 0);
-	if (cur->empty() && aStrings.m_exts.empty() && sizeOk)
+	if (l_include.empty() && aStrings.isDirectoryResult())
 	{
-// We satisfied all the search words! Add the directory...
-		const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, getDirSizeFast(), getFullName(), TTHValue(), -1  /*token*/);
+		const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, p_snapshot.getDirSize(p_dir), p_snapshot.getFullName(p_dir), TTHValue(), -1  /*token*/);
 		aResults.push_back(l_sr);
 		ShareManager::incHits();
 	}
 	
 	if (!aStrings.m_isDirectory)
 	{
-		for (auto i = m_share_files.cbegin(); i != m_share_files.cend() && !ClientManager::isBeforeShutdown(); ++i)
+		string l_file_low_name;
+		for (ShareSnapshot::FileId i = p_snapshot.getFirstFile(p_dir); i != p_snapshot.getEndFile(p_dir) && !ClientManager::isBeforeShutdown(); ++i)
 		{
-		
-			if (!(i->getSize() >= aStrings.m_gt))
-			{
-				continue;
-			}
-			else if (!(i->getSize() <= aStrings.m_lt))
-			{
+			const int64_t l_size = p_snapshot.getFileSize(i);
+			if (!aStrings.isFileSizeOk(l_size))
 				continue;
-			}
-			
-			if (aStrings.isExcluded(i->getName()))
+				
+			l_low_name = p_snapshot.getFileLowName(i, l_len);
+			l_file_low_name.assign(reinterpret_cast<const char*>(l_low_name), l_len);
+			if (aStrings.isExcludedLower(l_file_low_name))
 				continue;
 				
-			StringSearch::List::const_iterator j = cur->begin();
-			for (; j != cur->end() && j->matchLower(i->getLowName()); ++j) // http://flylinkdc.blogspot.com/2010/08/1.html
+			auto j = l_include.cbegin();
+			for (; j != l_include.cend() && j->matchLower(l_file_low_name); ++j)
 				;   // Empty
 				
-			if (j != cur->end())
+			if (j != l_include.cend())
 				continue;
 				
-			// Check file type...
-			if (aStrings.hasExt(i->getName()))
+			const string l_name = p_snapshot.getFileName(i);
+			if (aStrings.hasExt(l_name))
 			{
-				const SearchResultCore l_sr(SearchResult::TYPE_FILE, i->getSize(), getFullName() + i->getName(), i->getTTH(), -1  /*token*/);
+				const SearchResultCore l_sr(SearchResult::TYPE_FILE, l_size, p_snapshot.getFullName(p_dir) + l_name, p_snapshot.getFileTTH(i), -1  /*token*/);
 				aResults.push_back(l_sr);
 				ShareManager::incHits();
 				if (aResults.size() >= maxResults)
@@ -2910,19 +3311,18 @@ void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStr
 		}
 	}
 	
-	for (auto l = m_share_directories.cbegin(); l != m_share_directories.cend() && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++l)
+	for (ShareSnapshot::DirId l = p_snapshot.getFirstSubdirectory(p_dir); l != p_snapshot.getEndSubdirectory(p_dir) && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++l)
 	{
-		l->second->search(aResults, aStrings, maxResults);
+		searchSnapshot(p_snapshot, l, aResults, aStrings, l_include, maxResults);
 	}
-	aStrings.m_includePtr = old;
 }
 
-void ShareManager::search_max_result(SearchResultList& aResults, const StringList& params, StringList::size_type maxResults, StringSearch::List& reguest) noexcept // [!] IRainman add StringSearch::List& reguest
+void ShareManager::search_max_result(SearchResultList& aResults, const AdcCommand& p_cmd, StringList::size_type maxResults, StringSearch::List& reguest) noexcept // [!] IRainman add StringSearch::List& reguest
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
 		
-	AdcSearch srch(params);
+	AdcSearch srch(p_cmd);
 	reguest = srch.m_includeX; // [+] IRainman
 	if (srch.m_hasRoot)
 	{
@@ -2939,15 +3339,31 @@ void ShareManager::search_max_result(SearchResultList& aResults, const StringLis
 			}
 		}
 	}
+	if (!srch.isValid())
+	{
+		dcdebug("ShareManager::search_max_result: too many search terms (%u), matching them one by one\n", unsigned(srch.m_includeX.size()));
+		const auto l_snapshot = getSnapshot(false);
+		for (ShareSnapshot::DirId j = 0; j < l_snapshot->getRootCount() && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++j)
+		{
+			searchSnapshot(*l_snapshot, j, aResults, srch, srch.m_includeX, maxResults);
+		}
+		return;
+	}
+	bool l_is_index;
 	{
 #ifdef FLYLINKDC_USE_RW_LOCK_SHARE
 		CFlyReadLock(*g_csShare);
 #else
 		CFlyLock(g_csShare);
 #endif
-		for (auto j = g_list_directories.cbegin(); j != g_list_directories.cend() && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++j)
+		l_is_index = searchIndexL(aResults, srch, maxResults);
+	}
+	if (!l_is_index)
+	{
+		const auto l_snapshot = getSnapshot(false);
+		for (ShareSnapshot::DirId j = 0; j < l_snapshot->getRootCount() && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++j)
 		{
-			(*j)->search(aResults, srch, maxResults);
+			searchSnapshot(*l_snapshot, j, aResults, srch, srch.m_include.getFullMask(), maxResults);
 		}
 	}
 }
@@ -3051,6 +3467,7 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 			{
 				const string l_file_name = Util::getFileName(fname);
 				const auto i = d->findFileIterL(l_file_name);
+				const Directory::ShareFile* l_file;
 				if (i != d->m_share_files.end())
 				{
 					CFlyLock(g_csTTHIndex);
@@ -3062,6 +3479,8 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 					Directory::ShareFile* f = const_cast<Directory::ShareFile*>(&(*i));
 					f->setTTH(p_root);
 					g_tthIndex.insert(make_pair(f->getTTH(), i));
+					addTTHTableL(f->getTTH());
+					l_file = f;
 					// TODO g_lastSharedDate =
 					g_isNeedsUpdateShareSize = true;
 				}
@@ -3086,41 +3505,103 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 							updateIndicesFileL(*d, it.first);
 						}
 					}
+					addSearchIndexFileL(*d, *it.first);
+					l_file = f;
 				}
 				setDirty();
+				addSnapshotChangeL(*d, *l_file);
 				m_is_forceXmlRefresh = true;
+				Directory* l_root = d.get();
+				while (l_root->getParent())
+				{
+					l_root = l_root->getParent();
+				}
+				invalidateXmlCache(l_root->getLowName());
 			}
 		}
 	}
 	//   
-	clear_partial_cache(fname);
 	clear_tth_path_cache();
 	internalClearCache(true);
 }
 
-void ShareManager::clear_partial_cache(string p_path)
+uint64_t ShareManager::getXmlVersionL(const string& p_root)
 {
-	CFlyFastLock(g_csPartialCache);
-	bool l_is_clear = true;
-	if (!p_path.empty())
+	if (p_root.empty())
+		return g_xml_version;
+	const auto i = g_xml_root_versions.find(p_root);
+	return i == g_xml_root_versions.end() ? g_xml_all_version : std::max(i->second, g_xml_all_version);
+}
+
+void ShareManager::invalidateXmlCache(const string& p_root)
+{
+	CFlyFastLock(g_csXmlCache);
+	++g_xml_version;
+	if (p_root.empty())
 	{
-		boost::replace_all(p_path, "\\", "/");
-		for (auto i = g_partial_list_cache.begin(); i != g_partial_list_cache.end();)
+		g_xml_all_version = g_xml_version;
+		g_xml_root_versions.clear();
+		g_xml_fragments.clear();
+		g_partial_list_cache.clear();
+		return;
+	}
+	g_xml_root_versions[p_root] = g_xml_version;
+	g_xml_fragments.erase(p_root);
+	for (auto i = g_partial_list_cache.begin(); i != g_partial_list_cache.end();)
+	{
+		// "/" shows the sizes of all the roots
+		if (i->second.m_root.empty() || i->second.m_root == p_root)
+		{
+			i = g_partial_list_cache.erase(i);
+		}
+		else
 		{
-			if (p_path.find(i->first) != string::npos)
-			{
-				l_is_clear = false;
-				g_partial_list_cache.erase(i->first);
-				i = g_partial_list_cache.begin();
-				continue;
-			}
 			++i;
 		}
 	}
-	if (l_is_clear)
+}
+
+std::shared_ptr<const ShareManager::XmlFragment> ShareManager::getXmlFragment(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_root, uint64_t p_version, string& p_xml)
+{
+	size_t l_len;
+	const uint8_t* l_low_name = p_snapshot.getDirLowName(p_root, l_len);
+	const string l_root((const char*)l_low_name, l_len);
+	// The XML is made even for a cached fragment: the TTH of files.xml needs it, and it is cheap next to the packing
+	p_xml.clear();
 	{
-		g_partial_list_cache.clear();
+		StringOutputStream l_sos(p_xml);
+		string l_indent;
+		string l_tmp;
+		p_snapshot.toXml(l_sos, p_root, l_indent, l_tmp, true);
 	}
+	{
+		CFlyFastLock(g_csXmlCache);
+		const auto i = g_xml_fragments.find(l_root);
+		// The packed XML must be the hashed one, a fragment of another state of the root is packed again
+		if (i != g_xml_fragments.end() && i->second->m_xml_size == int64_t(p_xml.size()))
+		{
+			return i->second;
+		}
+	}
+	auto l_fragment = std::make_shared<XmlFragment>();
+	l_fragment->m_xml_size = p_xml.size();
+	{
+		StringOutputStream l_bz2(l_fragment->m_bz2);
+		ParallelBZipOutputStream l_bzipper(&l_bz2);
+		if (!p_xml.empty())
+		{
+			l_bzipper.write(p_xml);
+		}
+		l_bzipper.flushBuffers(true);
+	}
+	{
+		CFlyFastLock(g_csXmlCache);
+		if (getXmlVersionL(l_root) <= p_version)
+		{
+			g_xml_fragments[l_root] = l_fragment;
+		}
+	}
+	return l_fragment;
 }
 
 void ShareManager::on(TimerManagerListener::Second, uint64_t tick) noexcept
@@ -3128,6 +3609,25 @@ void ShareManager::on(TimerManagerListener::Second, uint64_t tick) noexcept
 	if ((++m_count_sec % 10) == 0)
 	{
 		CFlylinkDBManager::getInstance()->flush_hash();
+		// The hashed files go into the table in place, a new one is built only after it ran full
+		if (!g_RebuildIndexes && !std::atomic_load(&g_tth_table))
+		{
+			rebuildTTHTable();
+		}
+	}
+	// The searches see the files hashed after the last snapshot up to 5 seconds later - don't copy it after every file
+	if (g_is_snapshot_dirty && !ClientManager::isBeforeShutdown())
+	{
+		bool l_is_apply;
+		{
+			CFlyFastLock(g_csSnapshotChanges);
+			l_is_apply = g_snapshot_dirty_tick + 5 * 1000 < tick;
+		}
+		if (l_is_apply)
+		{
+			applySnapshotChanges();
+			internalClearCache(true);
+		}
 	}
 }
 
@@ -3149,6 +3649,26 @@ void ShareManager::on(TimerManagerListener::Minute, uint64_t tick) noexcept
 			g_BotDetectMap.clear();
 		}
 	}
+	bool l_is_rebuild_index;
+	{
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+		CFlyReadLock(*g_csShare);
+#else
+		CFlyLock(g_csShare);
+#endif
+		l_is_rebuild_index = BOOLSETTING(USE_SHARE_SEARCH_INDEX) != g_search_index.isReady();
+	}
+	if (l_is_rebuild_index && !ClientManager::isBeforeShutdown())
+	{
+		// The setting was changed or too many files were hashed after the last refresh
+		CFlyBusy l_busy(g_RebuildIndexes);
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+		CFlyWriteLock(*g_csShare);
+#else
+		CFlyLock(g_csShare);
+#endif
+		rebuildSearchIndexL();
+	}
 	internalCalcShareSize(); // [+]IRainman opt.
 	internalClearCache(false);
 #ifdef _DEBUG
@@ -3164,7 +3684,7 @@ void ShareManager::tryFixBadAlloc()
 		g_cache_limit = 10;
 	}
 	internalClearCache(true);
-	clear_partial_cache("");
+	invalidateXmlCache("");
 	clear_tth_path_cache();
 	static bool g_is_send_report = false;
 	if (!g_is_send_report)
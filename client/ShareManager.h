@@ -23,12 +23,17 @@
 #define DCPLUSPLUS_DCPP_SHARE_MANAGER_H
 
 #include <ShlObj.h>
+#include <atomic>
 
 #include "SearchManager.h"
 #include "LogManager.h"
 #include "HashManager.h"
 #include "QueueManagerListener.h"
 #include "BloomFilter.h"
+#include "MultiStringSearch.h"
+#include "ShareSearchIndex.h"
+#include "ShareSnapshot.h"
+#include "TTHLookupTable.h"
 #include "Pointer.h"
 #include "CFlylinkDBManager.h"
 
@@ -103,7 +108,7 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		bool   search_tth(const TTHValue& p_tth, SearchResultList& aResults, bool p_is_check_parent);
 	public:
 		void   search(SearchResultList& aResults, const SearchParam& p_search_param) noexcept;
-		void   search_max_result(SearchResultList& aResults, const StringList& params, StringList::size_type maxResults, StringSearch::List& reguest) noexcept;
+		void   search_max_result(SearchResultList& aResults, const AdcCommand& p_cmd, StringList::size_type maxResults, StringSearch::List& reguest) noexcept;
 		
 		bool findByRealPathName(const string& realPathname, TTHValue* outTTHPtr, string* outfilenamePtr = NULL, int64_t* outSizePtr = NULL); // [+] SSA
 		
@@ -317,6 +322,8 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 				DirectoryMap m_share_directories;
 				ShareFile::Set m_share_files;
 				int64_t m_size;
+				ShareSearchIndex::EntryId m_index_id;
+				ShareSnapshot::DirId m_snapshot_id;
 				
 				static Ptr create(const string& aName, const Ptr& aParent = Ptr())
 				{
@@ -339,11 +346,10 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 					return m_size;
 				}
 				
-				void search(SearchResultList& aResults, StringSearch::List& aStrings, const SearchParamBase& p_search_param) const noexcept;
-				void search(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults) const noexcept;
-				
-				void toXmlL(OutputStream& xmlFile, string& indent, string& tmp2, bool fullList) const;
-				void filesToXmlL(OutputStream& xmlFile, string& indent, string& tmp2) const;
+				uint16_t getTypes() const
+				{
+					return m_fileTypes_bitmap;
+				}
 				
 				ShareFile::Set::const_iterator findFileIterL(const string& aFile) const
 				{
@@ -373,14 +379,39 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		
 		struct AdcSearch
 		{
-			explicit AdcSearch(const StringList& params);
+			explicit AdcSearch(const AdcCommand& p_cmd);
 			
-			bool isExcluded(const string& str);
+			/** false if the query has more terms than MultiStringSearch can hold - m_includeX and m_excludeX are matched one by one then */
+			bool isValid() const
+			{
+				return m_isValid;
+			}
+			bool isExcludedLower(const string& p_low_name) const
+			{
+				if (m_isValid)
+					return m_exclude.matchLower(p_low_name, m_exclude.getFullMask()) != 0;
+				for (auto i = m_excludeX.cbegin(); i != m_excludeX.cend(); ++i)
+				{
+					if (i->matchLower(p_low_name))
+						return true;
+				}
+				return false;
+			}
+			/** A directory matching all the terms is a result itself */
+			bool isDirectoryResult() const
+			{
+				return m_exts.empty() && m_gt == 0;
+			}
+			bool isFileSizeOk(int64_t p_size) const
+			{
+				return p_size >= m_gt && p_size <= m_lt;
+			}
 			bool hasExt(const string& name);
 			
-			StringSearch::List* m_includePtr;
 			StringSearch::List m_includeX;
-			StringSearch::List m_exclude;
+			StringSearch::List m_excludeX;
+			MultiStringSearch m_include;
+			MultiStringSearch m_exclude;
 			StringList m_exts;
 			StringList m_noExts;
 			
@@ -390,12 +421,20 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 			TTHValue m_root;
 			bool m_hasRoot;
 			bool m_isDirectory;
+			bool m_isValid;
 		};
 		
 		boost::atomic_flag m_updateXmlListInProcess; // [+] IRainman opt.
 		
 		int64_t xmlListLen;
+		// [!] The uncompressed list isn't written any more: its TTH is calculated while the .bz2 is generated
 		TTHValue xmlRoot;
+		mutable FastCriticalSection m_csXmlRoot; // xmlRoot and the name of the .bz2 are replaced together
+		TTHValue getXmlRoot() const
+		{
+			CFlyFastLock(m_csXmlRoot);
+			return xmlRoot;
+		}
 		int64_t bzXmlListLen;
 		TTHValue bzXmlRoot;
 		unique_ptr<File> bzXmlRef;
@@ -417,9 +456,31 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		static CriticalSection g_csTTHIndex;
 		static FastCriticalSection g_csBot;
 		
-		static FastCriticalSection g_csPartialCache;
-		static std::unordered_map<string, std::pair<string, unsigned>> g_partial_list_cache;
-		static void clear_partial_cache(string p_path);
+		// [+] The cached XML: the packed list of every root (an independent bzip2 stream of files.xml.bz2)
+		// and the partial lists. A change of the share removes the entries of its root only.
+		struct XmlFragment
+		{
+			int64_t m_xml_size;
+			string m_bz2;
+		};
+		struct PartialList
+		{
+			string m_root; // the low name, empty for "/"
+			string m_xml;
+			unsigned m_hits;
+		};
+		static FastCriticalSection g_csXmlCache;
+		static std::unordered_map<string, std::shared_ptr<const XmlFragment>> g_xml_fragments; // by the low name of the root
+		static std::unordered_map<string, PartialList> g_partial_list_cache; // by the ADC path of the directory
+		static std::unordered_map<string, uint64_t> g_xml_root_versions; // the last change of every root
+		static uint64_t g_xml_version; // the last change of any root
+		static uint64_t g_xml_all_version; // the last change of all the roots
+		/** An entry is stored only if its root wasn't changed since the version it was made from */
+		static uint64_t getXmlVersionL(const string& p_root);
+		/** Removes the cached XML of the root, of all the roots if p_root is empty */
+		static void invalidateXmlCache(const string& p_root);
+		/** p_xml gets the XML of the root, the cached fragment only saves the packing */
+		static std::shared_ptr<const XmlFragment> getXmlFragment(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_root, uint64_t p_version, string& p_xml);
 		
 		static FastCriticalSection g_csTTHPathCache;
 		static std::unordered_map<TTHValue, std::pair<string, unsigned>> g_tth_path_cache;
@@ -470,7 +531,59 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		static bool g_isNeedsUpdateShareSize;
 		static int64_t g_CurrentShareSize;
 		static bool g_ignoreFileSizeHFS;
-		static BloomFilter<5> g_bloom;
+		static BlockedBloomFilter<5> g_bloom;
+		
+		// Points into the tree: cleared under the write lock of g_csShare wherever directories leave the tree
+		struct SearchIndexItem
+		{
+			SearchIndexItem(const Directory* p_dir, const Directory::ShareFile* p_file) : m_dir(p_dir), m_file(p_file)
+			{
+			}
+			const Directory* m_dir;
+			const Directory::ShareFile* m_file; // nullptr for the directory entry
+		};
+		static ShareSearchIndex g_search_index;
+		static std::vector<SearchIndexItem> g_search_index_items;
+		static void clearSearchIndexL();
+		void rebuildSearchIndexL();
+		void addSearchIndexDirL(Directory& p_dir);
+		void addSearchIndexFileL(const Directory& p_dir, const Directory::ShareFile& p_file);
+		bool searchIndexL(SearchResultList& aResults, const MultiStringSearch& p_search, const SearchParamBase& p_search_param) const;
+		bool searchIndexL(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults) const;
+		
+		// [+] Read-only copy of the tree for the searches and the file lists, swapped atomically after every change
+		static ShareSnapshot::Ptr g_snapshot;
+		static std::atomic<bool> g_is_snapshot_dirty;
+		// The files hashed after the snapshot, copied into a new one without the share lock
+		static ShareSnapshot::FileChangeList g_snapshot_changes;
+		static uint64_t g_snapshot_dirty_tick;
+		static FastCriticalSection g_csSnapshotChanges;
+		/** Serializes the builders of the snapshot: rebuildSnapshotL (under the share lock) and applySnapshotChanges (without it) */
+		static CriticalSection g_csSnapshot;
+		static void rebuildSnapshotL();
+		static void addSnapshotChangeL(const Directory& p_dir, const Directory::ShareFile& p_file);
+		static void applySnapshotChanges();
+		/** @param p_is_actual copy the pending changes into the snapshot first */
+		static ShareSnapshot::Ptr getSnapshot(bool p_is_actual);
+		
+		// [+] Lock-free prefilter of g_tthIndex for the TTH searches, the new TTHs are added to it in place.
+		// null only after it ran full, until the next rebuild - then the index is asked directly
+		static std::shared_ptr<TTHLookupTable> g_tth_table;
+		static void rebuildTTHTable();
+		static void addTTHTableL(const TTHValue& p_tth);
+		/** false - the TTH isn't shared for sure */
+		static bool isMaybeSharedTTH(const TTHValue& p_tth);
+		static string getRealPath(const ShareSnapshot& p_snapshot, ShareSnapshot::FileId p_file);
+		/** @param p_need terms of p_search not yet found in the parent directory names */
+		static void searchSnapshot(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_dir, SearchResultList& aResults, const MultiStringSearch& p_search,
+		                           MultiStringSearch::Mask p_need, const SearchParamBase& p_search_param) noexcept;
+		static void searchSnapshot(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_dir, SearchResultList& aResults, AdcSearch& aStrings,
+		                           MultiStringSearch::Mask p_need, StringList::size_type maxResults) noexcept;
+		/** The term by term walk for the queries MultiStringSearch can't hold. @param p_search terms not yet found in the parent directory names */
+		static void searchSnapshot(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_dir, SearchResultList& aResults, const StringSearch::List& p_search,
+		                           const SearchParamBase& p_search_param) noexcept;
+		static void searchSnapshot(const ShareSnapshot& p_snapshot, ShareSnapshot::DirId p_dir, SearchResultList& aResults, AdcSearch& aStrings,
+		                           const StringSearch::List& p_include, StringList::size_type maxResults) noexcept;
 		
 		string findFileAndRealPath(const string& virtualFile, TTHValue& p_tth, bool p_is_fetch_tth) const;
 		void checkShutdown(const string& virtualFile) const;
@@ -489,6 +602,7 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		void rebuildIndicesL(bool p_is_clear_cache);
 		
 		bool updateIndicesDirL(Directory& aDirectory);
+		static size_t getBloomItemsL(const Directory& p_dir);
 		bool updateIndicesFileL(Directory& dir, const Directory::ShareFile::Set::iterator& i);
 		
 		Directory::Ptr get_mergeL(const Directory::Ptr& directory);
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ShareSearchIndex.h"
+
+#include <boost/unordered/unordered_map.hpp>
+
+namespace
+{
+/** First element >= p_value in [p_first, p_last): exponential probe, then binary search */
+template<class T, class Proj>
+const T* gallop(const T* p_first, const T* p_last, ShareSearchIndex::EntryId p_value, Proj p_proj)
+{
+	size_t l_step = 1;
+	const T* l_low = p_first;
+	while (p_first + l_step < p_last && p_proj(p_first[l_step]) < p_value)
+	{
+		l_low = p_first + l_step;
+		l_step <<= 1;
+	}
+	const T* l_high = std::min(p_first + l_step + 1, p_last);
+	return std::lower_bound(l_low, l_high, p_value, [&](const T & p_item, ShareSearchIndex::EntryId p_v)
+	{
+		return p_proj(p_item) < p_v;
+	});
+}
+inline ShareSearchIndex::EntryId getId(const ShareSearchIndex::EntryId& p_id)
+{
+	return p_id;
+}
+inline ShareSearchIndex::EntryId getRangeEnd(const ShareSearchIndex::Range& p_range)
+{
+	return p_range.m_end;
+}
+inline bool inRanges(const ShareSearchIndex::RangeList& p_ranges, ShareSearchIndex::EntryId p_id)
+{
+	const auto i = std::upper_bound(p_ranges.cbegin(), p_ranges.cend(), p_id, [](ShareSearchIndex::EntryId p_v, const ShareSearchIndex::Range & p_range)
+	{
+		return p_v < p_range.m_end;
+	});
+	return i != p_ranges.cend() && i->m_begin <= p_id;
+}
+}
+
+void ShareSearchIndex::clear()
+{
+	m_names.clear();
+	m_name_offset.assign(1, 0);
+	m_subtree_end.clear();
+	m_is_dir.clear();
+	m_pending_parent.clear();
+	m_keys.clear();
+	m_offsets.clear();
+	m_postings.clear();
+	m_finalized = 0;
+	m_is_ready = false;
+}
+
+ShareSearchIndex::EntryId ShareSearchIndex::addEntry(const string& p_low_name, bool p_is_dir)
+{
+	if (m_name_offset.empty())
+		m_name_offset.push_back(0);
+	const EntryId l_id = EntryId(m_subtree_end.size());
+	m_names += p_low_name;
+	m_name_offset.push_back(uint32_t(m_names.size()));
+	m_subtree_end.push_back(l_id + 1);
+	m_is_dir.push_back(p_is_dir);
+	return l_id;
+}
+
+ShareSearchIndex::EntryId ShareSearchIndex::addDirectory(const string& p_low_name)
+{
+	dcassert(!m_is_ready);
+	return addEntry(p_low_name, true);
+}
+
+void ShareSearchIndex::closeDirectory(EntryId p_id)
+{
+	dcassert(m_is_dir[p_id]);
+	m_subtree_end[p_id] = EntryId(m_subtree_end.size());
+}
+
+ShareSearchIndex::EntryId ShareSearchIndex::addFile(const string& p_low_name)
+{
+	dcassert(!m_is_ready);
+	return addEntry(p_low_name, false);
+}
+
+ShareSearchIndex::EntryId ShareSearchIndex::addPendingFile(const string& p_low_name, EntryId p_parent)
+{
+	dcassert(m_is_ready && p_parent < m_finalized);
+	m_pending_parent.push_back(p_parent);
+	return addEntry(p_low_name, false);
+}
+
+void ShareSearchIndex::finalize()
+{
+	m_finalized = EntryId(m_subtree_end.size());
+	// Pass 1: count the entries of every trigram (the same trigram twice in one name is counted once)
+	typedef boost::unordered_map<uint32_t, std::pair<uint32_t, EntryId> > CountMap;
+	CountMap l_count;
+	for (EntryId i = 0; i < m_finalized; ++i)
+	{
+		size_t l_len;
+		const uint8_t* l_name = getName(i, l_len);
+		for (size_t j = 0; j + MIN_TERM_LENGTH <= l_len; ++j)
+		{
+			auto& l_item = l_count[getKey(l_name + j)];
+			if (l_item.first == 0 || l_item.second != i)
+			{
+				++l_item.first;
+				l_item.second = i;
+			}
+		}
+	}
+	m_keys.clear();
+	m_keys.reserve(l_count.size());
+	for (auto i = l_count.cbegin(); i != l_count.cend(); ++i)
+	{
+		m_keys.push_back(i->first);
+	}
+	std::sort(m_keys.begin(), m_keys.end());
+	m_offsets.resize(m_keys.size() + 1);
+	uint32_t l_total = 0;
+	for (size_t i = 0; i < m_keys.size(); ++i)
+	{
+		m_offsets[i] = l_total;
+		auto& l_item = l_count[m_keys[i]];
+		l_total += l_item.first;
+		l_item.first = m_offsets[i]; // now - fill cursor
+		l_item.second = INVALID_ID;
+	}
+	m_offsets[m_keys.size()] = l_total;
+	// Pass 2: fill the posting lists, ids are added in ascending order so the lists come out sorted
+	m_postings.resize(l_total);
+	for (EntryId i = 0; i < m_finalized; ++i)
+	{
+		size_t l_len;
+		const uint8_t* l_name = getName(i, l_len);
+		for (size_t j = 0; j + MIN_TERM_LENGTH <= l_len; ++j)
+		{
+			auto& l_item = l_count[getKey(l_name + j)];
+			if (l_item.second != i)
+			{
+				m_postings[l_item.first++] = i;
+				l_item.second = i;
+			}
+		}
+	}
+	m_is_ready = true;
+}
+
+size_t ShareSearchIndex::getMemoryUsage() const
+{
+	return m_names.capacity() +
+	       m_name_offset.capacity() * sizeof(uint32_t) +
+	       m_subtree_end.capacity() * sizeof(EntryId) +
+	       m_is_dir.capacity() / 8 +
+	       m_pending_parent.capacity() * sizeof(EntryId) +
+	       m_keys.capacity() * sizeof(uint32_t) +
+	       m_offsets.capacity() * sizeof(uint32_t) +
+	       m_postings.capacity() * sizeof(EntryId);
+}
+
+bool ShareSearchIndex::getPostings(uint32_t p_key, const EntryId*& p_begin, const EntryId*& p_end) const
+{
+	const auto i = std::lower_bound(m_keys.cbegin(), m_keys.cend(), p_key);
+	if (i == m_keys.cend() || *i != p_key)
+		return false;
+	const size_t l_index = i - m_keys.cbegin();
+	p_begin = m_postings.data() + m_offsets[l_index];
+	p_end = m_postings.data() + m_offsets[l_index + 1];
+	return true;
+}
+
+void ShareSearchIndex::findTerm(const MultiStringSearch& p_include, size_t p_index, const MultiStringSearch& p_exclude, RangeList& p_ranges) const
+{
+	p_ranges.clear();
+	const string& l_term = p_include.getPattern(p_index);
+	const MultiStringSearch::Mask l_bit = MultiStringSearch::Mask(1) << p_index;
+
+	// Posting lists of all the trigrams of the term, the shortest first
+	typedef std::pair<const EntryId*, const EntryId*> Postings;
+	std::vector<Postings> l_lists;
+	const uint8_t* l_pattern = reinterpret_cast<const uint8_t*>(l_term.data());
+	for (size_t j = 0; j + MIN_TERM_LENGTH <= l_term.size(); ++j)
+	{
+		Postings l_postings;
+		if (!getPostings(getKey(l_pattern + j), l_postings.first, l_postings.second))
+			return;
+		l_lists.push_back(l_postings);
+	}
+	std::sort(l_lists.begin(), l_lists.end(), [](const Postings & a, const Postings & b)
+	{
+		return a.second - a.first < b.second - b.first;
+	});
+
+	std::vector<const EntryId*> l_cursor(l_lists.size());
+	for (size_t k = 0; k < l_lists.size(); ++k)
+	{
+		l_cursor[k] = l_lists[k].first;
+	}
+	for (const EntryId* i = l_lists[0].first; i != l_lists[0].second; ++i)
+	{
+		const EntryId l_id = *i;
+		bool l_is_found = true;
+		for (size_t k = 1; k < l_lists.size(); ++k)
+		{
+			l_cursor[k] = gallop(l_cursor[k], l_lists[k].second, l_id, getId);
+			if (l_cursor[k] == l_lists[k].second)
+				return;
+			if (*l_cursor[k] != l_id)
+			{
+				l_is_found = false;
+				break;
+			}
+		}
+		if (!l_is_found)
+			continue;
+		// Trigrams are only a filter - verify the candidate
+		size_t l_len;
+		const uint8_t* l_name = getName(l_id, l_len);
+		if (p_include.matchLower(l_name, l_len, l_bit) == 0)
+			continue;
+		if (m_is_dir[l_id] && p_exclude.matchLower(l_name, l_len, p_exclude.getFullMask()) != 0)
+			continue;
+		// Entries come in the tree walk order: a range either nests into the previous one or follows it
+		if (!p_ranges.empty() && l_id < p_ranges.back().m_end)
+			continue;
+		p_ranges.push_back(Range(l_id, m_subtree_end[l_id]));
+	}
+}
+
+bool ShareSearchIndex::find(const MultiStringSearch& p_include, const MultiStringSearch& p_exclude, Result& p_result) const
+{
+	p_result.clear();
+	if (!isReady() || p_include.empty())
+		return false;
+	for (size_t i = 0; i < p_include.size(); ++i)
+	{
+		if (p_include.getPattern(i).size() < MIN_TERM_LENGTH)
+			return false;
+	}
+
+	std::vector<RangeList> l_terms(p_include.size());
+	for (size_t i = 0; i < p_include.size(); ++i)
+	{
+		findTerm(p_include, i, p_exclude, l_terms[i]);
+	}
+
+	// Intersect the ranges of all the terms (nested ranges were merged, so every list is sorted and disjoint)
+	p_result.m_ranges = l_terms[0];
+	RangeList l_next;
+	for (size_t i = 1; i < l_terms.size() && !p_result.m_ranges.empty(); ++i)
+	{
+		l_next.clear();
+		const Range* a = p_result.m_ranges.data();
+		const Range* const a_end = a + p_result.m_ranges.size();
+		const Range* b = l_terms[i].data();
+		const Range* const b_end = b + l_terms[i].size();
+		while (a != a_end && b != b_end)
+		{
+			if (a->m_end <= b->m_begin)
+			{
+				a = gallop(a, a_end, b->m_begin + 1, getRangeEnd);
+				continue;
+			}
+			if (b->m_end <= a->m_begin)
+			{
+				b = gallop(b, b_end, a->m_begin + 1, getRangeEnd);
+				continue;
+			}
+			l_next.push_back(Range(std::max(a->m_begin, b->m_begin), std::min(a->m_end, b->m_end)));
+			if (a->m_end < b->m_end)
+				++a;
+			else
+				++b;
+		}
+		p_result.m_ranges.swap(l_next);
+	}
+
+	// Pending tail: a file matches a term by its own name or by a range covering its parent
+	for (size_t j = 0; j < m_pending_parent.size(); ++j)
+	{
+		const EntryId l_id = m_finalized + EntryId(j);
+		size_t l_len;
+		const uint8_t* l_name = getName(l_id, l_len);
+		const MultiStringSearch::Mask l_found = p_include.matchLower(l_name, l_len, p_include.getFullMask());
+		bool l_is_match = true;
+		for (size_t i = 0; i < l_terms.size() && l_is_match; ++i)
+		{
+			if ((l_found & (MultiStringSearch::Mask(1) << i)) == 0)
+				l_is_match = inRanges(l_terms[i], m_pending_parent[j]);
+		}
+		if (l_is_match)
+			p_result.m_pending.push_back(l_id);
+	}
+	return true;
+}
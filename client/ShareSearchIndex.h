@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_SHARE_SEARCH_INDEX_H
+#define DCPLUSPLUS_DCPP_SHARE_SEARCH_INDEX_H
+
+#include "MultiStringSearch.h"
+
+/**
+ * Inverted trigram index over the lower-cased names of the share tree.
+ * Entries (directories and files) are numbered in the order of the tree walk, so the
+ * subtree of a directory is the contiguous range [id, subtree end). For every search
+ * term the posting lists of its trigrams are intersected (galloping search), the
+ * candidates are verified and turned into ranges; the ranges of all the terms are
+ * intersected again, so the cost depends on the number of matches, not on the share size.
+ * Files hashed after the index was built are kept in a small "pending" tail and checked directly.
+ */
+class ShareSearchIndex
+{
+	public:
+		typedef uint32_t EntryId;
+		static const EntryId INVALID_ID = ~EntryId(0);
+		static const size_t MIN_TERM_LENGTH = 3;
+
+		struct Range
+		{
+			Range(EntryId p_begin, EntryId p_end) : m_begin(p_begin), m_end(p_end)
+			{
+			}
+			EntryId m_begin;
+			EntryId m_end;
+		};
+		typedef std::vector<Range> RangeList;
+		struct Result
+		{
+			RangeList m_ranges;
+			std::vector<EntryId> m_pending;
+			void clear()
+			{
+				m_ranges.clear();
+				m_pending.clear();
+			}
+		};
+
+		ShareSearchIndex() : m_finalized(0), m_is_ready(false)
+		{
+		}
+		void clear();
+
+		/** Building (tree walk order): a directory covers all the entries added until closeDirectory */
+		EntryId addDirectory(const string& p_low_name);
+		void closeDirectory(EntryId p_id);
+		EntryId addFile(const string& p_low_name);
+		void finalize();
+
+		/** File added after finalize() (e.g. HashManagerListener::TTHDone) */
+		EntryId addPendingFile(const string& p_low_name, EntryId p_parent);
+
+		/** The index is built and the pending tail is still small enough */
+		bool isReady() const
+		{
+			return m_is_ready && getPendingCount() <= std::max<size_t>(m_finalized / 16, 4096);
+		}
+		size_t size() const
+		{
+			return m_subtree_end.size();
+		}
+		size_t getPendingCount() const
+		{
+			return m_subtree_end.size() - m_finalized;
+		}
+		size_t getMemoryUsage() const;
+
+		/**
+		 * Entries satisfying all the terms of p_include: a term is satisfied by the name of the entry
+		 * or by the name of any directory above it (unless the directory name matches p_exclude).
+		 * @return false if the index can't answer the query (not built or a term is too short)
+		 */
+		bool find(const MultiStringSearch& p_include, const MultiStringSearch& p_exclude, Result& p_result) const;
+
+	private:
+		EntryId addEntry(const string& p_low_name, bool p_is_dir);
+		const uint8_t* getName(EntryId p_id, size_t& p_len) const
+		{
+			p_len = m_name_offset[p_id + 1] - m_name_offset[p_id];
+			return reinterpret_cast<const uint8_t*>(m_names.data()) + m_name_offset[p_id];
+		}
+		static uint32_t getKey(const uint8_t* p_pos)
+		{
+			return uint32_t(p_pos[0]) | uint32_t(p_pos[1]) << 8 | uint32_t(p_pos[2]) << 16;
+		}
+		bool getPostings(uint32_t p_key, const EntryId*& p_begin, const EntryId*& p_end) const;
+		void findTerm(const MultiStringSearch& p_include, size_t p_index, const MultiStringSearch& p_exclude, RangeList& p_ranges) const;
+
+		string m_names;
+		std::vector<uint32_t> m_name_offset;
+		std::vector<EntryId> m_subtree_end;
+		std::vector<bool> m_is_dir;
+		std::vector<EntryId> m_pending_parent;
+
+		/** Posting lists: m_postings[m_offsets[i] .. m_offsets[i + 1]) for the trigram m_keys[i] */
+		std::vector<uint32_t> m_keys;
+		std::vector<uint32_t> m_offsets;
+		std::vector<EntryId> m_postings;
+
+		EntryId m_finalized;
+		bool m_is_ready;
+};
+
+#endif // DCPLUSPLUS_DCPP_SHARE_SEARCH_INDEX_H
@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ShareSnapshot.h"
+#include "SettingsManager.h"
+#include "SimpleXML.h"
+#include "Streams.h"
+
+ShareSnapshot::NameRef ShareSnapshot::addName(const string& p_name)
+{
+	NameRef l_ref;
+	l_ref.m_offset = uint32_t(m_names.size());
+	l_ref.m_len = uint32_t(p_name.size());
+	m_names += p_name;
+	return l_ref;
+}
+
+ShareSnapshot::DirId ShareSnapshot::addDirectory(const string& p_name, const string& p_low_name, DirId p_parent, int64_t p_size, uint16_t p_types)
+{
+	const DirId l_id = DirId(m_dir_parent.size());
+	if (p_parent == INVALID_ID)
+	{
+		dcassert(l_id == m_root_count);
+		++m_root_count;
+		m_root_real_paths.resize(m_root_count);
+	}
+	else
+	{
+		dcassert(m_dir_first_sub[p_parent] + m_dir_sub_count[p_parent] == l_id);
+		++m_dir_sub_count[p_parent];
+	}
+	m_dir_parent.push_back(p_parent);
+	m_dir_name.push_back(addName(p_name));
+	m_dir_low_name.push_back(p_low_name == p_name ? m_dir_name.back() : addName(p_low_name));
+	m_dir_first_file.push_back(0);
+	m_dir_file_count.push_back(0);
+	m_dir_first_sub.push_back(0);
+	m_dir_sub_count.push_back(0);
+	m_dir_size.push_back(p_size);
+	m_dir_types.push_back(p_types);
+	return l_id;
+}
+
+void ShareSnapshot::setRootRealPaths(DirId p_root, const StringList& p_real_paths)
+{
+	m_root_real_paths[p_root] = p_real_paths;
+}
+
+void ShareSnapshot::beginFiles(DirId p_dir)
+{
+	m_dir_first_file[p_dir] = FileId(m_file_dir.size());
+}
+
+ShareSnapshot::FileId ShareSnapshot::addFile(DirId p_dir, const string& p_name, const string& p_low_name, int64_t p_size, const TTHValue& p_tth, uint32_t p_ts, uint32_t p_hit,
+                                             uint8_t p_type, const std::shared_ptr<CFlyMediaInfo>& p_media)
+{
+	const FileId l_id = FileId(m_file_dir.size());
+	dcassert(m_dir_first_file[p_dir] + m_dir_file_count[p_dir] == l_id);
+	++m_dir_file_count[p_dir];
+	m_file_dir.push_back(p_dir);
+	m_file_name.push_back(addName(p_name));
+	m_file_low_name.push_back(p_low_name == p_name ? m_file_name.back() : addName(p_low_name));
+	m_file_size.push_back(p_size);
+	m_file_tth.push_back(p_tth);
+	m_file_ts.push_back(p_ts);
+	m_file_hit.push_back(p_hit);
+	m_file_type.push_back(p_type);
+	if (p_media)
+	{
+		m_file_media.push_back(uint32_t(m_media.size()));
+		m_media.push_back(p_media);
+	}
+	else
+	{
+		m_file_media.push_back(uint32_t(INVALID_ID));
+	}
+	return l_id;
+}
+
+void ShareSnapshot::beginSubdirectories(DirId p_dir)
+{
+	m_dir_first_sub[p_dir] = DirId(m_dir_parent.size());
+}
+
+void ShareSnapshot::finalize()
+{
+	m_tth_index.reserve(m_file_tth.size());
+	for (FileId i = 0; i < m_file_tth.size(); ++i)
+	{
+		m_tth_index.push_back(std::make_pair(m_file_tth[i], i));
+	}
+	std::stable_sort(m_tth_index.begin(), m_tth_index.end(), [](const std::pair<TTHValue, FileId>& a, const std::pair<TTHValue, FileId>& b)
+	{
+		return a.first < b.first;
+	});
+	m_names.shrink_to_fit();
+}
+
+void ShareSnapshot::setFile(FileId p_file, const FileChange& p_change)
+{
+	m_file_name[p_file] = addName(p_change.m_name);
+	m_file_low_name[p_file] = p_change.m_low_name == p_change.m_name ? m_file_name[p_file] : addName(p_change.m_low_name);
+	m_file_size[p_file] = p_change.m_size;
+	m_file_tth[p_file] = p_change.m_tth;
+	m_file_ts[p_file] = p_change.m_ts;
+	m_file_hit[p_file] = p_change.m_hit;
+	m_file_type[p_file] = p_change.m_type;
+	if (p_change.m_media)
+	{
+		m_file_media[p_file] = uint32_t(m_media.size());
+		m_media.push_back(p_change.m_media);
+	}
+	else
+	{
+		m_file_media[p_file] = uint32_t(INVALID_ID);
+	}
+}
+
+void ShareSnapshot::applyChanges(const ShareSnapshot& p_base, const FileChangeList& p_changes)
+{
+	dcassert(getDirCount() == 0);
+	// The names of p_base keep their offsets, the new ones are appended
+	m_names = p_base.m_names;
+	m_root_count = p_base.m_root_count;
+	m_root_real_paths = p_base.m_root_real_paths;
+	m_dir_parent = p_base.m_dir_parent;
+	m_dir_name = p_base.m_dir_name;
+	m_dir_low_name = p_base.m_dir_low_name;
+	m_dir_first_sub = p_base.m_dir_first_sub;
+	m_dir_sub_count = p_base.m_dir_sub_count;
+	m_dir_size = p_base.m_dir_size;
+	m_dir_types = p_base.m_dir_types;
+	m_dir_first_file.resize(m_dir_parent.size());
+	m_dir_file_count.resize(m_dir_parent.size());
+	m_media = p_base.m_media;
+	
+	std::vector<const FileChange*> l_changes;
+	l_changes.reserve(p_changes.size());
+	for (auto i = p_changes.cbegin(); i != p_changes.cend(); ++i)
+	{
+		dcassert(i->m_dir < m_dir_parent.size());
+		if (i->m_dir < m_dir_parent.size())
+			l_changes.push_back(&*i);
+	}
+	std::stable_sort(l_changes.begin(), l_changes.end(), [](const FileChange * a, const FileChange * b)
+	{
+		return a->m_dir < b->m_dir;
+	});
+	
+	const size_t l_file_count = p_base.getFileCount() + l_changes.size();
+	m_file_dir.reserve(l_file_count);
+	m_file_name.reserve(l_file_count);
+	m_file_low_name.reserve(l_file_count);
+	m_file_size.reserve(l_file_count);
+	m_file_tth.reserve(l_file_count);
+	m_file_ts.reserve(l_file_count);
+	m_file_hit.reserve(l_file_count);
+	m_file_type.reserve(l_file_count);
+	m_file_media.reserve(l_file_count);
+	
+	std::vector<bool> l_is_replaced(p_base.getFileCount(), false);
+	std::vector<std::pair<TTHValue, FileId>> l_new_tth;
+	std::vector<FileId> l_touched;
+	auto c = l_changes.cbegin();
+	for (DirId d = 0; d < m_dir_parent.size(); ++d)
+	{
+		const FileId l_first = FileId(m_file_dir.size());
+		const FileId l_base_first = p_base.getFirstFile(d);
+		const FileId l_base_end = p_base.getEndFile(d);
+		m_dir_first_file[d] = l_first;
+		m_file_dir.insert(m_file_dir.end(), l_base_end - l_base_first, d);
+		m_file_name.insert(m_file_name.end(), p_base.m_file_name.begin() + l_base_first, p_base.m_file_name.begin() + l_base_end);
+		m_file_low_name.insert(m_file_low_name.end(), p_base.m_file_low_name.begin() + l_base_first, p_base.m_file_low_name.begin() + l_base_end);
+		m_file_size.insert(m_file_size.end(), p_base.m_file_size.begin() + l_base_first, p_base.m_file_size.begin() + l_base_end);
+		m_file_tth.insert(m_file_tth.end(), p_base.m_file_tth.begin() + l_base_first, p_base.m_file_tth.begin() + l_base_end);
+		m_file_ts.insert(m_file_ts.end(), p_base.m_file_ts.begin() + l_base_first, p_base.m_file_ts.begin() + l_base_end);
+		m_file_hit.insert(m_file_hit.end(), p_base.m_file_hit.begin() + l_base_first, p_base.m_file_hit.begin() + l_base_end);
+		m_file_type.insert(m_file_type.end(), p_base.m_file_type.begin() + l_base_first, p_base.m_file_type.begin() + l_base_end);
+		m_file_media.insert(m_file_media.end(), p_base.m_file_media.begin() + l_base_first, p_base.m_file_media.begin() + l_base_end);
+		
+		l_touched.clear();
+		for (; c != l_changes.cend() && (*c)->m_dir == d; ++c)
+		{
+			const FileChange& l_change = **c;
+			m_dir_size[d] = l_change.m_dir_size;
+			// Same as Directory::addType
+			for (DirId p = d; p != INVALID_ID && !(m_dir_types[p] & (1 << l_change.m_type)); p = m_dir_parent[p])
+			{
+				m_dir_types[p] |= uint16_t(1 << l_change.m_type);
+			}
+			FileId l_file = l_first;
+			while (l_file != m_file_dir.size() && stricmp(getFileName(l_file), l_change.m_name) != 0)
+			{
+				++l_file;
+			}
+			if (l_file == m_file_dir.size())
+			{
+				m_file_dir.push_back(d);
+				m_file_name.push_back(NameRef());
+				m_file_low_name.push_back(NameRef());
+				m_file_size.push_back(0);
+				m_file_tth.push_back(TTHValue());
+				m_file_ts.push_back(0);
+				m_file_hit.push_back(0);
+				m_file_type.push_back(0);
+				m_file_media.push_back(uint32_t(INVALID_ID));
+			}
+			else if (l_file < l_first + (l_base_end - l_base_first))
+			{
+				l_is_replaced[l_base_first + (l_file - l_first)] = true;
+			}
+			setFile(l_file, l_change);
+			if (std::find(l_touched.cbegin(), l_touched.cend(), l_file) == l_touched.cend())
+			{
+				l_touched.push_back(l_file);
+			}
+		}
+		for (auto i = l_touched.cbegin(); i != l_touched.cend(); ++i)
+		{
+			l_new_tth.push_back(std::make_pair(m_file_tth[*i], *i));
+		}
+		m_dir_file_count[d] = uint32_t(m_file_dir.size() - l_first);
+	}
+	
+	// The TTH index of p_base is sorted already: renumber its files and merge the changed ones in
+	m_tth_index.reserve(m_file_dir.size());
+	for (auto i = p_base.m_tth_index.cbegin(); i != p_base.m_tth_index.cend(); ++i)
+	{
+		if (!l_is_replaced[i->second])
+		{
+			const DirId l_dir = p_base.m_file_dir[i->second];
+			m_tth_index.push_back(std::make_pair(i->first, m_dir_first_file[l_dir] + (i->second - p_base.getFirstFile(l_dir))));
+		}
+	}
+	const auto l_compare = [](const std::pair<TTHValue, FileId>& a, const std::pair<TTHValue, FileId>& b)
+	{
+		return a.first < b.first;
+	};
+	std::stable_sort(l_new_tth.begin(), l_new_tth.end(), l_compare);
+	const size_t l_middle = m_tth_index.size();
+	m_tth_index.insert(m_tth_index.end(), l_new_tth.begin(), l_new_tth.end());
+	std::inplace_merge(m_tth_index.begin(), m_tth_index.begin() + l_middle, m_tth_index.end(), l_compare);
+}
+
+size_t ShareSnapshot::getMemoryUsage() const
+{
+	return m_names.capacity() +
+	       m_dir_parent.capacity() * (sizeof(DirId) * 3 + sizeof(NameRef) * 2 + sizeof(uint32_t) * 2 + sizeof(int64_t) + sizeof(uint16_t)) +
+	       m_file_dir.capacity() * (sizeof(DirId) + sizeof(NameRef) * 2 + sizeof(int64_t) + sizeof(TTHValue) + sizeof(uint32_t) * 3 + sizeof(uint8_t)) +
+	       m_media.capacity() * sizeof(std::shared_ptr<CFlyMediaInfo>) +
+	       m_tth_index.capacity() * sizeof(std::pair<TTHValue, FileId>);
+}
+
+string ShareSnapshot::getFullName(DirId p_dir) const
+{
+	string l_result;
+	for (DirId i = p_dir; i != INVALID_ID; i = m_dir_parent[i])
+	{
+		l_result.insert(0, getDirName(i) + '\\');
+	}
+	return l_result;
+}
+
+string ShareSnapshot::getADCPath(DirId p_dir) const
+{
+	string l_result;
+	for (DirId i = p_dir; i != INVALID_ID; i = m_dir_parent[i])
+	{
+		l_result.insert(0, '/' + getDirName(i));
+	}
+	return l_result + '/';
+}
+
+ShareSnapshot::DirId ShareSnapshot::getRoot(DirId p_dir) const
+{
+	while (m_dir_parent[p_dir] != INVALID_ID)
+	{
+		p_dir = m_dir_parent[p_dir];
+	}
+	return p_dir;
+}
+
+ShareSnapshot::DirId ShareSnapshot::findRoot(const string& p_virtual_name) const
+{
+	for (DirId i = 0; i < m_root_count; ++i)
+	{
+		if (stricmp(getDirName(i), p_virtual_name) == 0)
+			return i;
+	}
+	return INVALID_ID;
+}
+
+ShareSnapshot::DirId ShareSnapshot::findSubdirectory(DirId p_dir, const string& p_name) const
+{
+	// The subdirectories were added in the order of Directory::DirectoryMap
+	DirId l_low = getFirstSubdirectory(p_dir);
+	DirId l_high = getEndSubdirectory(p_dir);
+	while (l_low < l_high)
+	{
+		const DirId l_mid = l_low + (l_high - l_low) / 2;
+		const int l_cmp = m_names.compare(m_dir_name[l_mid].m_offset, m_dir_name[l_mid].m_len, p_name);
+		if (l_cmp == 0)
+			return l_mid;
+		if (l_cmp < 0)
+			l_low = l_mid + 1;
+		else
+			l_high = l_mid;
+	}
+	return INVALID_ID;
+}
+
+ShareSnapshot::DirId ShareSnapshot::findDirectory(const string& p_adc_path) const
+{
+	DirId l_dir = INVALID_ID;
+	string::size_type i = 1, j = 1;
+	while ((i = p_adc_path.find('/', j)) != string::npos)
+	{
+		if (i == j)
+		{
+			j++;
+			continue;
+		}
+		const string l_name = p_adc_path.substr(j, i - j);
+		l_dir = l_dir == INVALID_ID ? findRoot(l_name) : findSubdirectory(l_dir, l_name);
+		if (l_dir == INVALID_ID)
+			return INVALID_ID;
+		j = i + 1;
+	}
+	return l_dir;
+}
+
+ShareSnapshot::FileId ShareSnapshot::findFile(DirId p_dir, const string& p_name) const
+{
+	for (FileId i = getFirstFile(p_dir); i != getEndFile(p_dir); ++i)
+	{
+		if (stricmp(getFileName(i), p_name) == 0)
+			return i;
+	}
+	return INVALID_ID;
+}
+
+ShareSnapshot::FileId ShareSnapshot::findFile(const TTHValue& p_tth) const
+{
+	const auto i = std::lower_bound(m_tth_index.cbegin(), m_tth_index.cend(), p_tth, [](const std::pair<TTHValue, FileId>& p_item, const TTHValue & p_value)
+	{
+		return p_item.first < p_value;
+	});
+	if (i == m_tth_index.cend() || i->first != p_tth)
+		return INVALID_ID;
+	return i->second;
+}
+
+ShareSnapshot::FileId ShareSnapshot::findVirtualFile(const string& p_virtual_path) const
+{
+	if (p_virtual_path.empty() || p_virtual_path[0] != '/')
+		return INVALID_ID;
+	string::size_type i = p_virtual_path.find('/', 1);
+	if (i == string::npos || i == 1)
+		return INVALID_ID;
+	DirId l_dir = findRoot(p_virtual_path.substr(1, i - 1));
+	string::size_type j = i + 1;
+	while (l_dir != INVALID_ID && (i = p_virtual_path.find('/', j)) != string::npos)
+	{
+		l_dir = findSubdirectory(l_dir, p_virtual_path.substr(j, i - j));
+		j = i + 1;
+	}
+	if (l_dir == INVALID_ID)
+		return INVALID_ID;
+	return findFile(l_dir, p_virtual_path.substr(j));
+}
+
+string ShareSnapshot::getRelativeRealPath(FileId p_file) const
+{
+	string l_result = getFileName(p_file);
+	for (DirId i = m_file_dir[p_file]; m_dir_parent[i] != INVALID_ID; i = m_dir_parent[i])
+	{
+		l_result.insert(0, getDirName(i) + PATH_SEPARATOR_STR);
+	}
+	return l_result;
+}
+
+#define LITERAL(n) n, sizeof(n)-1
+void ShareSnapshot::toXml(OutputStream& p_xml, DirId p_dir, string& p_indent, string& p_tmp, bool p_full_list) const
+{
+	if (!p_indent.empty())
+		p_xml.write(p_indent);
+	p_xml.write(LITERAL("<Directory Name=\""));
+	p_xml.write(SimpleXML::escapeAtrib(getDirName(p_dir), p_tmp));
+
+	if (p_full_list)
+	{
+		p_xml.write(LITERAL("\">\r\n"));
+
+		p_indent += '\t';
+		for (DirId i = getFirstSubdirectory(p_dir); i != getEndSubdirectory(p_dir); ++i)
+		{
+			toXml(p_xml, i, p_indent, p_tmp, p_full_list);
+		}
+
+		filesToXml(p_xml, p_dir, p_indent, p_tmp);
+
+		if (p_indent.length() > 1)
+		{
+			p_indent.erase(p_indent.length() - 1);
+		}
+		if (!p_indent.empty())
+		{
+			p_xml.write(p_indent);
+		}
+		p_xml.write(LITERAL("</Directory>\r\n"));
+	}
+	else
+	{
+		if (isEmpty(p_dir))
+		{
+			p_xml.write(LITERAL("\" />\r\n"));
+		}
+		else
+		{
+			p_xml.write(LITERAL("\" Incomplete=\"1\" />\r\n"));
+		}
+	}
+}
+
+void ShareSnapshot::filesToXml(OutputStream& p_xml, DirId p_dir, const string& p_indent, string& p_tmp) const
+{
+	const bool l_is_hit = BOOLSETTING(ENABLE_HIT_FILE_LIST);
+	for (FileId i = getFirstFile(p_dir); i != getEndFile(p_dir); ++i)
+	{
+		if (!p_indent.empty())
+			p_xml.write(p_indent);
+		p_xml.write(LITERAL("<File Name=\""));
+		p_xml.write(SimpleXML::escapeAtrib(getFileName(i), p_tmp));
+		p_xml.write(LITERAL("\" Size=\""));
+		p_xml.write(Util::toString(m_file_size[i]));
+		p_xml.write(LITERAL("\" TTH=\""));
+		p_tmp.clear();
+		p_xml.write(m_file_tth[i].toBase32(p_tmp));
+		if (m_file_hit[i] && l_is_hit)
+		{
+			p_xml.write(LITERAL("\" HIT=\""));
+			p_xml.write(Util::toString(m_file_hit[i]));
+		}
+		p_xml.write(LITERAL("\" TS=\""));
+		p_xml.write(Util::toString(m_file_ts[i]));
+		if (m_file_media[i] != INVALID_ID)
+		{
+			const CFlyMediaInfo& l_media = *m_media[m_file_media[i]];
+			if (l_media.m_bitrate)
+			{
+				p_xml.write(LITERAL("\" BR=\""));
+				p_xml.write(Util::toString(l_media.m_bitrate));
+			}
+			if (l_media.m_mediaX && l_media.m_mediaY)
+			{
+				p_xml.write(LITERAL("\" WH=\""));
+				p_xml.write(l_media.getXY());
+			}
+
+			if (!l_media.m_audio.empty())
+			{
+				p_xml.write(LITERAL("\" MA=\""));
+				if (l_media.m_is_need_escape)
+					p_xml.write(SimpleXML::escapeForce(l_media.m_audio, p_tmp));
+				else
+					p_xml.write(l_media.m_audio);
+			}
+			if (!l_media.m_video.empty())
+			{
+				p_xml.write(LITERAL("\" MV=\""));
+				if (l_media.m_is_need_escape)
+					p_xml.write(SimpleXML::escapeForce(l_media.m_video, p_tmp));
+				else
+					p_xml.write(l_media.m_video);
+			}
+		}
+		p_xml.write(LITERAL("\"/>\r\n"));
+	}
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_SHARE_SNAPSHOT_H
+#define DCPLUSPLUS_DCPP_SHARE_SNAPSHOT_H
+
+#include "MerkleTree.h"
+#include "SearchQueue.h"
+#include "CFlyMediaInfo.h"
+
+class OutputStream;
+
+/**
+ * Immutable, structure-of-arrays copy of the share tree for the readers.
+ * Directories are stored breadth-first, so the subdirectories (sorted by name) and the files
+ * of a directory are contiguous ranges; all the names live in one blob.
+ * ShareManager builds a new snapshot after the refresh and publishes it with an atomic shared_ptr swap -
+ * searches, toReal/getTTH and the file lists read it without g_csShare. The files hashed later are
+ * collected as FileChange and copied into a new snapshot with applyChanges, outside the share lock.
+ * The Directory tree is still the one the refresh and the hasher modify.
+ */
+class ShareSnapshot
+#ifdef _DEBUG
+	: boost::noncopyable
+#endif
+{
+	public:
+		typedef std::shared_ptr<const ShareSnapshot> Ptr;
+		typedef uint32_t DirId;
+		typedef uint32_t FileId;
+		static const uint32_t INVALID_ID = ~uint32_t(0);
+
+		struct NameRef
+		{
+			uint32_t m_offset;
+			uint32_t m_len;
+		};
+
+		ShareSnapshot() : m_root_count(0)
+		{
+		}
+
+		// Building (breadth-first) - only before the snapshot is published
+		DirId addDirectory(const string& p_name, const string& p_low_name, DirId p_parent, int64_t p_size, uint16_t p_types);
+		void setRootRealPaths(DirId p_root, const StringList& p_real_paths);
+		/** The files of p_dir are added right after this call */
+		void beginFiles(DirId p_dir);
+		FileId addFile(DirId p_dir, const string& p_name, const string& p_low_name, int64_t p_size, const TTHValue& p_tth, uint32_t p_ts, uint32_t p_hit,
+		               uint8_t p_type, const std::shared_ptr<CFlyMediaInfo>& p_media);
+		/** The subdirectories of p_dir are added right after this call */
+		void beginSubdirectories(DirId p_dir);
+		void finalize();
+		
+		/** A file added to a directory of the snapshot or hashed again after the snapshot was built */
+		struct FileChange
+		{
+			DirId m_dir;
+			int64_t m_dir_size; // Directory::getDirSizeFast after the change
+			string m_name;
+			string m_low_name;
+			int64_t m_size;
+			TTHValue m_tth;
+			uint32_t m_ts;
+			uint32_t m_hit;
+			uint8_t m_type;
+			std::shared_ptr<CFlyMediaInfo> m_media;
+		};
+		typedef std::vector<FileChange> FileChangeList;
+		/**
+		 * Build the snapshot as a copy of p_base with the changes (the directories must be the same).
+		 * The later change of a file wins; new files go to the end of their directory.
+		 */
+		void applyChanges(const ShareSnapshot& p_base, const FileChangeList& p_changes);
+
+		size_t getDirCount() const
+		{
+			return m_dir_parent.size();
+		}
+		size_t getFileCount() const
+		{
+			return m_file_dir.size();
+		}
+		DirId getRootCount() const
+		{
+			return m_root_count;
+		}
+		size_t getMemoryUsage() const;
+
+		// Directories
+		DirId getParent(DirId p_dir) const
+		{
+			return m_dir_parent[p_dir];
+		}
+		string getDirName(DirId p_dir) const
+		{
+			return getString(m_dir_name[p_dir]);
+		}
+		const uint8_t* getDirLowName(DirId p_dir, size_t& p_len) const
+		{
+			return getBytes(m_dir_low_name[p_dir], p_len);
+		}
+		FileId getFirstFile(DirId p_dir) const
+		{
+			return m_dir_first_file[p_dir];
+		}
+		FileId getEndFile(DirId p_dir) const
+		{
+			return m_dir_first_file[p_dir] + m_dir_file_count[p_dir];
+		}
+		DirId getFirstSubdirectory(DirId p_dir) const
+		{
+			return m_dir_first_sub[p_dir];
+		}
+		DirId getEndSubdirectory(DirId p_dir) const
+		{
+			return m_dir_first_sub[p_dir] + m_dir_sub_count[p_dir];
+		}
+		bool isEmpty(DirId p_dir) const
+		{
+			return m_dir_file_count[p_dir] == 0 && m_dir_sub_count[p_dir] == 0;
+		}
+		/** Size of the files in the directory itself (Directory::getDirSizeFast) */
+		int64_t getDirSize(DirId p_dir) const
+		{
+			return m_dir_size[p_dir];
+		}
+		bool hasType(DirId p_dir, Search::TypeModes p_type) const
+		{
+			return (p_type == Search::TYPE_ANY) || (m_dir_types[p_dir] & (1 << p_type));
+		}
+		/** "Root\Sub\" like Directory::getFullName */
+		string getFullName(DirId p_dir) const;
+		/** "/Root/Sub/" like Directory::getADCPathL */
+		string getADCPath(DirId p_dir) const;
+		const StringList& getRootRealPaths(DirId p_root) const
+		{
+			return m_root_real_paths[p_root];
+		}
+		/** Root directory with the given virtual name (case-insensitive) */
+		DirId findRoot(const string& p_virtual_name) const;
+		/** Subdirectory by exact name */
+		DirId findSubdirectory(DirId p_dir, const string& p_name) const;
+		/** "/Root/Sub/" -> directory, INVALID_ID if not found */
+		DirId findDirectory(const string& p_adc_path) const;
+
+		// Files
+		DirId getFileDir(FileId p_file) const
+		{
+			return m_file_dir[p_file];
+		}
+		string getFileName(FileId p_file) const
+		{
+			return getString(m_file_name[p_file]);
+		}
+		const uint8_t* getFileLowName(FileId p_file, size_t& p_len) const
+		{
+			return getBytes(m_file_low_name[p_file], p_len);
+		}
+		int64_t getFileSize(FileId p_file) const
+		{
+			return m_file_size[p_file];
+		}
+		const TTHValue& getFileTTH(FileId p_file) const
+		{
+			return m_file_tth[p_file];
+		}
+		Search::TypeModes getFileType(FileId p_file) const
+		{
+			return Search::TypeModes(m_file_type[p_file]);
+		}
+		/** File in the directory by name (case-insensitive) */
+		FileId findFile(DirId p_dir, const string& p_name) const;
+		FileId findFile(const TTHValue& p_tth) const;
+		/** "/Root/Sub/file" like ShareManager::splitVirtualL, INVALID_ID if not found */
+		FileId findVirtualFile(const string& p_virtual_path) const;
+		/** "Sub\file" relative to the real root folder of the file */
+		string getRelativeRealPath(FileId p_file) const;
+		DirId getRoot(DirId p_dir) const;
+
+		// File lists
+		void toXml(OutputStream& p_xml, DirId p_dir, string& p_indent, string& p_tmp, bool p_full_list) const;
+		void filesToXml(OutputStream& p_xml, DirId p_dir, const string& p_indent, string& p_tmp) const;
+
+	private:
+		NameRef addName(const string& p_name);
+		void setFile(FileId p_file, const FileChange& p_change);
+		string getString(const NameRef& p_ref) const
+		{
+			return m_names.substr(p_ref.m_offset, p_ref.m_len);
+		}
+		const uint8_t* getBytes(const NameRef& p_ref, size_t& p_len) const
+		{
+			p_len = p_ref.m_len;
+			return reinterpret_cast<const uint8_t*>(m_names.data()) + p_ref.m_offset;
+		}
+
+		string m_names;
+
+		DirId m_root_count;
+		std::vector<StringList> m_root_real_paths;
+
+		std::vector<DirId> m_dir_parent;
+		std::vector<NameRef> m_dir_name;
+		std::vector<NameRef> m_dir_low_name;
+		std::vector<FileId> m_dir_first_file;
+		std::vector<uint32_t> m_dir_file_count;
+		std::vector<DirId> m_dir_first_sub;
+		std::vector<uint32_t> m_dir_sub_count;
+		std::vector<int64_t> m_dir_size;
+		std::vector<uint16_t> m_dir_types;
+
+		std::vector<DirId> m_file_dir;
+		std::vector<NameRef> m_file_name;
+		std::vector<NameRef> m_file_low_name;
+		std::vector<int64_t> m_file_size;
+		std::vector<TTHValue> m_file_tth;
+		std::vector<uint32_t> m_file_ts;
+		std::vector<uint32_t> m_file_hit;
+		std::vector<uint8_t> m_file_type;
+		/** Index into m_media, INVALID_ID - no media info */
+		std::vector<uint32_t> m_file_media;
+		std::vector<std::shared_ptr<CFlyMediaInfo>> m_media;
+
+		/** TTH -> file, sorted by TTH */
+		std::vector<std::pair<TTHValue, FileId>> m_tth_index;
+};
+
+#endif // DCPLUSPLUS_DCPP_SHARE_SNAPSHOT_H
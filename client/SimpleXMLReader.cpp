@@ -24,11 +24,27 @@
 #include "Text.h"
 #include "Streams.h"
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLYLINKDC_USE_SSE2_XML_SCAN
+#endif
+
 inline static bool isSpace(int c)
 {
 	return c == 0x20 || c == 0x09 || c == 0x0d || c == 0x0a;
 }
 
+// Only the whitespace between the tags may stand before a child element
+static bool isBlank(const string& p_value)
+{
+	for (auto i = p_value.cbegin(); i != p_value.cend(); ++i)
+	{
+		if (!isSpace(*i))
+			return false;
+	}
+	return true;
+}
+
 inline static bool inRange(int c, int a, int b)
 {
 	return c >= a && c <= b;
@@ -69,6 +85,31 @@ inline static bool isNameChar(int c)
 	       ;
 }
 
+/** The first p_quote or '&' in [p_pos, p_end) */
+inline static const char* findValueEnd(const char* p_pos, const char* p_end, char p_quote)
+{
+#ifdef FLYLINKDC_USE_SSE2_XML_SCAN
+	const __m128i l_quote = _mm_set1_epi8(p_quote);
+	const __m128i l_amp = _mm_set1_epi8('&');
+	while (p_end - p_pos >= 16)
+	{
+		const __m128i l_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_pos));
+		const __m128i l_eq = _mm_or_si128(_mm_cmpeq_epi8(l_block, l_quote), _mm_cmpeq_epi8(l_block, l_amp));
+		const unsigned l_bits = static_cast<unsigned>(_mm_movemask_epi8(l_eq));
+		if (l_bits)
+		{
+			unsigned long l_index;
+			_BitScanForward(&l_index, l_bits);
+			return p_pos + l_index;
+		}
+		p_pos += 16;
+	}
+#endif
+	while (p_pos < p_end && *p_pos != p_quote && *p_pos != '&')
+		++p_pos;
+	return p_pos;
+}
+
 SimpleXMLReader::SimpleXMLReader(SimpleXMLReader::CallBack* callback) :
 	bufPos(0), pos(0), cb(callback), state(STATE_START)
 {
@@ -117,6 +158,22 @@ const string& SimpleXMLReader::CallBack::getAttrib(StringPairList& attribs, cons
 	}
 }
 
+SimpleXMLReader::StringRef SimpleXMLReader::CallBack::getAttribRef(const StringRefPairList& attribs, const StringRef& name, size_t hint)
+{
+	hint = min(hint, attribs.size());
+	for (size_t i = hint; i < attribs.size(); ++i)
+	{
+		if (attribs[i].first == name)
+			return attribs[i].second;
+	}
+	for (size_t i = 0; i < hint; ++i)
+	{
+		if (attribs[i].first == name)
+			return attribs[i].second;
+	}
+	return StringRef();
+}
+
 bool SimpleXMLReader::literal(const char* lit, size_t len, bool withSpace, ParseState newState)
 {
 	string::size_type n = 0, nend = bufSize();
@@ -159,6 +216,10 @@ bool SimpleXMLReader::element()
 	int c = charAt(1);
 	if (charAt(0) == '<' && isNameStartChar(c))
 	{
+		if (!isBlank(value))
+		{
+			error("Mixed content not supported");
+		}
 		if (elements.size() >= MAX_NESTING)
 		{
 			error("Max nesting exceeded");
@@ -618,6 +679,143 @@ bool SimpleXMLReader::content()
 	return true;
 }
 
+/**
+ * [+] Fast path of STATE_CONTENT: a whole start tag or end tag that is already in the buffer is parsed in one pass,
+ * the attribute values are found with SSE2 and passed to CallBack::startTagRef without copying.
+ * Returns false without consuming anything on entities, comments, CDATA, a non utf-8 encoding,
+ * a tag split between the reads and all the errors - the general state machine handles them.
+ */
+bool SimpleXMLReader::fastElement()
+{
+	if (!needChars(2) || charAt(0) != '<' || !(encoding.empty() || encoding == Text::g_utf8))
+	{
+		return false;
+	}
+	const char* const l_begin = buf.data() + bufPos;
+	const char* const l_end = buf.data() + buf.size();
+	if (l_begin[1] == '/')
+	{
+		return fastElementEnd(l_begin, l_end);
+	}
+	if (!isNameStartChar(l_begin[1]) || elements.size() >= MAX_NESTING)
+	{
+		return false;
+	}
+	if (!isBlank(value))
+	{
+		error("Mixed content not supported");
+	}
+	
+	const char* p = l_begin + 1;
+	while (p < l_end && isNameChar(*p))
+		++p;
+	const StringRef l_name(l_begin + 1, p - l_begin - 1);
+	if (l_name.size() > MAX_NAME_SIZE)
+	{
+		return false;
+	}
+	
+	m_attrib_refs.clear();
+	bool l_simple;
+	while (true)
+	{
+		while (p < l_end && isSpace(*p))
+			++p;
+		if (p == l_end)
+		{
+			return false;
+		}
+		if (*p == '>')
+		{
+			l_simple = false;
+			++p;
+			break;
+		}
+		if (*p == '/')
+		{
+			if (l_end - p < 2 || p[1] != '>')
+			{
+				return false;
+			}
+			l_simple = true;
+			p += 2;
+			break;
+		}
+		if (!isNameStartChar(*p))
+		{
+			return false;
+		}
+		const char* const l_attr_begin = p;
+		while (p < l_end && isNameChar(*p))
+			++p;
+		const StringRef l_attr(l_attr_begin, p - l_attr_begin);
+		// Spaces around '=' are left to the state machine
+		if (l_end - p < 2 || p[0] != '=' || (p[1] != '"' && p[1] != '\'') || l_attr.size() > MAX_NAME_SIZE)
+		{
+			return false;
+		}
+		const char l_quote = p[1];
+		const char* const l_value_begin = p + 2;
+		p = findValueEnd(l_value_begin, l_end, l_quote);
+		if (p == l_end || *p == '&' || size_t(p - l_value_begin) > MAX_VALUE_SIZE)
+		{
+			return false;
+		}
+		m_attrib_refs.push_back(StringRefPair(l_attr, StringRef(l_value_begin, p - l_value_begin)));
+		++p;
+	}
+	
+	const size_t l_len = p - l_begin;
+	if (cb->startTagRef(l_name, m_attrib_refs, l_simple))
+	{
+		if (!l_simple)
+		{
+			elements.push_back(string(l_name.data(), l_name.size()));
+		}
+	}
+	else
+	{
+		dcassert(attribs.empty());
+		attribs.resize(m_attrib_refs.size());
+		for (size_t i = 0; i < m_attrib_refs.size(); ++i)
+		{
+			attribs[i].first.assign(m_attrib_refs[i].first.data(), m_attrib_refs[i].first.size());
+			attribs[i].second.assign(m_attrib_refs[i].second.data(), m_attrib_refs[i].second.size());
+		}
+		elements.push_back(string(l_name.data(), l_name.size()));
+		cb->startTag(elements.back(), attribs, l_simple);
+		attribs.clear();
+		if (l_simple)
+		{
+			elements.pop_back();
+		}
+	}
+	m_attrib_refs.clear();
+	// Whitespace before the tag, the state machine drops it the same way
+	value.clear();
+	advancePos(l_len);
+	return true;
+}
+
+bool SimpleXMLReader::fastElementEnd(const char* p_begin, const char* p_end)
+{
+	if (elements.empty())
+	{
+		return false;
+	}
+	const string& l_top = elements.back();
+	const size_t l_len = l_top.size() + 3; // </name>
+	if (size_t(p_end - p_begin) < l_len || p_begin[l_len - 1] != '>' || l_top.compare(0, l_top.size(), p_begin + 2, l_top.size()) != 0)
+	{
+		return false;
+	}
+	cb->endTag(l_top, value);
+	value.clear();
+	elements.pop_back();
+	advancePos(l_len);
+	return true;
+}
+
 bool SimpleXMLReader::elementEnd()
 {
 	if (elements.empty())
@@ -850,7 +1048,8 @@ bool SimpleXMLReader::process()
 				|| error("Error while parsing CDATA");
 				break;
 			case STATE_CONTENT:
-				skipSpace(true)
+				fastElement()
+				|| skipSpace(true)
 				|| literal(LITN("<!--"), false, STATE_COMMENT)
 				|| literal(LITN("<![CDATA["), false, STATE_CDATA)
 				|| element()
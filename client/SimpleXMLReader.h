@@ -22,6 +22,7 @@
 #ifndef DCPLUSPLUS_DCPP_SIMPLEXMLREADER_H_
 #define DCPLUSPLUS_DCPP_SIMPLEXMLREADER_H_
 
+#include <boost/utility/string_view.hpp>
 #include "typedefs.h"
 
 class InputStream;
@@ -29,6 +30,11 @@ class InputStream;
 class SimpleXMLReader
 {
 	public:
+		/** Points into the parser buffer, valid during the callback only */
+		typedef boost::string_view StringRef;
+		typedef std::pair<StringRef, StringRef> StringRefPair;
+		typedef std::vector<StringRefPair> StringRefPairList;
+		
 		struct CallBack
 #ifdef _DEBUG
 			: private boost::noncopyable
@@ -37,9 +43,18 @@ class SimpleXMLReader
 				virtual ~CallBack() { }
 				virtual void startTag(const std::string& name, StringPairList& attribs, bool simple) = 0;
 				virtual void endTag(const std::string& name, const std::string& data) = 0;
+				/**
+				 * [+] Zero-copy variant of startTag for the fast path (utf-8 tags without entities).
+				 * Return false to get the same tag through startTag.
+				 */
+				virtual bool startTagRef(const StringRef& name, const StringRefPairList& attribs, bool simple)
+				{
+					return false;
+				}
 				
 			protected:
 				static const std::string& getAttrib(StringPairList& attribs, const std::string& name, size_t hint);
+				static StringRef getAttribRef(const StringRefPairList& attribs, const StringRef& name, size_t hint);
 		};
 		
 		explicit SimpleXMLReader(CallBack* callback);
@@ -133,6 +148,7 @@ class SimpleXMLReader
 		uint64_t pos;
 		
 		StringPairList attribs;
+		StringRefPairList m_attrib_refs;
 		std::string value;
 		
 		CallBack* cb;
@@ -185,6 +201,9 @@ class SimpleXMLReader
 		
 		bool content();
 		
+		bool fastElement();
+		bool fastElementEnd(const char* p_begin, const char* p_end);
+		
 		bool entref(std::string& d);
 		
 		bool process();
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "SnapshotSpeaker.h"
+
+__declspec(thread) SnapshotSpeakerBase::FireScope* SnapshotSpeakerBase::g_fire_scope = nullptr;
+
+void SnapshotSpeakerBase::waitForSlot(long p_slot, const long* p_own)
+{
+	while (m_active[p_slot] > p_own[p_slot])
+	{
+		Thread::yield();
+	}
+}
+
+void SnapshotSpeakerBase::waitForFires()
+{
+	// The events of this speaker on the current thread hold their slots until the removal returns
+	long l_own[2] = { 0, 0 };
+	for (const FireScope* i = g_fire_scope; i; i = i->m_prev)
+	{
+		if (&i->m_speaker == this)
+		{
+			++l_own[i->m_slot];
+		}
+	}
+	if (l_own[0] || l_own[1])
+	{
+		// Inside an event of this speaker: a remover holding m_removeCS may wait for this very event, so the epoch
+		// isn't flipped here. An event that could take the old snapshot was counted before the new one was published,
+		// so a slot seen without the events of other threads has none of them left.
+		bool l_is_drained[2] = { false, false };
+		for (;;)
+		{
+			for (long i = 0; i < 2; ++i)
+			{
+				if (!l_is_drained[i] && m_active[i] <= l_own[i])
+					l_is_drained[i] = true;
+			}
+			if (l_is_drained[0] && l_is_drained[1])
+				break;
+			Thread::yield();
+		}
+		return;
+	}
+	CFlyLock(m_removeCS);
+	const long l_epoch = m_epoch;
+	// The events left in the other slot by an earlier epoch, then the flip: the new events go to the other slot,
+	// and the events that could take the old snapshot are drained from this one
+	waitForSlot((l_epoch + 1) & 1, l_own);
+	Thread::safeInc(m_epoch);
+	waitForSlot(l_epoch & 1, l_own);
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_SNAPSHOT_SPEAKER_H
+#define DCPLUSPLUS_DCPP_SNAPSHOT_SPEAKER_H
+
+#include <boost/range/algorithm/find.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "Speaker.h"
+
+/**
+ * Counts the fire() calls in progress by epochs (two-phase, like RCU): removeListener flips the epoch
+ * and waits until the fire() calls of the old epoch are over. Every fire() that could still see
+ * the removed listener is waited for, whatever snapshot it took.
+ * The removals are serialized by m_removeCS, so the epoch is flipped once per drain and a remover
+ * doesn't wait for a slot that another remover has made current again.
+ */
+class SnapshotSpeakerBase
+{
+	protected:
+		SnapshotSpeakerBase() : m_epoch(0)
+		{
+			m_active[0] = 0;
+			m_active[1] = 0;
+		}
+		
+		/** A fire() of the speaker on the current thread: the scopes of a thread make a stack */
+		class FireScope
+		{
+			public:
+				explicit FireScope(SnapshotSpeakerBase& p_speaker) : m_speaker(p_speaker), m_prev(g_fire_scope)
+				{
+					for (;;)
+					{
+						const long l_epoch = p_speaker.m_epoch;
+						m_slot = l_epoch & 1;
+						Thread::safeInc(p_speaker.m_active[m_slot]);
+						// The epoch was flipped meanwhile: waitForFires may have seen this slot empty already
+						if (p_speaker.m_epoch == l_epoch)
+							break;
+						Thread::safeDec(p_speaker.m_active[m_slot]);
+					}
+					g_fire_scope = this;
+				}
+				~FireScope()
+				{
+					g_fire_scope = m_prev;
+					Thread::safeDec(m_speaker.m_active[m_slot]);
+				}
+			private:
+				friend class SnapshotSpeakerBase;
+				SnapshotSpeakerBase& m_speaker;
+				FireScope* const m_prev;
+				long m_slot;
+		};
+		
+		/**
+		 * Returns when all the fire() calls started before it are over.
+		 * The events of the current thread (a listener removed from inside an event) aren't waited for.
+		 */
+		void waitForFires();
+		
+	private:
+		static __declspec(thread) FireScope* g_fire_scope;
+		void waitForSlot(long p_slot, const long* p_own);
+		
+		volatile long m_epoch;
+		volatile long m_active[2];
+		CriticalSection m_removeCS;
+};
+
+/**
+ * [+] Speaker for the hot events (TimerManagerListener::Second, DownloadManagerListener::Tick, ClientListener).
+ * fire() takes no lock and doesn't copy the listeners: the list is an immutable snapshot published through
+ * an atomic shared pointer, addListener/removeListener build a new snapshot (copy-on-write).
+ * removeListener returns when no other thread runs an event that started before it, like Speaker does with its lock,
+ * so a listener can be destroyed after that. As with Speaker, it must not be called holding a lock that the
+ * listeners of this speaker take.
+ *
+ * Unlike Speaker, which holds its lock for the whole fire(), the events of different threads run concurrently:
+ * a listener guards its own state (the listeners of TimerManager, DownloadManager and Client put the events
+ * into their locked task queues or take their own locks).
+ * fireCoalesced keeps only the last event of every type until flushCoalesced delivers them.
+ */
+template<typename Listener>
+class SnapshotSpeaker : private SnapshotSpeakerBase
+{
+		typedef std::vector<Listener*> ListenerList;
+		typedef std::shared_ptr<const ListenerList> ListenerSnapshot;
+		typedef std::function<void(Listener*)> Event;
+	
+	public:
+		SnapshotSpeaker() noexcept : m_listeners(std::make_shared<const ListenerList>())
+		{
+		}
+		virtual ~SnapshotSpeaker()
+		{
+			dcassert(getSnapshot()->empty());
+		}
+		
+		template<typename... ArgT>
+		void fire(ArgT && ... args)
+		{
+			// Counted before the snapshot is taken, so removeListener waits for this event
+			FireScope l_scope(*this);
+			const ListenerSnapshot l_listeners = getSnapshot();
+#ifdef _DEBUG
+			extern volatile bool g_isShutdown;
+			if (g_isShutdown && !l_listeners->empty())
+			{
+				dcdebug("[SnapshotSpeaker][this=%p] fire-destroy! count = %d\n", this, int(l_listeners->size()));
+			}
+#endif
+			for (auto i = l_listeners->cbegin(); i != l_listeners->cend(); ++i)
+			{
+				(*i)->on(std::forward<ArgT>(args)...);
+			}
+		}
+#ifdef FLYLINKDC_USE_PROFILER_CS
+		template<typename... ArgT>
+		void fire_log(const char*, int, ArgT && ... args)
+		{
+			fire(std::forward<ArgT>(args)...);
+		}
+#endif
+		
+		/**
+		 * Queues the event for flushCoalesced, the previous queued event of the same type is dropped.
+		 * The arguments are copied, so the listener gets them by value or by const reference.
+		 */
+		template<typename T0, typename... ArgT>
+		void fireCoalesced(T0 && type, ArgT && ... args)
+		{
+			typedef typename std::decay<T0>::type EventType;
+			Event l_event = std::bind([](Listener * p_listener, const EventType & p_type, const typename std::decay<ArgT>::type & ... p_args)
+			{
+				p_listener->on(p_type, p_args...);
+			}, std::placeholders::_1, std::forward<T0>(type), std::forward<ArgT>(args)...);
+			CFlyFastLock(m_coalescedCS);
+			m_coalesced[EventType::TYPE] = std::move(l_event);
+		}
+		/** Delivers the events queued by fireCoalesced in the order of their types */
+		void flushCoalesced()
+		{
+			std::map<int, Event> l_events;
+			{
+				CFlyFastLock(m_coalescedCS);
+				l_events.swap(m_coalesced);
+			}
+			if (l_events.empty())
+				return;
+			FireScope l_scope(*this);
+			const ListenerSnapshot l_listeners = getSnapshot();
+			for (auto j = l_events.cbegin(); j != l_events.cend(); ++j)
+			{
+				for (auto i = l_listeners->cbegin(); i != l_listeners->cend(); ++i)
+				{
+					j->second(*i);
+				}
+			}
+		}
+		
+		void addListener(Listener* aListener)
+		{
+			extern volatile bool g_isBeforeShutdown;
+			dcassert(!g_isBeforeShutdown);
+			CFlyLock(m_listenerCS);
+			const ListenerSnapshot l_old = getSnapshot();
+			if (boost::range::find(*l_old, aListener) == l_old->end())
+			{
+				auto l_new = std::make_shared<ListenerList>(*l_old);
+				l_new->push_back(aListener);
+				std::atomic_store(&m_listeners, ListenerSnapshot(std::move(l_new)));
+			}
+			else
+			{
+				dcassert(0);
+			}
+		}
+		
+		void removeListener(Listener* aListener)
+		{
+			{
+				CFlyLock(m_listenerCS);
+				const ListenerSnapshot l_old = getSnapshot();
+				auto l_new = std::make_shared<ListenerList>(*l_old);
+				auto it = boost::range::find(*l_new, aListener);
+				if (it == l_new->end())
+				{
+					dcassert(l_old->empty());
+					return;
+				}
+				l_new->erase(it);
+				std::atomic_store(&m_listeners, ListenerSnapshot(std::move(l_new)));
+			}
+			waitForFires();
+		}
+		
+		void removeListeners()
+		{
+			{
+				CFlyLock(m_listenerCS);
+				std::atomic_store(&m_listeners, std::make_shared<const ListenerList>());
+			}
+			waitForFires();
+		}
+	
+	private:
+		ListenerSnapshot getSnapshot() const
+		{
+			return std::atomic_load(&m_listeners);
+		}
+		
+		ListenerSnapshot m_listeners;
+		CriticalSection m_listenerCS; // the writers only
+		
+		std::map<int, Event> m_coalesced;
+		FastCriticalSection m_coalescedCS;
+};
+
+#endif // DCPLUSPLUS_DCPP_SNAPSHOT_SPEAKER_H
@@ -24,6 +24,7 @@
 #include "ResourceManager.h"
 #include "CompatibilityManager.h"
 #include <iphlpapi.h>
+#include <mswsock.h>
 
 #include "../FlyFeatures/flyServer.h"
 
@@ -585,6 +586,72 @@ int Socket::write(const void* aBuffer, int aLen)
 	return sent;
 }
 
+static LPFN_TRANSMITFILE getTransmitFile(socket_t p_sock)
+{
+	// The extension is provided by the TCP provider (mswsock), so it is the same for all the sockets
+	static LPFN_TRANSMITFILE g_transmit_file = nullptr;
+	if (g_transmit_file == nullptr)
+	{
+		GUID l_guid = WSAID_TRANSMITFILE;
+		LPFN_TRANSMITFILE l_func = nullptr;
+		DWORD l_bytes = 0;
+		if (::WSAIoctl(p_sock, SIO_GET_EXTENSION_FUNCTION_POINTER, &l_guid, sizeof(l_guid), &l_func, sizeof(l_func), &l_bytes, nullptr, nullptr) == 0)
+		{
+			g_transmit_file = l_func;
+		}
+	}
+	return g_transmit_file;
+}
+
+bool Socket::startTransmitFile(HANDLE p_file, int64_t p_pos, size_t p_len, OVERLAPPED& p_ov)
+{
+	dcassert(m_type == TYPE_TCP && p_ov.hEvent && p_len);
+	const LPFN_TRANSMITFILE l_transmit_file = getTransmitFile(m_sock);
+	if (l_transmit_file == nullptr)
+		return false;
+		
+	// The socket is non-blocking, so the send is overlapped and its end is checked by getTransmitFileResult
+	::ResetEvent(p_ov.hEvent);
+	p_ov.Internal = 0;
+	p_ov.InternalHigh = 0;
+	p_ov.Offset = DWORD(p_pos & 0xFFFFFFFF);
+	p_ov.OffsetHigh = DWORD(p_pos >> 32);
+	if (!l_transmit_file(m_sock, p_file, DWORD(p_len), 0, &p_ov, nullptr, 0))
+	{
+		const int l_error = getLastError();
+		if (l_error == WSAEOPNOTSUPP || l_error == WSAENOTSOCK) // LSP without the extension
+			return false;
+		if (l_error != WSA_IO_PENDING)
+			throw SocketException(l_error);
+	}
+	return true;
+}
+
+int Socket::getTransmitFileResult(OVERLAPPED& p_ov)
+{
+	DWORD l_sent = 0;
+	DWORD l_flags = 0;
+	if (!::WSAGetOverlappedResult(m_sock, &p_ov, &l_sent, FALSE, &l_flags))
+	{
+		const int l_error = getLastError();
+		if (l_error == WSA_IO_INCOMPLETE)
+			return -1;
+		throw SocketException(l_error);
+	}
+	g_stats.m_tcp.totalUp += l_sent;
+	return static_cast<int>(l_sent);
+}
+
+void Socket::cancelTransmitFile(OVERLAPPED& p_ov) noexcept
+{
+	// The send was started by this thread, CancelIoEx isn't available in XP.
+	// A closed socket has cancelled the send already.
+	if (m_sock != INVALID_SOCKET)
+	{
+		::CancelIo(reinterpret_cast<HANDLE>(m_sock));
+	}
+	::WaitForSingleObject(p_ov.hEvent, INFINITE); // the cancelled send ends at once, p_ov can't be released before that
+}
 /**
 * Sends data, will block until all data has been sent or an exception occurs
 * @param aBuffer Buffer with data
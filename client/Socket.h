@@ -140,6 +140,21 @@ class Socket
 		{
 			return write(aData.data(), (int)aData.length());
 		}
+		/**
+		 * [+] Starts sending p_len bytes of the file from p_pos by the kernel (TransmitFile) without copying them to user mode.
+		 * Plain TCP only, the send is overlapped: p_ov.hEvent is a manual reset event, p_ov is used until the send ends.
+		 * @return false if TransmitFile isn't available for this socket (nothing is sent).
+		 * @throw SocketException Send failed.
+		 */
+		bool startTransmitFile(HANDLE p_file, int64_t p_pos, size_t p_len, OVERLAPPED& p_ov);
+		/**
+		 * [+] Checks the send of startTransmitFile without waiting.
+		 * @return The number of bytes sent, -1 if the send is still in progress.
+		 * @throw SocketException Send failed.
+		 */
+		int getTransmitFileResult(OVERLAPPED& p_ov);
+		/** [+] Cancels the send of startTransmitFile and waits for its end, the connection can't be used after that */
+		void cancelTransmitFile(OVERLAPPED& p_ov) noexcept;
 		virtual int writeTo(const string& aIp, uint16_t aPort, const void* aBuffer, int aLen, bool proxy = true);
 		int writeTo(const string& aIp, uint16_t aPort, const string& aData)
 		{
@@ -243,6 +258,11 @@ class Socket
 		{
 			return false;
 		}
+		/** [+] Data is buffered above the socket (SSL), so read() gives it without waiting for the socket */
+		virtual bool isReadPending()
+		{
+			return false;
+		}
 		virtual bool isTrusted()
 		{
 			return false;
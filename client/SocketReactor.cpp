@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "SocketReactor.h"
+#include "BufferedSocket.h"
+#include "CompatibilityManager.h"
+
+// Tasks and throttled sockets are checked at least so often
+static const uint64_t POLL_TIMEOUT = 250;
+// Without the wakeup socket the tasks are found by polling only
+static const uint64_t NO_WAKEUP_POLL_TIMEOUT = 20;
+
+typedef int (WSAAPI* WSAPollFunc)(LPWSAPOLLFD, ULONG, INT);
+
+static WSAPollFunc getWSAPoll()
+{
+	// WSAPoll is available since Windows Vista
+	static const WSAPollFunc g_func = (WSAPollFunc)GetProcAddress(GetModuleHandle(_T("ws2_32.dll")), "WSAPoll");
+	return g_func;
+}
+
+static void addToSet(vector<SOCKET>& p_set, SOCKET p_sock)
+{
+	// fd_set of Windows is a counted array: the count takes the first item, the sockets follow it
+	p_set.push_back(p_sock);
+	p_set[0] = p_set.size() - 1;
+}
+
+static bool isInSet(const vector<SOCKET>& p_set, SOCKET p_sock)
+{
+	const size_t l_count = reinterpret_cast<const fd_set*>(&p_set[0])->fd_count;
+	return std::find(p_set.cbegin() + 1, p_set.cbegin() + 1 + l_count, p_sock) != p_set.cbegin() + 1 + l_count;
+}
+
+static int pollSockets(WSAPOLLFD* p_fds, size_t p_count, int p_timeout)
+{
+	if (const auto l_poll = getWSAPoll())
+	{
+		return l_poll(p_fds, ULONG(p_count), p_timeout);
+	}
+	// Windows XP: select with the sets bigger than FD_SETSIZE
+	vector<SOCKET> l_read(1), l_write(1), l_except(1);
+	for (size_t i = 0; i < p_count; ++i)
+	{
+		if (p_fds[i].events & POLLRDNORM)
+			addToSet(l_read, p_fds[i].fd);
+		if (p_fds[i].events & POLLWRNORM)
+			addToSet(l_write, p_fds[i].fd);
+		addToSet(l_except, p_fds[i].fd);
+	}
+	timeval l_tv;
+	l_tv.tv_sec = p_timeout / 1000;
+	l_tv.tv_usec = (p_timeout % 1000) * 1000;
+	const int l_result = ::select(0, reinterpret_cast<fd_set*>(&l_read[0]), reinterpret_cast<fd_set*>(&l_write[0]), reinterpret_cast<fd_set*>(&l_except[0]), &l_tv);
+	if (l_result > 0)
+	{
+		for (size_t i = 0; i < p_count; ++i)
+		{
+			p_fds[i].revents = short((isInSet(l_read, p_fds[i].fd) ? POLLRDNORM : 0) | (isInSet(l_write, p_fds[i].fd) ? POLLWRNORM : 0) | (isInSet(l_except, p_fds[i].fd) ? POLLERR : 0));
+		}
+	}
+	return l_result;
+}
+
+SocketReactor::SocketReactor() : m_work_idle(0), m_is_stop(false)
+{
+	size_t l_count = SETTING(SOCKET_IO_THREADS);
+	if (l_count == 0)
+	{
+		l_count = std::max(std::min(CompatibilityManager::getProcessorsCount(), size_t(8)), size_t(2));
+	}
+	for (size_t i = 0; i < l_count; ++i)
+	{
+		m_io_threads.push_back(new IOThread());
+		m_io_threads.back()->start(64, "SocketReactor I/O");
+	}
+	for (size_t i = 0; i < WORK_THREADS; ++i)
+	{
+		{
+			CFlyFastLock(m_work_cs);
+			++m_work_idle;
+		}
+		startWorkThread();
+	}
+}
+
+SocketReactor::~SocketReactor()
+{
+	vector<WorkThread*> l_work_threads;
+	{
+		// An idle work thread leaves under the lock only if it doesn't see the stop yet
+		CFlyFastLock(m_work_cs);
+		m_is_stop = true;
+		l_work_threads.swap(m_work_threads);
+	}
+	for (auto i = l_work_threads.cbegin(); i != l_work_threads.cend(); ++i)
+	{
+		m_work_semaphore.signal();
+	}
+	for (auto i = m_io_threads.cbegin(); i != m_io_threads.cend(); ++i)
+	{
+		(*i)->stop();
+	}
+	for (auto i = l_work_threads.cbegin(); i != l_work_threads.cend(); ++i)
+	{
+		(*i)->join();
+		delete *i;
+	}
+	joinFinishedWorkThreads();
+	// The sockets left in the threads aren't deleted: their listeners may be gone already
+	for (auto i = m_io_threads.cbegin(); i != m_io_threads.cend(); ++i)
+	{
+		(*i)->join();
+		delete *i;
+	}
+}
+
+void SocketReactor::add(BufferedSocket* p_socket)
+{
+	IOThread* l_thread = m_io_threads.front();
+	for (auto i = m_io_threads.cbegin(); i != m_io_threads.cend(); ++i)
+	{
+		if ((*i)->getCount() < l_thread->getCount())
+		{
+			l_thread = *i;
+		}
+	}
+	p_socket->m_io_thread = l_thread;
+	l_thread->add(p_socket);
+}
+
+void SocketReactor::startWorkThread()
+{
+	WorkThread* l_thread = new WorkThread(*this);
+	{
+		CFlyFastLock(m_work_cs);
+		m_work_threads.push_back(l_thread);
+	}
+	l_thread->start(64, "SocketReactor work");
+}
+
+void SocketReactor::joinFinishedWorkThreads()
+{
+	vector<WorkThread*> l_finished;
+	{
+		CFlyFastLock(m_work_cs);
+		l_finished.swap(m_finished_work_threads);
+	}
+	for (auto i = l_finished.cbegin(); i != l_finished.cend(); ++i)
+	{
+		(*i)->join();
+		delete *i;
+	}
+}
+
+void SocketReactor::runTurn(BufferedSocket* p_socket)
+{
+	bool l_is_new_thread = false;
+	{
+		CFlyFastLock(m_work_cs);
+		if (m_is_stop)
+			return; // the sockets left aren't deleted, see ~SocketReactor
+		m_work_queue.push_back(p_socket);
+		// Every socket in the queue has a thread of its own: a turn doesn't wait for a blocked turn of another one
+		if (m_work_idle)
+			--m_work_idle;
+		else
+			l_is_new_thread = true;
+	}
+	joinFinishedWorkThreads();
+	if (l_is_new_thread)
+	{
+		startWorkThread();
+	}
+	m_work_semaphore.signal();
+}
+
+int SocketReactor::WorkThread::run()
+{
+	for (;;)
+	{
+		const bool l_is_signaled = m_reactor.m_work_semaphore.wait(WORK_IDLE_TIMEOUT);
+		if (m_reactor.m_is_stop)
+			break;
+		BufferedSocket* l_socket;
+		{
+			CFlyFastLock(m_reactor.m_work_cs);
+			if (!l_is_signaled)
+			{
+				// The threads started for a burst of connections leave when it is over
+				if (!m_reactor.m_is_stop && m_reactor.m_work_idle && m_reactor.m_work_threads.size() > WORK_THREADS)
+				{
+					--m_reactor.m_work_idle;
+					auto& l_threads = m_reactor.m_work_threads;
+					l_threads.erase(std::find(l_threads.begin(), l_threads.end(), this));
+					m_reactor.m_finished_work_threads.push_back(this);
+					break;
+				}
+				continue;
+			}
+			if (m_reactor.m_work_queue.empty())
+			{
+				dcassert(0);
+				continue;
+			}
+			l_socket = m_reactor.m_work_queue.front();
+			m_reactor.m_work_queue.pop_front();
+		}
+		l_socket->threadTurn();
+		{
+			CFlyFastLock(m_reactor.m_work_cs);
+			++m_reactor.m_work_idle;
+		}
+	}
+	return 0;
+}
+
+SocketReactor::IOThread::IOThread() : m_wake_sock(INVALID_SOCKET), m_is_wake_pending(0), m_count(0), m_is_stop(false)
+{
+	m_wake_sock = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_wake_sock != INVALID_SOCKET)
+	{
+		sockaddr_in l_addr = { 0 };
+		l_addr.sin_family = AF_INET;
+		l_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int l_len = sizeof(l_addr);
+		u_long l_is_non_blocking = 1;
+		if (::bind(m_wake_sock, (sockaddr*)&l_addr, sizeof(l_addr)) == SOCKET_ERROR ||
+		        ::getsockname(m_wake_sock, (sockaddr*)&l_addr, &l_len) == SOCKET_ERROR ||
+		        ::connect(m_wake_sock, (sockaddr*)&l_addr, sizeof(l_addr)) == SOCKET_ERROR ||
+		        ::ioctlsocket(m_wake_sock, FIONBIO, &l_is_non_blocking) == SOCKET_ERROR)
+		{
+			dcdebug("SocketReactor: no wakeup socket, error = %d\n", ::WSAGetLastError());
+			::closesocket(m_wake_sock);
+			m_wake_sock = INVALID_SOCKET;
+		}
+	}
+}
+
+SocketReactor::IOThread::~IOThread()
+{
+	if (m_wake_sock != INVALID_SOCKET)
+	{
+		::closesocket(m_wake_sock);
+	}
+}
+
+void SocketReactor::IOThread::add(BufferedSocket* p_socket)
+{
+	safeInc(m_count);
+	{
+		CFlyFastLock(m_cs);
+		m_added.push_back(p_socket);
+	}
+	wakeup();
+}
+
+void SocketReactor::IOThread::wakeup()
+{
+	if (m_wake_sock != INVALID_SOCKET && safeExchange(m_is_wake_pending, 1) == 0)
+	{
+		const char l_byte = 0;
+		::send(m_wake_sock, &l_byte, 1, 0);
+	}
+}
+
+void SocketReactor::IOThread::stop()
+{
+	m_is_stop = true;
+	safeExchange(m_is_wake_pending, 0);
+	wakeup();
+}
+
+int SocketReactor::IOThread::run()
+{
+	vector<WSAPOLLFD> l_fds;
+	vector<BufferedSocket*> l_polled; // the socket of every l_fds item after the wakeup one
+	const size_t l_first = m_wake_sock != INVALID_SOCKET ? 1 : 0;
+	while (!m_is_stop)
+	{
+		{
+			CFlyFastLock(m_cs);
+			m_sockets.insert(m_sockets.end(), m_added.cbegin(), m_added.cend());
+			m_added.clear();
+		}
+		
+		const uint64_t l_tick = GET_TICK();
+		uint64_t l_timeout = l_first ? POLL_TIMEOUT : NO_WAKEUP_POLL_TIMEOUT;
+		l_fds.clear();
+		l_polled.clear();
+		if (l_first)
+		{
+			const WSAPOLLFD l_fd = { m_wake_sock, POLLRDNORM, 0 };
+			l_fds.push_back(l_fd);
+		}
+		for (auto i = m_sockets.cbegin(); i != m_sockets.cend(); ++i)
+		{
+			const int l_wait_for = (*i)->getWaitFlags(l_tick, l_timeout);
+			if (l_wait_for)
+			{
+				const WSAPOLLFD l_fd = { (*i)->getPollSocket(), short(((l_wait_for & Socket::WAIT_READ) ? POLLRDNORM : 0) | ((l_wait_for & Socket::WAIT_WRITE) ? POLLWRNORM : 0)), 0 };
+				l_fds.push_back(l_fd);
+				l_polled.push_back(*i);
+			}
+		}
+		
+		if (l_fds.empty())
+		{
+			sleep(l_timeout);
+		}
+		else if (pollSockets(&l_fds[0], l_fds.size(), int(l_timeout)) == SOCKET_ERROR)
+		{
+			dcdebug("SocketReactor: poll error = %d\n", ::WSAGetLastError());
+			sleep(NO_WAKEUP_POLL_TIMEOUT);
+			for (auto i = l_fds.begin(); i != l_fds.end(); ++i)
+			{
+				i->revents = 0;
+			}
+		}
+		if (l_first && l_fds[0].revents)
+		{
+			// Drained before the flag is reset: a wakeup() after the reset sends a datagram that stays for the next poll.
+			// The tasks are looked at after the reset, so the task of a wakeup() that found the flag set isn't missed.
+			char l_buf[64];
+			while (::recv(m_wake_sock, l_buf, sizeof(l_buf), 0) > 0)
+			{
+			}
+			safeExchange(m_is_wake_pending, 0);
+		}
+		
+		// l_polled is a subsequence of m_sockets, so both are walked together
+		const uint64_t l_now = GET_TICK();
+		size_t l_fd = l_first;
+		for (auto i = m_sockets.begin(); i != m_sockets.end();)
+		{
+			BufferedSocket* l_socket = *i;
+			int l_events = Socket::WAIT_NONE;
+			if (l_fd < l_fds.size() && l_polled[l_fd - l_first] == l_socket)
+			{
+				const short l_revents = l_fds[l_fd].revents;
+				if (l_revents & (POLLRDNORM | POLLHUP | POLLERR))
+				{
+					l_events |= Socket::WAIT_READ;
+				}
+				if (l_revents & (POLLWRNORM | POLLERR))
+				{
+					l_events |= Socket::WAIT_WRITE;
+				}
+				++l_fd;
+			}
+			if (l_socket->m_is_busy)
+			{
+				++i; // the turn isn't over, the work thread wakes up the I/O thread at its end
+			}
+			else if (l_socket->m_is_shutdown)
+			{
+				i = m_sockets.erase(i);
+				safeDec(m_count);
+				delete l_socket;
+			}
+			else
+			{
+				if (l_socket->hasWork(l_events, l_now))
+				{
+					l_socket->m_turn_events = l_events;
+					l_socket->m_is_busy = true;
+					SocketReactor::getInstance()->runTurn(l_socket);
+				}
+				++i;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_SOCKET_REACTOR_H
+#define DCPLUSPLUS_DCPP_SOCKET_REACTOR_H
+
+#include "Singleton.h"
+#include "CFlyThread.h"
+#include "Semaphore.h"
+#include "Socket.h"
+
+class BufferedSocket;
+
+/**
+ * [+] Runs all BufferedSocket instances on a small pool of threads instead of a thread per socket.
+ * Every I/O thread only waits for its sockets with WSAPoll. A socket with something to do (ready for reading
+ * or writing, new tasks) is handed over to a work thread for one turn: the connection setup (name resolution,
+ * SOCKS5, SSL handshake), reading and sending of data and files, the tasks and the BufferedSocketListener
+ * callbacks. After the turn the socket comes back to its I/O thread.
+ *
+ * A socket has one turn at a time, so its callbacks never run concurrently and keep their order.
+ * A listener may block in a callback (the disk writes of DownloadManager, the database of UploadManager,
+ * the hub commands): only its own socket waits for it, the I/O thread and the other sockets don't.
+ */
+class SocketReactor : public Singleton<SocketReactor>
+{
+	public:
+		class IOThread : public Thread
+		{
+			public:
+				IOThread();
+				~IOThread();
+				
+				void add(BufferedSocket* p_socket);
+				/** A task was added to one of the sockets of the thread */
+				void wakeup();
+				void stop();
+				long getCount() const
+				{
+					return m_count;
+				}
+			private:
+				int run() override;
+				
+				FastCriticalSection m_cs;
+				vector<BufferedSocket*> m_added; // taken by run()
+				vector<BufferedSocket*> m_sockets; // used by run() only
+				socket_t m_wake_sock; // UDP socket connected to itself, a datagram ends WSAPoll
+				volatile long m_is_wake_pending;
+				volatile long m_count;
+				volatile bool m_is_stop;
+		};
+		
+		/** Attaches a new socket to the least loaded I/O thread, the thread deletes it after SHUTDOWN */
+		void add(BufferedSocket* p_socket);
+		/** Runs BufferedSocket::threadTurn on a work thread */
+		void runTurn(BufferedSocket* p_socket);
+		
+		/**
+		 * Work threads kept waiting. A dead peer, a slow handshake or a blocked listener holds a work thread
+		 * (up to LONG_TIMEOUT for the setup), so a new thread is started when all of them are busy;
+		 * the extra ones leave after WORK_IDLE_TIMEOUT.
+		 */
+		static const size_t WORK_THREADS = 8;
+		static const uint32_t WORK_IDLE_TIMEOUT = 60 * 1000;
+	
+	private:
+		class WorkThread : public Thread
+		{
+			public:
+				explicit WorkThread(SocketReactor& p_reactor) : m_reactor(p_reactor)
+				{
+				}
+			private:
+				int run() override;
+				SocketReactor& m_reactor;
+		};
+		void startWorkThread();
+		void joinFinishedWorkThreads();
+		
+		friend class Singleton<SocketReactor>;
+		
+		SocketReactor();
+		~SocketReactor();
+		
+		vector<IOThread*> m_io_threads;
+		vector<WorkThread*> m_work_threads;
+		
+		FastCriticalSection m_work_cs;
+		deque<BufferedSocket*> m_work_queue;
+		vector<WorkThread*> m_finished_work_threads; // left after WORK_IDLE_TIMEOUT, joined by the next runTurn
+		size_t m_work_idle; // work threads not claimed by runTurn
+		Semaphore m_work_semaphore;
+		volatile bool m_is_stop;
+};
+
+#endif // DCPLUSPLUS_DCPP_SOCKET_REACTOR_H
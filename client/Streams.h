@@ -90,6 +90,21 @@ class InputStream
 		virtual size_t read(void* p_buf, size_t& p_len) = 0;
 		/* This only works for file streams */
 		virtual void setPos(int64_t /*p_pos*/) { }
+		/** [+] The stream can give its data without copying (memory mapped file) */
+		virtual bool canReadRef() const
+		{
+			return false;
+		}
+		/**
+		 * [+] Zero-copy read: up to p_len bytes at the current position, valid until the next call.
+		 * @return pointer to the data, p_len is the number of bytes available there (0 - end of stream).
+		 */
+		virtual const uint8_t* readRef(size_t& p_len)
+		{
+			dcassert(0);
+			p_len = 0;
+			return nullptr;
+		}
 		
 		virtual void clean_stream()
 		{
@@ -162,6 +177,20 @@ class LimitedInputStream : public InputStream
 			maxBytes -= x;
 			return x;
 		}
+		bool canReadRef() const override
+		{
+			return s->canReadRef();
+		}
+		const uint8_t* readRef(size_t& len) override
+		{
+			dcassert(maxBytes >= 0);
+			len = (size_t)min(maxBytes, (int64_t)len);
+			if (len == 0)
+				return nullptr;
+			const uint8_t* x = s->readRef(len);
+			maxBytes -= len;
+			return x;
+		}
 		void clean_stream() override
 		{
 			s = nullptr;
@@ -17,29 +17,53 @@
  */
 
 #include "stdinc.h"
-
-#ifdef IRAINMAN_USE_STRING_POOL
-
 #include "StringPool.h"
 
-StringPool::StringMap StringPool::g_stringMap;
-FastCriticalSection StringPool::g_csStringMap;
+StringPool::Shard StringPool::g_shards[SHARD_COUNT];
 
-void StringPool::on(TimerManagerListener::Minute, uint64_t /*aTick*/) noexcept
+StringPool::StringPoolItemPtr StringPool::addString(const string& p_str)
 {
-	CFlyFastLock(g_csStringMap);
-	auto i = g_stringMap.cbegin();
-	while (i != g_stringMap.end())
+	Shard& l_shard = g_shards[boost::hash<string>()(p_str) % SHARD_COUNT];
+	CFlyFastLock(l_shard.m_cs);
+	auto& l_item = *l_shard.m_strings.insert(make_pair(p_str, Counter())).first;
+	// Under the lock: the sweep mustn't see the new reference half-done
+	Thread::safeInc(l_item.second.m_ref);
+	return &l_item;
+}
+
+StringPool::Stats StringPool::getStats()
+{
+	Stats l_stats;
+	for (size_t i = 0; i < SHARD_COUNT; ++i)
 	{
-		if (i->second == 0)
+		CFlyFastLock(g_shards[i].m_cs);
+		l_stats.m_count += g_shards[i].m_strings.size();
+		for (auto j = g_shards[i].m_strings.cbegin(); j != g_shards[i].m_strings.cend(); ++j)
 		{
-			g_stringMap.erase(i++);
+			l_stats.m_bytes += j->first.capacity();
+			l_stats.m_references += j->second.m_ref;
 		}
-		else
+	}
+	return l_stats;
+}
+
+void StringPool::on(TimerManagerListener::Minute, uint64_t /*aTick*/) noexcept
+{
+	for (size_t i = 0; i < SHARD_COUNT; ++i)
+	{
+		CFlyFastLock(g_shards[i].m_cs);
+		auto& l_strings = g_shards[i].m_strings;
+		for (auto j = l_strings.begin(); j != l_strings.end();)
 		{
-			++i;
+			// 0 can't grow again: addString takes the reference under the lock, addRef needs one already
+			if (j->second.m_ref == 0)
+			{
+				j = l_strings.erase(j);
+			}
+			else
+			{
+				++j;
+			}
 		}
 	}
 }
-
-#endif // IRAINMAN_USE_STRING_POOL
\ No newline at end of file
@@ -22,19 +22,34 @@
 #ifndef STRING_POOL_H
 #define STRING_POOL_H
 
-#ifdef IRAINMAN_USE_STRING_POOL
-
 #include "CFlyThread.h"
 #include "TimerManager.h"
 
+/**
+ * [!] Interned immutable strings for the values repeated by many users (tags, connection types, descriptions, e-mail).
+ * A value is read without any lock. The pointer to an item is only read through a holder of a reference,
+ * so an item without references can't be read by anybody: the timer removes it at the next sweep.
+ */
 class StringPool : public Singleton<StringPool>, private TimerManagerListener
 {
 		friend Singleton<StringPool>;
 		
-		typedef boost::unordered_map<string, volatile long> StringMap;
+		struct Counter
+		{
+			volatile long m_ref;
+			Counter() : m_ref(0)
+			{
+			}
+		};
+		typedef boost::unordered_map<string, Counter> StringMap;
 		
-		static StringMap g_stringMap;
-		static FastCriticalSection g_csStringMap;
+		static const size_t SHARD_COUNT = 16;
+		struct Shard
+		{
+			StringMap m_strings;
+			FastCriticalSection m_cs;
+		};
+		static Shard g_shards[SHARD_COUNT];
 		
 	public:
 	
@@ -47,26 +62,34 @@ class StringPool : public Singleton<StringPool>, private TimerManagerListener
 			TimerManager::getInstance()->removeListener(this);
 		}
 		
-		typedef pair<const string, volatile long>* StringPoolItemPtr;
+		typedef const StringMap::value_type* StringPoolItemPtr;
 		
-		static StringPoolItemPtr addString(const string& str)
+		/** Adds a reference to the value */
+		static StringPoolItemPtr addString(const string& p_str);
+		/** Adds one more reference to the value the caller holds a reference to already */
+		static void addRef(StringPoolItemPtr p_item)
 		{
-			StringPoolItemPtr ptr;
-			{
-				CFlyFastLock(g_csStringMap);
-				auto i = g_stringMap.insert(make_pair(str, 0));
-				ptr = &(*i.first);
-			}
-			Thread::safeInc(ptr->second);
-			return ptr;
+			dcassert(p_item->second.m_ref > 0);
+			Thread::safeInc(const_cast<Counter&>(p_item->second).m_ref);
 		}
-		static void removeString(StringPoolItemPtr ptr)
+		static void removeString(StringPoolItemPtr p_item)
 		{
-			Thread::safeDec(ptr->second);
+			Thread::safeDec(const_cast<Counter&>(p_item->second).m_ref);
 		}
+		
+		struct Stats
+		{
+			size_t m_count;
+			size_t m_bytes; // the strings without the map overhead
+			size_t m_references;
+			Stats() : m_count(0), m_bytes(0), m_references(0)
+			{
+			}
+		};
+		static Stats getStats();
+		
+	private:
 		void on(TimerManagerListener::Minute, uint64_t /*aTick*/) noexcept override;
 };
 
-#endif // IRAINMAN_USE_STRING_POOL
-
-#endif // STRING_POOL_H
\ No newline at end of file
+#endif // STRING_POOL_H
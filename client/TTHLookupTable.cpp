@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "TTHLookupTable.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLYLINKDC_USE_SSE2_TTH_LOOKUP
+#endif
+
+TTHLookupTable::TTHLookupTable(size_t p_count) : m_count(0)
+{
+	// At most a half of the slots are used: the probes stay short
+	size_t l_buckets = 1;
+	while (l_buckets * BUCKET_SIZE < p_count * 2)
+	{
+		l_buckets <<= 1;
+	}
+	m_keys.resize(l_buckets * BUCKET_SIZE);
+	m_mask = l_buckets - 1;
+}
+
+uint64_t* TTHLookupTable::getSlot(uint64_t p_key)
+{
+	size_t l_bucket = size_t(p_key) & m_mask;
+	for (;;)
+	{
+		uint64_t* l_slots = m_keys.data() + l_bucket * BUCKET_SIZE;
+		for (size_t i = 0; i < BUCKET_SIZE; ++i)
+		{
+			if (l_slots[i] == p_key || l_slots[i] == 0)
+			{
+				return l_slots + i;
+			}
+		}
+		l_bucket = (l_bucket + 1) & m_mask;
+	}
+}
+
+void TTHLookupTable::add(const TTHValue& p_tth)
+{
+	const uint64_t l_key = getKey(p_tth);
+	uint64_t* l_slot = getSlot(l_key);
+	if (*l_slot == 0)
+	{
+		*l_slot = l_key;
+		++m_count;
+		dcassert(m_count * 2 <= m_keys.size());
+	}
+}
+
+bool TTHLookupTable::addShared(const TTHValue& p_tth)
+{
+	const uint64_t l_key = getKey(p_tth);
+	uint64_t* l_slot = getSlot(l_key);
+	if (*l_slot == 0)
+	{
+		if ((m_count + 1) * 2 > m_keys.size())
+		{
+			return false;
+		}
+		// The empty slot is the end of the probe of this key: it's the only place a reader may look for it.
+		// One 64-bit store (a locked one on x86 too) with a full barrier - a reader never sees a half of the key
+		InterlockedExchange64(reinterpret_cast<volatile LONG64*>(l_slot), LONG64(l_key));
+		++m_count;
+	}
+	return true;
+}
+
+bool TTHLookupTable::find(uint64_t p_key) const
+{
+	size_t l_bucket = size_t(p_key) & m_mask;
+#ifdef FLYLINKDC_USE_SSE2_TTH_LOOKUP
+	const __m128i l_key = _mm_set_epi32(int(p_key >> 32), int(p_key), int(p_key >> 32), int(p_key));
+	const __m128i l_zero = _mm_setzero_si128();
+#endif
+	for (;;)
+	{
+		const uint64_t* l_slots = m_keys.data() + l_bucket * BUCKET_SIZE;
+#ifdef FLYLINKDC_USE_SSE2_TTH_LOOKUP
+		// A 64-bit key is equal when all its 8 bytes are: 0xFF or 0xFF00 in the byte mask of a half
+		const __m128i l_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l_slots));
+		const __m128i l_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l_slots + 2));
+		const unsigned l_equal = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi32(l_low, l_key))) |
+		                         unsigned(_mm_movemask_epi8(_mm_cmpeq_epi32(l_high, l_key))) << 16;
+		const unsigned l_empty = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi32(l_low, l_zero))) |
+		                         unsigned(_mm_movemask_epi8(_mm_cmpeq_epi32(l_high, l_zero))) << 16;
+		for (unsigned i = 0; i < BUCKET_SIZE * 8; i += 8)
+		{
+			if (((l_equal >> i) & 0xFF) == 0xFF)
+			{
+				return true;
+			}
+		}
+		for (unsigned i = 0; i < BUCKET_SIZE * 8; i += 8)
+		{
+			if (((l_empty >> i) & 0xFF) == 0xFF)
+			{
+				return false;
+			}
+		}
+#else
+		for (size_t i = 0; i < BUCKET_SIZE; ++i)
+		{
+			if (l_slots[i] == p_key)
+			{
+				return true;
+			}
+			if (l_slots[i] == 0)
+			{
+				return false;
+			}
+		}
+#endif
+		l_bucket = (l_bucket + 1) & m_mask;
+	}
+}
+
+bool TTHLookupTable::mayContain(const TTHValue& p_tth) const
+{
+	return find(getKey(p_tth));
+}
+
+void TTHLookupTable::mayContain(const TTHValue* const* p_tth, size_t p_count, bool* p_result) const
+{
+#ifdef FLYLINKDC_USE_SSE2_TTH_LOOKUP
+	// The misses of the independent lookups overlap instead of going one after another
+	for (size_t i = 0; i < p_count; ++i)
+	{
+		_mm_prefetch(reinterpret_cast<const char*>(getBucket(getKey(*p_tth[i]))), _MM_HINT_T0);
+	}
+#endif
+	for (size_t i = 0; i < p_count; ++i)
+	{
+		p_result[i] = find(getKey(*p_tth[i]));
+	}
+}
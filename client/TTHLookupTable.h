@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_TTH_LOOKUP_TABLE_H
+#define DCPLUSPLUS_DCPP_TTH_LOOKUP_TABLE_H
+
+#include "HashValue.h"
+#include "MerkleTree.h"
+
+/**
+ * [+] Set of the first 8 bytes of the shared TTHs: open addressing, buckets of 4 keys probed by SSE2.
+ * The bytes of a TTH are random already, so they are the hash and the key at once.
+ * A miss is exact, a hit may be another file with the same first 8 bytes - it is checked in the full index.
+ * The readers don't lock: the keys are only added, each one by an atomic store into an empty slot,
+ * so a probe sees a slot either empty or complete. Nothing is removed - a key of a file gone from the share
+ * is only a false hit until ShareManager builds a new table.
+ */
+class TTHLookupTable
+{
+	public:
+		explicit TTHLookupTable(size_t p_count);
+		
+		/** Only while the table isn't published */
+		void add(const TTHValue& p_tth);
+		/**
+		 * The published table: one writer at a time (ShareManager holds g_csTTHIndex), the readers go on.
+		 * false - no room (the table is half full), the TTH isn't added and a larger table has to be built.
+		 */
+		bool addShared(const TTHValue& p_tth);
+		bool mayContain(const TTHValue& p_tth) const;
+		/** p_result[i] = mayContain(p_tth[i]), the buckets of the whole array are fetched ahead */
+		void mayContain(const TTHValue* const* p_tth, size_t p_count, bool* p_result) const;
+		size_t size() const
+		{
+			return m_count;
+		}
+		
+	private:
+		static const size_t BUCKET_SIZE = 4;
+		
+		static uint64_t getKey(const TTHValue& p_tth)
+		{
+			uint64_t l_key;
+			memcpy(&l_key, p_tth.data, sizeof(l_key));
+			return l_key ? l_key : 1; // 0 - an empty slot
+		}
+		const uint64_t* getBucket(uint64_t p_key) const
+		{
+			return m_keys.data() + (size_t(p_key) & m_mask) * BUCKET_SIZE;
+		}
+		bool find(uint64_t p_key) const;
+		/** The slot of the key or the empty slot it goes to */
+		uint64_t* getSlot(uint64_t p_key);
+		
+		vector<uint64_t> m_keys;
+		size_t m_mask; // buckets - 1
+		size_t m_count;
+};
+
+#endif // DCPLUSPLUS_DCPP_TTH_LOOKUP_TABLE_H
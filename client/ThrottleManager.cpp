@@ -23,15 +23,12 @@
 
 #include "UploadManager.h"
 
-#include <boost/date_time/posix_time/posix_time.hpp>
 #ifdef FLYLINKDC_USE_BOOST_LOCK
 // #include <boost/thread/condition_variable.hpp>
 // #include <boost/thread.hpp>
 // #include <boost/detail/lightweight_mutex.hpp>
 #endif
 
-#define CONDWAIT_TIMEOUT        250
-
 ThrottleManager::ThrottleManager(void) : downTokens(0), upTokens(0), downLimit(0), upLimit(0)
 {
 }
@@ -39,10 +36,6 @@ ThrottleManager::ThrottleManager(void) : downTokens(0), upTokens(0), downLimit(0
 ThrottleManager::~ThrottleManager(void)
 {
 	TimerManager::getInstance()->removeListener(this);
-	
-	// release conditional variables on exit
-	downCond.notify_all();
-	upCond.notify_all();
 }
 
 /*
@@ -75,9 +68,8 @@ int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
 		return readSize;
 	}
 	
-	// no tokens, wait for them
-	downCond.timed_wait(lock, boost::posix_time::millisec(CONDWAIT_TIMEOUT));
-	return -1;  // from BufferedSocket: -1 = retry, 0 = connection close
+	// [!] no tokens: the turn ends and the socket retries later (SocketReactor), the work thread doesn't wait here
+	return NO_TOKENS;  // from BufferedSocket: -1 = retry, 0 = connection close
 }
 
 /*
@@ -85,14 +77,41 @@ int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
  * We must handle this a little bit differently than downloads, because of that stupidity in OpenSSL
  */
 int ThrottleManager::write(Socket* p_sock, const void* p_buffer, size_t& p_len)
+{
+	bool l_is_shared = false;
+	if (!takeUploadTokens(p_sock, p_len, l_is_shared))
+		return 0;   // from BufferedSocket: -1 = failed, 0 = retry
+		
+	// write to socket
+	const int sent = p_sock->write(p_buffer, p_len);
+	
+	if (l_is_shared)
+	{
+		// give a chance to other transfers to get a token
+		Thread::yield();
+	}
+	return sent;
+}
+
+/*
+ * [+] Limits a traffic and starts sending a part of the file by the kernel, the same tokens as write
+ */
+int ThrottleManager::transmitFile(Socket* p_sock, HANDLE p_file, int64_t p_pos, size_t& p_len, OVERLAPPED& p_ov)
+{
+	bool l_is_shared = false;
+	if (!takeUploadTokens(p_sock, p_len, l_is_shared))
+		return 0;
+		
+	return p_sock->startTransmitFile(p_file, p_pos, p_len, p_ov) ? 1 : -1;
+}
+
+bool ThrottleManager::takeUploadTokens(Socket* p_sock, size_t& p_len, bool& p_is_shared)
 {
 	//[+]IRainman SpeedLimiter
 	const auto currentMaxSpeed = p_sock->getMaxSpeed();
 	if (currentMaxSpeed < 0) // SU
 	{
-		// write to socket
-		const int sent = p_sock->write(p_buffer, p_len);
-		return sent;
+		return true;
 	}
 	else if (currentMaxSpeed > 0) // individual
 	{
@@ -100,18 +119,14 @@ int ThrottleManager::write(Socket* p_sock, const void* p_buffer, size_t& p_len)
 		const int64_t l_currentBucket = p_sock->getCurrentBucket();
 		p_len = min(p_len, static_cast<size_t>(l_currentBucket));
 		p_sock->setCurrentBucket(l_currentBucket - p_len);
-		
-		// write to socket
-		const int sent = p_sock->write(p_buffer, p_len);
-		return sent;
+		return true;
 	}
 	else // general
 	{
 		//[~]IRainman SpeedLimiter
 		if (upLimit == 0 || UploadManager::getUploadCount() == 0)
 		{
-			const int sent = p_sock->write(p_buffer, p_len);
-			return sent;
+			return true;
 		}
 		
 		boost::unique_lock<boost::mutex> lock(upMutex);
@@ -124,21 +139,12 @@ int ThrottleManager::write(Socket* p_sock, const void* p_buffer, size_t& p_len)
 			// Pour buckets of the calculated number of bytes,
 			// but as a real restriction on the specified number of bytes
 			upTokens -= p_len;
-			
-			// next code can't be in critical section, so we must unlock here
-			lock.unlock();
-			
-			// write to socket
-			const int sent = p_sock->write(p_buffer, p_len);
-			
-			// give a chance to other transfers to get a token
-			Thread::yield();
-			return sent;
+			p_is_shared = true;
+			return true;
 		}
 		
-		// no tokens, wait for them
-		upCond.timed_wait(lock, boost::posix_time::millisec(CONDWAIT_TIMEOUT));
-		return 0;   // from BufferedSocket: -1 = failed, 0 = retry
+		// no tokens, the caller retries later
+		return false;
 	}//[!]IRainman SpeedLimiter
 }
 
@@ -158,14 +164,12 @@ void ThrottleManager::on(TimerManagerListener::Second, uint64_t /*aTick*/) noexc
 	{
 		boost::lock_guard<boost::mutex> lock(downMutex);
 		downTokens = downLimit;
-		downCond.notify_all();
 	}
 	
 	if (upLimit > 0)
 	{
 		boost::lock_guard<boost::mutex> lock(upMutex);
 		upTokens = upLimit;
-		upCond.notify_all();
 	}
 }
 
@@ -36,6 +36,11 @@ class ThrottleManager :
 {
 	public:
 	
+		enum
+		{
+			NO_TOKENS = -2 // [+] read: the limit is reached, retry after a while
+		};
+		
 		/*
 		 * Limits a traffic and reads a packet from the network
 		 */
@@ -44,9 +49,16 @@ class ThrottleManager :
 		/*
 		 * Limits a traffic and writes a packet to the network
 		 * We must handle this a little bit differently than downloads, because of that stupidity in OpenSSL
+		 * @return 0 - no tokens, retry after a while
 		 */
 		int write(Socket* sock, const void* buffer, size_t& len);
 		
+		/*
+		 * [+] Limits a traffic and starts sending len bytes of the file from pos by the kernel (Socket::startTransmitFile)
+		 * @return 1 - the send is started; 0 - no tokens, retry after a while; -1 - TransmitFile isn't available
+		 */
+		int transmitFile(Socket* sock, HANDLE file, int64_t pos, size_t& len, OVERLAPPED& ov);
+		
 		/*
 		 * Returns current download limit.
 		 */
@@ -94,13 +106,11 @@ class ThrottleManager :
 		// download limiter
 		size_t             downLimit;
 		size_t                     downTokens;
-		boost::condition_variable   downCond;
 		boost::mutex                downMutex;
 		
 		// upload limiter
 		size_t             upLimit;
 		size_t                     upTokens;
-		boost::condition_variable   upCond;
 		boost::mutex                upMutex;
 		
 		friend class Singleton<ThrottleManager>;
@@ -109,6 +119,12 @@ class ThrottleManager :
 		
 		~ThrottleManager(void);
 		
+		/*
+		 * Cuts len down to the tokens of the socket or of the global bucket
+		 * @return false - no tokens, the caller has to retry
+		 */
+		bool takeUploadTokens(Socket* sock, size_t& len, bool& isShared);
+		
 		// TimerManagerListener
 		void on(TimerManagerListener::Minute, uint64_t aTick) noexcept override;//[+] IRainman SpeedLimiter
 		void on(TimerManagerListener::Second, uint64_t aTick) noexcept override;
@@ -258,6 +258,307 @@ uint8_t* TigerHash::finalize()
 	return getResult();
 }
 
+// [+] Multi-buffer leaf hashing: the same Tiger rounds on 4 (AVX2) or 8 (AVX-512) messages at once,
+// the S-box lookups are gathers. The vector code is selected at runtime by CPUID.
+#if !defined(TIGER_BIG_ENDIAN) && ((defined(_MSC_VER) && _MSC_VER >= 1700 && defined(_M_X64)) || defined(__AVX2__))
+#define TIGER_USE_AVX2
+#if (defined(_MSC_VER) && _MSC_VER >= 1911) || defined(__AVX512F__)
+#define TIGER_USE_AVX512
+#endif
+#endif
+
+/**
+ * Block p_index of the padded message "0x00 + p_data[0..p_len)": the leaf prefix, the data,
+ * 0x01, zeros and the bit length in the last 8 bytes (see finalize).
+ */
+static void getLeafBlock(const uint8_t* p_data, size_t p_len, size_t p_index, size_t p_block_count, uint64_t p_block[8])
+{
+	const size_t l_msg_len = p_len + 1;
+	const size_t l_begin = p_index * 64;
+	uint8_t* l_out = reinterpret_cast<uint8_t*>(p_block);
+	if (l_begin != 0 && l_begin + 64 <= l_msg_len)
+	{
+		memcpy(l_out, p_data + l_begin - 1, 64);
+		return;
+	}
+	for (size_t j = 0; j < 64; ++j)
+	{
+		const size_t l_pos = l_begin + j;
+		l_out[j] = l_pos == 0 ? 0 : l_pos < l_msg_len ? p_data[l_pos - 1] : l_pos == l_msg_len ? 0x01 : 0;
+	}
+	if (p_index + 1 == p_block_count)
+	{
+		p_block[7] = uint64_t(l_msg_len) << 3;
+	}
+}
+
+#ifdef TIGER_USE_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+enum TigerSimdLevel
+{
+	TIGER_SIMD_NONE,
+	TIGER_SIMD_AVX2,
+	TIGER_SIMD_AVX512
+};
+
+TigerSimdLevel getTigerSimdLevel()
+{
+#ifdef _MSC_VER
+	int l_info[4];
+	__cpuid(l_info, 0);
+	if (l_info[0] < 7)
+		return TIGER_SIMD_NONE;
+	__cpuid(l_info, 1);
+	// OSXSAVE + AVX
+	if ((l_info[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28))
+		return TIGER_SIMD_NONE;
+	const unsigned __int64 l_xcr0 = _xgetbv(0);
+	if ((l_xcr0 & 6) != 6) // the OS does not save the YMM registers
+		return TIGER_SIMD_NONE;
+	__cpuidex(l_info, 7, 0);
+#ifdef TIGER_USE_AVX512
+	if ((l_info[1] & (1 << 16)) != 0 && (l_xcr0 & 0xE6) == 0xE6) // AVX512F + opmask/ZMM state
+		return TIGER_SIMD_AVX512;
+#endif
+	return (l_info[1] & (1 << 5)) != 0 ? TIGER_SIMD_AVX2 : TIGER_SIMD_NONE;
+#else
+#ifdef TIGER_USE_AVX512
+	if (__builtin_cpu_supports("avx512f"))
+		return TIGER_SIMD_AVX512;
+#endif
+	return __builtin_cpu_supports("avx2") ? TIGER_SIMD_AVX2 : TIGER_SIMD_NONE;
+#endif
+}
+
+struct TigerLanesAVX2
+{
+	typedef __m256i Vector;
+	enum { COUNT = 4 };
+	static Vector set1(uint64_t p_value)
+	{
+		return _mm256_set1_epi64x(p_value);
+	}
+	static Vector load(const uint64_t p_block[][8], int i)
+	{
+		return _mm256_set_epi64x(p_block[3][i], p_block[2][i], p_block[1][i], p_block[0][i]);
+	}
+	static void store(uint64_t* p_out, Vector v)
+	{
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(p_out), v);
+	}
+	static Vector xor_(Vector a, Vector b)
+	{
+		return _mm256_xor_si256(a, b);
+	}
+	static Vector add(Vector a, Vector b)
+	{
+		return _mm256_add_epi64(a, b);
+	}
+	static Vector sub(Vector a, Vector b)
+	{
+		return _mm256_sub_epi64(a, b);
+	}
+	template<int N> static Vector shl(Vector a)
+	{
+		return _mm256_slli_epi64(a, N);
+	}
+	template<int N> static Vector shr(Vector a)
+	{
+		return _mm256_srli_epi64(a, N);
+	}
+	/** p_table[(c >> N) & 0xFF] */
+	template<int N> static Vector lookup(const uint64_t* p_table, Vector c)
+	{
+		const Vector l_index = _mm256_and_si256(_mm256_srli_epi64(c, N), _mm256_set1_epi64x(0xFF));
+		return _mm256_i64gather_epi64(reinterpret_cast<const long long*>(p_table), l_index, 8);
+	}
+};
+
+#ifdef TIGER_USE_AVX512
+struct TigerLanesAVX512
+{
+	typedef __m512i Vector;
+	enum { COUNT = 8 };
+	static Vector set1(uint64_t p_value)
+	{
+		return _mm512_set1_epi64(p_value);
+	}
+	static Vector load(const uint64_t p_block[][8], int i)
+	{
+		return _mm512_set_epi64(p_block[7][i], p_block[6][i], p_block[5][i], p_block[4][i], p_block[3][i], p_block[2][i], p_block[1][i], p_block[0][i]);
+	}
+	static void store(uint64_t* p_out, Vector v)
+	{
+		_mm512_storeu_si512(p_out, v);
+	}
+	static Vector xor_(Vector a, Vector b)
+	{
+		return _mm512_xor_si512(a, b);
+	}
+	static Vector add(Vector a, Vector b)
+	{
+		return _mm512_add_epi64(a, b);
+	}
+	static Vector sub(Vector a, Vector b)
+	{
+		return _mm512_sub_epi64(a, b);
+	}
+	template<int N> static Vector shl(Vector a)
+	{
+		return _mm512_slli_epi64(a, N);
+	}
+	template<int N> static Vector shr(Vector a)
+	{
+		return _mm512_srli_epi64(a, N);
+	}
+	template<int N> static Vector lookup(const uint64_t* p_table, Vector c)
+	{
+		const Vector l_index = _mm512_and_si512(_mm512_srli_epi64(c, N), _mm512_set1_epi64(0xFF));
+		return _mm512_i64gather_epi64(l_index, p_table, 8);
+	}
+};
+#endif // TIGER_USE_AVX512
+
+/** round(a,b,c,x,mul) of tiger_compress_macro */
+template<class L, int MUL> void tigerRoundN(const uint64_t* p_table, typename L::Vector& a, typename L::Vector& b, typename L::Vector& c, typename L::Vector x)
+{
+	c = L::xor_(c, x);
+	a = L::sub(a, L::xor_(L::xor_(L::template lookup<0 * 8>(p_table, c), L::template lookup<2 * 8>(p_table + 256, c)),
+	                      L::xor_(L::template lookup<4 * 8>(p_table + 256 * 2, c), L::template lookup<6 * 8>(p_table + 256 * 3, c))));
+	b = L::add(b, L::xor_(L::xor_(L::template lookup<1 * 8>(p_table + 256 * 3, c), L::template lookup<3 * 8>(p_table + 256 * 2, c)),
+	                      L::xor_(L::template lookup<5 * 8>(p_table + 256, c), L::template lookup<7 * 8>(p_table, c))));
+	// No 64-bit multiply in AVX2: 5 = 4 + 1, 7 = 8 - 1, 9 = 8 + 1
+	b = MUL == 5 ? L::add(L::template shl<2>(b), b) : MUL == 7 ? L::sub(L::template shl<3>(b), b) : L::add(L::template shl<3>(b), b);
+}
+
+template<class L, int MUL> void tigerPassN(const uint64_t* p_table, typename L::Vector& a, typename L::Vector& b, typename L::Vector& c, const typename L::Vector* x)
+{
+	tigerRoundN<L, MUL>(p_table, a, b, c, x[0]);
+	tigerRoundN<L, MUL>(p_table, b, c, a, x[1]);
+	tigerRoundN<L, MUL>(p_table, c, a, b, x[2]);
+	tigerRoundN<L, MUL>(p_table, a, b, c, x[3]);
+	tigerRoundN<L, MUL>(p_table, b, c, a, x[4]);
+	tigerRoundN<L, MUL>(p_table, c, a, b, x[5]);
+	tigerRoundN<L, MUL>(p_table, a, b, c, x[6]);
+	tigerRoundN<L, MUL>(p_table, b, c, a, x[7]);
+}
+
+template<class L> void tigerKeyScheduleN(typename L::Vector* x)
+{
+	const typename L::Vector l_ones = L::set1(~uint64_t(0));
+	x[0] = L::sub(x[0], L::xor_(x[7], L::set1(_ULL(0xA5A5A5A5A5A5A5A5))));
+	x[1] = L::xor_(x[1], x[0]);
+	x[2] = L::add(x[2], x[1]);
+	x[3] = L::sub(x[3], L::xor_(x[2], L::template shl<19>(L::xor_(x[1], l_ones))));
+	x[4] = L::xor_(x[4], x[3]);
+	x[5] = L::add(x[5], x[4]);
+	x[6] = L::sub(x[6], L::xor_(x[5], L::template shr<23>(L::xor_(x[4], l_ones))));
+	x[7] = L::xor_(x[7], x[6]);
+	x[0] = L::add(x[0], x[7]);
+	x[1] = L::sub(x[1], L::xor_(x[0], L::template shl<19>(L::xor_(x[7], l_ones))));
+	x[2] = L::xor_(x[2], x[1]);
+	x[3] = L::add(x[3], x[2]);
+	x[4] = L::sub(x[4], L::xor_(x[3], L::template shr<23>(L::xor_(x[2], l_ones))));
+	x[5] = L::xor_(x[5], x[4]);
+	x[6] = L::add(x[6], x[5]);
+	x[7] = L::sub(x[7], L::xor_(x[6], L::set1(_ULL(0x0123456789ABCDEF))));
+}
+
+/** Hash L::COUNT consecutive leaves of TigerHash::hashLeaves: lane i of the vectors belongs to the i-th leaf */
+template<class L> void tigerHashLeavesN(const uint64_t* p_table, const uint8_t* p_data, size_t p_leaf_size, uint8_t* p_result)
+{
+	typedef typename L::Vector Vector;
+	const size_t l_block_count = (p_leaf_size + 1 + 1 + 8 + 63) / 64; // prefix, data, 0x01, bit length
+	Vector l_state[3] = { L::set1(_ULL(0x0123456789ABCDEF)), L::set1(_ULL(0xFEDCBA9876543210)), L::set1(_ULL(0xF096A5B4C3B2E187)) };
+	uint64_t l_block[L::COUNT][8];
+	for (size_t k = 0; k < l_block_count; ++k)
+	{
+		for (size_t i = 0; i < L::COUNT; ++i)
+		{
+			getLeafBlock(p_data + i * p_leaf_size, p_leaf_size, k, l_block_count, l_block[i]);
+		}
+		Vector x[8];
+		for (int j = 0; j < 8; ++j)
+		{
+			x[j] = L::load(l_block, j);
+		}
+		Vector a = l_state[0];
+		Vector b = l_state[1];
+		Vector c = l_state[2];
+		tigerPassN<L, 5>(p_table, a, b, c, x);
+		tigerKeyScheduleN<L>(x);
+		tigerPassN<L, 7>(p_table, c, a, b, x);
+		tigerKeyScheduleN<L>(x);
+		tigerPassN<L, 9>(p_table, b, c, a, x);
+		l_state[0] = L::xor_(a, l_state[0]);
+		l_state[1] = L::sub(b, l_state[1]);
+		l_state[2] = L::add(c, l_state[2]);
+	}
+	uint64_t l_res[3][L::COUNT];
+	for (int j = 0; j < 3; ++j)
+	{
+		L::store(l_res[j], l_state[j]);
+	}
+	for (size_t i = 0; i < L::COUNT; ++i)
+	{
+		uint64_t* l_out = reinterpret_cast<uint64_t*>(p_result + i * TigerHash::BYTES);
+		l_out[0] = l_res[0][i];
+		l_out[1] = l_res[1][i];
+		l_out[2] = l_res[2][i];
+	}
+}
+}
+#endif // TIGER_USE_AVX2
+
+bool TigerHash::isMultiBufferSupported()
+{
+#ifdef TIGER_USE_AVX2
+	static const bool g_is_supported = getTigerSimdLevel() != TIGER_SIMD_NONE;
+	return g_is_supported;
+#else
+	return false;
+#endif
+}
+
+void TigerHash::hashLeaves(const uint8_t* p_data, size_t p_leaf_size, size_t p_count, uint8_t* p_result, size_t p_max_lanes)
+{
+	size_t l_leaf = 0;
+#ifdef TIGER_USE_AVX2
+	static const TigerSimdLevel g_level = getTigerSimdLevel();
+#ifdef TIGER_USE_AVX512
+	if (g_level == TIGER_SIMD_AVX512 && p_max_lanes >= TigerLanesAVX512::COUNT)
+	{
+		for (; l_leaf + TigerLanesAVX512::COUNT <= p_count; l_leaf += TigerLanesAVX512::COUNT)
+		{
+			tigerHashLeavesN<TigerLanesAVX512>(table, p_data + l_leaf * p_leaf_size, p_leaf_size, p_result + l_leaf * BYTES);
+		}
+	}
+#endif
+	if (g_level != TIGER_SIMD_NONE && p_max_lanes >= TigerLanesAVX2::COUNT)
+	{
+		for (; l_leaf + TigerLanesAVX2::COUNT <= p_count; l_leaf += TigerLanesAVX2::COUNT)
+		{
+			tigerHashLeavesN<TigerLanesAVX2>(table, p_data + l_leaf * p_leaf_size, p_leaf_size, p_result + l_leaf * BYTES);
+		}
+		_mm256_zeroupper();
+	}
+#endif // TIGER_USE_AVX2
+	for (; l_leaf < p_count; ++l_leaf)
+	{
+		const uint8_t l_zero = 0;
+		TigerHash h;
+		h.update(&l_zero, 1);
+		h.update(p_data + l_leaf * p_leaf_size, p_leaf_size);
+		memcpy(p_result + l_leaf * BYTES, h.finalize(), BYTES);
+	}
+}
+
 const uint64_t TigerHash::table[4 * 256] =
 {
 	_ULL(0x02AAB17CF7E90C5E)   /*    0 */,    _ULL(0xAC424B03E243A8EC)   /*    1 */,
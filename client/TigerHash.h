@@ -63,6 +63,19 @@ class TigerHash
 		{
 			return (uint8_t*) res;
 		}
+		
+		/** Max number of leaves compressed side by side by hashLeaves (AVX-512), batches should be a multiple of it */
+		static const size_t LEAF_LANES = 8;
+		/**
+		 * [+] Tiger tree leaf hashes (Tiger of 0x00 + leaf) of p_count consecutive leaves of p_leaf_size bytes.
+		 * The leaves are independent, so they are compressed 8 (AVX-512) or 4 (AVX2) at a time
+		 * when the CPU supports it, otherwise one by one.
+		 * @param p_result p_count * BYTES bytes
+		 * @param p_max_lanes widest kernel allowed (8, 4 or 1), lets the tests check every kernel against the scalar code
+		 */
+		static void hashLeaves(const uint8_t* p_data, size_t p_leaf_size, size_t p_count, uint8_t* p_result, size_t p_max_lanes = LEAF_LANES);
+		/** The vector path of hashLeaves is used on this CPU */
+		static bool isMultiBufferSupported();
 	private:
 		enum { BLOCK_SIZE = 512 / 8 };
 		/** 512 bit blocks for the compress function */
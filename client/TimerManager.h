@@ -21,7 +21,7 @@
 #ifndef DCPLUSPLUS_DCPP_TIMER_MANAGER_H
 #define DCPLUSPLUS_DCPP_TIMER_MANAGER_H
 
-#include "Speaker.h"
+#include "SnapshotSpeaker.h"
 #include "Singleton.h"
 #include <boost/thread/mutex.hpp>
 
@@ -48,7 +48,7 @@ class TimerManagerListener
 		virtual void on(Hour, uint64_t) noexcept { }
 };
 
-class TimerManager : public Speaker<TimerManagerListener>, public Singleton<TimerManager>, public Thread
+class TimerManager : public SnapshotSpeaker<TimerManagerListener>, public Singleton<TimerManager>, public Thread
 {
 	public:
 		void shutdown();
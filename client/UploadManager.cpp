@@ -29,6 +29,7 @@
 #include "FinishedManager.h"
 #include "PGLoader.h"
 #include "SharedFileStream.h"
+#include "MappedFileStream.h"
 #include "IPGrant.h"
 #include "../FlyFeatures/flyServer.h"
 
@@ -418,7 +419,8 @@ bool UploadManager::prepareFile(UserConnection* aSource, const string& aType, co
 			}
 			else
 			{
-				File* f = new File(sourceFile, File::READ, File::OPEN);
+				// [!] The mapped stream gives the data to the socket without copying
+				MappedFileStream* f = new MappedFileStream(sourceFile);
 				
 				start = aStartPos;
 				int64_t sz = f->getSize();
@@ -1308,7 +1310,7 @@ void UploadManager::on(AdcCommand::GFI, UserConnection* aSource, const AdcComman
 		return;
 	}
 	
-	if (c.getParameters().size() < 2)
+	if (c.getParamCount() < 2)
 	{
 		aSource->send(AdcCommand(AdcCommand::SEV_RECOVERABLE, AdcCommand::ERROR_PROTOCOL_GENERIC, "Missing parameters"));
 		return;
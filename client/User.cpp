@@ -553,9 +553,12 @@ void Identity::getParams(StringMap& sm, const string& prefix, bool compatibility
 	}
 	{
 		CFlyFastLock(m_si_fcs);
-		for (auto i = m_stringInfo.cbegin(); i != m_stringInfo.cend(); ++i)
+		if (const StringFields* l_fields = m_string_fields)
 		{
-			sm[prefix + string((char*)(&i->first), 2)] = i->second;
+			for (auto i = l_fields->begin(); i != l_fields->end(); ++i)
+			{
+				sm[prefix + string((const char*)(&i->m_tag), 2)] = i->m_value->first;
+			}
 		}
 	}
 }
@@ -734,19 +737,19 @@ string Identity::getStringParam(const char* name) const // [!] IRainman fix.
 		}
 	};
 	
+	CFlyFastLock(m_si_fcs);
+	if (const StringFields* l_fields = m_string_fields)
 	{
-		CFlyFastLock(m_si_fcs);
-		const auto i = m_stringInfo.find(*(short*)name);
-#ifdef FLYLINKDC_USE_PROFILER_CS
-		l_lock.m_add_log_info = "[get] name = ";
-		l_lock.m_add_log_info += string(name) + string(i == m_stringInfo.end() ? " [ not_found! ]" : "[ " + i->second + " ]" + " Nick = " + getNick());
-#endif
-		if (i != m_stringInfo.end())
+		const short l_tag = *(short*)name;
+		for (auto i = l_fields->begin(); i != l_fields->end() && i->m_tag <= l_tag; ++i)
 		{
+			if (i->m_tag == l_tag)
+			{
 #ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
-			CFlylinkDBManager::getInstance()->identity_get(name, iNickRule->second);
+				CFlylinkDBManager::getInstance()->identity_get(name, i->m_value->first);
 #endif
-			return i->second;
+				return i->m_value->first;
+			}
 		}
 	}
 	return Util::emptyString;
@@ -818,10 +821,43 @@ void Identity::setStringParam(const char* name, const string& val) // [!] IRainm
 #ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
 	CFlylinkDBManager::getInstance()->identity_set(name, val);
 #endif
+	const short l_tag = *(short*)name;
+	if (prepareStringParam(l_tag, val))
+	{
+		StringParams l_params;
+		l_params.push_back(make_pair(l_tag, boost::string_view(val)));
+		CFlyFastLock(m_si_fcs);
+#ifdef FLYLINKDC_USE_PROFILER_CS
+		l_lock.m_add_log_info = "[set] name = ";
+		l_lock.m_add_log_info += string(name) + string(val.empty() ? " val.empty()" : val);
+#endif
+		setStringParamsL(l_params);
+	}
+}
+
+void Identity::setStringParams(const StringParams& p_params)
+{
+	StringParams l_params;
+	for (auto i = p_params.cbegin(); i != p_params.cend(); ++i)
+	{
+		if (prepareStringParam(i->first, i->second))
+		{
+			l_params.push_back(*i);
+		}
+	}
+	if (!l_params.empty())
+	{
+		CFlyFastLock(m_si_fcs);
+		setStringParamsL(l_params);
+	}
+}
+
+bool Identity::prepareStringParam(short p_tag, const boost::string_view& p_val)
+{
 	bool l_is_processing_stringInfo_map = true;
-	if (val.empty())
+	if (p_val.empty())
 	{
-		switch (*(short*)name) // TODO: move to instantly method
+		switch (p_tag) // TODO: move to instantly method
 		{
 			case TAG('E', 'M'):
 			{
@@ -837,64 +873,187 @@ void Identity::setStringParam(const char* name, const string& val) // [!] IRainm
 			}
 		}
 	}
-	bool l_is_skip_string_map = false;
-	if (l_is_processing_stringInfo_map)
+	if (!l_is_processing_stringInfo_map)
 	{
+		return false;
+	}
+	switch (p_tag)
+	{
+		case TAG('A', 'P'):
+		{
+			setDicAP(mergeDicId(p_val.to_string()));
+			return false;
+		}
+		case TAG('V', 'E'):
+		{
+			setDicVE(mergeDicId(p_val.to_string()));
+			return false;
+		}
+		case TAG('E', 'M'):
+		{
+			setNotEmptyStringBit(EM, !p_val.empty());
+			break;
+		}
+		case TAG('D', 'E'):
 		{
-			switch (*(short*)name)
+			setNotEmptyStringBit(DE, !p_val.empty());
+			break;
+		}
+	}
+	return true;
+}
+
+void Identity::setStringParamsL(const StringParams& p_params)
+{
+	// A changed value is replaced right in the array, a removed one is marked by nullptr till the array is rebuilt
+	boost::container::small_vector<StringFields::Field, 8> l_added; // sorted by the tag
+	size_t l_removed = 0;
+	for (auto i = p_params.cbegin(); i != p_params.cend(); ++i)
+	{
+		const short l_tag = i->first;
+		const boost::string_view& l_val = i->second;
+		StringFields::Field* l_field = nullptr;
+		if (m_string_fields)
+		{
+			for (auto j = m_string_fields->begin(); j != m_string_fields->end() && j->m_tag <= l_tag; ++j)
 			{
-				case TAG('A', 'P'):
-				{
-					setDicAP(mergeDicId(val));
-					l_is_skip_string_map = true;
-					break;
-				}
-				case TAG('V', 'E'):
-				{
-					setDicVE(mergeDicId(val));
-					l_is_skip_string_map = true;
-					break;
-				}
-				case TAG('E', 'M'):
+				if (j->m_tag == l_tag)
 				{
-					setNotEmptyStringBit(EM, !val.empty());
-					break;
-				}
-				case TAG('D', 'E'):
-				{
-					setNotEmptyStringBit(DE, !val.empty());
+					l_field = j;
 					break;
 				}
 			}
 		}
-		if (l_is_skip_string_map == false)
+		if (l_field)
 		{
-			CFlyFastLock(m_si_fcs);
-#ifdef FLYLINKDC_USE_PROFILER_CS
-			l_lock.m_add_log_info = "[set] name = ";
-			l_lock.m_add_log_info += string(name) + string(val.empty() ? " val.empty()" : val);
-#endif
-			if (val.empty())
+			if (l_field->m_value ? l_field->m_value->first == l_val : l_val.empty())
+			{
+				continue;
+			}
+			if (l_field->m_value)
+			{
+				StringPool::removeString(l_field->m_value);
+				l_field->m_value = nullptr;
+				++l_removed;
+			}
+			if (!l_val.empty())
+			{
+				l_field->m_value = StringPool::addString(l_val.to_string());
+				--l_removed;
+			}
+			continue;
+		}
+		auto j = l_added.begin();
+		while (j != l_added.end() && j->m_tag < l_tag)
+		{
+			++j;
+		}
+		if (j != l_added.end() && j->m_tag == l_tag)
+		{
+			StringPool::removeString(j->m_value);
+			if (l_val.empty())
 			{
-				m_stringInfo.erase(*(short*)name);
+				l_added.erase(j);
 			}
 			else
 			{
-				m_stringInfo[*(short*)name] = val;
+				j->m_value = StringPool::addString(l_val.to_string());
 			}
 		}
+		else if (!l_val.empty())
+		{
+			StringFields::Field l_new_field;
+			l_new_field.m_tag = l_tag;
+			l_new_field.m_value = StringPool::addString(l_val.to_string());
+			l_added.insert(j, l_new_field);
+		}
 	}
-	else
+	if (l_removed == 0 && l_added.empty())
+	{
+		return;
+	}
+	// The references move into the new array: from the old one and from l_added
+	const size_t l_count = (m_string_fields ? m_string_fields->m_count : 0) - l_removed + l_added.size();
+	StringFields* l_fields = l_count ? StringFields::create(l_count) : nullptr;
+	StringFields::Field* l_dst = l_fields ? l_fields->begin() : nullptr;
+	auto l_add = l_added.cbegin();
+	if (m_string_fields)
 	{
-		//   m_stringInfo  
-		//      ?
+		for (auto j = m_string_fields->begin(); j != m_string_fields->end(); ++j)
+		{
+			if (j->m_value)
+			{
+				for (; l_add != l_added.cend() && l_add->m_tag < j->m_tag; ++l_add)
+				{
+					*l_dst++ = *l_add;
+				}
+				*l_dst++ = *j;
+			}
+		}
 	}
+	for (; l_add != l_added.cend(); ++l_add)
+	{
+		*l_dst++ = *l_add;
+	}
+	dcassert(l_dst == (l_fields ? l_fields->end() : nullptr));
+	free(m_string_fields);
+	m_string_fields = l_fields;
 }
 
 Identity::~Identity()
 {
+	if (m_string_fields)
+	{
+		StringFields::destroy(m_string_fields);
+	}
+}
+
+Identity::StringFields* Identity::StringFields::create(size_t p_count)
+{
+	auto l_fields = static_cast<StringFields*>(malloc(offsetof(StringFields, m_fields) + p_count * sizeof(Field)));
+	if (l_fields == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	l_fields->m_count = p_count;
+	return l_fields;
+}
+
+void Identity::StringFields::destroy(StringFields* p_fields)
+{
+	for (auto i = p_fields->begin(); i != p_fields->end(); ++i)
+	{
+		StringPool::removeString(i->m_value);
+	}
+	free(p_fields);
 }
 
+#ifndef IRAINMAN_IDENTITY_IS_NON_COPYABLE
+void Identity::setStringFields(const Identity& rhs)
+{
+	// Each identity holds its own array and its own references to the strings
+	StringFields* l_fields = nullptr;
+	{
+		CFlyFastLock(rhs.m_si_fcs);
+		if (rhs.m_string_fields)
+		{
+			l_fields = StringFields::create(rhs.m_string_fields->m_count);
+			std::copy(rhs.m_string_fields->begin(), rhs.m_string_fields->end(), l_fields->begin());
+			for (auto i = l_fields->begin(); i != l_fields->end(); ++i)
+			{
+				StringPool::addRef(i->m_value);
+			}
+		}
+	}
+	CFlyFastLock(m_si_fcs);
+	if (m_string_fields)
+	{
+		StringFields::destroy(m_string_fields);
+	}
+	m_string_fields = l_fields;
+}
+#endif
+
 void FavoriteUser::update(const OnlineUser& info) // !SMT!-fix
 {
 	// [!] FlylinkDC Team: please let me know if the assertions fail. IRainman.
@@ -1097,38 +1256,41 @@ void Identity::getReport(string& p_report) const
 		
 		{
 			CFlyFastLock(m_si_fcs);
-			for (auto i = m_stringInfo.cbegin(); i != m_stringInfo.cend(); ++i)
+			if (const StringFields* l_fields = m_string_fields)
 			{
-				auto name = string((char*)(&i->first), 2);
-				const auto& value = i->second;
-				// TODO: translate known tags and format values to something more readable
-				switch (i->first)
+				for (auto i = l_fields->begin(); i != l_fields->end(); ++i)
 				{
-					case TAG('C', 'S'): // ok
-						name = "Cheat description";
-						break;
-					case TAG('D', 'E'): // ok
-						name = STRING(DESCRIPTION);
-						break;
-					case TAG('E', 'M'): // ok
-						name = "E-mail";
-						break;
-					case TAG('K', 'P'): // ok
-						name = "KeyPrint";
-						break;
-					case TAG('V', 'E'):
-					case TAG('A', 'P'):
-					case TAG('F', '1'):
-					case TAG('F', '2'):
-					case TAG('F', '3'):
-					case TAG('F', '4'):
-					case TAG('F', '5'):
-						continue;
-						break;
-					default:
-						name += " (unknown)";
+					auto name = string((const char*)(&i->m_tag), 2);
+					const auto& value = i->m_value->first;
+					// TODO: translate known tags and format values to something more readable
+					switch (i->m_tag)
+					{
+						case TAG('C', 'S'): // ok
+							name = "Cheat description";
+							break;
+						case TAG('D', 'E'): // ok
+							name = STRING(DESCRIPTION);
+							break;
+						case TAG('E', 'M'): // ok
+							name = "E-mail";
+							break;
+						case TAG('K', 'P'): // ok
+							name = "KeyPrint";
+							break;
+						case TAG('V', 'E'):
+						case TAG('A', 'P'):
+						case TAG('F', '1'):
+						case TAG('F', '2'):
+						case TAG('F', '3'):
+						case TAG('F', '4'):
+						case TAG('F', '5'):
+							continue;
+							break;
+						default:
+							name += " (unknown)";
+					}
+					appendIfValueNotEmpty(name, value);
 				}
-				appendIfValueNotEmpty(name, value);
 			}
 		}
 		
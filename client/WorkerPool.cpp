@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "WorkerPool.h"
+#include "CompatibilityManager.h"
+
+WorkerPool::WorkerPool() : m_is_stop(false)
+{
+	// Two at least: a job waiting for its reader must not hold up the rest on a single processor
+	const size_t l_count = std::max<size_t>(CompatibilityManager::getProcessorsCount(), 2);
+	for (size_t i = 0; i < l_count; ++i)
+	{
+		m_threads.push_back(new Worker(*this));
+		m_threads.back()->start(64, "WorkerPool");
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	m_is_stop = true;
+	for (auto i = m_threads.cbegin(); i != m_threads.cend(); ++i)
+	{
+		m_semaphore.signal();
+	}
+	for (auto i = m_threads.cbegin(); i != m_threads.cend(); ++i)
+	{
+		(*i)->join();
+		delete *i;
+	}
+	dcassert(m_jobs.empty());
+}
+
+void WorkerPool::post(const Job& p_job)
+{
+	{
+		CFlyFastLock(m_cs);
+		m_jobs.push_back(p_job);
+	}
+	m_semaphore.signal();
+}
+
+void WorkerPool::runParallel(const Job& p_work, size_t p_threads)
+{
+	struct State
+	{
+		FastCriticalSection m_cs;
+		size_t m_running;
+		bool m_is_closed;
+		Semaphore m_done;
+		const Job m_work;
+		explicit State(const Job& p_work) : m_running(0), m_is_closed(false), m_work(p_work)
+		{
+		}
+	};
+	const size_t l_helpers = std::min(p_threads, m_threads.size() + 1);
+	if (l_helpers <= 1)
+	{
+		p_work();
+		return;
+	}
+	const auto l_state = std::make_shared<State>(p_work);
+	for (size_t i = 1; i < l_helpers; ++i)
+	{
+		post([l_state]()
+		{
+			{
+				CFlyFastLock(l_state->m_cs);
+				if (l_state->m_is_closed)
+					return;
+				++l_state->m_running;
+			}
+			l_state->m_work();
+			bool l_is_last;
+			{
+				CFlyFastLock(l_state->m_cs);
+				l_is_last = --l_state->m_running == 0 && l_state->m_is_closed;
+			}
+			if (l_is_last)
+			{
+				l_state->m_done.signal();
+			}
+		});
+	}
+	p_work();
+	// The helpers that didn't start yet won't, the running ones finish their parts
+	for (;;)
+	{
+		{
+			CFlyFastLock(l_state->m_cs);
+			l_state->m_is_closed = true;
+			if (l_state->m_running == 0)
+				break;
+		}
+		l_state->m_done.wait();
+	}
+}
+
+int WorkerPool::Worker::run()
+{
+	while (m_pool.m_semaphore.wait() && !m_pool.m_is_stop)
+	{
+		Job l_job;
+		{
+			CFlyFastLock(m_pool.m_cs);
+			if (m_pool.m_jobs.empty())
+			{
+				dcassert(0);
+				continue;
+			}
+			l_job.swap(m_pool.m_jobs.front());
+			m_pool.m_jobs.pop_front();
+		}
+		l_job();
+	}
+	return 0;
+}
+
+WorkerPool::Group::Group() : m_state(std::make_shared<State>())
+{
+}
+
+WorkerPool::Group::~Group()
+{
+	wait();
+}
+
+void WorkerPool::Group::post(const Job& p_job)
+{
+	const auto l_state = m_state;
+	Thread::safeInc(l_state->m_count);
+	WorkerPool::getInstance()->post([l_state, p_job]()
+	{
+		p_job();
+		if (Thread::safeDec(l_state->m_count) == 0)
+		{
+			l_state->m_done.signal();
+		}
+	});
+}
+
+void WorkerPool::Group::wait()
+{
+	// m_done is signaled every time the counter drops to zero, so it is checked again after each signal
+	while (m_state->m_count)
+	{
+		m_state->m_done.wait();
+	}
+}
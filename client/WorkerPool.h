@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_WORKER_POOL_H
+#define DCPLUSPLUS_DCPP_WORKER_POOL_H
+
+#include "Singleton.h"
+#include "CFlyThread.h"
+#include "Semaphore.h"
+
+/**
+ * [+] One pool of threads for the CPU work split into parts: packing and unpacking of the file lists,
+ * matching of the ADLSearch rules, parsing of the $MyINFO batches.
+ * The threads are started once with the core, a job is taken by the first free thread in the order of posting.
+ * A job may wait for its owner (a stream waits for its reader), but never for other jobs of the pool.
+ */
+class WorkerPool : public Singleton<WorkerPool>
+{
+	public:
+		typedef std::function<void()> Job;
+		
+		/**
+		 * The jobs posted by one owner. The owner waits for all of them before it goes away,
+		 * the jobs keep the counter alive after that.
+		 */
+		class Group
+		{
+			public:
+				Group();
+				~Group();
+				void post(const Job& p_job);
+				/** Returns when all the jobs posted so far are finished */
+				void wait();
+			private:
+				struct State
+				{
+					volatile long m_count;
+					Semaphore m_done;
+					State() : m_count(0)
+					{
+					}
+				};
+				std::shared_ptr<State> m_state;
+		};
+		
+		/** The job must not throw */
+		void post(const Job& p_job);
+		/**
+		 * Runs p_work on the calling thread and on up to p_threads - 1 threads of the pool at once.
+		 * p_work takes its parts itself until none is left. The pool threads that are still busy
+		 * when the caller is done don't join in, so a busy pool only costs the parallelism.
+		 */
+		void runParallel(const Job& p_work, size_t p_threads);
+		
+		size_t getThreadsCount() const
+		{
+			return m_threads.size();
+		}
+		
+	private:
+		class Worker : public Thread
+		{
+			public:
+				explicit Worker(WorkerPool& p_pool) : m_pool(p_pool)
+				{
+				}
+			private:
+				int run() override;
+				WorkerPool& m_pool;
+		};
+		
+		friend class Singleton<WorkerPool>;
+		
+		WorkerPool();
+		~WorkerPool();
+		
+		vector<Worker*> m_threads;
+		FastCriticalSection m_cs;
+		std::deque<Job> m_jobs;
+		Semaphore m_semaphore;
+		volatile bool m_is_stop;
+};
+
+#endif // DCPLUSPLUS_DCPP_WORKER_POOL_H
@@ -204,7 +204,6 @@ typedef unsigned __int64 uint64_t;
 #  endif
 # endif
 #endif
-//#define IRAINMAN_USE_STRING_POOL
 #define IRAINMAN_ENABLE_CON_STATUS_ON_FAV_HUBS
 //#define IRAINMAN_SPEED_LIMITER_5S4_10 //  :   = 5 *   + 4,   = 10 *  
 //#define IRAINMAN_INCLUDE_USER_CHECK // -     .   100    ?
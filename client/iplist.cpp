@@ -34,13 +34,12 @@
 
 IPList::IPList()
 {
-	// Initialize IP mask list and create IPArrayList into the ipRangeList
+	// Initialize IP mask list
 	uint32_t l_mask = 0x00000000;
 	for (uint32_t level = 1; level < 33; ++level)
 	{
 		l_mask = (l_mask >> 1) | 0x80000000;
 		m_maskList[ l_mask ] =  level ;
-		m_ipRangeList.push_back(IPList::IPArrayList(l_mask));
 	}
 }
 
@@ -62,7 +61,7 @@ void IPList::add(uint32_t ip)
 {
 	if (ip == INADDR_NONE || ip == 0)
 		return;
-	addRangeListAndSort(ip, 31);
+	addRangeToList(ip, ip);
 }
 
 uint32_t IPList::add(const std::string& IPNumber, const std::string& Mask)
@@ -85,12 +84,8 @@ void IPList::add(uint32_t ip, uint32_t umask)
 	const auto it = m_maskList.find(umask);
 	if (it != m_maskList.end())
 	{
-		const  uint32_t Level = it->second;
-		if (Level)
-		{
-			ip = ip & umask;
-			addRangeListAndSort(ip, Level - 1);
-		}
+		ip = ip & umask;
+		addRangeToList(ip, ip | ~umask);
 	}
 }
 
@@ -146,52 +141,8 @@ uint32_t IPList::addRange(uint32_t fromIP, uint32_t toIP)
 		add(fromIP);
 		return START_AND_END_EQUAL;
 	}
-	else
-	{
-		uint32_t diff = toIP - fromIP;
-		int diffLevel = 1;
-		uint32_t range = 0x80000000;
-		if (diff < 256)
-		{
-			diffLevel = 24;
-			range = 0x00000100;
-		}
-		while (range > diff)
-		{
-			range = range >> 1;
-			diffLevel++;
-		}
-		
-		uint32_t mask = getMaskByLevel(diffLevel);
-		
-		uint32_t minIP = fromIP & mask;
-		if (minIP < fromIP) minIP += range;
-		if (minIP > fromIP)
-		{
-			addRange(fromIP, minIP - 1);
-			fromIP = minIP;
-		}
-		if (fromIP == toIP)
-		{
-			add(fromIP);
-		}
-		else
-		{
-			if ((minIP + (range - 1)) <= toIP)
-			{
-				add(minIP, mask);
-				fromIP = minIP + range;
-			}
-			if (fromIP == toIP)
-			{
-				add(toIP);
-			}
-			else
-			{
-				if (fromIP < toIP) addRange(fromIP, toIP);
-			}
-		}
-	}
+	// [!] The range is stored as is, it isn't split into the mask blocks any more
+	addRangeToList(fromIP, toIP);
 	return NO_IP_ERROR;
 }
 
@@ -299,17 +250,80 @@ void IPList::addData(const std::string& Data, CFlyLog& p_log)
 			linestart = lineend + 1;
 		}
 	}
+	build();
 }
-void IPList::addRangeListAndSort(uint32_t p_ip, uint32_t p_level)
+
+void IPList::addRangeToList(uint32_t p_from, uint32_t p_to)
 {
 	dcassert(!ClientManager::isBeforeShutdown());
+	dcassert(p_from <= p_to);
 	CFlyFastLock(m_cs);
-	m_ipRangeList[p_level].add(p_ip);
-	if (std::find(m_usedList.begin(), m_usedList.end(), p_level) == m_usedList.end())
+	m_pending.push_back(std::make_pair(p_from, p_to));
+}
+
+void IPList::build()
+{
+	std::vector<std::pair<uint32_t, uint32_t> > l_ranges;
+	{
+		CFlyFastLock(m_cs);
+		if (m_pending.empty())
+			return;
+		l_ranges.swap(m_pending);
+		l_ranges.reserve(l_ranges.size() + m_starts.size());
+		for (size_t i = 0; i < m_starts.size(); ++i)
+		{
+			l_ranges.push_back(std::make_pair(m_starts[i], m_ends[i]));
+		}
+	}
+	// Sorting and merging are done without the lock, the checks go on with the old lists
+	std::sort(l_ranges.begin(), l_ranges.end());
+	std::vector<uint32_t> l_starts;
+	std::vector<uint32_t> l_ends;
+	l_starts.reserve(l_ranges.size());
+	l_ends.reserve(l_ranges.size());
+	for (auto i = l_ranges.cbegin(); i != l_ranges.cend(); ++i)
+	{
+		// Overlapping and adjacent ranges are joined
+		if (!l_ends.empty() && (l_ends.back() == 0xFFFFFFFF || i->first <= l_ends.back() + 1))
+		{
+			l_ends.back() = std::max(l_ends.back(), i->second);
+		}
+		else
+		{
+			l_starts.push_back(i->first);
+			l_ends.push_back(i->second);
+		}
+	}
+	l_starts.shrink_to_fit();
+	l_ends.shrink_to_fit();
+	CFlyFastLock(m_cs);
+	m_starts.swap(l_starts);
+	m_ends.swap(l_ends);
+}
+
+void IPList::swap(IPList& p_list)
+{
+	dcassert(&p_list != this);
+	CFlyFastLock(m_cs);
+	m_starts.swap(p_list.m_starts);
+	m_ends.swap(p_list.m_ends);
+	m_pending.swap(p_list.m_pending);
+}
+
+bool IPList::findRange(const std::vector<uint32_t>& p_starts, const std::vector<uint32_t>& p_ends, uint32_t p_ip)
+{
+	if (p_starts.empty())
+		return false;
+	// The last range that starts not after p_ip; the loop has no data-dependent branches
+	const uint32_t* l_base = p_starts.data();
+	size_t l_count = p_starts.size();
+	while (l_count > 1)
 	{
-		m_usedList.push_back(p_level);
-		std::sort(m_usedList.begin(), m_usedList.end());
+		const size_t l_half = l_count / 2;
+		l_base = l_base[l_half] <= p_ip ? l_base + l_half : l_base;
+		l_count -= l_half;
 	}
+	return *l_base <= p_ip && p_ip <= p_ends[l_base - p_starts.data()];
 }
 
 bool IPList::checkIp(UINT32 ip)
@@ -318,13 +332,8 @@ bool IPList::checkIp(UINT32 ip)
 	dcassert(!ClientManager::isBeforeShutdown());
 	if (!ClientManager::isBeforeShutdown())
 	{
-		size_t i = 0;
 		CFlyFastLock(m_cs);
-		while (!found && i < m_usedList.size())
-		{
-			found = m_ipRangeList[m_usedList[i]].check(ip); // TODO: Please optimize my searching faster than brute force search!
-			i++;
-		}
+		found = findRange(m_starts, m_ends, ip);
 	}
 	return found;
 }
@@ -332,11 +341,9 @@ bool IPList::checkIp(UINT32 ip)
 void IPList::clear()
 {
 	CFlyFastLock(m_cs);
-	for (size_t i = 0; i < m_usedList.size(); i++)
-	{
-		m_ipRangeList[m_usedList[i]].clear();
-	}
-	m_usedList.clear();
+	m_starts.clear();
+	m_ends.clear();
+	m_pending.clear();
 }
 
 #endif // FLYLINKDC_USE_IPFILTER
@@ -36,54 +36,7 @@ class CFlyLog;
 
 class IPList
 {
-		// TODO: needs review :(
-		// Please optimize my searching faster than brute force search!
 	private:
-		class IPArrayList
-		{
-			private:
-				std::vector< uint32_t > m_ipNumList;
-				uint32_t m_ipmask;
-				
-			public:
-				explicit IPArrayList(uint32_t p_mask)
-					: m_ipmask(p_mask)
-				{
-				}
-				
-				void add(uint32_t p_IPNum)
-				{
-					m_ipNumList.push_back(p_IPNum & m_ipmask);
-					std::sort(m_ipNumList.begin(), m_ipNumList.end());
-				}
-				
-				bool check(uint32_t p_IPNum)
-				{
-					bool found;
-					if (!m_ipNumList.empty())
-					{
-						p_IPNum = p_IPNum & m_ipmask;
-						//found = ipNumList.BinarySearch(IPNum) >= 0;
-						found = std::find(m_ipNumList.begin(), m_ipNumList.end(), p_IPNum) != m_ipNumList.end(); // TODO: Please optimize my searching faster than brute force search!
-					}
-					else
-					{
-						found = false;
-					}
-					return found;
-				}
-				
-				void clear()
-				{
-					m_ipNumList.clear();
-				}
-				
-				uint32_t getMask()
-				{
-					return m_ipmask;
-				}
-		};
-		
 		enum IP_ERROR_STATE
 		{
 			NO_IP_ERROR = 0,
@@ -96,9 +49,12 @@ class IPList
 			LAST
 		};
 		
-		std::vector<IPArrayList> m_ipRangeList;
 		std::map<uint32_t, uint32_t> m_maskList;
-		std::vector< uint32_t > m_usedList;
+		// [!] The ranges are kept sorted and merged: m_starts[i] - m_ends[i], m_ends[i] < m_starts[i + 1].
+		// checkIp() is a binary search, the lists are rebuilt by build() and replaced under the lock.
+		std::vector<uint32_t> m_starts;
+		std::vector<uint32_t> m_ends;
+		std::vector<std::pair<uint32_t, uint32_t> > m_pending; // added after the last build()
 		FastCriticalSection m_cs; // [!] IRainman opt: use spin lock here.
 		
 		static uint32_t parseIP(const std::string& IPNumber);
@@ -112,7 +68,8 @@ class IPList
 		
 		uint32_t addRange(uint32_t fromIP, uint32_t toIP);
 		uint32_t addRange(const std::string& fromIP, const std::string& toIP);
-		void addRangeListAndSort(uint32_t p_ip, uint32_t p_level);
+		void addRangeToList(uint32_t p_from, uint32_t p_to);
+		static bool findRange(const std::vector<uint32_t>& p_starts, const std::vector<uint32_t>& p_ends, uint32_t p_ip);
 		string translateIPError(int32_t& p_errorCode);
 		
 	public:
@@ -121,10 +78,16 @@ class IPList
 		bool empty()
 		{
 			CFlyFastLock(m_cs);
-			return m_usedList.empty();
+			return m_starts.empty();
 		}
+		/// The lines are collected and checked by checkIp() only after build()
 		void addLine(std::string Line, CFlyLog& p_log);
+		/// addLine() for every line and build()
 		void addData(const std::string& Data, CFlyLog& p_log);
+		/// Merges the added lines into the checked ranges
+		void build();
+		/// Replaces the ranges at once: a list is loaded aside and swapped in, the checks don't see a half-loaded list
+		void swap(IPList& p_list);
 		
 		bool checkIp(uint32_t ip);
 		
@@ -29,6 +29,7 @@
 #include "StringTokenizer.h"
 #include "MappingManager.h"
 #include "CompatibilityManager.h"
+#include "WorkerPool.h"
 
 #include "../FlyFeatures/flyServer.h"
 #include "ZenLib/Format/Http/Http_Utils.h"
@@ -2811,10 +2812,16 @@ bool NmdcHub::extJSONParse(const string& param, bool p_is_disable_fire /*= false
 		{
 			if (ou->getIdentity().setExtJSON(param))
 			{
-				ou->getIdentity().setStringParam("F1", l_root["Country"].asString());
-				ou->getIdentity().setStringParam("F2", l_root["City"].asString());
-				ou->getIdentity().setStringParam("F3", l_root["ISP"].asString());
-				ou->getIdentity().setStringParam("F4", l_root["Gender"].asString());
+				const string l_country = l_root["Country"].asString();
+				const string l_city = l_root["City"].asString();
+				const string l_isp = l_root["ISP"].asString();
+				const string l_gender = l_root["Gender"].asString();
+				Identity::StringParams l_string_params;
+				l_string_params.push_back(make_pair(short(TAG('F', '1')), boost::string_view(l_country)));
+				l_string_params.push_back(make_pair(short(TAG('F', '2')), boost::string_view(l_city)));
+				l_string_params.push_back(make_pair(short(TAG('F', '3')), boost::string_view(l_isp)));
+				l_string_params.push_back(make_pair(short(TAG('F', '4')), boost::string_view(l_gender)));
+				ou->getIdentity().setStringParams(l_string_params);
 				ou->getIdentity().setExtJSONSupportInfo(l_root["Support"].asString());
 				ou->getIdentity().setExtJSONRAMWorkingSet(l_root["RAM"].asInt());
 				ou->getIdentity().setExtJSONRAMPeakWorkingSet(l_root["RAMPeak"].asInt());
@@ -2865,7 +2872,12 @@ void NmdcHub::myInfoParse(const string& param)
 	}
 	i = j + 1;
 	
-	OnlineUserPtr ou = getUser(l_nick, false, m_bLastMyInfoCommand == DIDNT_GET_YET_FIRST_MYINFO); //     
+	const OnlineUserPtr ou = getUser(l_nick, false, m_bLastMyInfoCommand == DIDNT_GET_YET_FIRST_MYINFO); //     
+	myInfoParse(ou, l_nick, param, i, nullptr);
+}
+
+void NmdcHub::myInfoParse(const OnlineUserPtr& ou, const string& p_nick, const string& param, string::size_type i, OnlineUserList* p_updated)
+{
 	ou->getUser()->setFlag(User::IS_MYINFO);
 #ifdef FLYLINKDC_USE_CHECK_CHANGE_MYINFO
 	string l_my_info_before_change;
@@ -2890,7 +2902,7 @@ void NmdcHub::myInfoParse(const string& param)
 #endif
 	}
 #endif // FLYLINKDC_USE_CHECK_CHANGE_MYINFO
-	j = param.find('$', i);
+	string::size_type j = param.find('$', i);
 	dcassert(j != string::npos)
 	if (j == string::npos)
 		return;
@@ -3024,7 +3036,7 @@ void NmdcHub::myInfoParse(const string& param)
 #ifdef _DEBUG
 					LogManager::message("[!!!!!!!!!!!] Only change Share New = " +
 					                    param.substr(i) + " old = " +
-					                    l_my_info_before_change.substr(i) + " l_nick = " + l_nick + " hub = " + getHubUrl());
+					                    l_my_info_before_change.substr(i) + " l_nick = " + p_nick + " hub = " + getHubUrl());
 #endif
 				}
 			}
@@ -3045,33 +3057,33 @@ void NmdcHub::myInfoParse(const string& param)
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 		CFlyFastLock(m_cs_virus);
 #ifdef FLYLINKDC_USE_VIRUS_CHECK_DEBUG
-		const auto l_check_nick = m_virus_nick_checked.insert(l_nick);
+		const auto l_check_nick = m_virus_nick_checked.insert(p_nick);
 		if (l_check_nick.second == false)
 		{
-			auto& l_new_my_info = m_check_myinfo_dup[l_nick];
+			auto& l_new_my_info = m_check_myinfo_dup[p_nick];
 			if (l_new_my_info != param)
 			{
 				if (!l_new_my_info.empty())
 				{
-					//LogManager::message("Change MyINFO [2]! Nick = " + l_nick + " Hub = " + getHubUrl() + " New MyINFO = " + param + " Old MyINFO = " + l_new_my_info);
+					//LogManager::message("Change MyINFO [2]! Nick = " + p_nick + " Hub = " + getHubUrl() + " New MyINFO = " + param + " Old MyINFO = " + l_new_my_info);
 				}
 				l_new_my_info = param;
 			}
 			else
 			{
-				//LogManager::message("Duplicate MyINFO[2]! " + l_nick + " Hub = " + getHubUrl() + " MyINFO = " + param);
+				//LogManager::message("Duplicate MyINFO[2]! " + p_nick + " Hub = " + getHubUrl() + " MyINFO = " + param);
 			}
 		}
 		else
 		{
-			//LogManager::message("First virus check [0]! Nick = " + l_nick + " Hub = " + getHubUrl() + " MyINFO = " + param);
+			//LogManager::message("First virus check [0]! Nick = " + p_nick + " Hub = " + getHubUrl() + " MyINFO = " + param);
 		}
 #endif
-		if (m_virus_nick.find(l_nick) == m_virus_nick.end())
+		if (m_virus_nick.find(p_nick) == m_virus_nick.end())
 		{
-			if (CFlylinkDBManager::getInstance()->is_virus_bot(l_nick, l_share_size, ou->getIdentity().m_is_real_user_ip_from_hub ? ou->getIdentity().getIpRAW() : boost::asio::ip::address_v4()))
+			if (CFlylinkDBManager::getInstance()->is_virus_bot(p_nick, l_share_size, ou->getIdentity().m_is_real_user_ip_from_hub ? ou->getIdentity().getIpRAW() : boost::asio::ip::address_v4()))
 			{
-				m_virus_nick.insert(l_nick);
+				m_virus_nick.insert(p_nick);
 			}
 		}
 #endif // FLYLINKDC_USE_ANTIVIRUS_DB
@@ -3088,7 +3100,7 @@ void NmdcHub::myInfoParse(const string& param)
 	string l_ext_json_param;
 	{
 		CFlyReadLock(*m_cs);
-		const auto l_find_ext_json = m_ext_json_deferred.find(l_nick);
+		const auto l_find_ext_json = m_ext_json_deferred.find(p_nick);
 		if (l_find_ext_json != m_ext_json_deferred.end())
 		{
 			l_ext_json_param = l_find_ext_json->second;
@@ -3099,11 +3111,18 @@ void NmdcHub::myInfoParse(const string& param)
 		extJSONParse(l_ext_json_param, true); // true -   ClientListener::UserUpdatedMyINFO
 		{
 			CFlyWriteLock(*m_cs);
-			m_ext_json_deferred.erase(l_nick);
+			m_ext_json_deferred.erase(p_nick);
 		}
 	}
 #endif // FLYLINKDC_USE_EXT_JSON
-	updatedMyINFO(ou);
+	if (p_updated)
+	{
+		p_updated->push_back(ou);
+	}
+	else
+	{
+		updatedMyINFO(ou);
+	}
 }
 
 void NmdcHub::on(BufferedSocketListener::SearchArrayTTH, CFlySearchArrayTTH& p_search_array) noexcept
@@ -3220,13 +3239,129 @@ void NmdcHub::on(BufferedSocketListener::DDoSSearchDetect, const string& p_error
 	fly_fire1(ClientListener::DDoSSearchDetect(), p_error);
 }
 
+void NmdcHub::myInfoParseBatch(const StringList& p_myInfoArray)
+{
+	struct Item
+	{
+		string m_line;
+		string m_nick;
+		string::size_type m_pos;
+		CID m_cid;
+		OnlineUserPtr m_ou;
+		Item() : m_pos(string::npos)
+		{
+		}
+	};
+	vector<Item> l_items(p_myInfoArray.size());
+	
+	// 1. The conversion, the nicks and the CIDs (Tiger) don't touch the hub - in parallel chunks
+	const string& l_hub_url = getHubUrl();
+	volatile long l_next = 0;
+	const auto l_work = [this, &p_myInfoArray, &l_items, &l_hub_url, &l_next]()
+	{
+		const size_t CHUNK_SIZE = 256;
+		for (;;)
+		{
+			const size_t l_begin = static_cast<size_t>(BaseThread::safeInc(l_next) - 1) * CHUNK_SIZE;
+			if (l_begin >= l_items.size())
+				break;
+			const size_t l_end = std::min(l_begin + CHUNK_SIZE, l_items.size());
+			for (size_t k = l_begin; k < l_end; ++k)
+			{
+				Item& l_item = l_items[k];
+				l_item.m_line = toUtf8MyINFO(p_myInfoArray[k]);
+				const string::size_type j = l_item.m_line.find(' ', 5);
+				if (j == string::npos || j == 5)
+					continue;
+				l_item.m_nick = l_item.m_line.substr(5, j - 5);
+				l_item.m_pos = j + 1;
+				l_item.m_cid = ClientManager::makeCid(l_item.m_nick, l_hub_url);
+			}
+		}
+	};
+	WorkerPool::getInstance()->runParallel(l_work, l_items.size() / 4000 + 1);
+	
+	// 2. The known users are found under one lock, the new ones are created with one lock of ClientManager
+	StringList l_new_nicks;
+	vector<CID> l_new_cids;
+	vector<size_t> l_new_items;
+	{
+		std::unordered_set<string> l_new_nick_set;
+		const string l_my_nick = getMyNick();
+		CFlyReadLock(*m_cs);
+		for (size_t k = 0; k < l_items.size(); ++k)
+		{
+			Item& l_item = l_items[k];
+			if (l_item.m_nick.empty() || l_item.m_nick == l_my_nick)
+				continue;
+			const auto l_user = m_users.find(l_item.m_nick);
+			if (l_user != m_users.end())
+			{
+				l_item.m_ou = l_user->second;
+			}
+			else if (l_new_nick_set.insert(l_item.m_nick).second)
+			{
+				l_new_nicks.push_back(l_item.m_nick);
+				l_new_cids.push_back(l_item.m_cid);
+				l_new_items.push_back(k);
+			}
+		}
+	}
+	if (!l_new_nicks.empty())
+	{
+		vector<UserPtr> l_users;
+		ClientManager::getUsers(l_new_nicks, l_new_cids, getHubID(), l_users);
+		OnlineUserList l_online;
+		l_online.reserve(l_users.size());
+		{
+			CFlyWriteLock(*m_cs);
+			for (size_t k = 0; k < l_users.size(); ++k)
+			{
+				Item& l_item = l_items[l_new_items[k]];
+				auto l_ou = m_users.insert(make_pair(l_item.m_nick, OnlineUserPtr()));
+				if (l_ou.second)
+				{
+					l_ou.first->second = std::make_shared<OnlineUser>(l_users[k], *this, 0);
+					l_ou.first->second->getIdentity().setNick(l_item.m_nick);
+					l_online.push_back(l_ou.first->second);
+				}
+				l_item.m_ou = l_ou.first->second;
+			}
+		}
+		ClientManager::getInstance()->putOnline(l_online, true);
+	}
+	
+	// 3. The rest of $MyINFO changes the users one by one, the listeners get them all at once
+	OnlineUserList l_updated;
+	l_updated.reserve(l_items.size());
+	for (auto i = l_items.begin(); i != l_items.end() && !ClientManager::isBeforeShutdown(); ++i)
+	{
+		if (i->m_nick.empty())
+			continue;
+		if (!i->m_ou)
+		{
+			i->m_ou = getUser(i->m_nick, false, m_bLastMyInfoCommand == DIDNT_GET_YET_FIRST_MYINFO);
+		}
+		myInfoParse(i->m_ou, i->m_nick, i->m_line, i->m_pos, &l_updated);
+		COMMAND_DEBUG("$MyINFO " + i->m_line, DebugTask::HUB_IN, getIpPort());
+	}
+	updatedMyINFO(l_updated);
+}
+
 void NmdcHub::on(BufferedSocketListener::MyInfoArray, StringList& p_myInfoArray) noexcept
 {
-	for (auto i = p_myInfoArray.cbegin(); i != p_myInfoArray.end() && !ClientManager::isBeforeShutdown(); ++i)
+	if (p_myInfoArray.size() >= MYINFO_BATCH_MIN_SIZE)
+	{
+		myInfoParseBatch(p_myInfoArray);
+	}
+	else
 	{
-		const auto l_utf_line = toUtf8MyINFO(*i);
-		myInfoParse(l_utf_line);
-		COMMAND_DEBUG("$MyINFO " + l_utf_line, DebugTask::HUB_IN, getIpPort());
+		for (auto i = p_myInfoArray.cbegin(); i != p_myInfoArray.end() && !ClientManager::isBeforeShutdown(); ++i)
+		{
+			const auto l_utf_line = toUtf8MyINFO(*i);
+			myInfoParse(l_utf_line);
+			COMMAND_DEBUG("$MyINFO " + l_utf_line, DebugTask::HUB_IN, getIpPort());
+		}
 	}
 	p_myInfoArray.clear();
 	processAutodetect(true);
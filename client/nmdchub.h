@@ -242,6 +242,11 @@ class NmdcHub : public Client, private Flags
 		bool resendMyINFO(bool p_always_send, bool p_is_force_passive);
 		void myInfo(bool p_alwaysSend, bool p_is_force_passive = false);
 		void myInfoParse(const string& param);
+		/** @param p_updated null - fire UserUpdatedMyINFO, otherwise the user is added here */
+		void myInfoParse(const OnlineUserPtr& ou, const string& p_nick, const string& param, string::size_type i, OnlineUserList* p_updated);
+		// [+] The $MyINFO flood after the login: the users are created with one lock per batch and updated with one event
+		static const size_t MYINFO_BATCH_MIN_SIZE = 64;
+		void myInfoParseBatch(const StringList& p_myInfoArray);
 #ifdef FLYLINKDC_USE_EXT_JSON
 		bool extJSONParse(const string& param, bool p_is_disable_fire = false);
 // #define FLYLINKDC_USE_EXT_JSON_GUARD
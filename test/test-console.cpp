@@ -39,6 +39,7 @@
 
 int getmac();
 void get_adapters();
+int test_fast_paths(bool p_bench); // test-fast-paths.cpp
 
 bool g_UseCSRecursionLog = false;
 FastCriticalSection FastAllocBase::cs;
@@ -721,6 +722,11 @@ class A
 
 int _tmain(int argc, _TCHAR* argv[])
 {
+	// test-console.exe -check [-bench]
+	if (argc > 1 && _tcscmp(argv[1], _T("-check")) == 0)
+	{
+		return test_fast_paths(argc > 2 && _tcscmp(argv[2], _T("-bench")) == 0);
+	}
 	/*
 	//std::vector<unique_ptr<A>> l_set;
 	    std::vector<A> l_set;
@@ -0,0 +1,890 @@
+/*
+ * Equivalence checks and micro-benchmarks of the fast paths of the client:
+ * every optimized routine is compared with the plain code it replaces.
+ * Run: test-console.exe -check [-bench]
+ */
+
+#include "stdafx.h"
+#include "stdinc.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+
+#include "../client/TigerHash.h"
+#include "../client/SimpleXML.h"
+#include "../client/Util.h"
+#include "../client/LineFramer.h"
+#include "../client/AdcCommand.h"
+#include "cycle.h"
+
+// Util.cpp brings the whole client with it: the console test defines only the empty strings of Text.cpp, SimpleXMLReader.cpp and AdcCommand.cpp
+const string Util::emptyString;
+const wstring Util::emptyStringW;
+const tstring Util::emptyStringT;
+
+static int g_errors = 0;
+
+#define CHECK_EQUAL(a, b, what)\
+	if (!((a) == (b)))\
+	{\
+		++g_errors;\
+		std::cout << "FAILED: " << what << std::endl;\
+	}
+
+static void fillRandom(std::vector<uint8_t>& p_buf, uint32_t p_seed)
+{
+	for (size_t i = 0; i < p_buf.size(); ++i)
+	{
+		p_seed = p_seed * 1103515245 + 12345;
+		p_buf[i] = uint8_t(p_seed >> 16);
+	}
+}
+
+static std::string toHex(const uint8_t* p_data, size_t p_len)
+{
+	static const char g_hex[] = "0123456789ABCDEF";
+	std::string l_res;
+	for (size_t i = 0; i < p_len; ++i)
+	{
+		l_res += g_hex[p_data[i] >> 4];
+		l_res += g_hex[p_data[i] & 0x0F];
+	}
+	return l_res;
+}
+
+/** Tiger of 0x00 + leaf, the way hashLeaves computes the leaves it can't batch */
+static std::string scalarLeaf(const uint8_t* p_leaf, size_t p_leaf_size)
+{
+	const uint8_t l_zero = 0;
+	TigerHash h;
+	h.update(&l_zero, 1);
+	h.update(p_leaf, p_leaf_size);
+	return toHex(h.finalize(), TigerHash::BYTES);
+}
+
+/**
+ * TigerHash::hashLeaves: each kernel width (8 - AVX-512, 4 - AVX2, 1 - scalar) against the scalar Tiger.
+ * The leaf sizes cross the 64 byte block and the 56 byte padding boundaries,
+ * the counts leave ragged tails of 1..7 leaves after the full vector batches.
+ */
+static void test_tiger_hash_leaves()
+{
+	static const size_t g_leaf_sizes[] = { 0, 1, 7, 54, 55, 56, 57, 63, 64, 65, 119, 120, 127, 128, 1000, 1024 };
+	static const size_t g_lanes[] = { 8, 4, 1 };
+	std::cout << "TigerHash::hashLeaves, vector path: " << (TigerHash::isMultiBufferSupported() ? "yes" : "no (scalar only)") << std::endl;
+	for (size_t s = 0; s < _countof(g_leaf_sizes); ++s)
+	{
+		const size_t l_leaf_size = g_leaf_sizes[s];
+		const size_t l_max_count = 3 * TigerHash::LEAF_LANES + 7;
+		std::vector<uint8_t> l_data(l_leaf_size * l_max_count + 1);
+		fillRandom(l_data, uint32_t(l_leaf_size + 1));
+		std::vector<std::string> l_expected(l_max_count);
+		for (size_t i = 0; i < l_max_count; ++i)
+		{
+			l_expected[i] = scalarLeaf(&l_data[i * l_leaf_size], l_leaf_size);
+		}
+		for (size_t l = 0; l < _countof(g_lanes); ++l)
+		{
+			for (size_t l_count = 1; l_count <= l_max_count; ++l_count)
+			{
+				std::vector<uint8_t> l_result(l_count * TigerHash::BYTES + 1, 0xCD);
+				TigerHash::hashLeaves(&l_data[0], l_leaf_size, l_count, &l_result[0], g_lanes[l]);
+				for (size_t i = 0; i < l_count; ++i)
+				{
+					CHECK_EQUAL(toHex(&l_result[i * TigerHash::BYTES], TigerHash::BYTES), l_expected[i],
+					            "hashLeaves lanes=" << g_lanes[l] << " leaf_size=" << l_leaf_size << " count=" << l_count << " leaf=" << i);
+				}
+				CHECK_EQUAL(l_result[l_count * TigerHash::BYTES], 0xCD, "hashLeaves wrote past the result, lanes=" << g_lanes[l] << " count=" << l_count);
+			}
+		}
+	}
+}
+
+static void bench_tiger_hash_leaves()
+{
+	static const size_t g_lanes[] = { 8, 4, 1 };
+	const size_t l_leaf_size = 1024;
+	const size_t l_count = 64 * 1024; // 64 MB
+	std::vector<uint8_t> l_data(l_leaf_size * l_count);
+	fillRandom(l_data, 1);
+	std::vector<uint8_t> l_result(l_count * TigerHash::BYTES);
+	for (size_t l = 0; l < _countof(g_lanes); ++l)
+	{
+		const ticks l_start = getticks();
+		TigerHash::hashLeaves(&l_data[0], l_leaf_size, l_count, &l_result[0], g_lanes[l]);
+		const double l_ticks = elapsed(getticks(), l_start);
+		std::cout << "hashLeaves lanes=" << g_lanes[l] << ": " << std::fixed << std::setprecision(2)
+		          << l_ticks / double(l_data.size()) << " ticks/byte" << std::endl;
+	}
+}
+
+/** Writes every callback of SimpleXMLReader into one string, the start tags come through startTag or startTagRef */
+class XmlRecorder : public SimpleXMLReader::CallBack
+{
+	public:
+		explicit XmlRecorder(bool p_is_ref) : m_is_ref(p_is_ref), m_ref_count(0)
+		{
+		}
+		void startTag(const std::string& name, StringPairList& attribs, bool simple) override
+		{
+			m_log += '<';
+			m_log += name;
+			for (auto i = attribs.cbegin(); i != attribs.cend(); ++i)
+			{
+				addAttrib(i->first.data(), i->first.size(), i->second.data(), i->second.size());
+			}
+			m_log += simple ? "/>\n" : ">\n";
+		}
+		bool startTagRef(const SimpleXMLReader::StringRef& name, const SimpleXMLReader::StringRefPairList& attribs, bool simple) override
+		{
+			if (!m_is_ref)
+			{
+				return false;
+			}
+			++m_ref_count;
+			m_log += '<';
+			m_log.append(name.data(), name.size());
+			for (auto i = attribs.cbegin(); i != attribs.cend(); ++i)
+			{
+				addAttrib(i->first.data(), i->first.size(), i->second.data(), i->second.size());
+			}
+			m_log += simple ? "/>\n" : ">\n";
+			return true;
+		}
+		void endTag(const std::string& name, const std::string& data) override
+		{
+			m_log += "</" + name + '>' + data + '\n';
+		}
+		std::string m_log;
+		size_t m_ref_count;
+	private:
+		void addAttrib(const char* p_name, size_t p_name_len, const char* p_value, size_t p_value_len)
+		{
+			m_log += ' ';
+			m_log.append(p_name, p_name_len);
+			m_log += "=[";
+			m_log.append(p_value, p_value_len);
+			m_log += ']';
+		}
+		const bool m_is_ref;
+};
+
+/** Feeds the XML by p_chunk bytes, a chunk of 1 byte never gives the fast path a whole tag */
+static std::string parseXml(const std::string& p_xml, bool p_is_ref, size_t p_chunk, uint32_t p_seed, size_t* p_ref_count = nullptr)
+{
+	XmlRecorder l_recorder(p_is_ref);
+	SimpleXMLReader l_reader(&l_recorder);
+	try
+	{
+		for (size_t i = 0; i < p_xml.size();)
+		{
+			size_t l_len = p_chunk;
+			if (p_seed)
+			{
+				p_seed = p_seed * 1103515245 + 12345;
+				l_len = 1 + (p_seed >> 16) % p_chunk; // random cuts inside the tags
+			}
+			l_len = std::min(l_len, p_xml.size() - i);
+			l_reader.parse(p_xml.data() + i, l_len, true);
+			i += l_len;
+		}
+	}
+	catch (const SimpleXMLException& e)
+	{
+		l_recorder.m_log += "ERROR: " + e.getError() + '\n';
+	}
+	if (p_ref_count)
+	{
+		*p_ref_count = l_recorder.m_ref_count;
+	}
+	return l_recorder.m_log;
+}
+
+/**
+ * A file list like the DC++ ones: nested directories, plain and extended file tags, and now and then
+ * what the fast path leaves to the state machine - entities, single quotes, spaces around '=', comments, CDATA.
+ */
+static std::string makeFileListing(size_t p_files, uint32_t p_seed)
+{
+	static const char* const g_name_parts[] = { "Music", "Video", "file", " ", "-", "_", "2017", ".mp3", ".avi", "\xD0\x9C\xD1\x83\xD0\xB7\xD1\x8B\xD0\xBA\xD0\xB0", "&amp;", "&apos;", "&quot;", "&lt;", "&#65;", "'", "x" };
+	std::string l_xml = "\xEF\xBB\xBF<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\r\n"
+	                    "<FileListing Version=\"1\" CID=\"WZXBXMI4YQBLIQ7XXZSGRBNCHCUOZNAL7DLHUAQ\" Base=\"/\" Generator=\"DC++ 0.868\">\r\n";
+	std::vector<bool> l_stack; // the open directories
+	auto l_random = [&p_seed](uint32_t p_range)
+	{
+		p_seed = p_seed * 1103515245 + 12345;
+		return (p_seed >> 8) % p_range;
+	};
+	auto l_name = [&]()
+	{
+		std::string l_res;
+		const size_t l_parts = 1 + l_random(4);
+		for (size_t i = 0; i < l_parts; ++i)
+		{
+			// the rare parts (entities, quote, utf-8) at the end of the table
+			const uint32_t l_index = l_random(100) < 90 ? l_random(9) : l_random(_countof(g_name_parts));
+			l_res += g_name_parts[l_index];
+		}
+		return l_res;
+	};
+	for (size_t l_files = 0; l_files < p_files;)
+	{
+		const std::string l_indent(l_stack.size() + 1, '\t');
+		const uint32_t l_kind = l_random(100);
+		if (l_kind < 8 && l_stack.size() < 8)
+		{
+			l_xml += l_indent + "<Directory Name=\"" + l_name() + "\">\r\n";
+			l_stack.push_back(true);
+			continue;
+		}
+		if (l_kind < 14 && !l_stack.empty())
+		{
+			l_stack.pop_back();
+			l_xml += std::string(l_stack.size() + 1, '\t') + "</Directory>\r\n";
+			continue;
+		}
+		++l_files;
+		std::string l_name_value = l_name();
+		const std::string l_size = std::to_string(l_random(1000000) * 1000 + l_random(1000));
+		const std::string l_tth = "CLHBSOR3G6MQHLR2WCZ5B6FWWNDZ2RKN6SFK" + std::to_string(100 + l_random(900));
+		const uint32_t l_variant = l_random(100);
+		if (l_variant < 3)
+		{
+			// apostrophes: no quote inside the value
+			std::replace(l_name_value.begin(), l_name_value.end(), '\'', 'q');
+			l_xml += l_indent + "<File Name='" + l_name_value + "' Size='" + l_size + "' TTH='" + l_tth + "'/>\r\n";
+		}
+		else if (l_variant < 5)
+		{
+			l_xml += l_indent + "<File Name = \"" + l_name_value + "\" Size=\"" + l_size + "\"  TTH=\"" + l_tth + "\" />\r\n";
+		}
+		else if (l_variant < 7)
+		{
+			l_xml += l_indent + "<!-- " + l_size + " -->\r\n";
+			l_xml += l_indent + "<File Name=\"" + l_name_value + "\" Size=\"" + l_size + "\" TTH=\"" + l_tth + "\"></File>\r\n";
+		}
+		else if (l_variant < 8)
+		{
+			l_xml += l_indent + "<File Name=\"" + l_name_value + "\" Size=\"" + l_size + "\" TTH=\"" + l_tth + "\"><![CDATA[<" + l_size + ">]]></File>\r\n";
+		}
+		else if (l_variant < 20)
+		{
+			l_xml += l_indent + "<File Name=\"" + l_name_value + "\" Size=\"" + l_size + "\" TTH=\"" + l_tth + "\" TS=\"1493750000\" BR=\"320\" MV=\"1920x1080\" MA=\"AAC, 2ch\"/>\r\n";
+		}
+		else
+		{
+			l_xml += l_indent + "<File Name=\"" + l_name_value + "\" Size=\"" + l_size + "\" TTH=\"" + l_tth + "\"/>\r\n";
+		}
+	}
+	while (!l_stack.empty())
+	{
+		l_stack.pop_back();
+		l_xml += std::string(l_stack.size() + 1, '\t') + "</Directory>\r\n";
+	}
+	l_xml += "</FileListing>\r\n";
+	return l_xml;
+}
+
+/**
+ * SimpleXMLReader fast path (whole tags in the buffer, startTagRef) against the state machine alone (fed byte by byte).
+ * The start tags taken through startTagRef, refused by it and cut at random places must give the same callbacks.
+ */
+static void test_simple_xml_reader()
+{
+	const std::string l_list = makeFileListing(20000, 7);
+	const std::string l_expected = parseXml(l_list, true, 1, 0);
+	size_t l_ref_count = 0;
+	CHECK_EQUAL(parseXml(l_list, true, l_list.size(), 0, &l_ref_count), l_expected, "SimpleXMLReader fast path, startTagRef");
+	CHECK_EQUAL(l_ref_count != 0, true, "SimpleXMLReader fast path wasn't taken");
+	CHECK_EQUAL(parseXml(l_list, false, l_list.size(), 0), l_expected, "SimpleXMLReader fast path, startTag");
+	for (uint32_t l_seed = 1; l_seed <= 4; ++l_seed)
+	{
+		CHECK_EQUAL(parseXml(l_list, true, 4096, l_seed), l_expected, "SimpleXMLReader fast path, random reads, seed=" << l_seed);
+		CHECK_EQUAL(parseXml(l_list, true, 64, l_seed), l_expected, "SimpleXMLReader fast path, short random reads, seed=" << l_seed);
+	}
+	
+	// The errors are found by the state machine at the same place
+	static const char* const g_bad[] =
+	{
+		"<a><b x=\"1\"></a>",
+		"<a>text<b/></a>",
+		"<a x=\"1/>",
+		"<a x=\"1\"y=\"2\"/>",
+		"<a x=1/>",
+		"<a><b></b></c>",
+		"<a>&bad;</a>",
+		"<a x=\"&#;\"/>",
+		"<a/><b/>",
+		"<1a/>",
+		"<a x=\"1\" x=\"2\"/>",
+		"<a>\r\n<b x=\"\"/>\r\n</a>",
+	};
+	for (size_t i = 0; i < _countof(g_bad); ++i)
+	{
+		const std::string l_xml = g_bad[i];
+		CHECK_EQUAL(parseXml(l_xml, true, l_xml.size(), 0), parseXml(l_xml, true, 1, 0), "SimpleXMLReader fast path, malformed: " << l_xml);
+	}
+}
+
+/** Only counts the tags: the benchmark measures the parser, not the recording */
+class XmlCounter : public SimpleXMLReader::CallBack
+{
+	public:
+		explicit XmlCounter(bool p_is_ref) : m_is_ref(p_is_ref), m_count(0)
+		{
+		}
+		void startTag(const std::string&, StringPairList& attribs, bool) override
+		{
+			m_count += attribs.size();
+		}
+		bool startTagRef(const SimpleXMLReader::StringRef&, const SimpleXMLReader::StringRefPairList& attribs, bool) override
+		{
+			m_count += attribs.size();
+			return m_is_ref;
+		}
+		void endTag(const std::string&, const std::string&) override
+		{
+		}
+		size_t m_count;
+	private:
+		const bool m_is_ref;
+};
+
+static void bench_simple_xml_reader()
+{
+	const std::string l_list = makeFileListing(1000000, 11);
+	for (int l_is_ref = 1; l_is_ref >= 0; --l_is_ref)
+	{
+		XmlCounter l_counter(l_is_ref != 0);
+		SimpleXMLReader l_reader(&l_counter);
+		const size_t l_chunk = 64 * 1024; // as parse(InputStream&) reads
+		const ticks l_start = getticks();
+		for (size_t i = 0; i < l_list.size(); i += l_chunk)
+		{
+			l_reader.parse(l_list.data() + i, std::min(l_chunk, l_list.size() - i), true);
+		}
+		const double l_ticks = elapsed(getticks(), l_start);
+		std::cout << "SimpleXMLReader, 1M files, " << (l_is_ref ? "startTagRef" : "startTag") << ": " << std::fixed << std::setprecision(2)
+		          << l_ticks / double(l_list.size()) << " ticks/byte (" << l_list.size() / (1024 * 1024) << " MB)" << std::endl;
+	}
+}
+
+/** The hub line framing BufferedSocket had before LineFramer: the read is appended to the unfinished command, the commands are cut off by find/erase */
+template<typename OnLine>
+static size_t copyFrameLines(std::string& p_line, const char* p_data, size_t p_len, char p_separator, OnLine& p_on_line)
+{
+	std::string l = p_line + std::string(p_data, p_len);
+	size_t l_left = p_len;
+	size_t l_pos;
+	while ((l_pos = l.find(p_separator)) != std::string::npos)
+	{
+		const bool l_is_line = l_pos > 0 ? p_on_line(boost::string_view(l.data(), l_pos)) : true;
+		l.erase(0, l_pos + 1);
+		if (l.length() < l_left)
+		{
+			l_left = l.length();
+		}
+		if (!l_is_line)
+		{
+			// we changed mode; remainder of l is invalid.
+			p_line.clear();
+			return p_len - l_left;
+		}
+	}
+	p_line = l;
+	return p_len;
+}
+
+/** A NMDC hub connection in MODE_LINE: "$Data N" switches it to MODE_DATA for the next N bytes, as a command switches BufferedSocket */
+class HubReplay
+{
+	public:
+		HubReplay(bool p_is_ref, bool p_is_log) : m_count(0), m_is_ref(p_is_ref), m_is_log(p_is_log), m_data_bytes(0)
+		{
+		}
+		void read(const char* p_data, size_t p_len)
+		{
+			while (p_len > 0)
+			{
+				size_t l_used;
+				if (m_data_bytes == 0)
+				{
+					l_used = m_is_ref ? copyFrameLines(m_line, p_data, p_len, '|', *this) : LineFramer::feed(m_line, p_data, p_len, '|', *this);
+				}
+				else
+				{
+					l_used = std::min(m_data_bytes, p_len);
+					m_data_bytes -= l_used;
+					if (m_is_log)
+					{
+						m_log.append(p_data, l_used).append(m_data_bytes ? "" : "\n");
+					}
+				}
+				p_data += l_used;
+				p_len -= l_used;
+			}
+		}
+		bool operator()(const boost::string_view& p_line)
+		{
+			++m_count;
+			if (m_is_log)
+			{
+				m_log.append(p_line.data(), p_line.size()).append("\n");
+			}
+			if (p_line.starts_with("$Data "))
+			{
+				m_data_bytes = strtoul(p_line.data() + 6, nullptr, 10);
+			}
+			return m_data_bytes == 0;
+		}
+		std::string result() const
+		{
+			return m_log + "UNFINISHED " + m_line;
+		}
+		size_t m_count;
+	private:
+		const bool m_is_ref;
+		const bool m_is_log;
+		size_t m_data_bytes;
+		std::string m_line;
+		std::string m_log;
+};
+
+/** A hub session: the login, the user list, searches, chat, the empty commands, long lines and binary blocks with the separator inside */
+static std::string makeHubStream(size_t p_commands, uint32_t p_seed)
+{
+	std::string l_stream = "$Lock EXTENDEDPROTOCOL_verlihub Pk=version1.0.0|$HubName Test hub|$Hello tester|";
+	for (size_t i = 0; i < p_commands; ++i)
+	{
+		p_seed = p_seed * 1103515245 + 12345;
+		const uint32_t l_kind = (p_seed >> 16) % 100;
+		const std::string l_nick = "user" + std::to_string(i % 5000);
+		if (l_kind < 60)
+		{
+			l_stream += "$MyINFO $ALL " + l_nick + " description " + std::to_string(i) + "<FlylinkDC++ V:r600,M:A,H:1/0/0,S:5>$ $100\x01$" + l_nick + "@mail.ru$" + std::to_string(i * 1234567ULL) + "$|";
+		}
+		else if (l_kind < 75)
+		{
+			l_stream += "$Search Hub:" + l_nick + " F?T?0?9?TTH:" + std::string(39, char('A' + i % 26)) + "|";
+		}
+		else if (l_kind < 90)
+		{
+			l_stream += "<" + l_nick + "> chat message number " + std::to_string(i) + "|";
+		}
+		else if (l_kind < 95)
+		{
+			l_stream += std::string(1 + (p_seed >> 8) % 3, '|');
+		}
+		else if (l_kind < 97)
+		{
+			l_stream += "<" + l_nick + "> " + std::string(1000 + (p_seed >> 8) % 2000, char('a' + i % 26)) + "|";
+		}
+		else
+		{
+			std::vector<uint8_t> l_block(1 + (p_seed >> 8) % 300);
+			fillRandom(l_block, p_seed);
+			for (size_t j = 0; j < l_block.size(); ++j)
+			{
+				l_block[j] = (l_block[j] & 7) == 0 ? '|' : char('0' + l_block[j] % 64);
+			}
+			l_stream += "$Data " + std::to_string(l_block.size()) + "|" + std::string(l_block.begin(), l_block.end());
+		}
+	}
+	l_stream += "$MyINFO $ALL unfinished";
+	return l_stream;
+}
+
+static std::string replayHub(const std::string& p_stream, bool p_is_ref, size_t p_max_read, uint32_t p_seed)
+{
+	HubReplay l_replay(p_is_ref, true);
+	for (size_t i = 0; i < p_stream.size();)
+	{
+		p_seed = p_seed * 1103515245 + 12345;
+		const size_t l_len = std::min(p_stream.size() - i, 1 + (p_seed >> 8) % p_max_read);
+		l_replay.read(p_stream.data() + i, l_len);
+		i += l_len;
+	}
+	return l_replay.result();
+}
+
+/**
+ * LineFramer (BufferedSocket, MODE_LINE) against the copy/find/erase framing it replaces.
+ * The reads cut the commands, the separators and the "$Data" blocks at random places.
+ */
+static void test_line_framer()
+{
+	const std::string l_stream = makeHubStream(3000, 5);
+	const std::string l_expected = replayHub(l_stream, true, l_stream.size(), 0);
+	CHECK_EQUAL(replayHub(l_stream, false, l_stream.size(), 0), l_expected, "LineFramer, one read");
+	static const size_t g_max_reads[] = { 1, 2, 7, 100, 1500, 65536 };
+	for (size_t r = 0; r < _countof(g_max_reads); ++r)
+	{
+		for (uint32_t l_seed = 1; l_seed <= 3; ++l_seed)
+		{
+			CHECK_EQUAL(replayHub(l_stream, true, g_max_reads[r], l_seed), l_expected, "copy/find/erase framing, reads up to " << g_max_reads[r] << ", seed=" << l_seed);
+			CHECK_EQUAL(replayHub(l_stream, false, g_max_reads[r], l_seed), l_expected, "LineFramer, reads up to " << g_max_reads[r] << ", seed=" << l_seed);
+		}
+	}
+}
+
+static void bench_line_framer()
+{
+	const std::string l_stream = makeHubStream(300000, 13);
+	static const size_t g_max_reads[] = { 1460, 65536 };
+	for (size_t r = 0; r < _countof(g_max_reads); ++r)
+	{
+		for (int l_is_ref = 1; l_is_ref >= 0; --l_is_ref)
+		{
+			HubReplay l_replay(l_is_ref != 0, false);
+			uint32_t l_seed = 17;
+			const ticks l_start = getticks();
+			for (size_t i = 0; i < l_stream.size();)
+			{
+				l_seed = l_seed * 1103515245 + 12345;
+				const size_t l_len = std::min(l_stream.size() - i, 1 + (l_seed >> 8) % g_max_reads[r]);
+				l_replay.read(l_stream.data() + i, l_len);
+				i += l_len;
+			}
+			const double l_ticks = elapsed(getticks(), l_start);
+			std::cout << "Hub line framing, reads up to " << g_max_reads[r] << ", " << (l_is_ref ? "copy/find/erase" : "LineFramer") << ": " << std::fixed << std::setprecision(2)
+			          << l_ticks / double(l_stream.size()) << " ticks/byte (" << l_replay.m_count << " commands, " << l_stream.size() / (1024 * 1024) << " MB)" << std::endl;
+		}
+	}
+}
+
+/** AdcCommand::parse before PARSE_BORROW: the parameters are unescaped char by char into a StringList. Gives "fourcc|from|to|params|NI|GR" or the error */
+static std::string copyParseAdc(const std::string& p_line, bool p_nmdc)
+{
+	try
+	{
+		std::string::size_type i = 5;
+		char l_type;
+		std::string l_cmd;
+		if (p_nmdc)
+		{
+			if (p_line.length() < 7)
+				throw ParseException("Too short");
+			l_type = AdcCommand::TYPE_CLIENT;
+			l_cmd = p_line.substr(4, 3);
+			i += 3;
+		}
+		else
+		{
+			if (p_line.length() < 4)
+				throw ParseException("Too short");
+			l_type = p_line[0];
+			l_cmd = p_line.substr(1, 3);
+		}
+		if (strchr("BCDEFIHU", l_type) == nullptr || l_type == 0)
+		{
+			throw ParseException("Invalid type");
+		}
+		const bool l_has_from = l_type == AdcCommand::TYPE_BROADCAST || l_type == AdcCommand::TYPE_DIRECT || l_type == AdcCommand::TYPE_ECHO || l_type == AdcCommand::TYPE_FEATURE;
+		const bool l_has_to = l_type == AdcCommand::TYPE_DIRECT || l_type == AdcCommand::TYPE_ECHO;
+		uint32_t l_from = l_type == AdcCommand::TYPE_INFO ? AdcCommand::HUB_SID : 0;
+		uint32_t l_to = 0;
+		bool l_fromSet = p_nmdc;
+		bool l_toSet = false;
+		bool l_featureSet = false;
+		StringList l_params;
+		std::string l_cur;
+		const auto l_add = [&]()
+		{
+			if (l_has_from && !l_fromSet)
+			{
+				if (l_cur.length() != 4)
+					throw ParseException("Invalid SID length");
+				l_from = AdcCommand::toSID(l_cur);
+				l_fromSet = true;
+			}
+			else if (l_has_to && !l_toSet)
+			{
+				if (l_cur.length() != 4)
+					throw ParseException("Invalid SID length");
+				l_to = AdcCommand::toSID(l_cur);
+				l_toSet = true;
+			}
+			else if (l_type == AdcCommand::TYPE_FEATURE && !l_featureSet)
+			{
+				if (l_cur.length() % 5 != 0)
+					throw ParseException("Invalid feature length");
+				l_featureSet = true;
+			}
+			else
+			{
+				l_params.push_back(l_cur);
+			}
+			l_cur.clear();
+		};
+		for (; i < p_line.length(); ++i)
+		{
+			switch (p_line[i])
+			{
+				case '\\':
+					if (++i == p_line.length())
+						throw ParseException("Escape at eol");
+					if (p_line[i] == 's')
+						l_cur += ' ';
+					else if (p_line[i] == 'n')
+						l_cur += '\n';
+					else if (p_line[i] == '\\')
+						l_cur += '\\';
+					else if (p_line[i] == ' ' && p_nmdc)
+						l_cur += ' ';
+					else
+						throw ParseException("Unknown escape");
+					break;
+				case ' ':
+					l_add();
+					break;
+				default:
+					l_cur += p_line[i];
+			}
+		}
+		if (!l_cur.empty())
+		{
+			l_add();
+		}
+		if (l_has_from && !l_fromSet)
+			throw ParseException("Missing from_sid");
+		if (l_type == AdcCommand::TYPE_FEATURE && !l_featureSet)
+			throw ParseException("Missing feature");
+		if (l_has_to && !l_toSet)
+			throw ParseException("Missing to_sid");
+			
+		std::string l_res = l_type + l_cmd + "|" + std::to_string(l_from) + "|" + std::to_string(l_to) + "|";
+		std::string l_nick = "-";
+		bool l_is_group = false;
+		for (auto j = l_params.cbegin(); j != l_params.cend(); ++j)
+		{
+			l_res += *j + '\x01';
+			if (l_nick == "-" && j->compare(0, 2, "NI") == 0)
+				l_nick = j->substr(2);
+			l_is_group |= *j == "GR1";
+		}
+		return l_res + "|" + l_nick + "|" + (l_is_group ? "G" : "g");
+	}
+	catch (const ParseException& e)
+	{
+		return "E:" + e.getError();
+	}
+}
+
+/** The same string from a parsed command, through the accessors the handlers of a borrowed command use */
+static std::string describeAdc(const AdcCommand& p_cmd)
+{
+	std::string l_res = p_cmd.getFourCC() + "|" + std::to_string(p_cmd.getFrom()) + "|" + std::to_string(p_cmd.getTo()) + "|";
+	for (size_t i = 0; i < p_cmd.getParamCount(); ++i)
+	{
+		const auto l_param = p_cmd.getParamView(i);
+		if (l_param.data()[l_param.size()] != ' ' && l_param.data()[l_param.size()] != 0)
+		{
+			l_res += "[no separator after the view]";
+		}
+		l_res += p_cmd.getParam(i) + '\x01';
+	}
+	std::string l_nick;
+	boost::string_view l_nick_view;
+	if (p_cmd.getParam("NI", 0, l_nick) != p_cmd.getParam("NI", 0, l_nick_view) || l_nick != l_nick_view)
+	{
+		l_res += "[getParam(string_view) differs]";
+	}
+	return l_res + "|" + (p_cmd.getParam("NI", 0, l_nick) ? l_nick : "-") + "|" + (p_cmd.hasFlag("GR", 0) ? "G" : "g");
+}
+
+static std::string parseAdc(const std::string& p_line, bool p_nmdc, AdcCommand::ParseMode p_mode)
+{
+	try
+	{
+		AdcCommand l_cmd(p_line, p_nmdc, p_mode);
+		if (p_mode == AdcCommand::PARSE_COPY)
+		{
+			// getParameters() of a copied command is the StringList itself
+			std::string l_res = describeAdc(l_cmd);
+			const StringList& l_params = l_cmd.getParameters();
+			CHECK_EQUAL(l_params.size(), l_cmd.getParamCount(), "AdcCommand, PARSE_COPY getParameters: " << p_line);
+			return l_res;
+		}
+		return describeAdc(l_cmd);
+	}
+	catch (const ParseException& e)
+	{
+		return "E:" + e.getError();
+	}
+}
+
+static std::string randomAdcParam(uint32_t& p_seed, size_t p_len, bool p_is_escaped)
+{
+	static const char g_chars[] = "abcdefghijklmnopqrstuvwxyzABCDEF0123456789";
+	std::string l_res;
+	for (size_t i = 0; i < p_len; ++i)
+	{
+		p_seed = p_seed * 1103515245 + 12345;
+		const uint32_t l_rnd = p_seed >> 16;
+		if (p_is_escaped && l_rnd % 13 == 0)
+			l_res += "\\s";
+		else if (p_is_escaped && l_rnd % 13 == 1)
+			l_res += "\\\\";
+		else if (p_is_escaped && l_rnd % 13 == 2)
+			l_res += "\\n";
+		else
+			l_res += g_chars[l_rnd % (_countof(g_chars) - 1)];
+	}
+	return l_res;
+}
+
+/** Hub traffic: INF with 10-45 parameters (past the 32 kept on the stack), SCH, directed and feature commands, $ADCGET and broken lines */
+static std::vector<std::pair<std::string, bool>> makeAdcLines(size_t p_count, uint32_t p_seed)
+{
+	std::vector<std::pair<std::string, bool>> l_lines;
+	for (size_t k = 0; k < p_count; ++k)
+	{
+		p_seed = p_seed * 1103515245 + 12345;
+		const uint32_t l_kind = (p_seed >> 16) % 100;
+		std::string l;
+		bool l_nmdc = false;
+		if (l_kind < 50)
+		{
+			l = "BINF " + randomAdcParam(p_seed, 4, false) + " ID" + randomAdcParam(p_seed, 39, false) + " NI" + randomAdcParam(p_seed, 8 + k % 10, true) +
+			    " SL3 SS1234567890 SF4567 HN2 HR0 HO0 VEFlylinkDC++\\sr600 US1310720 SUTCP4,UDP4,ADC0 I4192.168.1.2 U412345 DE" + randomAdcParam(p_seed, k % 40, true);
+			for (size_t i = k % 36; i > 0; --i)
+			{
+				l += " X" + std::to_string(i) + randomAdcParam(p_seed, i % 7, true);
+			}
+		}
+		else if (l_kind < 75)
+		{
+			l = "BSCH " + randomAdcParam(p_seed, 4, false) + " AN" + randomAdcParam(p_seed, 6, true) + " AN" + randomAdcParam(p_seed, 5, false) + " TO" + randomAdcParam(p_seed, 8, false) + (k % 2 ? " GR1" : " GR0");
+		}
+		else if (l_kind < 80)
+		{
+			l = "DMSG " + randomAdcParam(p_seed, 4, false) + " " + randomAdcParam(p_seed, 4, false) + " " + randomAdcParam(p_seed, 20, true) + " PM" + randomAdcParam(p_seed, 4, false);
+		}
+		else if (l_kind < 83)
+		{
+			l = "FSCH " + randomAdcParam(p_seed, 4, false) + " +TCP4-NAT0 TRZSAD4EJMKXUNSY5SBRWPU6RGCCQ2M5SOK6TN7RY";
+		}
+		else if (l_kind < 86)
+		{
+			l = "ISTA 000 " + randomAdcParam(p_seed, 30, true);
+		}
+		else if (l_kind < 90)
+		{
+			l = "$ADCGET file TTH/" + randomAdcParam(p_seed, 39, false) + " 0 -1 ZL1 " + randomAdcParam(p_seed, 5, false) + "\\ " + randomAdcParam(p_seed, 3, false);
+			l_nmdc = true;
+		}
+		else
+		{
+			// the error paths
+			static const char* const g_heads[] = { "", "B", "BIN", "XINF ", "BINF ", "BINF AAAAA ", "DMSG AAAA ", "DMSG AAAA BB ", "FSCH AAAA ", "FSCH AAAA +TCP ", "EINF AAAA BBBB ", "$ADC", "DMSG AAAA", "FSCH AAAA" };
+			l = g_heads[k % _countof(g_heads)] + randomAdcParam(p_seed, k % 12, true);
+			if (k % 3 == 0)
+				l += "\\";
+			if (k % 5 == 0)
+				l += "\\x";
+			if (k % 7 == 0)
+				l += "  ";
+			l_nmdc = l.compare(0, 4, "$ADC") == 0;
+		}
+		l_lines.push_back(std::make_pair(l, l_nmdc));
+	}
+	return l_lines;
+}
+
+/**
+ * AdcCommand::parse: PARSE_BORROW (views into the line and into the unescape buffer) and PARSE_COPY
+ * against the char by char parser they replace, the broken lines must throw the same errors.
+ * A copied or materialized borrowed command must not point into the line after it's gone.
+ */
+static void test_adc_command_parse()
+{
+	const auto l_lines = makeAdcLines(20000, 3);
+	for (auto i = l_lines.cbegin(); i != l_lines.cend(); ++i)
+	{
+		const std::string l_expected = copyParseAdc(i->first, i->second);
+		CHECK_EQUAL(parseAdc(i->first, i->second, AdcCommand::PARSE_BORROW), l_expected, "AdcCommand, PARSE_BORROW: " << i->first);
+		CHECK_EQUAL(parseAdc(i->first, i->second, AdcCommand::PARSE_COPY), l_expected, "AdcCommand, PARSE_COPY: " << i->first);
+	}
+	
+	for (auto i = l_lines.cbegin(); i != l_lines.cend(); ++i)
+	{
+		const std::string l_expected = copyParseAdc(i->first, i->second);
+		if (l_expected.compare(0, 2, "E:") == 0)
+			continue;
+		std::unique_ptr<std::string> l_line(new std::string(i->first));
+		std::unique_ptr<AdcCommand> l_borrowed(new AdcCommand(*l_line, i->second, AdcCommand::PARSE_BORROW));
+		AdcCommand l_materialized(*l_line, i->second, AdcCommand::PARSE_BORROW);
+		l_materialized.getParameters();
+#ifndef _DEBUG // AdcCommand is noncopyable in the debug build
+		AdcCommand l_copy(*l_borrowed);
+		AdcCommand l_assigned(AdcCommand::CMD_INF);
+		l_assigned = *l_borrowed;
+#endif
+		// the views of l_borrowed into the unescape buffer go away with it, the ones into the line with the line
+		l_borrowed.reset();
+		std::fill(l_line->begin(), l_line->end(), '#');
+		l_line.reset();
+		CHECK_EQUAL(describeAdc(l_materialized), l_expected, "AdcCommand, PARSE_BORROW then getParameters: " << i->first);
+#ifndef _DEBUG
+		CHECK_EQUAL(describeAdc(l_copy), l_expected, "AdcCommand, copy of PARSE_BORROW: " << i->first);
+		CHECK_EQUAL(describeAdc(l_assigned), l_expected, "AdcCommand, assignment of PARSE_BORROW: " << i->first);
+#endif
+	}
+}
+
+static void bench_adc_command_parse()
+{
+	std::vector<std::string> l_lines;
+	const auto l_all = makeAdcLines(100000, 19);
+	for (auto i = l_all.cbegin(); i != l_all.cend(); ++i)
+	{
+		if ((i->first.compare(0, 5, "BINF ") == 0 || i->first.compare(0, 5, "BSCH ") == 0) && copyParseAdc(i->first, false).compare(0, 2, "E:") != 0)
+		{
+			l_lines.push_back(i->first);
+		}
+	}
+	for (int l_is_borrow = 0; l_is_borrow <= 1; ++l_is_borrow)
+	{
+		size_t l_sink = 0;
+		const ticks l_start = getticks();
+		for (int r = 0; r < 10; ++r)
+		{
+			for (auto i = l_lines.cbegin(); i != l_lines.cend(); ++i)
+			{
+				// what dispatch and the INF/SCH handlers do with a command
+				AdcCommand l_cmd(*i, false, l_is_borrow ? AdcCommand::PARSE_BORROW : AdcCommand::PARSE_COPY);
+				boost::string_view l_nick;
+				for (size_t j = 0; j < l_cmd.getParamCount(); ++j)
+				{
+					l_sink += l_cmd.getParamView(j).size();
+				}
+				if (l_cmd.getParam("NI", 0, l_nick))
+				{
+					l_sink += l_nick.size();
+				}
+			}
+		}
+		const double l_ticks = elapsed(getticks(), l_start);
+		std::cout << "AdcCommand INF/SCH, " << (l_is_borrow ? "PARSE_BORROW" : "PARSE_COPY") << ": " << std::fixed << std::setprecision(0)
+		          << l_ticks / double(l_lines.size() * 10) << " ticks/command (" << l_lines.size() << " commands x 10, " << l_sink << ")" << std::endl;
+	}
+}
+
+int test_fast_paths(bool p_bench)
+{
+	g_errors = 0;
+	test_tiger_hash_leaves();
+	test_simple_xml_reader();
+	test_line_framer();
+	test_adc_command_parse();
+	if (p_bench)
+	{
+		bench_tiger_hash_leaves();
+		bench_simple_xml_reader();
+		bench_line_framer();
+		bench_adc_command_parse();
+	}
+	std::cout << (g_errors ? "FAILED, errors: " : "OK, errors: ") << g_errors << std::endl;
+	return g_errors ? 1 : 0;
+}
@@ -3614,6 +3614,14 @@ void HubFrame::on(ClientListener::UserUpdatedMyINFO, const OnlineUserPtr& user)
 	}
 }
 
+void HubFrame::on(ClientListener::UsersUpdatedMyINFO, const Client*, const OnlineUserList& aList) noexcept
+{
+	for (auto i = aList.cbegin(); i != aList.cend() && !isClosedOrShutdown(); ++i)
+	{
+		on(ClientListener::UserUpdatedMyINFO(), *i);
+	}
+}
+
 void HubFrame::on(ClientListener::StatusMessage, const Client*, const string& line, int statusFlags) noexcept
 {
 	speak(ADD_STATUS_LINE, Text::toDOS(line), !BOOLSETTING(FILTER_MESSAGES) || !(statusFlags & ClientListener::FLAG_IS_SPAM));